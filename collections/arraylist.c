@@ -37,6 +37,7 @@ ArrayList_t* arraylist_init_len(uint32_t init_len) {
     res->err = LIST_OKAY;
     res->len = 0;
     res->allocated = init_len;
+    res->fixed = 0;
 
     // Initialize the mutex
     pthread_mutexattr_t attr;
@@ -56,6 +57,25 @@ ArrayList_t* arraylist_init_len(uint32_t init_len) {
     return res;
 }
 
+/**
+ * @inherit
+ */
+ArrayList_t* arraylist_init_fixed(ArrayList_t* list, void** array, uint32_t len) {
+    list->impl = LIST_ARRAY;
+    list->err = LIST_OKAY;
+    list->len = 0;
+    list->allocated = len;
+    list->array = array;
+    list->fixed = 1;
+
+    // Same mutex as a normal list, so the list functions behave the same
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&list->mutex, &attr);
+    return list;
+}
+
 /**
  * @inherit
  */
@@ -83,6 +103,13 @@ ListError_t arraylist_add_pos(ArrayList_t* list, uint32_t pos, void* element) {
 
     // Next, check to see if we need to reallocate the array
     if ((list->len + 1) > list->allocated) {
+        // Fixed lists can't grow
+        if (list->fixed) {
+            list->err = LIST_MEMORY;
+            pthread_mutex_unlock(&list->mutex);
+            return LIST_MEMORY;
+        }
+
         // Ask for array memory and make sure it was allocated
         void** temp = realloc(list->array, sizeof(void*) * (list->allocated + DEFAULT_LIST_STEP));
         if (temp == NULL) {
@@ -164,7 +191,7 @@ void* arraylist_remove(ArrayList_t* list, uint32_t pos) {
     list->len -= 1;
 
 	// If we have too much allocated overhead, deallocate, leaving a little bit of buffer room
-    if (list->len + (DEFAULT_LIST_STEP * 4) < list->allocated)
+    if (!list->fixed && list->len + (DEFAULT_LIST_STEP * 4) < list->allocated)
     {
         // Ask to reallocate our memory into a smaller area, making sure it worked
         uint32_t request = list->len + DEFAULT_LIST_STEP;
@@ -203,6 +230,12 @@ uint32_t arraylist_size(ArrayList_t* list) {
  * @inherit
  */
 void arraylist_free(ArrayList_t* list) {
+    // The caller owns a fixed list's memory
+    if (list->fixed) {
+        pthread_mutex_destroy(&list->mutex);
+        return;
+    }
+
     pthread_mutex_lock(&list->mutex);
     free(list->array);
     list->array = NULL;
@@ -30,6 +30,7 @@ typedef struct ArrayList {
     uint32_t len; // length of the array in elements
     uint32_t allocated; // length of memory allocated (in elements)
     void** array; // element array
+    uint8_t fixed; // set if the array (and list) live in memory the caller owns
 } ArrayList_t;
 #pragma pack(pop)
 
@@ -50,6 +51,19 @@ ArrayList_t* arraylist_init();
  */
 ArrayList_t* arraylist_init_len(uint32_t init_len);
 
+/**
+ * Initialize an array list in memory the caller owns, with room for a fixed number
+ * of elements. The list never grows past that, and arraylist_free only cleans up
+ * the mutex, leaving the memory to the caller
+ *
+ * @param list where to build the list
+ * @param array room for the elements
+ * @param len the number of elements the array has room for
+ * @return the array list data structure
+ * @error none
+ */
+ArrayList_t* arraylist_init_fixed(ArrayList_t* list, void** array, uint32_t len);
+
 /**
  * Add an item to the end of the array list
  *
@@ -68,7 +82,7 @@ ListError_t arraylist_add(ArrayList_t* list, void* element);
  * @param pos the position to place the element (must be in range 0 to array length)
  * @param element the element to add to the list
  * @return the list error code (see enum ListError)
- * @error err is set to LIST_MEMORY if a memory request failed
+ * @error err is set to LIST_MEMORY if a memory request failed (or a fixed list is full)
  *            or LIST_BOUNDS if pos is out of bounds
  */
 ListError_t arraylist_add_pos(ArrayList_t* list, uint32_t pos, void* element);
@@ -0,0 +1,298 @@
+/**
+ * core/network/client.c
+ *
+ * Keeps a robot connected to the FMS
+ *
+ * @author agent <agent@local>
+ */
+#define _GNU_SOURCE // needed for clock_gettime(...), pthread_condattr_setclock(...)
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "client.h"
+#include "lowlevel.h"
+#include "../utils/dbgprint.h"
+
+/**
+ * Gets the current monotonic time
+ *
+ * @returns the time in nanoseconds
+ */
+static uint64_t _client_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * Waits on the client's condition until signalled or the time is up. The
+ * client's lock must be held.
+ *
+ * @param client the client to wait on
+ * @param deadline when to stop waiting (monotonic, in nanoseconds)
+ */
+static void _client_wait_until(LLNetClient_t* client, uint64_t deadline) {
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000ULL;
+    ts.tv_nsec = deadline % 1000000000ULL;
+    pthread_cond_timedwait(&client->cond, &client->mutex, &ts);
+}
+
+/**
+ * Handles a lost connection: passes it on, then wakes the client up to connect again
+ *
+ * @param worker the connection that was lost
+ */
+static void _client_on_disconnect(WorkerConnection_t* worker) {
+    LLNetClient_t* client = worker->client;
+    if (client == NULL) {
+        return; // not handed over yet, the client thread checks tcp_status once it is
+    }
+    if (client->on_disconnect != NULL) {
+        client->on_disconnect(worker);
+    }
+
+    pthread_mutex_lock(&client->mutex);
+    if (client->worker == worker) {
+        client->lost = true;
+        pthread_cond_broadcast(&client->cond);
+    }
+    pthread_mutex_unlock(&client->mutex);
+}
+
+/**
+ * Makes one attempt at connecting
+ *
+ * @param client the client to connect
+ * @returns the connection, or NULL if it couldn't be made
+ */
+static WorkerConnection_t* _client_connect(LLNetClient_t* client) {
+    NetConnection_t* connection = llnet_connection_init_from(client->settings);
+    connection->on_disconnect = &_client_on_disconnect;
+
+    WorkerConnection_t* worker = llnet_connection_connect_client(connection, client->host, client->on_packet,
+        client->connect_timeout_ms, client);
+    if (worker->state != cs_WORKER) {
+        llnet_connection_free((NetConnection_t*) worker);
+        return NULL;
+    }
+
+    // The server expects to hear who we are before anything else
+    if (client->init != NULL && llnet_connection_send(worker, np_TCP, client->init) != 0) {
+        dbg_warning("could not send INIT packet\n");
+    }
+    if (client->on_connect != NULL) {
+        client->on_connect(worker);
+    }
+    return worker;
+}
+
+/**
+ * Makes the client's connection, and makes it again whenever it's lost
+ *
+ * @param _targs the client
+ * @returns NULL
+ */
+static void* _client_thread(void* _targs) {
+    LLNetClient_t* client = (LLNetClient_t*) _targs;
+    uint32_t backoff_ms = client->backoff_min_ms;
+
+    pthread_mutex_lock(&client->mutex);
+    while (!client->stop) {
+        // Nothing to do while connected
+        if (client->worker != NULL && !client->lost) {
+            pthread_cond_wait(&client->cond, &client->mutex);
+            continue;
+        }
+
+        // Clean up the connection that was lost, once nothing is sending on it
+        if (client->worker != NULL) {
+            if (client->senders > 0) {
+                pthread_cond_wait(&client->cond, &client->mutex);
+                continue;
+            }
+            WorkerConnection_t* old = client->worker;
+            client->worker = NULL;
+            client->lost = false;
+            pthread_mutex_unlock(&client->mutex);
+            llnet_connection_free((NetConnection_t*) old);
+            pthread_mutex_lock(&client->mutex);
+            continue;
+        }
+
+        pthread_mutex_unlock(&client->mutex);
+        WorkerConnection_t* worker = _client_connect(client);
+        pthread_mutex_lock(&client->mutex);
+
+        if (worker != NULL) {
+            // The connection may have dropped before it was handed over
+            client->worker = worker;
+            client->lost = (worker->tcp_status == ls_DISCONNECTED);
+            client->connects += 1;
+            backoff_ms = client->backoff_min_ms;
+            pthread_cond_broadcast(&client->cond);
+            continue;
+        }
+
+        // Wait before trying again, a little less than the backoff so many robots don't all try at once
+        client->failures += 1;
+        client->jitter = (client->jitter * 1103515245) + 12345;
+        uint32_t wait_ms = backoff_ms - ((client->jitter >> 16) % ((backoff_ms / 4) + 1));
+        uint64_t deadline = _client_now() + ((uint64_t) wait_ms * 1000000);
+        while (!client->stop && _client_now() < deadline) {
+            _client_wait_until(client, deadline);
+        }
+        backoff_ms = (backoff_ms * 2 > client->backoff_max_ms)? client->backoff_max_ms : backoff_ms * 2;
+    }
+    pthread_mutex_unlock(&client->mutex);
+
+    return NULL;
+}
+
+/**
+ * @inherit
+ */
+LLNetClient_t* llnet_client_init(NetConnection_t* settings, char* host, void (*on_packet)(uint32_t, IntermediateTLV_t*)) {
+    LLNetClient_t* client = calloc(1, sizeof(LLNetClient_t));
+    pthread_mutex_init(&client->mutex, NULL);
+
+    // Deadlines are on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&client->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    client->settings = settings;
+    client->host = strdup(host);
+    client->on_packet = on_packet;
+    client->on_disconnect = settings->on_disconnect;
+    client->connect_timeout_ms = LLNET_CLIENT_CONNECT_TIMEOUT_MS;
+    client->backoff_min_ms = LLNET_CLIENT_BACKOFF_MIN_MS;
+    client->backoff_max_ms = LLNET_CLIENT_BACKOFF_MAX_MS;
+    client->jitter = (uint32_t) _client_now() ^ (uint32_t) (uintptr_t) client;
+    return client;
+}
+
+/**
+ * @inherit
+ */
+void llnet_client_set_init(LLNetClient_t* client, IntermediateTLV_t* init) {
+    if (client->init != NULL) {
+        llnet_packet_free(client->init);
+        client->init = NULL;
+    }
+    if (init == NULL) {
+        return;
+    }
+
+    client->init = malloc(sizeof(IntermediateTLV_t));
+    memcpy(client->init, init, sizeof(IntermediateTLV_t));
+    client->init->data = NULL;
+    if (init->length > 0) {
+        client->init->data = malloc(init->length);
+        memcpy(client->init->data, init->data, init->length);
+    }
+}
+
+/**
+ * @inherit
+ */
+void llnet_client_set_handlers(LLNetClient_t* client, void (*on_connect)(WorkerConnection_t*),
+        void (*on_disconnect)(WorkerConnection_t*)) {
+    client->on_connect = on_connect;
+    client->on_disconnect = on_disconnect;
+}
+
+/**
+ * @inherit
+ */
+void llnet_client_set_backoff(LLNetClient_t* client, uint32_t connect_timeout_ms, uint32_t backoff_min_ms,
+        uint32_t backoff_max_ms) {
+    client->connect_timeout_ms = connect_timeout_ms;
+    client->backoff_min_ms = (backoff_min_ms == 0)? 1 : backoff_min_ms;
+    client->backoff_max_ms = (backoff_max_ms < client->backoff_min_ms)? client->backoff_min_ms : backoff_max_ms;
+}
+
+/**
+ * @inherit
+ */
+void llnet_client_start(LLNetClient_t* client) {
+    if (client->started) {
+        return;
+    }
+    client->started = true;
+    pthread_create(&client->thread, NULL, &_client_thread, (void*) client);
+}
+
+/**
+ * @inherit
+ */
+bool llnet_client_wait(LLNetClient_t* client, uint32_t timeout_ms) {
+    uint64_t deadline = _client_now() + ((uint64_t) timeout_ms * 1000000);
+
+    pthread_mutex_lock(&client->mutex);
+    while ((client->worker == NULL || client->lost) && _client_now() < deadline) {
+        _client_wait_until(client, deadline);
+    }
+    bool connected = client->worker != NULL && !client->lost;
+    pthread_mutex_unlock(&client->mutex);
+
+    return connected;
+}
+
+/**
+ * @inherit
+ */
+uint32_t llnet_client_send(LLNetClient_t* client, NetworkProtocol_t proto, IntermediateTLV_t* packet) {
+    // Count the send, so the connection isn't freed under it (without holding the lock while sending)
+    WorkerConnection_t* worker = NULL;
+    pthread_mutex_lock(&client->mutex);
+    if (client->worker != NULL && !client->lost) {
+        worker = client->worker;
+        client->senders += 1;
+    }
+    pthread_mutex_unlock(&client->mutex);
+    if (worker == NULL) {
+        return -1;
+    }
+
+    uint32_t rc = llnet_connection_send(worker, proto, packet);
+
+    pthread_mutex_lock(&client->mutex);
+    client->senders -= 1;
+    if (client->senders == 0) {
+        pthread_cond_broadcast(&client->cond);
+    }
+    pthread_mutex_unlock(&client->mutex);
+
+    return rc;
+}
+
+/**
+ * @inherit
+ */
+void llnet_client_free(LLNetClient_t* client) {
+    if (client->started) {
+        pthread_mutex_lock(&client->mutex);
+        client->stop = true;
+        pthread_cond_broadcast(&client->cond);
+        pthread_mutex_unlock(&client->mutex);
+        pthread_join(client->thread, NULL);
+    }
+
+    if (client->worker != NULL) {
+        llnet_connection_free((NetConnection_t*) client->worker);
+    }
+    llnet_connection_free(client->settings);
+    if (client->init != NULL) {
+        llnet_packet_free(client->init);
+    }
+    free(client->host);
+    pthread_mutex_destroy(&client->mutex);
+    pthread_cond_destroy(&client->cond);
+    free(client);
+}
@@ -0,0 +1,138 @@
+/**
+ * core/network/client.h
+ *
+ * Keeps a robot connected to the FMS. A client makes a connection from a set
+ * of settings, and when the connection is lost (or can't be made) it tries
+ * again with exponential backoff, replaying the INIT packet on every new
+ * connection so the robot gets back onto the field without any help.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_CLIENT
+#define __CORE_NETWORK_CLIENT
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "lowlevel.h"
+
+#define LLNET_CLIENT_CONNECT_TIMEOUT_MS (250) // longest an attempt waits for the server
+#define LLNET_CLIENT_BACKOFF_MIN_MS (10) // wait after the first failed attempt
+#define LLNET_CLIENT_BACKOFF_MAX_MS (2000) // longest wait between attempts
+
+// Defines a connection that is kept up
+typedef struct LLNetClient {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // signalled when the connection is made or lost, the last send finishes, or the client is stopped
+    bool stop;
+    bool started;
+    pthread_t thread; // makes the connection, and makes it again when it's lost
+
+    // what to connect to, and how
+    NetConnection_t* settings; // never connected, copied for every attempt
+    char* host;
+    void (*on_packet)(uint32_t, IntermediateTLV_t*);
+    void (*on_connect)(WorkerConnection_t*); // may be NULL
+    void (*on_disconnect)(WorkerConnection_t*); // may be NULL
+    IntermediateTLV_t* init; // sent first on every connection, may be NULL
+    uint32_t connect_timeout_ms;
+    uint32_t backoff_min_ms;
+    uint32_t backoff_max_ms;
+    uint32_t jitter; // state for spreading out attempts from many clients
+
+    // current state
+    WorkerConnection_t* worker; // NULL while (re)connecting
+    bool lost; // true once the current connection has dropped
+    uint32_t senders; // sends in progress on the current connection, it isn't freed until they finish
+    uint64_t connects; // number of connections made
+    uint64_t failures; // number of attempts that failed
+} LLNetClient_t;
+
+/**
+ * Creates a client (without connecting, see llnet_client_start)
+ *
+ * @param settings an unconnected connection with the settings every connection
+ *        should have (capabilities, limits, filters and so on). The client
+ *        takes ownership of it.
+ * @param host the host to connect to (copied)
+ * @param (*on_packet) the handler function that gets called on every incoming packet
+ * @return the client
+ */
+LLNetClient_t* llnet_client_init(NetConnection_t* settings, char* host, void (*on_packet)(uint32_t, IntermediateTLV_t*));
+
+/**
+ * Sets the packet that is sent first on every connection, before on_connect is
+ * called. Must be called before the client is started.
+ *
+ * @param client the client to configure
+ * @param init the packet (normally an INIT packet) to send, or NULL for none. The
+ *        packet is copied.
+ */
+void llnet_client_set_init(LLNetClient_t* client, IntermediateTLV_t* init);
+
+/**
+ * Sets the handlers called when a connection is made or lost. Must be called
+ * before the client is started.
+ *
+ * @param client the client to configure
+ * @param (*on_connect) called once a connection is made (and the INIT packet is sent), may be NULL
+ * @param (*on_disconnect) called when a connection is lost, may be NULL
+ */
+void llnet_client_set_handlers(LLNetClient_t* client, void (*on_connect)(WorkerConnection_t*),
+    void (*on_disconnect)(WorkerConnection_t*));
+
+/**
+ * Sets how the client connects. Must be called before the client is started.
+ *
+ * @param client the client to configure
+ * @param connect_timeout_ms the longest an attempt waits for the server
+ * @param backoff_min_ms the wait after the first failed attempt, doubled after every failure
+ * @param backoff_max_ms the longest wait between attempts
+ */
+void llnet_client_set_backoff(LLNetClient_t* client, uint32_t connect_timeout_ms, uint32_t backoff_min_ms,
+    uint32_t backoff_max_ms);
+
+/**
+ * Starts connecting, in the background
+ *
+ * @param client the client to start
+ */
+void llnet_client_start(LLNetClient_t* client);
+
+/**
+ * Waits for the client to be connected
+ *
+ * @param client the client to wait on
+ * @param timeout_ms the longest to wait
+ * @returns true if the client is connected
+ */
+bool llnet_client_wait(LLNetClient_t* client, uint32_t timeout_ms);
+
+/**
+ * Sends a packet on the client's current connection
+ *
+ * @param client the client to send with
+ * @param proto the protocol to use (see llnet_connection_send)
+ * @param packet the packet to send
+ * @returns zero on success, or an error code if there is no connection or the send failed
+ */
+uint32_t llnet_client_send(LLNetClient_t* client, NetworkProtocol_t proto, IntermediateTLV_t* packet);
+
+/**
+ * Stops a client, closing its connection, and cleans it up
+ *
+ * @param client the client to clean up
+ */
+void llnet_client_free(LLNetClient_t* client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,237 @@
+/**
+ * core/network/compress.c
+ *
+ * A small LZ77-family block codec. The block format is a series of sequences,
+ * each made of a token byte (high nibble: literal length, low nibble: match
+ * length - 4), optional length extension bytes, the literals, and a 16-bit
+ * little-endian match offset. The final sequence only carries literals.
+ *
+ * @author agent <agent@local>
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "compress.h"
+
+#define _LLNET_LZ_MIN_MATCH   (4)
+#define _LLNET_LZ_MAX_OFFSET  (0xffff)
+#define _LLNET_LZ_HASH_BITS   (12)
+#define _LLNET_LZ_HASH_SIZE   (1 << _LLNET_LZ_HASH_BITS)
+
+/**
+ * Reads 4 bytes from a buffer without alignment requirements
+ *
+ * @param p the pointer to read from
+ * @returns the 4 bytes as an integer
+ */
+static inline uint32_t _lz_read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(uint32_t));
+    return v;
+}
+
+/**
+ * Hashes 4 bytes into a table index
+ *
+ * @param v the 4 bytes to hash
+ * @returns the table index
+ */
+static inline uint32_t _lz_hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - _LLNET_LZ_HASH_BITS);
+}
+
+/**
+ * Writes a length extension (series of 255s followed by the remainder)
+ *
+ * @param dst the output buffer
+ * @param op the current output position, updated on return
+ * @param dst_cap the length of the output buffer
+ * @param len the remaining length to encode
+ * @returns 0 on success, -1 if the output buffer is too small
+ */
+static int _lz_write_length(uint8_t* dst, uint32_t* op, uint32_t dst_cap, uint32_t len) {
+    while (len >= 255) {
+        if (*op >= dst_cap) {
+            return -1;
+        }
+        dst[(*op)++] = 255;
+        len -= 255;
+    }
+    if (*op >= dst_cap) {
+        return -1;
+    }
+    dst[(*op)++] = (uint8_t) len;
+    return 0;
+}
+
+/**
+ * Writes a sequence to the output buffer
+ *
+ * @param dst the output buffer
+ * @param op the current output position, updated on return
+ * @param dst_cap the length of the output buffer
+ * @param lit the literals to write
+ * @param lit_len the number of literals
+ * @param offset the match offset (ignored if match_len is zero)
+ * @param match_len the length of the match, zero for the final sequence
+ * @returns 0 on success, -1 if the output buffer is too small
+ */
+static int _lz_write_sequence(uint8_t* dst, uint32_t* op, uint32_t dst_cap, const uint8_t* lit,
+        uint32_t lit_len, uint32_t offset, uint32_t match_len) {
+    // Build the token
+    uint32_t ml = (match_len == 0)? 0 : match_len - _LLNET_LZ_MIN_MATCH;
+    uint8_t token = (uint8_t) (((lit_len >= 15)? 15 : lit_len) << 4) | ((ml >= 15)? 15 : ml);
+    if (*op >= dst_cap) {
+        return -1;
+    }
+    dst[(*op)++] = token;
+
+    // Write the literals
+    if (lit_len >= 15 && _lz_write_length(dst, op, dst_cap, lit_len - 15) < 0) {
+        return -1;
+    }
+    if (*op + lit_len > dst_cap) {
+        return -1;
+    }
+    memcpy(dst + *op, lit, lit_len);
+    *op += lit_len;
+
+    // Final sequence has no match
+    if (match_len == 0) {
+        return 0;
+    }
+
+    // Write the offset and the match length
+    if (*op + 2 > dst_cap) {
+        return -1;
+    }
+    dst[(*op)++] = offset & 0xff;
+    dst[(*op)++] = (offset >> 8) & 0xff;
+    if (ml >= 15 && _lz_write_length(dst, op, dst_cap, ml - 15) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @inherit
+ */
+int32_t llnet_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap) {
+    // Positions are stored off-by-one so that zero means "empty"
+    uint32_t table[_LLNET_LZ_HASH_SIZE];
+    memset(table, 0, sizeof(table));
+
+    uint32_t ip = 0;
+    uint32_t anchor = 0;
+    uint32_t op = 0;
+
+    // Greedy match search
+    while (src_len >= _LLNET_LZ_MIN_MATCH && ip <= src_len - _LLNET_LZ_MIN_MATCH) {
+        uint32_t seq = _lz_read32(src + ip);
+        uint32_t h = _lz_hash(seq);
+        uint32_t ref = table[h];
+        table[h] = ip + 1;
+
+        // Check for a usable match
+        if (ref == 0 || (ip - (ref - 1)) > _LLNET_LZ_MAX_OFFSET || _lz_read32(src + ref - 1) != seq) {
+            ip += 1;
+            continue;
+        }
+        ref -= 1;
+
+        // Extend the match as far as it goes
+        uint32_t match_len = _LLNET_LZ_MIN_MATCH;
+        while (ip + match_len < src_len && src[ref + match_len] == src[ip + match_len]) {
+            match_len += 1;
+        }
+
+        // Emit everything up to here
+        if (_lz_write_sequence(dst, &op, dst_cap, src + anchor, ip - anchor, ip - ref, match_len) < 0) {
+            return -1;
+        }
+        ip += match_len;
+        anchor = ip;
+    }
+
+    // Emit the trailing literals
+    if (_lz_write_sequence(dst, &op, dst_cap, src + anchor, src_len - anchor, 0, 0) < 0) {
+        return -1;
+    }
+    return (int32_t) op;
+}
+
+/**
+ * Reads a length extension
+ *
+ * @param src the input buffer
+ * @param ip the current input position, updated on return
+ * @param src_len the length of the input buffer
+ * @param len the length to add the extension to
+ * @returns 0 on success, -1 if the input was truncated
+ */
+static int _lz_read_length(const uint8_t* src, uint32_t* ip, uint32_t src_len, uint32_t* len) {
+    uint8_t b;
+    do {
+        if (*ip >= src_len) {
+            return -1;
+        }
+        b = src[(*ip)++];
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+/**
+ * @inherit
+ */
+int32_t llnet_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len) {
+    uint32_t ip = 0;
+    uint32_t op = 0;
+
+    while (ip < src_len) {
+        uint8_t token = src[ip++];
+
+        // Copy the literals
+        uint32_t lit_len = token >> 4;
+        if (lit_len == 15 && _lz_read_length(src, &ip, src_len, &lit_len) < 0) {
+            return -1;
+        }
+        if (lit_len > src_len - ip || lit_len > dst_len - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        // The final sequence has no match
+        if (ip == src_len) {
+            break;
+        }
+
+        // Decode the match
+        if (src_len - ip < 2) {
+            return -1;
+        }
+        uint32_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return -1;
+        }
+        uint32_t match_len = token & 0x0f;
+        if (match_len == 15 && _lz_read_length(src, &ip, src_len, &match_len) < 0) {
+            return -1;
+        }
+        match_len += _LLNET_LZ_MIN_MATCH;
+        if (match_len > dst_len - op) {
+            return -1;
+        }
+
+        // Matches may overlap the output, so copy byte-by-byte
+        for (uint32_t i = 0; i < match_len; i += 1) {
+            dst[op + i] = dst[op - offset + i];
+        }
+        op += match_len;
+    }
+
+    return (int32_t) op;
+}
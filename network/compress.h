@@ -0,0 +1,56 @@
+/**
+ * core/network/compress.h
+ *
+ * A small, dependency-free LZ77-family codec used to compress large packet
+ * payloads (CONFIG_RESPONSE key/value lists, DEBUG data, etc.)
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_COMPRESS
+#define __CORE_NETWORK_COMPRESS
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Gets the worst-case size of a compressed block for a given input length
+ *
+ * @macro
+ * @param len the length of the uncompressed data
+ */
+#define llnet_compress_bound(len) ((len) + ((len) / 255) + 16)
+
+/**
+ * Compresses a block of memory
+ *
+ * @param src the data to compress
+ * @param src_len the length of the data to compress
+ * @param dst the buffer to write the compressed block into
+ * @param dst_cap the length of the destination buffer
+ * @returns the length of the compressed block, or -1 if the block did not fit
+ *          into the destination buffer
+ */
+int32_t llnet_compress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_cap);
+
+/**
+ * Decompresses a block of memory created by llnet_compress
+ *
+ * @param src the compressed block
+ * @param src_len the length of the compressed block
+ * @param dst the buffer to write the decompressed data into
+ * @param dst_len the expected length of the decompressed data
+ * @returns the number of bytes written, or -1 if the block was malformed or
+ *          would overrun the destination buffer
+ */
+int32_t llnet_decompress(const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
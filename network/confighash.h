@@ -0,0 +1,48 @@
+/**
+ * core/network/confighash.h
+ *
+ * The seeded hash behind the perfect hash of known config keys. It's shared by
+ * the generator (configkeys-gen.c), which picks the seeds, and the lookup
+ * (configknown.c), which has to hash keys exactly the same way.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_CONFIGHASH
+#define __CORE_NETWORK_CONFIGHASH
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Hashes a key (FNV-1a from a seeded basis, then mixed so the low bits, which
+ * pick the slot, depend on every byte)
+ *
+ * @param key the key
+ * @param length the length of the key
+ * @param seed the seed
+ * @returns the hash
+ */
+static inline uint32_t config_hash(const char* key, size_t length, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (size_t i = 0; i < length; i += 1) {
+        hash ^= (uint8_t) key[i];
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
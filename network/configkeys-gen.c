@@ -0,0 +1,292 @@
+/**
+ * core/network/configkeys-gen.c
+ *
+ * Build-time generator for configkeys.gen.h. The known keys are compiled in
+ * from the list named by CONFIG_KEYS_DEF (configkeys.def by default), then a
+ * perfect hash is searched for: keys are split into buckets by one hash, and
+ * each bucket gets its own seed that sends all of its keys to distinct, unused
+ * slots. A lookup is then two hashes and one compare, with no probing.
+ *
+ * The header (printed to stdout) has the key enum, the typed struct the values
+ * are decoded into, and the tables used by configknown.c.
+ *
+ * usage: configkeys-gen > configkeys.gen.h
+ *
+ * @author agent <agent@local>
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packet.h"
+#include "confighash.h"
+
+#ifndef CONFIG_KEYS_DEF
+#define CONFIG_KEYS_DEF "configkeys.def"
+#endif
+
+#define _GEN_MAX_SEEDS (1u << 20) // seeds tried per bucket before the table is made bigger
+#define _GEN_MAX_SLOTS (1u << 16)
+
+static const char* const KEYS[] = {
+#define CONFIG_KEY(field, key, type) key,
+#include CONFIG_KEYS_DEF
+#undef CONFIG_KEY
+};
+
+static const char* const FIELDS[] = {
+#define CONFIG_KEY(field, key, type) #field,
+#include CONFIG_KEYS_DEF
+#undef CONFIG_KEY
+};
+
+static const KVPair_Type_t TYPES[] = {
+#define CONFIG_KEY(field, key, type) type,
+#include CONFIG_KEYS_DEF
+#undef CONFIG_KEY
+};
+
+#define _GEN_COUNT ((uint32_t) (sizeof(KEYS) / sizeof(KEYS[0])))
+
+/**
+ * Gets the smallest power of two at least as big as a number
+ *
+ * @param n the number
+ * @returns the power of two
+ */
+static uint32_t _gen_pow2(uint32_t n) {
+    uint32_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+/**
+ * Tries to find a seed for every bucket, so each key lands in its own slot
+ *
+ * @param buckets the number of buckets (a power of two)
+ * @param slots the number of slots (a power of two)
+ * @param seeds set to each bucket's seed
+ * @param table set to the key in each slot, or -1
+ * @returns false if some bucket had no seed that worked
+ */
+static bool _gen_search(uint32_t buckets, uint32_t slots, uint32_t* seeds, int32_t* table) {
+    uint32_t* bucket_of = malloc(sizeof(uint32_t) * _GEN_COUNT);
+    uint32_t* size = calloc(buckets, sizeof(uint32_t));
+    uint32_t* placed = malloc(sizeof(uint32_t) * _GEN_COUNT);
+    bool* done = calloc(buckets, sizeof(bool));
+    for (uint32_t k = 0; k < _GEN_COUNT; k += 1) {
+        bucket_of[k] = config_hash(KEYS[k], strlen(KEYS[k]), 0) & (buckets - 1);
+        size[bucket_of[k]] += 1;
+    }
+    for (uint32_t s = 0; s < slots; s += 1) {
+        table[s] = -1;
+    }
+
+    // Place the biggest buckets first, while the table is emptiest
+    bool found = true;
+    for (uint32_t n = 0; n < buckets && found; n += 1) {
+        uint32_t b = buckets;
+        for (uint32_t c = 0; c < buckets; c += 1) {
+            if (!done[c] && (b == buckets || size[c] > size[b])) {
+                b = c;
+            }
+        }
+        done[b] = true;
+        seeds[b] = 0;
+        if (size[b] == 0) {
+            continue;
+        }
+
+        found = false;
+        for (uint32_t seed = 1; seed < _GEN_MAX_SEEDS && !found; seed += 1) {
+            uint32_t count = 0;
+            found = true;
+            for (uint32_t k = 0; k < _GEN_COUNT && found; k += 1) {
+                if (bucket_of[k] != b) {
+                    continue;
+                }
+                uint32_t slot = config_hash(KEYS[k], strlen(KEYS[k]), seed) & (slots - 1);
+                if (table[slot] != -1) {
+                    found = false;
+                    break;
+                }
+                table[slot] = (int32_t) k;
+                placed[count] = slot;
+                count += 1;
+            }
+            if (found) {
+                seeds[b] = seed;
+            } else {
+                // Take this seed's keys back out and try the next one
+                for (uint32_t p = 0; p < count; p += 1) {
+                    table[placed[p]] = -1;
+                }
+            }
+        }
+    }
+
+    free(bucket_of);
+    free(size);
+    free(placed);
+    free(done);
+    return found;
+}
+
+/**
+ * Prints a key as a C string literal
+ *
+ * @param key the key
+ */
+static void _gen_print_key(const char* key) {
+    putchar('"');
+    for (const char* c = key; *c != '\0'; c += 1) {
+        if (*c == '"' || *c == '\\') {
+            printf("\\%c", *c);
+        } else if (*c < 0x20 || *c > 0x7e) {
+            printf("\\%03o", (uint8_t) *c);
+        } else {
+            putchar(*c);
+        }
+    }
+    putchar('"');
+}
+
+/**
+ * Gets the C type a value of a config type is decoded into
+ *
+ * @param type the type
+ * @returns the C type, or NULL for an unknown type
+ */
+static const char* _gen_ctype(KVPair_Type_t type) {
+    switch (type) {
+        case kv_Integer:
+            return "int32_t";
+        case kv_Float:
+            return "float";
+        case kv_Double:
+            return "double";
+        case kv_CString:
+            return "char*";
+        case kv_Boolean:
+            return "bool";
+    }
+    return NULL;
+}
+
+/**
+ * Gets the name of a config type
+ *
+ * @param type the type
+ * @returns the name of its enum value
+ */
+static const char* _gen_type_name(KVPair_Type_t type) {
+    static const char* NAMES[] = { "kv_Integer", "kv_Float", "kv_Double", "kv_CString", "kv_Boolean" };
+    return NAMES[type];
+}
+
+/**
+ * Entry point to the generator
+ */
+int main(int argc, char** argv) {
+    (void) argc;
+
+    // Check the list before searching
+    if (_GEN_COUNT == 0) {
+        fprintf(stderr, "%s: %s has no keys\n", argv[0], CONFIG_KEYS_DEF);
+        return EXIT_FAILURE;
+    }
+    for (uint32_t k = 0; k < _GEN_COUNT; k += 1) {
+        if (KEYS[k][0] == '\0' || _gen_ctype(TYPES[k]) == NULL) {
+            fprintf(stderr, "%s: key %u (%s) is empty or has an unknown type\n", argv[0], k, FIELDS[k]);
+            return EXIT_FAILURE;
+        }
+        for (uint32_t j = 0; j < k; j += 1) {
+            if (strcmp(KEYS[j], KEYS[k]) == 0) {
+                fprintf(stderr, "%s: key \"%s\" is listed twice\n", argv[0], KEYS[k]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    // Start with about two keys per bucket and one slot per key, growing the table until every bucket fits
+    uint32_t buckets = _gen_pow2((_GEN_COUNT + 1) / 2);
+    uint32_t slots = _gen_pow2(_GEN_COUNT);
+    uint32_t* seeds = malloc(sizeof(uint32_t) * buckets);
+    int32_t* table = NULL;
+    bool found = false;
+    while (!found && slots <= _GEN_MAX_SLOTS) {
+        free(table);
+        table = malloc(sizeof(int32_t) * slots);
+        found = _gen_search(buckets, slots, seeds, table);
+        slots = found? slots : slots * 2;
+    }
+    if (!found) {
+        fprintf(stderr, "%s: could not find a perfect hash for %u keys\n", argv[0], _GEN_COUNT);
+        return EXIT_FAILURE;
+    }
+
+    printf("/**\n * configkeys.gen.h\n *\n");
+    printf(" * Automatically generated perfect hash of the known config keys, from %s\n *\n", CONFIG_KEYS_DEF);
+    printf(" * @generated by configkeys-gen, do not edit\n */\n");
+    printf("#ifndef __CORE_NETWORK_CONFIGKEYS_GEN\n#define __CORE_NETWORK_CONFIGKEYS_GEN\n\n");
+    printf("// allow C++ to parse this\n#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n");
+    printf("#include <stdint.h>\n#include <stdbool.h>\n#include <stddef.h>\n\n#include \"packet.h\"\n\n");
+    printf("#define CONFIG_KNOWN_COUNT (%u)\n", _GEN_COUNT);
+    printf("#define CONFIG_KNOWN_BUCKETS (%u)\n", buckets);
+    printf("#define CONFIG_KNOWN_SLOTS (%u)\n\n", slots);
+
+    printf("// Defines the known keys\ntypedef enum ConfigKnownKey {\n");
+    for (uint32_t k = 0; k < _GEN_COUNT; k += 1) {
+        printf("    ck_%s = %u, // ", FIELDS[k], k);
+        _gen_print_key(KEYS[k]);
+        printf("\n");
+    }
+    printf("} ConfigKnownKey_t;\n\n");
+
+    printf("// Defines the decoded values of the known keys\ntypedef struct ConfigKnown {\n");
+    for (uint32_t k = 0; k < _GEN_COUNT; k += 1) {
+        printf("    %s %s;%s\n", _gen_ctype(TYPES[k]), FIELDS[k],
+            (TYPES[k] == kv_CString)? " // owned, see config_known_clear" : "");
+    }
+    printf("    bool present[CONFIG_KNOWN_COUNT]; // set once a key's value has been decoded\n");
+    printf("} ConfigKnown_t;\n\n");
+
+    // The tables are only needed (and only defined) in configknown.c
+    printf("#ifdef CONFIG_KNOWN_TABLES\n");
+    printf("static const uint32_t CONFIG_KNOWN_SEEDS[CONFIG_KNOWN_BUCKETS] = {");
+    for (uint32_t b = 0; b < buckets; b += 1) {
+        printf("%s%u", (b == 0)? " " : ", ", seeds[b]);
+    }
+    printf(" };\nstatic const int32_t CONFIG_KNOWN_TABLE[CONFIG_KNOWN_SLOTS] = {");
+    for (uint32_t s = 0; s < slots; s += 1) {
+        printf("%s%d", (s == 0)? " " : ", ", table[s]);
+    }
+    printf(" };\nstatic const char* const CONFIG_KNOWN_KEYS[CONFIG_KNOWN_COUNT] = {\n");
+    for (uint32_t k = 0; k < _GEN_COUNT; k += 1) {
+        printf("    ");
+        _gen_print_key(KEYS[k]);
+        printf(",\n");
+    }
+    printf("};\nstatic const uint32_t CONFIG_KNOWN_LENGTHS[CONFIG_KNOWN_COUNT] = {");
+    for (uint32_t k = 0; k < _GEN_COUNT; k += 1) {
+        printf("%s%zu", (k == 0)? " " : ", ", strlen(KEYS[k]));
+    }
+    printf(" };\nstatic const KVPair_Type_t CONFIG_KNOWN_TYPES[CONFIG_KNOWN_COUNT] = {");
+    for (uint32_t k = 0; k < _GEN_COUNT; k += 1) {
+        printf("%s%s", (k == 0)? " " : ", ", _gen_type_name(TYPES[k]));
+    }
+    printf(" };\nstatic const size_t CONFIG_KNOWN_OFFSETS[CONFIG_KNOWN_COUNT] = {\n");
+    for (uint32_t k = 0; k < _GEN_COUNT; k += 1) {
+        printf("    offsetof(ConfigKnown_t, %s),\n", FIELDS[k]);
+    }
+    printf("};\n#endif\n\n");
+
+    printf("#ifdef __cplusplus\n}\n#endif\n\n#endif\n");
+    free(seeds);
+    free(table);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+/**
+ * core/network/configknown.c
+ *
+ * Decodes known config keys into typed fields
+ *
+ * @author agent <agent@local>
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONFIG_KNOWN_TABLES // only this file uses the generated tables
+#include "configknown.h"
+#include "confighash.h"
+
+/**
+ * @inherit
+ */
+int32_t config_known_find(const char* key, size_t length) {
+    uint32_t bucket = config_hash(key, length, 0) & (CONFIG_KNOWN_BUCKETS - 1);
+    uint32_t slot = config_hash(key, length, CONFIG_KNOWN_SEEDS[bucket]) & (CONFIG_KNOWN_SLOTS - 1);
+    int32_t index = CONFIG_KNOWN_TABLE[slot];
+    if (index == CONFIG_KNOWN_NONE || CONFIG_KNOWN_LENGTHS[index] != length ||
+            memcmp(CONFIG_KNOWN_KEYS[index], key, length) != 0) {
+        return CONFIG_KNOWN_NONE;
+    }
+    return index;
+}
+
+/**
+ * @inherit
+ */
+const char* config_known_key(ConfigKnownKey_t key) {
+    return CONFIG_KNOWN_KEYS[key];
+}
+
+/**
+ * @inherit
+ */
+KVPair_Type_t config_known_type(ConfigKnownKey_t key) {
+    return CONFIG_KNOWN_TYPES[key];
+}
+
+/**
+ * @inherit
+ */
+void config_known_init(ConfigKnown_t* known) {
+    memset(known, 0, sizeof(ConfigKnown_t));
+}
+
+/**
+ * Writes a value into its field
+ *
+ * @param known the values
+ * @param key the key
+ * @param kv the pair, for its CString value
+ * @param value the decoded value
+ * @returns false if a CString value couldn't be copied (the field is unchanged)
+ */
+static bool _known_store(ConfigKnown_t* known, int32_t key, const PViewKV_t* kv, const KVPair_Value_u* value) {
+    void* field = ((uint8_t*) known) + CONFIG_KNOWN_OFFSETS[key];
+    switch (CONFIG_KNOWN_TYPES[key]) {
+        case kv_Integer:
+            *((int32_t*) field) = value->Integer;
+            break;
+        case kv_Float:
+            *((float*) field) = value->Float;
+            break;
+        case kv_Double:
+            *((double*) field) = value->Double;
+            break;
+        case kv_Boolean:
+            *((bool*) field) = (value->Boolean != 0);
+            break;
+        case kv_CString: {
+            // The value points into the packet, so it's copied (its length includes the nul)
+            char* copy = malloc(kv->value_length);
+            if (copy == NULL) {
+                return false;
+            }
+            memcpy(copy, kv->value, kv->value_length);
+            free(*((char**) field));
+            *((char**) field) = copy;
+            break;
+        }
+    }
+    known->present[key] = true;
+    return true;
+}
+
+/**
+ * @inherit
+ */
+bool config_known_apply(ConfigKnown_t* known, const PacketView_t* view, ConfigStore_t** others) {
+    PViewKVIter_t iter;
+    PViewKV_t kv;
+    KVPair_Value_u value;
+    if (others != NULL) {
+        *others = NULL;
+    }
+
+    // Check the whole list first, so a bad packet changes nothing
+    if (!pview_kv_begin(view, &iter)) {
+        return false;
+    }
+    while (pview_kv_next(&iter, &kv)) {
+        if (!pview_kv_value(&kv, &value)) {
+            return false;
+        }
+    }
+    if (iter.malformed) {
+        return false;
+    }
+
+    bool unknown = false;
+    pview_kv_begin(view, &iter);
+    while (pview_kv_next(&iter, &kv)) {
+        int32_t key = config_known_find(kv.key, kv.key_length);
+        if (key == CONFIG_KNOWN_NONE || kv.type != CONFIG_KNOWN_TYPES[key]) {
+            unknown = true;
+            continue;
+        }
+        pview_kv_value(&kv, &value);
+        if (!_known_store(known, key, &kv, &value)) {
+            return false;
+        }
+    }
+
+    // Everything else takes the dynamic path
+    if (unknown && others != NULL) {
+        *others = config_store_from_view(view);
+    }
+    return true;
+}
+
+/**
+ * @inherit
+ */
+void config_known_clear(ConfigKnown_t* known) {
+    for (uint32_t key = 0; key < CONFIG_KNOWN_COUNT; key += 1) {
+        if (CONFIG_KNOWN_TYPES[key] == kv_CString) {
+            free(*((char**) (((uint8_t*) known) + CONFIG_KNOWN_OFFSETS[key])));
+        }
+    }
+    config_known_init(known);
+}
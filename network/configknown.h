@@ -0,0 +1,91 @@
+/**
+ * core/network/configknown.h
+ *
+ * Decodes the config keys a build knows about (see configkeys.def) straight
+ * into the fields of a ConfigKnown_t. The key list is turned into a perfect
+ * hash when the code is built, so each pair in a CONFIG_RESPONSE or
+ * CONFIG_UPDATE costs two hashes and one compare to place, with no generic
+ * table or list in between. Keys that aren't known (or whose value has the
+ * wrong type) are handed to a ConfigStore instead.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_CONFIGKNOWN
+#define __CORE_NETWORK_CONFIGKNOWN
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "packet.h"
+#include "packetview.h"
+#include "configstore.h"
+#include "configkeys.gen.h" // made from configkeys.def by the Makefile
+
+#define CONFIG_KNOWN_NONE (-1)
+
+/**
+ * Finds a known key
+ *
+ * @param key the key (doesn't need to be nul-terminated)
+ * @param length the length of the key
+ * @returns the key (a ConfigKnownKey_t), or CONFIG_KNOWN_NONE
+ */
+int32_t config_known_find(const char* key, size_t length);
+
+/**
+ * Gets the name of a known key
+ *
+ * @param key the key
+ * @returns the name
+ */
+const char* config_known_key(ConfigKnownKey_t key);
+
+/**
+ * Gets the type a known key's value must have
+ *
+ * @param key the key
+ * @returns the type
+ */
+KVPair_Type_t config_known_type(ConfigKnownKey_t key);
+
+/**
+ * Sets up an empty set of known values
+ *
+ * @param known the values
+ */
+void config_known_init(ConfigKnown_t* known);
+
+/**
+ * Decodes the pairs in a CONFIG_RESPONSE or CONFIG_UPDATE packet. Known keys
+ * overwrite the matching field (the last value wins if a key repeats); if any
+ * key isn't known, the whole list is also decoded into a ConfigStore.
+ *
+ * @param known the values to update
+ * @param view a view of the packet, which can be released once this returns
+ * @param others if not NULL, set to a store holding the packet's pairs when some
+ *        weren't known (to be freed with config_store_free), or NULL if every
+ *        pair was
+ * @returns false if the packet is a different type or its list is malformed,
+ *          in which case nothing is changed, or if a CString value couldn't be
+ *          copied, in which case the pairs before it have already been applied
+ */
+bool config_known_apply(ConfigKnown_t* known, const PacketView_t* view, ConfigStore_t** others);
+
+/**
+ * Cleans up a set of known values (the strings it owns), leaving it empty
+ *
+ * @param known the values
+ */
+void config_known_clear(ConfigKnown_t* known);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,233 @@
+/**
+ * core/network/configstore.c
+ *
+ * Flat, indexed storage for the key-value pairs in a CONFIG packet
+ *
+ * @author agent <agent@local>
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "configstore.h"
+
+#define _STORE_ALIGN (8) // enough for the doubles in the value array
+#define _STORE_ROUND(size) (((size) + _STORE_ALIGN - 1) & ~((size_t) _STORE_ALIGN - 1))
+#define _STORE_MIN_SLOTS (8)
+
+/**
+ * Hashes a key (32-bit FNV-1a)
+ *
+ * @param key the key
+ * @param length the length of the key
+ * @returns the hash
+ */
+static uint32_t _store_hash(const char* key, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i += 1) {
+        hash ^= (uint8_t) key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Gets the number of index slots for a number of pairs, keeping the index at
+ * most half full so probe chains stay short
+ *
+ * @param count the number of pairs
+ * @returns the number of slots (a power of two)
+ */
+static uint32_t _store_slots(uint32_t count) {
+    uint32_t slots = _STORE_MIN_SLOTS;
+    while (slots < count * 2) {
+        slots <<= 1;
+    }
+    return slots;
+}
+
+/**
+ * Finds the index slot for a key: either the slot holding it, or the empty
+ * slot where it would go
+ *
+ * @param store the store
+ * @param key the key
+ * @param hash the key's hash
+ * @returns the slot
+ */
+static uint32_t _store_probe(const ConfigStore_t* store, const char* key, uint32_t hash) {
+    uint32_t slot = hash & store->index_mask;
+    while (store->index[slot] != 0) {
+        uint32_t entry = store->index[slot] - 1;
+        if (store->key_hashes[entry] == hash && strcmp(store->strings + store->key_offsets[entry], key) == 0) {
+            break;
+        }
+        slot = (slot + 1) & store->index_mask;
+    }
+    return slot;
+}
+
+/**
+ * @inherit
+ */
+ConfigStore_t* config_store_from_view(const PacketView_t* view) {
+    // First pass: check the list, and count the pairs and string bytes
+    PViewKVIter_t iter;
+    PViewKV_t kv;
+    KVPair_Value_u value;
+    if (!pview_kv_begin(view, &iter)) {
+        return NULL;
+    }
+    uint32_t count = 0;
+    size_t strings_len = 0;
+    while (pview_kv_next(&iter, &kv)) {
+        if (!pview_kv_value(&kv, &value)) {
+            return NULL;
+        }
+        strings_len += kv.key_length + 1 + ((kv.type == kv_CString)? kv.value_length : 0);
+        count += 1;
+    }
+    if (iter.malformed) {
+        return NULL;
+    }
+
+    // Lay the arrays out in one allocation, widest first
+    uint32_t slots = _store_slots(count);
+    size_t values_at = _STORE_ROUND(sizeof(ConfigStore_t));
+    size_t offsets_at = values_at + _STORE_ROUND(sizeof(KVPair_Value_u) * count);
+    size_t hashes_at = offsets_at + _STORE_ROUND(sizeof(uint32_t) * count);
+    size_t index_at = hashes_at + _STORE_ROUND(sizeof(uint32_t) * count);
+    size_t types_at = index_at + _STORE_ROUND(sizeof(uint32_t) * slots);
+    size_t strings_at = types_at + _STORE_ROUND(count);
+    uint8_t* base = malloc(strings_at + strings_len);
+    if (base == NULL) {
+        return NULL;
+    }
+    ConfigStore_t* store = (ConfigStore_t*) base;
+    store->count = count;
+    store->index_mask = slots - 1;
+    store->values = (KVPair_Value_u*) (base + values_at);
+    store->key_offsets = (uint32_t*) (base + offsets_at);
+    store->key_hashes = (uint32_t*) (base + hashes_at);
+    store->index = (uint32_t*) (base + index_at);
+    store->types = base + types_at;
+    store->strings = (char*) (base + strings_at);
+    memset(store->index, 0, sizeof(uint32_t) * slots);
+
+    // Second pass: fill in the arrays and the index
+    uint32_t strings_used = 0;
+    pview_kv_begin(view, &iter);
+    for (uint32_t i = 0; i < count && pview_kv_next(&iter, &kv); i += 1) {
+        store->key_offsets[i] = strings_used;
+        memcpy(store->strings + strings_used, kv.key, kv.key_length + 1);
+        strings_used += kv.key_length + 1;
+
+        store->types[i] = (uint8_t) kv.type;
+        pview_kv_value(&kv, &store->values[i]);
+        if (kv.type == kv_CString) {
+            store->values[i].CString = store->strings + strings_used;
+            memcpy(store->strings + strings_used, kv.value, kv.value_length);
+            strings_used += kv.value_length;
+        }
+
+        // A repeated key takes over the slot, so the last value wins
+        store->key_hashes[i] = _store_hash(kv.key, kv.key_length);
+        uint32_t slot = _store_probe(store, store->strings + store->key_offsets[i], store->key_hashes[i]);
+        store->index[slot] = i + 1;
+    }
+    return store;
+}
+
+/**
+ * @inherit
+ */
+int32_t config_store_find(const ConfigStore_t* store, const char* key) {
+    uint32_t slot = _store_probe(store, key, _store_hash(key, strlen(key)));
+    return (int32_t) store->index[slot] - 1; // empty slots give CONFIG_STORE_NOT_FOUND
+}
+
+/**
+ * @inherit
+ */
+const char* config_store_key(const ConfigStore_t* store, uint32_t entry) {
+    return store->strings + store->key_offsets[entry];
+}
+
+/**
+ * Finds the value for a key, checking its type
+ *
+ * @param store the store
+ * @param key the key
+ * @param type the type the caller wants
+ * @returns the value, or NULL if the key is missing or has a different type
+ */
+static const KVPair_Value_u* _store_get(const ConfigStore_t* store, const char* key, KVPair_Type_t type) {
+    int32_t entry = config_store_find(store, key);
+    if (entry == CONFIG_STORE_NOT_FOUND || store->types[entry] != type) {
+        return NULL;
+    }
+    return &store->values[entry];
+}
+
+/**
+ * @inherit
+ */
+bool config_store_get_int(const ConfigStore_t* store, const char* key, int32_t* out) {
+    const KVPair_Value_u* value = _store_get(store, key, kv_Integer);
+    if (value == NULL) {
+        return false;
+    }
+    *out = value->Integer;
+    return true;
+}
+
+/**
+ * @inherit
+ */
+bool config_store_get_float(const ConfigStore_t* store, const char* key, float* out) {
+    const KVPair_Value_u* value = _store_get(store, key, kv_Float);
+    if (value == NULL) {
+        return false;
+    }
+    *out = value->Float;
+    return true;
+}
+
+/**
+ * @inherit
+ */
+bool config_store_get_double(const ConfigStore_t* store, const char* key, double* out) {
+    const KVPair_Value_u* value = _store_get(store, key, kv_Double);
+    if (value == NULL) {
+        return false;
+    }
+    *out = value->Double;
+    return true;
+}
+
+/**
+ * @inherit
+ */
+bool config_store_get_bool(const ConfigStore_t* store, const char* key, bool* out) {
+    const KVPair_Value_u* value = _store_get(store, key, kv_Boolean);
+    if (value == NULL) {
+        return false;
+    }
+    *out = value->Boolean != 0;
+    return true;
+}
+
+/**
+ * @inherit
+ */
+const char* config_store_get_string(const ConfigStore_t* store, const char* key) {
+    const KVPair_Value_u* value = _store_get(store, key, kv_CString);
+    return (value == NULL)? NULL : value->CString;
+}
+
+/**
+ * @inherit
+ */
+void config_store_free(ConfigStore_t* store) {
+    free(store);
+}
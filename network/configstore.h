@@ -0,0 +1,132 @@
+/**
+ * core/network/configstore.h
+ *
+ * Flat, indexed storage for the key-value pairs in a CONFIG_RESPONSE or
+ * CONFIG_UPDATE packet. Pairs are kept as parallel arrays (key offsets, key
+ * hashes, types, values) in one allocation, with an open-addressed index built
+ * while the packet is parsed, so looking up a key is a hash and (usually) one
+ * probe instead of a scan over a list of pairs.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_CONFIGSTORE
+#define __CORE_NETWORK_CONFIGSTORE
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "packet.h"
+#include "packetview.h"
+
+#define CONFIG_STORE_NOT_FOUND (-1)
+
+// Defines a decoded set of config pairs
+typedef struct ConfigStore {
+    uint32_t count; // number of pairs
+    uint32_t index_mask; // number of index slots, minus one (always a power of two)
+
+    // One entry per pair, in packet order
+    KVPair_Value_u* values; // CString values point into strings
+    uint32_t* key_offsets; // where each key starts in strings
+    uint32_t* key_hashes;
+    uint8_t* types; // KVPair_Type_t
+
+    uint32_t* index; // entry number plus one, zero for an empty slot
+    char* strings; // keys and CString values, nul-terminated
+} ConfigStore_t;
+
+/**
+ * Decodes the pairs in a CONFIG_RESPONSE or CONFIG_UPDATE packet into a store.
+ * If a key appears more than once, the last value wins.
+ *
+ * @param view a view of the packet, which can be released once this returns
+ * @returns the store (in a single allocation), or NULL if the packet is a
+ *          different type, its list is malformed, or memory ran out
+ */
+ConfigStore_t* config_store_from_view(const PacketView_t* view);
+
+/**
+ * Finds the entry for a key
+ *
+ * @param store the store
+ * @param key the key to look for
+ * @returns the entry number, or CONFIG_STORE_NOT_FOUND
+ */
+int32_t config_store_find(const ConfigStore_t* store, const char* key);
+
+/**
+ * Gets the key of an entry
+ *
+ * @param store the store
+ * @param entry the entry number (less than store->count)
+ * @returns the key
+ */
+const char* config_store_key(const ConfigStore_t* store, uint32_t entry);
+
+/**
+ * Gets an integer value
+ *
+ * @param store the store
+ * @param key the key to look for
+ * @param out set to the value if it was found
+ * @returns false if the key is missing or isn't an integer
+ */
+bool config_store_get_int(const ConfigStore_t* store, const char* key, int32_t* out);
+
+/**
+ * Gets a float value
+ *
+ * @param store the store
+ * @param key the key to look for
+ * @param out set to the value if it was found
+ * @returns false if the key is missing or isn't a float
+ */
+bool config_store_get_float(const ConfigStore_t* store, const char* key, float* out);
+
+/**
+ * Gets a double value
+ *
+ * @param store the store
+ * @param key the key to look for
+ * @param out set to the value if it was found
+ * @returns false if the key is missing or isn't a double
+ */
+bool config_store_get_double(const ConfigStore_t* store, const char* key, double* out);
+
+/**
+ * Gets a boolean value
+ *
+ * @param store the store
+ * @param key the key to look for
+ * @param out set to the value if it was found
+ * @returns false if the key is missing or isn't a boolean
+ */
+bool config_store_get_bool(const ConfigStore_t* store, const char* key, bool* out);
+
+/**
+ * Gets a string value
+ *
+ * @param store the store
+ * @param key the key to look for
+ * @returns the string (owned by the store), or NULL if the key is missing or
+ *          isn't a string
+ */
+const char* config_store_get_string(const ConfigStore_t* store, const char* key);
+
+/**
+ * Cleans up a store
+ *
+ * @param store the store
+ */
+void config_store_free(ConfigStore_t* store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,266 @@
+/**
+ * core/network/estop.c
+ *
+ * Emergency stop fast path
+ *
+ * @author agent <agent@local>
+ */
+#define _DEFAULT_SOURCE // needed for clock_gettime(...)
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "estop.h"
+#include "lowlevel.h"
+#include "packet.h"
+
+/**
+ * Gets the current monotonic time
+ *
+ * @returns the time in nanoseconds
+ */
+static uint64_t _estop_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * Writes the e-stop frame to one of a connection's sockets
+ *
+ * @param estop the facility
+ * @param connection the connection to e-stop
+ * @param proto the socket to write to
+ * @returns true if the whole frame was written
+ */
+static bool _estop_write(LLNetEstop_t* estop, WorkerConnection_t* connection, NetworkProtocol_t proto) {
+    return llnet_connection_write_frame(connection, proto, estop->frame, LLNET_ESTOP_FRAME_LENGTH) ==
+        LLNET_ESTOP_FRAME_LENGTH;
+}
+
+/**
+ * Starts the record of a connection being e-stopped. The facility's lock must
+ * be held.
+ *
+ * @param estop the facility
+ * @param connection the connection being e-stopped
+ * @returns the record, or NULL if there's no room left to record it
+ */
+static LLNetEstopRecord_t* _estop_record(LLNetEstop_t* estop, WorkerConnection_t* connection) {
+    if (estop->num_records >= estop->capacity) {
+        return NULL;
+    }
+    LLNetEstopRecord_t* record = &estop->records[estop->num_records];
+    record->id = connection->connection_id;
+    record->sent_ns = _estop_now();
+    record->acked_ns = 0;
+    record->tcp_sent = false;
+    record->udp_sent = false;
+    estop->num_records += 1;
+    return record;
+}
+
+/**
+ * Writes the e-stop frame to a connection (UDP then TCP) and records it. The
+ * facility's lock must be held.
+ *
+ * @param estop the facility
+ * @param connection the connection to e-stop
+ * @returns true if the frame was written to at least one socket
+ */
+static bool _estop_send(LLNetEstop_t* estop, WorkerConnection_t* connection) {
+    LLNetEstopRecord_t* record = _estop_record(estop, connection);
+
+    // UDP first, it can't be held up behind anything already in the TCP stream
+    bool udp_sent = _estop_write(estop, connection, np_UDP);
+    bool tcp_sent = _estop_write(estop, connection, np_TCP);
+    estop->sent_ns = _estop_now();
+
+    if (record != NULL) {
+        record->udp_sent = udp_sent;
+        record->tcp_sent = tcp_sent;
+    }
+    return udp_sent || tcp_sent;
+}
+
+/**
+ * Collects a connection to e-stop, holding it so the frame can be written once
+ * the registry is unlocked. The facility's lock must be held.
+ *
+ * @param connection the connection to e-stop
+ * @param _estop the facility
+ */
+static void _estop_collect(WorkerConnection_t* connection, void* _estop) {
+    LLNetEstop_t* estop = (LLNetEstop_t*) _estop;
+    if (estop->num_targets < estop->capacity) {
+        llnet_connection_retain(connection);
+        estop->targets[estop->num_targets] = connection;
+        estop->num_targets += 1;
+    } else {
+        // No room to hold (or record) it, so it can't wait until the registry is unlocked
+        _estop_write(estop, connection, np_UDP);
+        _estop_write(estop, connection, np_TCP);
+    }
+}
+
+/**
+ * Starts a new e-stop: stamps the frame and forgets the last one. The
+ * facility's lock must be held.
+ *
+ * @param estop the facility
+ */
+static void _estop_begin(LLNetEstop_t* estop) {
+    estop->triggered_ns = _estop_now();
+    estop->num_records = 0;
+    estop->num_targets = 0;
+    estop->timestamp = llnet_context_timestamp(estop->context);
+    uint32_t timestamp = htonl(estop->timestamp);
+    memcpy(estop->frame + 4, &timestamp, sizeof(uint32_t));
+}
+
+/**
+ * @inherit
+ */
+LLNetEstop_t* llnet_estop_init(LLNetContext_t* context, uint32_t capacity) {
+    LLNetEstop_t* estop = calloc(1, sizeof(LLNetEstop_t));
+    if (estop == NULL) {
+        return NULL;
+    }
+    estop->records = calloc(capacity, sizeof(LLNetEstopRecord_t));
+    estop->targets = calloc(capacity, sizeof(WorkerConnection_t*));
+    if ((estop->records == NULL || estop->targets == NULL) && capacity > 0) {
+        free(estop->records);
+        free(estop->targets);
+        free(estop);
+        return NULL;
+    }
+    estop->context = context;
+    estop->capacity = capacity;
+    pthread_mutex_init(&estop->mutex, NULL);
+
+    // STATE_UPDATE to E_STOPPED, the timestamp is filled in on each trigger
+    uint32_t word = htonl((pt_STATE_UPDATE << 24) | LLNET_ESTOP_PAYLOAD_LENGTH);
+    memcpy(estop->frame, &word, sizeof(uint32_t));
+    estop->frame[LLNET_HEADER_LENGTH] = rs_E_STOPPED;
+    return estop;
+}
+
+/**
+ * @inherit
+ */
+uint32_t llnet_estop_trigger(LLNetEstop_t* estop) {
+    pthread_mutex_lock(&estop->mutex);
+    _estop_begin(estop);
+
+    // Only collect the connections while the registry is locked, a slow TCP write shouldn't hold it
+    uint32_t count = llnet_context_foreach(estop->context, &_estop_collect, estop);
+
+    // UDP to every robot first, so no robot's copy waits behind another robot's TCP stream
+    for (uint32_t i = 0; i < estop->num_targets; i += 1) {
+        LLNetEstopRecord_t* record = _estop_record(estop, estop->targets[i]);
+        bool udp_sent = _estop_write(estop, estop->targets[i], np_UDP);
+        if (record != NULL) {
+            record->udp_sent = udp_sent;
+        }
+    }
+    for (uint32_t i = 0; i < estop->num_targets; i += 1) {
+        bool tcp_sent = _estop_write(estop, estop->targets[i], np_TCP);
+        if (i < estop->num_records) {
+            estop->records[i].tcp_sent = tcp_sent;
+        }
+        llnet_connection_release(estop->targets[i]);
+    }
+    estop->sent_ns = _estop_now();
+    estop->num_targets = 0;
+
+    pthread_mutex_unlock(&estop->mutex);
+    return count;
+}
+
+/**
+ * @inherit
+ */
+uint32_t llnet_estop_trigger_one(LLNetEstop_t* estop, WorkerConnection_t* connection) {
+    pthread_mutex_lock(&estop->mutex);
+    _estop_begin(estop);
+    bool sent = _estop_send(estop, connection);
+    pthread_mutex_unlock(&estop->mutex);
+    return sent? 0 : -1;
+}
+
+/**
+ * @inherit
+ */
+bool llnet_estop_observe(LLNetEstop_t* estop, uint32_t id, IntermediateTLV_t* packet) {
+    // Only a successful status update answers the e-stop (UPDATE_STATUS doesn't say which state it's about)
+    if (packet->type != pt_UPDATE_STATUS || packet->length < 1 || packet->data[0] != sc_SUCCESS) {
+        return false;
+    }
+    uint64_t now = _estop_now();
+
+    bool first = false;
+    pthread_mutex_lock(&estop->mutex);
+
+    // Responses stamped before the trigger are to something else (timestamps wrap, so compare the difference)
+    if ((int32_t) (packet->timestamp - estop->timestamp) < 0) {
+        pthread_mutex_unlock(&estop->mutex);
+        return false;
+    }
+    for (uint32_t i = 0; i < estop->num_records; i += 1) {
+        LLNetEstopRecord_t* record = &estop->records[i];
+        if (record->id == id) {
+            if (record->acked_ns == 0) {
+                record->acked_ns = now;
+                first = true;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&estop->mutex);
+    return first;
+}
+
+/**
+ * @inherit
+ */
+uint32_t llnet_estop_pending(LLNetEstop_t* estop) {
+    uint32_t pending = 0;
+    pthread_mutex_lock(&estop->mutex);
+    for (uint32_t i = 0; i < estop->num_records; i += 1) {
+        if (estop->records[i].acked_ns == 0) {
+            pending += 1;
+        }
+    }
+    pthread_mutex_unlock(&estop->mutex);
+    return pending;
+}
+
+/**
+ * @inherit
+ */
+uint64_t llnet_estop_worst_latency(LLNetEstop_t* estop) {
+    uint64_t worst = 0;
+    pthread_mutex_lock(&estop->mutex);
+    for (uint32_t i = 0; i < estop->num_records; i += 1) {
+        LLNetEstopRecord_t* record = &estop->records[i];
+        // From the trigger, so time spent writing to the robots before this one counts too
+        if (record->acked_ns != 0 && record->acked_ns - estop->triggered_ns > worst) {
+            worst = record->acked_ns - estop->triggered_ns;
+        }
+    }
+    pthread_mutex_unlock(&estop->mutex);
+    return worst;
+}
+
+/**
+ * @inherit
+ */
+void llnet_estop_free(LLNetEstop_t* estop) {
+    pthread_mutex_destroy(&estop->mutex);
+    free(estop->records);
+    free(estop->targets);
+    free(estop);
+}
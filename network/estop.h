@@ -0,0 +1,126 @@
+/**
+ * core/network/estop.h
+ *
+ * Emergency stop fast path. The e-stop frame (a STATE_UPDATE to E_STOPPED) is
+ * built ahead of time, and triggering an e-stop writes it straight to every
+ * connection's TCP and UDP sockets, without going through any of llnet's
+ * queues. The copies are written one after the other (not in parallel), but
+ * the UDP copy goes to every robot before any TCP copy is written. The time
+ * from the trigger to each robot's UPDATE_STATUS response is recorded, so the
+ * worst case can be checked against a bound.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_ESTOP
+#define __CORE_NETWORK_ESTOP
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "lowlevel.h"
+
+#define LLNET_ESTOP_PAYLOAD_LENGTH (4) // new state, 3 reserved bytes
+#define LLNET_ESTOP_FRAME_LENGTH (LLNET_HEADER_LENGTH + LLNET_ESTOP_PAYLOAD_LENGTH)
+
+// Defines the record of one connection being e-stopped
+typedef struct LLNetEstopRecord {
+    uint32_t id; // connection id
+    uint64_t sent_ns; // when the frame started being written (monotonic clock)
+    uint64_t acked_ns; // when the response came in, zero until it does
+    bool tcp_sent; // true if the frame made it into the TCP socket
+    bool udp_sent; // true if the frame made it into the UDP socket
+} LLNetEstopRecord_t;
+
+// Defines an e-stop facility for a context
+typedef struct LLNetEstop {
+    LLNetContext_t* context;
+    uint8_t frame[LLNET_ESTOP_FRAME_LENGTH]; // the e-stop frame, only the timestamp changes
+
+    // records of the last e-stop, preallocated so triggering never allocates
+    pthread_mutex_t mutex;
+    uint32_t capacity;
+    uint32_t num_records;
+    LLNetEstopRecord_t* records;
+    uint32_t num_targets;
+    WorkerConnection_t** targets; // connections being e-stopped (held until they've been written to)
+    uint32_t timestamp; // timestamp the last e-stop frame was sent with
+    uint64_t triggered_ns; // when the last e-stop was triggered
+    uint64_t sent_ns; // when the last frame of the last e-stop was written
+} LLNetEstop_t;
+
+/**
+ * Creates an e-stop facility
+ *
+ * @param context the context whose connections are e-stopped
+ * @param capacity the most connections whose latency is recorded. Any
+ *        connections beyond it are still e-stopped, but are written to while
+ *        the context's registry is locked.
+ * @return the facility, or NULL if a memory request failed
+ */
+LLNetEstop_t* llnet_estop_init(LLNetContext_t* context, uint32_t capacity);
+
+/**
+ * E-stops every connection in the context, sending the e-stop frame over both
+ * TCP and UDP
+ *
+ * @param estop the facility to use
+ * @returns the number of connections the frame was sent to
+ */
+uint32_t llnet_estop_trigger(LLNetEstop_t* estop);
+
+/**
+ * E-stops a single connection, sending the e-stop frame over both TCP and UDP
+ *
+ * @param estop the facility to use
+ * @param connection the connection to e-stop
+ * @returns zero if the frame was sent on at least one socket, or an error code
+ */
+uint32_t llnet_estop_trigger_one(LLNetEstop_t* estop, WorkerConnection_t* connection);
+
+/**
+ * Checks an incoming packet for a response to the last e-stop, recording the
+ * latency if so. A response is a successful UPDATE_STATUS stamped no earlier
+ * than the e-stop frame. Should be called from the on_packet handler.
+ *
+ * @param estop the facility to use
+ * @param id the connection the packet came in on
+ * @param packet the packet (not freed)
+ * @returns true if the packet was the first response from that connection
+ */
+bool llnet_estop_observe(LLNetEstop_t* estop, uint32_t id, IntermediateTLV_t* packet);
+
+/**
+ * Gets the number of connections that haven't responded to the last e-stop
+ *
+ * @param estop the facility to check
+ * @returns the number of connections still waiting
+ */
+uint32_t llnet_estop_pending(LLNetEstop_t* estop);
+
+/**
+ * Gets the worst trigger-to-response latency of the last e-stop, which covers
+ * writing the frame to every robot ahead of the slowest one
+ *
+ * @param estop the facility to check
+ * @returns the latency (in nanoseconds) of the slowest response so far
+ */
+uint64_t llnet_estop_worst_latency(LLNetEstop_t* estop);
+
+/**
+ * Cleans up an e-stop facility
+ *
+ * @param estop the facility to clean up
+ */
+void llnet_estop_free(LLNetEstop_t* estop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
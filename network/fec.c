@@ -0,0 +1,253 @@
+/**
+ * core/network/fec.c
+ *
+ * XOR parity forward error correction for UDP frames
+ *
+ * @author agent <agent@local>
+ */
+#define _DEFAULT_SOURCE // needed for CLOCK_MONOTONIC
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "fec.h"
+
+#define _FEC_HEADER_LENGTH (8) // matches LLNET_HEADER_LENGTH
+#define _FEC_LENGTH_MASK (0x3fffff) // matches LLNET_LENGTH_MASK
+#define _FEC_MAX_SKIPPED (64) // most groups counted as lost between two received ones (the estimate is saturated well before)
+
+/**
+ * XORs a frame into a buffer
+ *
+ * @param dst the buffer to XOR into
+ * @param src the frame to XOR in
+ * @param len the length of the frame
+ */
+static void _fec_xor(uint8_t* dst, const uint8_t* src, uint32_t len) {
+    for (uint32_t i = 0; i < len; i += 1) {
+        dst[i] ^= src[i];
+    }
+}
+
+/**
+ * Picks a group size for a loss rate: the more loss, the more parity
+ *
+ * @param loss the loss rate (frames per thousand)
+ * @returns the group size
+ */
+static uint8_t _fec_group_size(uint32_t loss) {
+    if (loss >= 150) {
+        return 2;
+    } else if (loss >= 50) {
+        return 4;
+    } else if (loss >= 10) {
+        return 8;
+    }
+    return LLNET_FEC_MAX_GROUP;
+}
+
+/**
+ * @inherit
+ */
+LLNetFec_t* fec_init() {
+    LLNetFec_t* fec = calloc(1, sizeof(LLNetFec_t));
+    if (fec == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&fec->mutex, NULL);
+
+    // Deadlines are on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&fec->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    fec->tx.k = LLNET_FEC_DEFAULT_GROUP;
+    fec->tx.next_k = LLNET_FEC_DEFAULT_GROUP;
+    return fec;
+}
+
+/**
+ * @inherit
+ */
+bool fec_encode(LLNetFecEncoder_t* enc, const uint8_t* frame, uint32_t len, uint8_t* tag) {
+    tag[0] = (enc->group >> 8) & 0xff;
+    tag[1] = enc->group & 0xff;
+    tag[2] = enc->index;
+    tag[3] = enc->k;
+
+    _fec_xor(enc->parity, frame, len);
+    if (len > enc->parity_len) {
+        enc->parity_len = len;
+    }
+    enc->index += 1;
+    return enc->index >= enc->k;
+}
+
+/**
+ * @inherit
+ */
+uint32_t fec_parity(LLNetFecEncoder_t* enc, uint8_t* out) {
+    out[0] = (enc->group >> 8) & 0xff;
+    out[1] = enc->group & 0xff;
+    out[2] = enc->index; // number of frames covered
+    out[3] = enc->k;
+    memcpy(out + LLNET_FEC_TAG_LENGTH, enc->parity, enc->parity_len);
+    uint32_t len = LLNET_FEC_TAG_LENGTH + enc->parity_len;
+
+    // Start the next group
+    memset(enc->parity, 0, enc->parity_len);
+    enc->parity_len = 0;
+    enc->index = 0;
+    enc->group += 1;
+    enc->k = enc->next_k;
+    return len;
+}
+
+/**
+ * @inherit
+ */
+void fec_encoder_adapt(LLNetFecEncoder_t* enc, uint32_t loss) {
+    enc->next_k = _fec_group_size(loss);
+}
+
+/**
+ * Folds one group's losses into the loss rate
+ *
+ * @param dec the decoder
+ * @param lost the number of frames in the group that were lost
+ * @param k the size of the group
+ */
+static void _fec_count_group(LLNetFecDecoder_t* dec, uint32_t lost, uint32_t k) {
+    uint32_t loss = (lost * 1000) / k;
+    dec->loss = ((dec->loss * 7) + loss) / 8;
+    dec->groups += 1;
+    if (dec->groups % LLNET_FEC_REPORT_GROUPS == 0) {
+        dec->report_due = true;
+    }
+}
+
+/**
+ * Closes the group being collected, folding its losses into the loss rate
+ *
+ * @param dec the decoder
+ */
+static void _fec_close_group(LLNetFecDecoder_t* dec) {
+    if (!dec->active) {
+        return;
+    }
+    _fec_count_group(dec, dec->k - dec->received, dec->k);
+    dec->active = false;
+}
+
+/**
+ * Starts collecting a new group
+ *
+ * @param dec the decoder
+ * @param group the group
+ * @param k the size of the group
+ */
+static void _fec_open_group(LLNetFecDecoder_t* dec, uint16_t group, uint8_t k) {
+    _fec_close_group(dec);
+
+    // Nothing at all arrived from the groups in between (a gap going backwards is reordering, not loss)
+    uint16_t skipped = group - dec->group - 1;
+    if (dec->groups > 0 && skipped < 0x8000) {
+        for (uint16_t i = 0; i < skipped && i < _FEC_MAX_SKIPPED; i += 1) {
+            _fec_count_group(dec, 1, 1);
+        }
+    }
+
+    memset(dec->acc, 0, dec->acc_len);
+    dec->acc_len = 0;
+    dec->group = group;
+    dec->k = k;
+    dec->received = 0;
+    dec->mask = 0;
+    dec->active = true;
+}
+
+/**
+ * @inherit
+ */
+void fec_decode_data(LLNetFecDecoder_t* dec, const uint8_t* tag, const uint8_t* frame, uint32_t len) {
+    uint16_t group = (tag[0] << 8) | tag[1];
+    uint8_t index = tag[2];
+    uint8_t k = tag[3];
+    if (len > LLNET_FEC_MAX_FRAME || k == 0 || k > LLNET_FEC_MAX_GROUP || index >= k) {
+        return;
+    }
+
+    if (!dec->active || dec->group != group) {
+        _fec_open_group(dec, group, k);
+    }
+    if (dec->mask & (1U << index)) {
+        return; // duplicate
+    }
+    dec->mask |= (1U << index);
+    dec->received += 1;
+
+    _fec_xor(dec->acc, frame, len);
+    if (len > dec->acc_len) {
+        dec->acc_len = len;
+    }
+}
+
+/**
+ * @inherit
+ */
+int32_t fec_decode_parity(LLNetFecDecoder_t* dec, const uint8_t* payload, uint32_t len, uint8_t* out) {
+    if (len < LLNET_FEC_TAG_LENGTH || len - LLNET_FEC_TAG_LENGTH > LLNET_FEC_MAX_FRAME) {
+        return -1;
+    }
+    uint16_t group = (payload[0] << 8) | payload[1];
+    uint8_t covered = payload[2];
+    uint8_t k = payload[3];
+    if (k == 0 || k > LLNET_FEC_MAX_GROUP || covered == 0 || covered > k) {
+        return -1;
+    }
+
+    // Every frame of the group may have been lost (only recoverable if k is 1)
+    if (!dec->active || dec->group != group) {
+        _fec_open_group(dec, group, k);
+    }
+
+    // A group flushed early only has the frames the parity covers
+    if (dec->mask >> covered) {
+        _fec_close_group(dec);
+        return -1;
+    }
+    dec->k = covered;
+
+    // XOR can only rebuild a single lost frame
+    int32_t rc = -1;
+    uint32_t plen = len - LLNET_FEC_TAG_LENGTH;
+    if (dec->received == dec->k) {
+        rc = 0;
+    } else if (dec->received + 1 == dec->k && dec->acc_len <= plen) {
+        memcpy(out, payload + LLNET_FEC_TAG_LENGTH, plen);
+        _fec_xor(out, dec->acc, dec->acc_len);
+
+        // The rebuilt header says how long the frame really was
+        uint32_t word;
+        memcpy(&word, out, sizeof(uint32_t));
+        uint32_t flen = (ntohl(word) & _FEC_LENGTH_MASK) + _FEC_HEADER_LENGTH;
+        rc = (plen >= _FEC_HEADER_LENGTH && flen <= plen)? (int32_t) flen : -1;
+    }
+
+    _fec_close_group(dec);
+    return rc;
+}
+
+/**
+ * @inherit
+ */
+void fec_free(LLNetFec_t* fec) {
+    pthread_mutex_destroy(&fec->mutex);
+    pthread_cond_destroy(&fec->cond);
+    free(fec);
+}
@@ -0,0 +1,139 @@
+/**
+ * core/network/fec.h
+ *
+ * XOR parity forward error correction for UDP frames. Frames are sent in
+ * groups of k, followed by a parity frame that is the XOR of every frame in the
+ * group, so any single lost frame in a group can be rebuilt without a resend.
+ * The group size adapts to the loss rate the other side reports.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_FEC
+#define __CORE_NETWORK_FEC
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define LLNET_FEC_TAG_LENGTH (4) // group (u16), index in group (u8), group size (u8)
+#define LLNET_FEC_MAX_FRAME (1200) // largest frame (header + payload) that is protected
+#define LLNET_FEC_MAX_GROUP (16) // largest group size
+#define LLNET_FEC_DEFAULT_GROUP (4) // group size used until the other side reports
+#define LLNET_FEC_REPORT_GROUPS (8) // groups between loss reports
+#define LLNET_FEC_FLUSH_US (2000) // longest a group is left unfinished before its parity is sent anyway
+
+// Defines the sending side of a FEC stream
+typedef struct LLNetFecEncoder {
+    uint16_t group; // current group
+    uint8_t index; // number of frames in the current group so far
+    uint8_t k; // size of the current group
+    uint8_t next_k; // size of the next group
+    uint32_t parity_len; // length of the longest frame in the current group
+    uint64_t deadline_ns; // when the current group's parity is sent, even if it isn't full (monotonic clock)
+    uint8_t parity[LLNET_FEC_MAX_FRAME]; // XOR of the frames in the current group
+} LLNetFecEncoder_t;
+
+// Defines the receiving side of a FEC stream
+typedef struct LLNetFecDecoder {
+    bool active; // true if a group is being collected
+    uint16_t group; // current group
+    uint8_t k; // size of the current group
+    uint8_t received; // number of frames received in the current group
+    uint32_t mask; // which frames in the current group were received
+    uint32_t acc_len; // length of the longest frame received in the current group
+    uint8_t acc[LLNET_FEC_MAX_FRAME]; // XOR of the frames received in the current group
+
+    // loss tracking
+    uint32_t groups; // number of groups seen
+    uint32_t loss; // smoothed loss rate, in frames per thousand
+    bool report_due; // true when the loss rate should be reported to the other side
+} LLNetFecDecoder_t;
+
+// Defines the FEC state of a connection
+typedef struct LLNetFec {
+    pthread_mutex_t mutex; // guards the encoder (sends come from any thread)
+    pthread_cond_t cond; // signalled when a group is started or the flusher is stopped (monotonic clock)
+    bool stop; // set to stop the flusher
+    pthread_t flusher; // sends the parity of groups left unfinished past their deadline
+    LLNetFecEncoder_t tx;
+    LLNetFecDecoder_t rx; // only used by the UDP listener
+} LLNetFec_t;
+
+/**
+ * Creates the FEC state for a connection
+ *
+ * @return the state, or NULL if a memory request failed
+ */
+LLNetFec_t* fec_init();
+
+/**
+ * Adds a frame to the current group
+ *
+ * @param enc the encoder
+ * @param frame the frame (LLNET header and payload) as it would be sent
+ * @param len the length of the frame, at most LLNET_FEC_MAX_FRAME
+ * @param tag set to the tag to send with the frame
+ * @returns true if the group is complete and the parity frame should be sent
+ */
+bool fec_encode(LLNetFecEncoder_t* enc, const uint8_t* frame, uint32_t len, uint8_t* tag);
+
+/**
+ * Finishes the current group, writing its parity and starting the next group.
+ * A group can be finished early (before it has k frames), the parity then
+ * only covers the frames that were sent.
+ *
+ * @param enc the encoder
+ * @param out the buffer to write the tag and parity to (at least
+ *        LLNET_FEC_TAG_LENGTH + LLNET_FEC_MAX_FRAME bytes)
+ * @returns the number of bytes written
+ */
+uint32_t fec_parity(LLNetFecEncoder_t* enc, uint8_t* out);
+
+/**
+ * Sets the group size used from the next group on
+ *
+ * @param enc the encoder
+ * @param loss the loss rate reported by the other side (frames per thousand)
+ */
+void fec_encoder_adapt(LLNetFecEncoder_t* enc, uint32_t loss);
+
+/**
+ * Records a received frame
+ *
+ * @param dec the decoder
+ * @param tag the tag the frame was sent with
+ * @param frame the frame (LLNET header and payload), without the tag
+ * @param len the length of the frame
+ */
+void fec_decode_data(LLNetFecDecoder_t* dec, const uint8_t* tag, const uint8_t* frame, uint32_t len);
+
+/**
+ * Handles a parity frame, rebuilding the missing frame of the group if exactly
+ * one was lost. Groups that were skipped over entirely count as lost.
+ *
+ * @param dec the decoder
+ * @param payload the parity frame's payload (tag and parity)
+ * @param len the length of the payload
+ * @param out the buffer to rebuild the lost frame into (at least LLNET_FEC_MAX_FRAME bytes)
+ * @returns the length of the rebuilt frame, 0 if there was nothing to rebuild,
+ *          or -1 if the parity frame was invalid or too many frames were lost
+ */
+int32_t fec_decode_parity(LLNetFecDecoder_t* dec, const uint8_t* payload, uint32_t len, uint8_t* out);
+
+/**
+ * Cleans up the FEC state for a connection
+ *
+ * @param fec the state to clean up
+ */
+void fec_free(LLNetFec_t* fec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,222 @@
+/**
+ * core/network/keyintern.c
+ *
+ * A process-wide table of interned config keys
+ *
+ * @author agent <agent@local>
+ */
+#define _DEFAULT_SOURCE // needed for strnlen(...)
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "keyintern.h"
+
+#define _INTERN_MIN_SLOTS (256)
+#define _INTERN_CHUNK (1024) // names are kept in chunks so their addresses never move
+#define _INTERN_CHUNKS (INTERN_MAX_KEYS / _INTERN_CHUNK)
+
+// Defines the open-addressed index. Each slot is the key's hash in the top
+// half and its id in the bottom half, so one atomic load reads both; zero is
+// an empty slot.
+typedef struct InternIndex {
+    uint32_t mask; // number of slots, minus one
+    struct InternIndex* retired; // the index this one replaced, kept for readers still using it
+    uint64_t slots[];
+} InternIndex_t;
+
+static pthread_mutex_t intern_mutex = PTHREAD_MUTEX_INITIALIZER;
+static InternIndex_t* intern_index = NULL;
+static const char** intern_names[_INTERN_CHUNKS];
+static uint32_t intern_total = 0;
+static size_t intern_bytes = 0; // name bytes held, guarded by the mutex
+
+/**
+ * Hashes a key (32-bit FNV-1a)
+ *
+ * @param key the key
+ * @param length the length of the key
+ * @returns the hash
+ */
+static uint32_t _intern_hash(const char* key, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i += 1) {
+        hash ^= (uint8_t) key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Gets the name of an id, without checking it
+ *
+ * @param id the id
+ * @returns the name
+ */
+static const char* _intern_name(uint32_t id) {
+    return intern_names[(id - 1) / _INTERN_CHUNK][(id - 1) % _INTERN_CHUNK];
+}
+
+/**
+ * Looks a key up in an index
+ *
+ * @param index the index (may be NULL)
+ * @param key the key
+ * @param length the length of the key
+ * @param hash the key's hash
+ * @returns the key's id, or INTERN_NONE
+ */
+static uint32_t _intern_lookup(InternIndex_t* index, const char* key, size_t length, uint32_t hash) {
+    if (index == NULL) {
+        return INTERN_NONE;
+    }
+    uint32_t slot = hash & index->mask;
+    while (true) {
+        uint64_t entry = __atomic_load_n(&index->slots[slot], __ATOMIC_ACQUIRE);
+        if (entry == 0) {
+            return INTERN_NONE;
+        }
+        uint32_t id = (uint32_t) entry;
+        if ((uint32_t) (entry >> 32) == hash) {
+            const char* name = _intern_name(id);
+            if (strnlen(name, length + 1) == length && memcmp(name, key, length) == 0) {
+                return id;
+            }
+        }
+        slot = (slot + 1) & index->mask;
+    }
+}
+
+/**
+ * Puts an id in an index, the caller holds the mutex
+ *
+ * @param index the index
+ * @param hash the key's hash
+ * @param id the key's id
+ */
+static void _intern_place(InternIndex_t* index, uint32_t hash, uint32_t id) {
+    uint32_t slot = hash & index->mask;
+    while (index->slots[slot] != 0) {
+        slot = (slot + 1) & index->mask;
+    }
+    __atomic_store_n(&index->slots[slot], ((uint64_t) hash << 32) | id, __ATOMIC_RELEASE);
+}
+
+/**
+ * Makes sure the index has room for one more key (keeping it at most half
+ * full), the caller holds the mutex
+ *
+ * @returns false if a bigger index couldn't be allocated
+ */
+static bool _intern_reserve() {
+    InternIndex_t* old = intern_index;
+    uint32_t slots = (old == NULL)? _INTERN_MIN_SLOTS : old->mask + 1;
+    if (old != NULL && (intern_total + 1) * 2 <= slots) {
+        return true;
+    }
+    if (old != NULL) {
+        slots *= 2;
+    }
+
+    InternIndex_t* fresh = calloc(1, sizeof(InternIndex_t) + (sizeof(uint64_t) * slots));
+    if (fresh == NULL) {
+        return false;
+    }
+    fresh->mask = slots - 1;
+    fresh->retired = old;
+    for (uint32_t id = 1; id <= intern_total; id += 1) {
+        const char* name = _intern_name(id);
+        _intern_place(fresh, _intern_hash(name, strlen(name)), id);
+    }
+    __atomic_store_n(&intern_index, fresh, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @inherit
+ */
+uint32_t intern_find(const char* key, size_t length) {
+    InternIndex_t* index = __atomic_load_n(&intern_index, __ATOMIC_ACQUIRE);
+    return _intern_lookup(index, key, length, _intern_hash(key, length));
+}
+
+/**
+ * @inherit
+ */
+uint32_t intern_key(const char* key, size_t length) {
+    if (length > INTERN_MAX_KEY_LENGTH) {
+        return INTERN_NONE;
+    }
+
+    // Most keys have been seen before, so try without the lock first
+    uint32_t hash = _intern_hash(key, length);
+    uint32_t id = _intern_lookup(__atomic_load_n(&intern_index, __ATOMIC_ACQUIRE), key, length, hash);
+    if (id != INTERN_NONE) {
+        return id;
+    }
+
+    pthread_mutex_lock(&intern_mutex);
+
+    // Someone else may have added it while we waited
+    id = _intern_lookup(intern_index, key, length, hash);
+    if (id != INTERN_NONE || intern_total == INTERN_MAX_KEYS || intern_bytes + length + 1 > INTERN_MAX_BYTES ||
+            !_intern_reserve()) {
+        pthread_mutex_unlock(&intern_mutex);
+        return id;
+    }
+
+    // Copy the key, and make room for its name if this starts a new chunk
+    uint32_t chunk = intern_total / _INTERN_CHUNK;
+    char* name = malloc(length + 1);
+    if (intern_names[chunk] == NULL) {
+        intern_names[chunk] = calloc(_INTERN_CHUNK, sizeof(const char*));
+    }
+    if (name == NULL || intern_names[chunk] == NULL) {
+        free(name);
+        pthread_mutex_unlock(&intern_mutex);
+        return INTERN_NONE;
+    }
+    memcpy(name, key, length);
+    name[length] = '\0';
+
+    // The name goes in before the id is published, so readers always find it
+    id = intern_total + 1;
+    intern_bytes += length + 1;
+    intern_names[chunk][intern_total % _INTERN_CHUNK] = name;
+    __atomic_store_n(&intern_total, id, __ATOMIC_RELEASE);
+    _intern_place(intern_index, hash, id);
+
+    pthread_mutex_unlock(&intern_mutex);
+    return id;
+}
+
+/**
+ * @inherit
+ */
+const char* intern_name(uint32_t id) {
+    if (id == INTERN_NONE || id > __atomic_load_n(&intern_total, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return _intern_name(id);
+}
+
+/**
+ * @inherit
+ */
+bool intern_owns(const char* key) {
+    size_t length = strnlen(key, INTERN_MAX_KEY_LENGTH + 1);
+    if (length > INTERN_MAX_KEY_LENGTH) {
+        return false;
+    }
+    uint32_t id = intern_find(key, length);
+    return id != INTERN_NONE && intern_name(id) == key;
+}
+
+/**
+ * @inherit
+ */
+uint32_t intern_count() {
+    return __atomic_load_n(&intern_total, __ATOMIC_ACQUIRE);
+}
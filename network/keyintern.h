@@ -0,0 +1,84 @@
+/**
+ * core/network/keyintern.h
+ *
+ * A process-wide table of interned config keys. Each distinct key is copied
+ * once and given a small, stable id; after that, the same key maps to the same
+ * id and the same canonical pointer, so keys can be compared as integers and
+ * decoded pairs don't need their own copy.
+ *
+ * Lookups never take a lock. Adding a key takes a mutex, and the index grows
+ * by publishing a bigger copy, so readers always see a complete table. The
+ * table only grows, so it's capped: keys longer than INTERN_MAX_KEY_LENGTH are
+ * never interned, and once INTERN_MAX_KEYS keys or INTERN_MAX_BYTES of names
+ * are held, nothing more is added. Past that, callers keep their own copy.
+ * Callers should only intern keys from a peer once the packet holding them has
+ * been checked, so a malformed packet can't use up the table.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_KEYINTERN
+#define __CORE_NETWORK_KEYINTERN
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define INTERN_NONE (0) // never a valid id
+#define INTERN_MAX_KEYS (65536)
+#define INTERN_MAX_KEY_LENGTH (128) // longer keys are left to the caller to copy
+#define INTERN_MAX_BYTES (1 << 20) // most name bytes the table holds
+
+/**
+ * Interns a key, adding it if it hasn't been seen before
+ *
+ * @param key the key (doesn't need to be nul-terminated, but can't contain nuls)
+ * @param length the length of the key
+ * @returns the key's id, or INTERN_NONE if the key is too long, the table is full
+ *          (or out of memory)
+ */
+uint32_t intern_key(const char* key, size_t length);
+
+/**
+ * Finds the id of a key without adding it
+ *
+ * @param key the key (doesn't need to be nul-terminated)
+ * @param length the length of the key
+ * @returns the key's id, or INTERN_NONE if it hasn't been interned
+ */
+uint32_t intern_find(const char* key, size_t length);
+
+/**
+ * Gets the canonical copy of an interned key, which lives as long as the
+ * process and must not be changed
+ *
+ * @param id the key's id
+ * @returns the nul-terminated key, or NULL if the id isn't valid
+ */
+const char* intern_name(uint32_t id);
+
+/**
+ * Checks whether a string is the canonical copy of an interned key (rather than
+ * a copy of one), so whoever holds it knows not to free it
+ *
+ * @param key the nul-terminated string
+ * @returns true if it's owned by the table
+ */
+bool intern_owns(const char* key);
+
+/**
+ * Gets the number of keys interned so far
+ *
+ * @returns the number of keys
+ */
+uint32_t intern_count();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
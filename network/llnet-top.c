@@ -0,0 +1,183 @@
+/**
+ * core/network/llnet-top.c
+ *
+ * Live view of the connections in a running process, read from the stats
+ * segment it publishes (see llnet_context_publish_stats). The segment is
+ * attached read-only, so watching never slows the process down.
+ *
+ * usage: llnet-top [-s segment] [-i interval_ms] [-n iterations]
+ *
+ * @author agent <agent@local>
+ */
+#define _DEFAULT_SOURCE // needed for getopt(...) and clock_gettime(...)
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "statshm.h"
+
+#define _DEFAULT_INTERVAL_MS (1000)
+
+/**
+ * Gets the current monotonic time
+ *
+ * @returns the time in nanoseconds
+ */
+static uint64_t _now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * Finds a connection in the last snapshot
+ *
+ * @param prev the last snapshot
+ * @param num_prev the number of slots in it
+ * @param id the connection to find
+ * @returns the slot, or NULL if the connection is new
+ */
+static LLNetStatsSlot_t* _find(LLNetStatsSlot_t* prev, uint32_t num_prev, uint32_t id) {
+    for (uint32_t i = 0; i < num_prev; i += 1) {
+        if (prev[i].connection_id == id) {
+            return &prev[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Gets a rate from two readings of a counter
+ *
+ * @param now the current reading
+ * @param then the last reading
+ * @param elapsed_ns the time between them
+ * @returns the rate, per second
+ */
+static double _rate(uint64_t now, uint64_t then, uint64_t elapsed_ns) {
+    if (elapsed_ns == 0 || now < then) {
+        return 0;
+    }
+    return (double) (now - then) * 1e9 / elapsed_ns;
+}
+
+/**
+ * Draws one screen
+ *
+ * @param shm the segment
+ * @param cur the current snapshot
+ * @param num_cur the number of slots in it
+ * @param prev the last snapshot
+ * @param num_prev the number of slots in it
+ * @param elapsed_ns the time between the snapshots
+ */
+static void _draw(LLNetStatsShm_t* shm, LLNetStatsSlot_t* cur, uint32_t num_cur, LLNetStatsSlot_t* prev,
+    uint32_t num_prev, uint64_t elapsed_ns) {
+    uint64_t updated = __atomic_load_n(&shm->header->updated_ns, __ATOMIC_RELAXED);
+    uint64_t now = _now_ns();
+    printf("\033[H\033[2J"); // home and clear
+    printf("llnet-top  %s  pid %lu  connections %u  updated %.1f ms ago\n\n", shm->name,
+        (unsigned long) shm->header->pid, num_cur, (updated != 0 && now > updated)? (now - updated) / 1e6 : 0.0);
+    printf("%-10s %-21s %9s %9s %9s %9s %7s %8s %8s %7s %9s\n", "id", "peer", "rx pkt/s", "tx pkt/s", "rx kB/s",
+        "tx kB/s", "tcp inq", "tcp outq", "rtt ms", "retrans", "drops");
+
+    for (uint32_t i = 0; i < num_cur; i += 1) {
+        LLNetStatsSlot_t* c = &cur[i];
+        LLNetStatsSlot_t* p = _find(prev, num_prev, c->connection_id);
+        LLNetStats_t* pst = (p != NULL)? &p->stats : &c->stats;
+
+        char peer[32];
+        struct in_addr addr;
+        addr.s_addr = c->peer_addr;
+        snprintf(peer, sizeof(peer), "%s:%u", inet_ntoa(addr), ntohs(c->peer_port));
+        uint64_t drops = c->stats.rx_dropped_invalid + c->stats.rx_dropped_ratelimit + c->stats.rx_dropped_kernel;
+
+        printf("0x%08x %-21s %9.0f %9.0f %9.1f %9.1f %7lu %8lu %8.2f %7lu %9lu\n", c->connection_id, peer,
+            _rate(c->stats.rx_packets, pst->rx_packets, elapsed_ns),
+            _rate(c->stats.tx_packets, pst->tx_packets, elapsed_ns),
+            _rate(c->stats.rx_bytes, pst->rx_bytes, elapsed_ns) / 1e3,
+            _rate(c->stats.tx_bytes, pst->tx_bytes, elapsed_ns) / 1e3,
+            (unsigned long) c->sockets.tcp_rx_queued, (unsigned long) c->sockets.tcp_tx_queued,
+            c->sockets.tcp_rtt_us / 1e3, (unsigned long) c->sockets.tcp_retransmits, (unsigned long) drops);
+    }
+    fflush(stdout);
+}
+
+/**
+ * Takes a snapshot of every slot in use
+ *
+ * @param shm the segment
+ * @param out where to copy the slots (capacity entries)
+ * @returns the number of slots copied
+ */
+static uint32_t _snapshot(LLNetStatsShm_t* shm, LLNetStatsSlot_t* out) {
+    uint32_t count = 0;
+    uint32_t num_slots = __atomic_load_n(&shm->header->num_slots, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < num_slots; i += 1) {
+        if (statshm_read(shm, i, &out[count])) {
+            count += 1;
+        }
+    }
+    return count;
+}
+
+/**
+ * Entry point to the program
+ */
+int main(int argc, char** argv) {
+    const char* name = LLNET_STATSHM_DEFAULT_NAME;
+    uint32_t interval_ms = _DEFAULT_INTERVAL_MS;
+    int64_t iterations = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:i:n:h")) != -1) {
+        switch (opt) {
+            case 's':
+                name = optarg;
+                break;
+            case 'i':
+                interval_ms = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                iterations = strtol(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-s segment] [-i interval_ms] [-n iterations]\n", argv[0]);
+                return (opt == 'h')? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    LLNetStatsShm_t* shm = statshm_open(name);
+    if (shm == NULL) {
+        fprintf(stderr, "%s: could not attach to %s (is the process publishing stats?)\n", argv[0], name);
+        return EXIT_FAILURE;
+    }
+
+    // Rates come from the difference between two snapshots
+    uint32_t capacity = shm->header->capacity;
+    LLNetStatsSlot_t* cur = calloc(capacity, sizeof(LLNetStatsSlot_t));
+    LLNetStatsSlot_t* prev = calloc(capacity, sizeof(LLNetStatsSlot_t));
+    uint32_t num_prev = _snapshot(shm, prev);
+    uint64_t prev_ns = _now_ns();
+    for (int64_t i = 0; iterations < 0 || i < iterations; i += 1) {
+        usleep(interval_ms * 1000);
+        uint32_t num_cur = _snapshot(shm, cur);
+        uint64_t now = _now_ns();
+        _draw(shm, cur, num_cur, prev, num_prev, now - prev_ns);
+
+        LLNetStatsSlot_t* tmp = prev;
+        prev = cur;
+        cur = tmp;
+        num_prev = num_cur;
+        prev_ns = now;
+    }
+
+    free(cur);
+    free(prev);
+    statshm_close(shm);
+    return EXIT_SUCCESS;
+}
@@ -5,7 +5,7 @@
  *
  * @author Connor Henley, @thatging3rkid
  */
-#define _DEFAULT_SOURCE // needed for hstrerror(...), clock_gettime(...)
+#define _GNU_SOURCE // needed for clock_gettime(...), pthread_attr_setaffinity_np(...)
  
 // standards
 #include <stdio.h>
@@ -26,28 +26,70 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <linux/sock_diag.h>
 
 // threading
 #include <pthread.h>
 
+// event notification
+#include <sys/eventfd.h>
+
 // errno
 #include <errno.h>
 
 // local things
 #include "lowlevel.h"
 #include "constants.h"
+#include "compress.h"
+#include "ratelimit.h"
+#include "fec.h"
+#include "reliable.h"
+#include "sockfilter.h"
+#include "statshm.h"
 #include "../utils/bounds.h"
 #include "../utils/dbgprint.h"
 #include "../collections/arraylist.h"
+#include "../collections/queue.h"
 
 #define _LLNET_UDP_BUFFER_LENGTH (65535)
+#define _LLNET_COMPRESS_HEADER_LENGTH (4) // compressed payloads start with the original length
+#define _LLNET_PROTOCOLS (2) // number of NetworkProtocol_t values
+#define _LLNET_UDP_MAX_DATAGRAM (65507) // largest UDP payload over IPv4
+
+/**
+ * Adds to one of a worker's statistics counters (safe from any thread)
+ *
+ * @macro
+ * @param w the worker connection
+ * @param field the LLNetStats_t field to add to
+ * @param n the amount to add
+ */
+#define _llnet_stat_add(w, field, n) __atomic_fetch_add(&(w)->stats.field, (n), __ATOMIC_RELAXED)
+
+/**
+ * Gets the capabilities the other side of a connection advertised (safe from
+ * any thread, the TCP listener updates them whenever a hello arrives)
+ *
+ * @macro
+ * @param w the worker connection
+ */
+#define _llnet_peer_caps(w) __atomic_load_n(&(w)->peer_caps, __ATOMIC_RELAXED)
+
+// Control frame opcodes (first byte of a LLNET_TYPE_CONTROL payload)
+#define _LLNET_CTRL_HELLO (0x01) // advertises capabilities, followed by 3 reserved bytes and the caps word
+#define _LLNET_CTRL_HELLO_LENGTH (8)
+#define _LLNET_CTRL_FEC_REPORT (0x02) // reports FEC loss, followed by 3 reserved bytes and the loss rate (per thousand)
+#define _LLNET_CTRL_FEC_REPORT_LENGTH (8)
 
-static ArrayList_t* connections = NULL;
-static int32_t llnet_time_offset = 0; // this value is added on a send, subtracted on a recieve
-static uint32_t next_connection_id = 1; // this value will be used as the next connection id
-static pthread_mutex_t next_connection_id_mutex = PTHREAD_MUTEX_INITIALIZER; // mutex for the next connection ID
+static LLNetContext_t* default_context = NULL; // context used by the context-less API
+static pthread_once_t default_context_once = PTHREAD_ONCE_INIT; // guards creation of the default context
 
 // Argument structure for the network send function/thread
 typedef struct {
@@ -56,544 +98,2931 @@ typedef struct {
     IntermediateTLV_t* packet;
     uint32_t* rc;
     bool* finished;
+    LLNetSendHandle_t* handle; // completion handle for asynchronous sends, or NULL
 } SendThreadArgs;
 
+static SendThreadArgs sender_stop; // enqueued to tell a connection's sender thread to stop
+
+static void _llnet_registry_remove(WorkerConnection_t* worker);
+static void _llnet_reclaim(WorkerConnection_t* worker);
+static void _llnet_deliver(WorkerConnection_t* worker, IntermediateTLV_t* tlv, bool compressed);
+static void _llnet_frame_deliver(WorkerConnection_t* worker, uint8_t* frame, uint32_t len, bool count);
+
 /**
- * Sends a packet out over the network
+ * Marks an asynchronous send as finished, waking any waiters and posting the
+ * handle to its completion queue
  *
- * @param _targs the argument structure
- * @returns NULL
- * @note function will always clean up the argument structure
+ * @param handle the send that finished
+ * @param rc the result of the send
  */
-static void* _llnet_pckt_send(void* _targs) {
-    // Convert to the correct structure type
-    SendThreadArgs* targs = (SendThreadArgs*) _targs;
-
-    // Get a buffer to copy the packet into
-    uint32_t buf_len = targs->packet->length + LLNET_HEADER_LENGTH;
-    uint8_t* buf = malloc(buf_len);
-
-    // Generate the first word
-    uint32_t pckt_len_net = htonl(targs->packet->length);
-    memcpy(buf, &pckt_len_net, sizeof(uint32_t));
-    buf[0] = targs->packet->type;
+static void _llnet_send_complete(LLNetSendHandle_t* handle, uint32_t rc) {
+    // Post to the completion queue before marking it finished, once a waiter sees the send finish it
+    // may free the handle. The lock is held throughout so a harvester can wait for us to let go of it.
+    pthread_mutex_lock(&handle->mutex);
+    handle->rc = rc;
+    LLNetCompletionQueue_t* cq = handle->cq;
+    if (cq != NULL) {
+        queue_enqueue(cq->completed, handle);
+        uint64_t one = 1;
+        if (write(cq->event_fd, &one, sizeof(uint64_t)) < 0) {
+            dbg_warning("could not signal completion queue: %s\n", strerror(errno));
+        }
+    }
+    handle->finished = true;
+    pthread_cond_broadcast(&handle->cond);
+    pthread_mutex_unlock(&handle->mutex);
+}
 
-    // Get the timestamp and convert to milliseconds
+/**
+ * Gets the current monotonic time
+ *
+ * @returns the time in nanoseconds
+ */
+static uint64_t _llnet_now_ns() {
     struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    targs->packet->timestamp = (uint32_t) ((ts.tv_sec * 1000) + round(ts.tv_nsec / 1.0e6) + llnet_time_offset);
-    uint32_t timestamp = htonl(targs->packet->timestamp);
-    memcpy((buf + 4), &timestamp, sizeof(uint32_t));
-
-    // Copy the remaining data
-    memcpy((buf + LLNET_HEADER_LENGTH), targs->packet->data, targs->packet->length);
-
-    int err; // save errors
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
 
-    // Handle the send based on the protocol
-    if (targs->proto == np_TCP) {
-        // Send the data using TCP
-        err = write(targs->connection->tcp_fd, buf, buf_len);
-    } else if (targs->proto == np_UDP) {
-        // Send the data using UDP
-        err = sendto(targs->connection->udp_fd, buf, buf_len, 0,
-            (struct sockaddr*) &targs->connection->other_addr, sizeof(struct sockaddr_in));
+/**
+ * Finishes the current FEC group and sends its parity frame. The FEC mutex must
+ * be held.
+ *
+ * @param worker the connection to send on
+ * @param timestamp the timestamp to send the parity frame with (network order)
+ */
+static void _llnet_send_fec_parity(WorkerConnection_t* worker, const uint8_t* timestamp) {
+    uint8_t pbuf[LLNET_HEADER_LENGTH + LLNET_FEC_TAG_LENGTH + LLNET_FEC_MAX_FRAME];
+    uint32_t plen = fec_parity(&worker->fec->tx, pbuf + LLNET_HEADER_LENGTH);
+    uint32_t pword = htonl((LLNET_TYPE_FEC << 24) | plen);
+    memcpy(pbuf, &pword, sizeof(uint32_t));
+    memcpy(pbuf + 4, timestamp, sizeof(uint32_t));
+    if (sendto(worker->udp_fd, pbuf, plen + LLNET_HEADER_LENGTH, 0,
+            (struct sockaddr*) &worker->other_addr, sizeof(struct sockaddr_in)) < 0) {
+        dbg_warning("could not send FEC parity: %s\n", strerror(errno));
     }
+}
 
-    // Store the error
-    if (targs->rc != NULL) {
-        *(targs->rc) = (err < 0)? err : 0;
+/**
+ * Sends a frame over UDP as part of a FEC group, followed by the group's
+ * parity frame if the frame completes the group
+ *
+ * @param worker the connection to send on
+ * @param buf the frame (header and payload)
+ * @param buf_len the length of the frame
+ * @returns the result of sending the frame
+ */
+static int _llnet_send_fec(WorkerConnection_t* worker, uint8_t* buf, uint32_t buf_len) {
+    LLNetFec_t* fec = worker->fec;
+    pthread_mutex_lock(&fec->mutex);
+
+    // The first frame in a group starts the clock on its parity
+    if (fec->tx.index == 0) {
+        fec->tx.deadline_ns = _llnet_now_ns() + (LLNET_FEC_FLUSH_US * 1000ULL);
+        pthread_cond_signal(&fec->cond);
     }
-
-    // Mark that we're finished
-    if (targs->finished != NULL) {
-        *(targs->finished) = true;
+    uint8_t tag[LLNET_FEC_TAG_LENGTH];
+    bool complete = fec_encode(&fec->tx, buf, buf_len, tag);
+
+    // The tag goes between the header and the payload, and is counted in the length
+    uint32_t word;
+    memcpy(&word, buf, sizeof(uint32_t));
+    word = ntohl(word);
+    uint32_t header[2];
+    header[0] = htonl((word & ~LLNET_LENGTH_MASK) | LLNET_FLAG_FEC | ((word & LLNET_LENGTH_MASK) + LLNET_FEC_TAG_LENGTH));
+    memcpy(&header[1], buf + 4, sizeof(uint32_t));
+
+    struct iovec iov[3];
+    iov[0].iov_base = header;
+    iov[0].iov_len = LLNET_HEADER_LENGTH;
+    iov[1].iov_base = tag;
+    iov[1].iov_len = LLNET_FEC_TAG_LENGTH;
+    iov[2].iov_base = buf + LLNET_HEADER_LENGTH;
+    iov[2].iov_len = buf_len - LLNET_HEADER_LENGTH;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_name = &worker->other_addr;
+    msg.msg_namelen = sizeof(struct sockaddr_in);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+    int err = sendmsg(worker->udp_fd, &msg, 0);
+
+    // Close off the group with its parity (which shares the frame's timestamp)
+    if (complete) {
+        _llnet_send_fec_parity(worker, buf + 4);
     }
 
-    // Clean up
-    free(buf);
-    free(targs);
-    targs = NULL;
-
-    return NULL;
+    pthread_mutex_unlock(&fec->mutex);
+    return err;
 }
 
 /**
- * Listens for incoming TCP data, decodes the data, then hands them to the handler
+ * Sends the parity of groups that are left unfinished past their deadline, so
+ * the last frames before a pause are protected too
  *
- * @param _targs the connection to listen on
+ * @param _targs the connection to send parity for
  * @returns NULL
  */
-static void* _llnet_listener_tcp(void* _targs) {
+static void* _llnet_fec_flusher(void* _targs) {
     WorkerConnection_t* worker = (WorkerConnection_t*) _targs;
-    worker->tcp_status = ls_OKAY;
+    LLNetFec_t* fec = worker->fec;
 
-    // Enable deferred cancelling (this is default, but expected behavior)
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
-
-    while (true) {
-        // Get some memory to store the data
-        IntermediateTLV_t* tlv = malloc(sizeof(IntermediateTLV_t));
+    pthread_mutex_lock(&fec->mutex);
+    while (!fec->stop) {
+        // Wait for a group to start
+        if (fec->tx.index == 0) {
+            pthread_cond_wait(&fec->cond, &fec->mutex);
+            continue;
+        }
+        uint64_t now = _llnet_now_ns();
+        if (now < fec->tx.deadline_ns) {
+            struct timespec ts;
+            ts.tv_sec = fec->tx.deadline_ns / 1000000000ULL;
+            ts.tv_nsec = fec->tx.deadline_ns % 1000000000ULL;
+            pthread_cond_timedwait(&fec->cond, &fec->mutex, &ts);
+            continue;
+        }
 
-        // Read the first word of the header
-        uint32_t header;
-        int nread = read(worker->tcp_fd, &header, sizeof(uint32_t));
+        // Close off the group early, the parity is stamped with the current time
+        uint32_t timestamp = htonl(llnet_context_timestamp(worker->context));
+        _llnet_send_fec_parity(worker, (uint8_t*) &timestamp);
+    }
+    pthread_mutex_unlock(&fec->mutex);
 
-        // Handle errors from the read
-        if (nread <= 0) {
-            // Handle an unexpected error
-            if (nread < 0) {
-                dbg_info("error reading TCP socket: %s\n", strerror(errno));
-            }
+    return NULL;
+}
 
-            // Generic clean-up
-            free(tlv);
-            break;
-        }
+/**
+ * Creates a worker's FEC state and starts its flusher, if it doesn't have them
+ *
+ * @param worker the connection to protect frames on
+ */
+static void _llnet_fec_start(WorkerConnection_t* worker) {
+    if (worker->fec != NULL) {
+        return;
+    }
+    LLNetFec_t* fec = fec_init();
+    if (fec == NULL) {
+        dbg_warning("could not set up FEC\n");
+        return;
+    }
+    worker->fec = fec;
+    pthread_create(&fec->flusher, NULL, &_llnet_fec_flusher, (void*) worker);
+}
 
-        // Start the decode
-        header = ntohl(header);
-        tlv->type = (header & 0xff000000) >> 24;
-        tlv->length = header & 0xffffff;
+/**
+ * Stops a worker's FEC flusher (the FEC state itself is left for fec_free)
+ *
+ * @param worker the connection to stop flushing for
+ */
+static void _llnet_fec_stop(WorkerConnection_t* worker) {
+    LLNetFec_t* fec = worker->fec;
+    if (fec == NULL) {
+        return;
+    }
 
-        // Read the timestamp
-        uint32_t timestamp;
-        read(worker->tcp_fd, &timestamp, sizeof(uint32_t)); // assume no errors
-        tlv->timestamp = ntohl(timestamp);
+    pthread_mutex_lock(&fec->mutex);
+    fec->stop = true;
+    pthread_cond_signal(&fec->cond);
+    pthread_mutex_unlock(&fec->mutex);
+    pthread_join(fec->flusher, NULL);
+}
 
-        // Read the rest of the data into the packet
-        tlv->data = malloc(tlv->length);
-        int32_t tread = 0;
-        while (tlv->length > tread) {
-            // Read all the data from the OS buffer
-            nread = read(worker->tcp_fd, tlv->data, (tlv->length - tread));
-
-            // Handle errors from the read
-            if (nread <= 0) {
-                // Handle an unexpected error
-                if (nread < 0) {
-                    dbg_info("error reading TCP socket: %s\n", strerror(errno));
-                }
+/**
+ * Writes all of a buffer to a blocking socket
+ *
+ * @param fd the socket
+ * @param buf the buffer
+ * @param buf_len the length of the buffer
+ * @returns the length written, or -1 on error
+ */
+static int _llnet_write_full(int fd, const uint8_t* buf, uint32_t buf_len) {
+    uint32_t done = 0;
+    while (done < buf_len) {
+        ssize_t err = send(fd, buf + done, buf_len - done, MSG_NOSIGNAL); // a lost peer is an error, not a signal
+        if (err < 0 && errno == EINTR) {
+            continue;
+        }
+        if (err < 0) {
+            return -1;
+        }
+        done += err;
+    }
+    return (int) done;
+}
 
-                // Generic clean-up
-                free(tlv->data);
-                free(tlv);
-                break;
-            } else {
-                // Normal case, mark the data read
-                tread += nread;
-            }
+/**
+ * Finishes a frame a non-blocking write only sent part of, waiting a little for
+ * room in the socket's buffer
+ *
+ * @param fd the socket
+ * @param buf the rest of the frame
+ * @param buf_len the length of the rest of the frame
+ * @param timeout_ms the longest to wait
+ * @returns zero if it was finished, -1 if not
+ */
+static int _llnet_finish_write(int fd, const uint8_t* buf, uint32_t buf_len, uint32_t timeout_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t deadline = ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000) + timeout_ms;
+    while (buf_len > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t now = ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        if (now > deadline || poll(&pfd, 1, (int) (deadline - now)) <= 0) {
+            return -1;
+        }
+        ssize_t err = send(fd, buf, buf_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (err < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            return -1;
         }
+        if (err > 0) {
+            buf += err;
+            buf_len -= err;
+        }
+    }
+    return 0;
+}
 
-        // Call the handler
-        worker->on_packet(worker->connection_id, tlv);
+/**
+ * Writes an encoded frame to the socket for the given protocol
+ *
+ * @param worker the connection to send on
+ * @param proto the protocol to send with
+ * @param buf the frame (header and payload)
+ * @param buf_len the length of the frame
+ * @returns the result of the write
+ */
+static int _llnet_write(WorkerConnection_t* worker, NetworkProtocol_t proto, uint8_t* buf, uint32_t buf_len) {
+    int err = -1;
+
+    // Handle the send based on the protocol
+    if (proto == np_TCP) {
+        // Send the data using TCP, all of it before anyone else writes
+        pthread_mutex_lock(&worker->tcp_write_mutex);
+        err = _llnet_write_full(worker->tcp_fd, buf, buf_len);
+        pthread_mutex_unlock(&worker->tcp_write_mutex);
+    } else if (proto == np_UDP) {
+        // Protect small frames with FEC if both sides agreed to it
+        if (worker->fec != NULL && (_llnet_peer_caps(worker) & llcap_FEC) &&
+                buf[0] != LLNET_TYPE_CONTROL && buf_len <= LLNET_FEC_MAX_FRAME) {
+            err = _llnet_send_fec(worker, buf, buf_len);
+        } else {
+            // Send the data using UDP
+            err = sendto(worker->udp_fd, buf, buf_len, 0,
+                (struct sockaddr*) &worker->other_addr, sizeof(struct sockaddr_in));
+        }
     }
+    return err;
+}
 
-    worker->tcp_status = ls_DISCONNECTED;
-    return NULL;
+/**
+ * Checks that a payload can be described by a frame header. Longer payloads
+ * would run into the flag bits of the length field, so they can't be sent.
+ *
+ * @param length the length of the payload
+ * @returns true if it can be sent
+ */
+static bool _llnet_length_ok(uint32_t length) {
+    if (length > LLNET_LENGTH_MASK) {
+        dbg_error("packet too large to send (length=%u, max=%u)\n", length, LLNET_LENGTH_MASK);
+        return false;
+    }
+    return true;
 }
 
 /**
- * Listens for incoming UDP data, decodes the data, the hands them to the handler
+ * Sends the bundle waiting for a protocol, if there is one. The bundler's
+ * mutex must be held.
  *
- * @param _targs the connection to listen to
- * @returns NULL
+ * @param worker the connection to send on
+ * @param proto the protocol of the bundle to send
+ * @returns the result of the write (zero if there was nothing to send)
  */
-static void* _llnet_listener_udp(void* _targs) {
-    WorkerConnection_t* worker = (WorkerConnection_t*) _targs;
-    worker->udp_status = ls_OKAY;
-    uint8_t* buf = malloc(_LLNET_UDP_BUFFER_LENGTH);
+static int _llnet_bundle_flush(WorkerConnection_t* worker, NetworkProtocol_t proto) {
+    LLNetBundler_t* bundler = worker->bundler;
+    uint32_t len = bundler->pending_len[proto];
+    if (len <= LLNET_HEADER_LENGTH) {
+        return 0;
+    }
 
-    // Enable deferred cancelling (this is default, but expected behavior)
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+    // The bundle takes the first frame's timestamp
+    uint8_t* buf = bundler->pending[proto];
+    uint32_t word = htonl((LLNET_TYPE_BUNDLE << 24) | (len - LLNET_HEADER_LENGTH));
+    memcpy(buf, &word, sizeof(uint32_t));
+    memcpy(buf + 4, buf + LLNET_HEADER_LENGTH + 4, sizeof(uint32_t));
+
+    int err = _llnet_write(worker, proto, buf, len);
+    if (err >= 0) {
+        _llnet_stat_add(worker, tx_bundles, 1);
+        _llnet_stat_add(worker, tx_packets, bundler->pending_frames[proto]);
+        _llnet_stat_add(worker, tx_bytes, len);
+    }
+    bundler->pending_len[proto] = LLNET_HEADER_LENGTH;
+    bundler->pending_frames[proto] = 0;
+    return err;
+}
 
-    while (true) {
-        // Get some memory to store the data
-        IntermediateTLV_t* tlv = malloc(sizeof(IntermediateTLV_t));
+/**
+ * Adds a frame to the bundle waiting for a protocol, sending the bundle first
+ * if the frame doesn't fit
+ *
+ * @param worker the connection to send on
+ * @param proto the protocol to send with
+ * @param buf the frame (header and payload)
+ * @param buf_len the length of the frame
+ * @returns the result of sending the full bundle, or zero if the frame is waiting
+ */
+static int _llnet_bundle_add(WorkerConnection_t* worker, NetworkProtocol_t proto, uint8_t* buf, uint32_t buf_len) {
+    LLNetBundler_t* bundler = worker->bundler;
+    uint32_t max = (proto == np_UDP)? LLNET_BUNDLE_MAX_UDP : LLNET_BUNDLE_MAX_TCP;
+    int err = 0;
+
+    pthread_mutex_lock(&bundler->mutex);
+    if (bundler->pending_len[proto] + buf_len > max) {
+        err = _llnet_bundle_flush(worker, proto);
+    }
 
-        // Get the UDP packet in full
-        int nread = recvfrom(worker->udp_fd, buf, _LLNET_UDP_BUFFER_LENGTH, MSG_WAITALL,
-            (struct sockaddr*) &worker->other_addr, &worker->other_addr_len);
+    // The first frame in a bundle starts the window
+    if (bundler->pending_len[proto] == LLNET_HEADER_LENGTH) {
+        bundler->deadline_ns[proto] = _llnet_now_ns() + ((uint64_t) worker->bundle_window_us * 1000);
+        pthread_cond_signal(&bundler->cond);
+    }
+    memcpy(bundler->pending[proto] + bundler->pending_len[proto], buf, buf_len);
+    bundler->pending_len[proto] += buf_len;
+    bundler->pending_frames[proto] += 1;
+    pthread_mutex_unlock(&bundler->mutex);
 
-        // Handle errors from the read
-        if (nread <= 0) {
-            // Handle an unexpected error
-            if (nread < 0) {
-                dbg_info("error reading UDP socket: %s\n", strerror(errno));
+    return (err < 0)? err : 0;
+}
+
+/**
+ * Sends bundles once their window is up
+ *
+ * @param _targs the connection to send bundles for
+ * @returns NULL
+ */
+static void* _llnet_bundler_thread(void* _targs) {
+    WorkerConnection_t* worker = (WorkerConnection_t*) _targs;
+    LLNetBundler_t* bundler = worker->bundler;
+
+    pthread_mutex_lock(&bundler->mutex);
+    while (!bundler->stop) {
+        // Find the next bundle that's due
+        uint64_t deadline = UINT64_MAX;
+        for (size_t p = 0; p < _LLNET_PROTOCOLS; p += 1) {
+            if (bundler->pending_len[p] > LLNET_HEADER_LENGTH && bundler->deadline_ns[p] < deadline) {
+                deadline = bundler->deadline_ns[p];
             }
+        }
 
-            free(tlv);
-            break;
+        // Wait for something to do
+        if (deadline == UINT64_MAX) {
+            pthread_cond_wait(&bundler->cond, &bundler->mutex);
+            continue;
         }
-        if (nread < LLNET_HEADER_LENGTH) {
-            dbg_warning("invalid header length %u\n", nread);
-            free(tlv);
+        uint64_t now = _llnet_now_ns();
+        if (now < deadline) {
+            struct timespec ts;
+            ts.tv_sec = deadline / 1000000000ULL;
+            ts.tv_nsec = deadline % 1000000000ULL;
+            pthread_cond_timedwait(&bundler->cond, &bundler->mutex, &ts);
             continue;
         }
 
-        // Start the decode
-        uint32_t header = ntohl(((uint32_t*) buf)[0]);
-        tlv->type = (header & 0xff000000) >> 24;
-        tlv->length = (header & 0xffffff);
-
-        // Decode the timestamp
-        uint32_t timestamp = ((uint32_t*) buf)[1];
-        tlv->timestamp = ntohl(timestamp);
-
-        // Save the rest of the data
-        tlv->data = malloc(tlv->length);
-        uint32_t t = tlv->length; // trick gcc that this isn't a bit-field
-        memcpy(tlv->data, (buf + LLNET_HEADER_LENGTH), min(t, (uint32_t) (nread - LLNET_HEADER_LENGTH)));
+        // Send everything that's due
+        for (size_t p = 0; p < _LLNET_PROTOCOLS; p += 1) {
+            if (bundler->deadline_ns[p] <= now) {
+                _llnet_bundle_flush(worker, (NetworkProtocol_t) p);
+            }
+        }
+    }
 
-        // Call the handler
-        worker->on_packet(worker->connection_id, tlv);
+    // Don't leave anything behind
+    for (size_t p = 0; p < _LLNET_PROTOCOLS; p += 1) {
+        _llnet_bundle_flush(worker, (NetworkProtocol_t) p);
     }
+    pthread_mutex_unlock(&bundler->mutex);
 
-    worker->udp_status = ls_DISCONNECTED;
-    free(buf);
     return NULL;
 }
 
 /**
- * Accepts incoming connections over TCP, creates the necessary data structures
- * for the connection, and start the listener threads.
+ * Creates a worker's bundler and starts its thread, if it doesn't have one
  *
- * @param _targs the connection to use
- * @returns NULL
+ * @param worker the connection to bundle frames for
  */
-static void* _llnet_accepter_thread(void* _targs) {
-    AccepterConnection_t* accepter = (AccepterConnection_t*) _targs;
+static void _llnet_bundler_start(WorkerConnection_t* worker) {
+    if (worker->bundler != NULL) {
+        return;
+    }
+    LLNetBundler_t* bundler = calloc(1, sizeof(LLNetBundler_t));
+    pthread_mutex_init(&bundler->mutex, NULL);
+
+    // Deadlines are on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&bundler->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    bundler->pending[np_TCP] = malloc(LLNET_BUNDLE_MAX_TCP);
+    bundler->pending[np_UDP] = malloc(LLNET_BUNDLE_MAX_UDP);
+    for (size_t p = 0; p < _LLNET_PROTOCOLS; p += 1) {
+        bundler->pending_len[p] = LLNET_HEADER_LENGTH; // space for the bundle's header
+    }
 
-    // Enable deferred cancelling (this is default, but expected behavior)
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+    worker->bundler = bundler;
+    pthread_create(&bundler->thread, NULL, &_llnet_bundler_thread, (void*) worker);
+}
 
-    // Loop until someone tells us not to
-    while (true) {
-        // Make a data structure
-        WorkerConnection_t* worker = malloc(sizeof(WorkerConnection_t));
-        worker->udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+/**
+ * Stops a worker's bundler and cleans it up
+ *
+ * @param worker the connection to stop bundling for
+ * @param flush true to send any waiting frames, false to throw them away
+ */
+static void _llnet_bundler_stop(WorkerConnection_t* worker, bool flush) {
+    LLNetBundler_t* bundler = worker->bundler;
+    if (bundler == NULL) {
+        return;
+    }
 
-        // Make sure the socket request was successful
-        if (worker->udp_fd < 0) {
-            dbg_error("UDP socket creation failed: %s\n", strerror(errno));
-            close(worker->udp_fd);
-            free(worker);
-            exit(EXIT_FAILURE); // for now, exit on error
+    pthread_mutex_lock(&bundler->mutex);
+    if (!flush) {
+        for (size_t p = 0; p < _LLNET_PROTOCOLS; p += 1) {
+            bundler->pending_len[p] = LLNET_HEADER_LENGTH;
+            bundler->pending_frames[p] = 0;
         }
+    }
+    bundler->stop = true;
+    pthread_cond_signal(&bundler->cond);
+    pthread_mutex_unlock(&bundler->mutex);
+    pthread_join(bundler->thread, NULL);
+
+    pthread_mutex_destroy(&bundler->mutex);
+    pthread_cond_destroy(&bundler->cond);
+    for (size_t p = 0; p < _LLNET_PROTOCOLS; p += 1) {
+        free(bundler->pending[p]);
+    }
+    free(bundler);
+    worker->bundler = NULL;
+}
 
-        // Set the SO_REUSEADDR and SO_REUSEPORT flags (because resource leaks *will* happen)
-        int opt_value = 1;
-        int err = setsockopt(worker->udp_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt_value, sizeof(int));
-        if (err < 0) {
-            dbg_error("could not set socket options: %s\n", strerror(errno));
-            close(worker->udp_fd);
-            free(worker);
-            exit(EXIT_FAILURE);
+/**
+ * Encodes a packet into a frame (header and payload), compressing the payload
+ * if both sides agreed to it. The packet's timestamp is set to the send time.
+ *
+ * @param worker the connection the frame will be sent on
+ * @param packet the packet to encode
+ * @param reserve the number of bytes to leave free before the frame
+ * @param len set to the length of the frame (not including the reserved bytes)
+ * @returns the buffer, with the frame starting after the reserved bytes
+ */
+static uint8_t* _llnet_encode(WorkerConnection_t* worker, IntermediateTLV_t* packet, uint32_t reserve, uint32_t* len) {
+    uint32_t length = packet->length;
+    uint32_t flags = 0;
+
+    // Only compress if both sides agreed to it and it's worth it
+    bool compress = (worker->caps & _llnet_peer_caps(worker) & llcap_COMPRESSION) &&
+        (packet->type != LLNET_TYPE_CONTROL) && (length >= worker->compress_threshold);
+
+    // Get a buffer to copy the packet into (with space for compression if needed)
+    uint32_t buf_len = length + LLNET_HEADER_LENGTH;
+    uint32_t bound = llnet_compress_bound(length);
+    uint8_t* base = malloc(reserve + (compress? (LLNET_HEADER_LENGTH + _LLNET_COMPRESS_HEADER_LENGTH + bound) : buf_len));
+    uint8_t* buf = base + reserve;
+
+    // Try to compress directly into the send buffer, fall back to a plain copy
+    if (compress) {
+        int32_t clen = llnet_compress(packet->data, length,
+            buf + LLNET_HEADER_LENGTH + _LLNET_COMPRESS_HEADER_LENGTH, bound);
+        if (clen > 0 && (uint32_t) clen + _LLNET_COMPRESS_HEADER_LENGTH < length) {
+            uint32_t orig_len_net = htonl(length);
+            memcpy(buf + LLNET_HEADER_LENGTH, &orig_len_net, sizeof(uint32_t));
+            length = clen + _LLNET_COMPRESS_HEADER_LENGTH;
+            buf_len = length + LLNET_HEADER_LENGTH;
+            flags = LLNET_FLAG_COMPRESSED;
+        } else {
+            compress = false;
         }
+    }
+    if (!compress) {
+        memcpy((buf + LLNET_HEADER_LENGTH), packet->data, length);
+    }
 
-        // Fill in everything else
-        worker->on_packet = accepter->on_packet;
-        worker->tcp_status = ls_NOT_STARTED;
-        worker->udp_status = ls_NOT_STARTED;
+    // Generate the first word
+    uint32_t pckt_len_net = htonl(length | flags);
+    memcpy(buf, &pckt_len_net, sizeof(uint32_t));
+    buf[0] = packet->type;
 
-        // Get the connection_id lock, save it's value, increment, and return the lock
-        pthread_mutex_lock(&next_connection_id_mutex);
-        worker->connection_id = next_connection_id;
-        next_connection_id += 1;
-        pthread_mutex_unlock(&next_connection_id_mutex);
+    // Stamp the packet with the send time
+    packet->timestamp = llnet_context_timestamp(worker->context);
+    uint32_t timestamp = htonl(packet->timestamp);
+    memcpy((buf + 4), &timestamp, sizeof(uint32_t));
 
-        // Accept the connection
-        worker->other_addr_len = sizeof(struct sockaddr_in);
-        worker->tcp_fd = accept(accepter->tcp_fd, (struct sockaddr*) &worker->other_addr, &worker->other_addr_len);
+    *len = buf_len;
+    return base;
+}
 
-        // Handle error: unexpected error
-        if (worker->tcp_fd < 0) {
-            dbg_warning("could not accept client: %s\n", strerror(errno));
-            close(worker->udp_fd);
-            free(worker);
-            continue;
+/**
+ * Sends reliable channel messages again when they aren't acknowledged in time
+ *
+ * @param _targs the connection to watch the reliable channel of
+ * @returns NULL
+ */
+static void* _llnet_reliable_thread(void* _targs) {
+    WorkerConnection_t* worker = (WorkerConnection_t*) _targs;
+    LLNetReliable_t* rel = worker->reliable;
+
+    pthread_mutex_lock(&rel->mutex);
+    while (!rel->stop) {
+        // Send everything that's due again
+        uint64_t now = _llnet_now_ns();
+        uint32_t failed = 0;
+        LLNetReliableEntry_t* entry;
+        while ((entry = reliable_next_due(rel, now, &failed)) != NULL) {
+            if (_llnet_write(worker, np_UDP, entry->buf, entry->len) >= 0) {
+                _llnet_stat_add(worker, tx_retransmits, 1);
+            }
+        }
+        if (failed > 0) {
+            dbg_warning("gave up on %u reliable message(s)\n", failed);
+            _llnet_stat_add(worker, tx_reliable_failed, failed);
         }
 
-        // Bind the UDP socket so that the OS knows to give us data
-        err = bind(worker->udp_fd, (struct sockaddr*) &worker->other_addr, sizeof(struct sockaddr_in));
-        if (err < 0) {
-            dbg_warning("bind failed: %s\n", strerror(errno));
-            close(worker->udp_fd);
-            free(worker);
-            continue;
+        // Sleep until the next timer is up, or something new is sent
+        uint64_t deadline = reliable_next_deadline(rel);
+        if (deadline == UINT64_MAX) {
+            pthread_cond_wait(&rel->cond, &rel->mutex);
+        } else {
+            struct timespec ts;
+            ts.tv_sec = deadline / 1000000000ULL;
+            ts.tv_nsec = deadline % 1000000000ULL;
+            pthread_cond_timedwait(&rel->cond, &rel->mutex, &ts);
         }
+    }
+    pthread_mutex_unlock(&rel->mutex);
+
+    return NULL;
+}
+
+/**
+ * Creates a worker's reliable channel and starts its timer thread, if it
+ * doesn't have one
+ *
+ * @param worker the connection to create the channel for
+ */
+static void _llnet_reliable_start(WorkerConnection_t* worker) {
+    if (worker->reliable != NULL) {
+        return;
+    }
+    worker->reliable = reliable_init();
+    pthread_create(&worker->reliable->thread, NULL, &_llnet_reliable_thread, (void*) worker);
+}
+
+/**
+ * Stops a worker's reliable channel and cleans it up. Anything not yet
+ * acknowledged is dropped.
+ *
+ * @param worker the connection to stop the channel for
+ */
+static void _llnet_reliable_stop(WorkerConnection_t* worker) {
+    LLNetReliable_t* rel = worker->reliable;
+    if (rel == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&rel->mutex);
+    rel->stop = true;
+    pthread_cond_signal(&rel->cond);
+    pthread_mutex_unlock(&rel->mutex);
+    pthread_join(rel->thread, NULL);
+
+    reliable_free(rel);
+    worker->reliable = NULL;
+}
+
+/**
+ * Sends an encoded frame, bundling it if both sides agreed to it
+ *
+ * @param worker the connection to send the frame out using
+ * @param proto the protocol to use
+ * @param buf the frame (header and payload), copied if it's bundled
+ * @param buf_len the length of the frame
+ * @returns the result of the write (negative on error)
+ */
+static int _llnet_send_encoded(WorkerConnection_t* worker, NetworkProtocol_t proto, uint8_t* buf, uint32_t buf_len) {
+    int err = -1; // save errors
+
+    // Small frames wait to be bundled if both sides agreed to it (and are counted when the bundle
+    // goes out), anything else has to go out after the frames already waiting
+    uint32_t bundle_max = (proto == np_UDP)? LLNET_BUNDLE_MAX_UDP : LLNET_BUNDLE_MAX_TCP;
+    if (worker->bundler != NULL && (worker->caps & _llnet_peer_caps(worker) & llcap_BUNDLE) &&
+            buf[0] != LLNET_TYPE_CONTROL && buf_len + LLNET_HEADER_LENGTH <= bundle_max) {
+        return _llnet_bundle_add(worker, proto, buf, buf_len);
+    }
+    if (worker->bundler != NULL) {
+        pthread_mutex_lock(&worker->bundler->mutex);
+        _llnet_bundle_flush(worker, proto);
+        pthread_mutex_unlock(&worker->bundler->mutex);
+    }
+    err = _llnet_write(worker, proto, buf, buf_len);
+
+    // Count the packet if it made it out
+    if (err >= 0) {
+        _llnet_stat_add(worker, tx_packets, 1);
+        _llnet_stat_add(worker, tx_bytes, buf_len);
+    }
+    return err;
+}
+
+/**
+ * Sends a packet out over the network
+ *
+ * @param _targs the argument structure
+ * @returns NULL
+ * @note function will always clean up the argument structure
+ */
+static void* _llnet_pckt_send(void* _targs) {
+    // Convert to the correct structure type
+    SendThreadArgs* targs = (SendThreadArgs*) _targs;
+
+    WorkerConnection_t* worker = targs->connection;
+    uint32_t buf_len;
+    uint8_t* buf = _llnet_encode(worker, targs->packet, 0, &buf_len);
+    int err = _llnet_send_encoded(worker, targs->proto, buf, buf_len);
+
+    // Store the error
+    uint32_t rc = (err < 0)? err : 0;
+    if (targs->rc != NULL) {
+        __atomic_store_n(targs->rc, rc, __ATOMIC_RELAXED);
+    }
+
+    // Mark that we're finished (release, so rc is visible to whoever sees this)
+    if (targs->finished != NULL) {
+        __atomic_store_n(targs->finished, true, __ATOMIC_RELEASE);
+    }
+    if (targs->handle != NULL) {
+        _llnet_send_complete(targs->handle, rc);
+    }
+
+    // Clean up
+    free(buf);
+    free(targs);
+    targs = NULL;
+
+    return NULL;
+}
+
+/**
+ * Sends a packet out over the network, then releases the reference that was
+ * taken on the connection for the send
+ *
+ * @param _targs the argument structure
+ * @returns NULL
+ */
+static void* _llnet_pckt_send_held(void* _targs) {
+    WorkerConnection_t* worker = ((SendThreadArgs*) _targs)->connection;
+    _llnet_pckt_send(_targs);
+    llnet_connection_release(worker);
+    return NULL;
+}
+
+/**
+ * Sends queued packets for a connection, one at a time and in order
+ *
+ * @param _targs the connection to send packets for
+ * @returns NULL
+ */
+static void* _llnet_sender_thread(void* _targs) {
+    WorkerConnection_t* worker = (WorkerConnection_t*) _targs;
+
+    while (true) {
+        // Wait for something to send
+        queue_block(worker->send_queue);
+        SendThreadArgs* stargs = queue_dequeue(worker->send_queue);
+        if (stargs == &sender_stop) {
+            break;
+        }
+
+        // Fail the send if the connection is going away
+        if (__atomic_load_n(&worker->sender_drop, __ATOMIC_ACQUIRE)) {
+            _llnet_send_complete(stargs->handle, -1);
+            free(stargs);
+            continue;
+        }
+        _llnet_pckt_send((void*) stargs);
+    }
+
+    return NULL;
+}
+
+/**
+ * Stops a connection's sender thread, if it was started. No more asynchronous
+ * sends are accepted on the connection afterwards.
+ *
+ * @param worker the connection to stop the sender of
+ * @param flush true to send anything still queued, false to fail it
+ */
+static void _llnet_sender_stop(WorkerConnection_t* worker, bool flush) {
+    pthread_mutex_lock(&worker->sender_mutex);
+    worker->sender_closed = true;
+    if (worker->sender_started) {
+        if (!flush) {
+            __atomic_store_n(&worker->sender_drop, true, __ATOMIC_RELEASE);
+        }
+        queue_enqueue(worker->send_queue, &sender_stop);
+        pthread_join(worker->sender_thread, NULL);
+        queue_free(worker->send_queue);
+        worker->send_queue = NULL;
+        worker->sender_started = false;
+    }
+    pthread_mutex_unlock(&worker->sender_mutex);
+}
+
+/**
+ * Sends a control frame advertising this side's capabilities
+ *
+ * @param worker the connection to advertise on
+ * @returns the error code from the send (zero on success)
+ */
+static uint32_t _llnet_send_hello(WorkerConnection_t* worker) {
+    uint8_t data[_LLNET_CTRL_HELLO_LENGTH] = {0};
+    data[0] = _LLNET_CTRL_HELLO;
+    uint32_t caps_net = htonl(worker->caps);
+    memcpy(data + 4, &caps_net, sizeof(uint32_t));
+
+    IntermediateTLV_t pckt;
+    pckt.type = LLNET_TYPE_CONTROL;
+    pckt.length = _LLNET_CTRL_HELLO_LENGTH;
+    pckt.data = data;
+    return llnet_connection_send(worker, np_TCP, &pckt);
+}
+
+/**
+ * Handles a control frame, which is consumed by llnet
+ *
+ * @param worker the connection the frame came in on
+ * @param tlv the control frame (freed by this function)
+ */
+static void _llnet_handle_control(WorkerConnection_t* worker, IntermediateTLV_t* tlv) {
+    if (tlv->length >= _LLNET_CTRL_HELLO_LENGTH && tlv->data[0] == _LLNET_CTRL_HELLO) {
+        uint32_t caps;
+        memcpy(&caps, tlv->data + 4, sizeof(uint32_t));
+        __atomic_store_n(&worker->peer_caps, ntohl(caps), __ATOMIC_RELAXED);
+    } else if (tlv->length >= _LLNET_CTRL_FEC_REPORT_LENGTH && tlv->data[0] == _LLNET_CTRL_FEC_REPORT) {
+        uint32_t loss;
+        memcpy(&loss, tlv->data + 4, sizeof(uint32_t));
+        if (worker->fec != NULL) {
+            pthread_mutex_lock(&worker->fec->mutex);
+            fec_encoder_adapt(&worker->fec->tx, ntohl(loss));
+            pthread_mutex_unlock(&worker->fec->mutex);
+        }
+    } else {
+        dbg_warning("unknown control frame (length=%u)\n", tlv->length);
+    }
+    llnet_packet_free(tlv);
+}
+
+/**
+ * Handles a message on the reliable channel: acknowledgements update the sent
+ * messages, and data is acknowledged and handed up in order
+ *
+ * @param worker the connection the message came in on
+ * @param tlv the message (freed by this function)
+ */
+static void _llnet_handle_reliable(WorkerConnection_t* worker, IntermediateTLV_t* tlv) {
+    LLNetReliable_t* rel = worker->reliable;
+    uint32_t length = tlv->length;
+
+    // Don't get cancelled holding the channel's lock or messages taken off it
+    int cancel_state;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+
+    if (length >= LLNET_RELIABLE_ACK_LENGTH && tlv->data[0] == rk_ACK) {
+        uint32_t words[3];
+        memcpy(words, tlv->data + 4, sizeof(words));
+        uint64_t sack = ((uint64_t) ntohl(words[1]) << 32) | ntohl(words[2]);
+        if (rel != NULL) {
+            pthread_mutex_lock(&rel->mutex);
+            reliable_ack(rel, ntohl(words[0]), sack, _llnet_now_ns());
+            pthread_mutex_unlock(&rel->mutex);
+        }
+    } else if (length >= LLNET_RELIABLE_DATA_HEADER + LLNET_HEADER_LENGTH && tlv->data[0] == rk_DATA) {
+        uint32_t seq;
+        memcpy(&seq, tlv->data + 4, sizeof(uint32_t));
+        seq = ntohl(seq);
+        uint8_t* frame = tlv->data + LLNET_RELIABLE_DATA_HEADER;
+        uint32_t flen = length - LLNET_RELIABLE_DATA_HEADER;
+
+        // Without a channel on this side, there's no order to keep
+        if (rel == NULL) {
+            _llnet_frame_deliver(worker, frame, flen, false);
+            llnet_packet_free(tlv);
+            pthread_setcancelstate(cancel_state, NULL);
+            return;
+        }
+
+        // Take everything that's now in order, and work out the acknowledgement
+        uint8_t* ready[LLNET_RELIABLE_WINDOW];
+        uint32_t ready_len[LLNET_RELIABLE_WINDOW];
+        uint32_t num_ready = 0;
+        uint32_t next_expected;
+        uint64_t sack;
+        pthread_mutex_lock(&rel->mutex);
+        reliable_receive(rel, seq, frame, flen);
+        while (num_ready < LLNET_RELIABLE_WINDOW &&
+                (ready[num_ready] = reliable_pop(rel, &ready_len[num_ready])) != NULL) {
+            num_ready += 1;
+        }
+        reliable_ack_state(rel, &next_expected, &sack);
+        pthread_mutex_unlock(&rel->mutex);
+
+        // Acknowledge every message, even duplicates (the last ACK may have been lost)
+        uint8_t ack[LLNET_HEADER_LENGTH + LLNET_RELIABLE_ACK_LENGTH] = {0};
+        uint32_t words[3] = { htonl(next_expected), htonl(sack >> 32), htonl(sack & 0xffffffff) };
+        uint32_t word = htonl((LLNET_TYPE_RELIABLE << 24) | LLNET_RELIABLE_ACK_LENGTH);
+        memcpy(ack, &word, sizeof(uint32_t));
+        ack[LLNET_HEADER_LENGTH] = rk_ACK;
+        memcpy(ack + LLNET_HEADER_LENGTH + 4, words, sizeof(words));
+        if (_llnet_write(worker, np_UDP, ack, sizeof(ack)) < 0) {
+            dbg_warning("could not send ACK: %s\n", strerror(errno));
+        }
+
+        for (uint32_t i = 0; i < num_ready; i += 1) {
+            _llnet_frame_deliver(worker, ready[i], ready_len[i], false);
+            free(ready[i]);
+        }
+    } else {
+        dbg_warning("invalid reliable message (length=%u)\n", length);
+        _llnet_stat_add(worker, rx_dropped_invalid, 1);
+    }
+
+    llnet_packet_free(tlv);
+    pthread_setcancelstate(cancel_state, NULL);
+}
+
+/**
+ * Charges a received frame against a connection's rate limits
+ *
+ * Bundles aren't charged themselves, each frame inside is charged when the bundle is split,
+ * so a bundled frame costs the same as one sent on its own.
+ *
+ * @param worker the connection the frame came in on
+ * @param type the type of the frame
+ * @return true if the frame should be accepted
+ */
+static bool _llnet_ratelimit_accept(WorkerConnection_t* worker, uint8_t type) {
+    if (worker->limiter == NULL || type == LLNET_TYPE_BUNDLE) {
+        return true;
+    }
+    if (!ratelimit_accept(worker->limiter, type)) {
+        _llnet_stat_add(worker, rx_dropped_ratelimit, 1);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Splits a bundle into its frames and delivers each of them
+ *
+ * @param worker the connection the bundle came in on
+ * @param bundle the bundle (freed by this function)
+ */
+static void _llnet_split_bundle(WorkerConnection_t* worker, IntermediateTLV_t* bundle) {
+    uint32_t length = bundle->length;
+    uint32_t pos = 0;
+    uint32_t count = 0;
+
+    while (pos + LLNET_HEADER_LENGTH <= length) {
+        uint32_t word;
+        uint32_t timestamp;
+        memcpy(&word, bundle->data + pos, sizeof(uint32_t));
+        memcpy(&timestamp, bundle->data + pos + 4, sizeof(uint32_t));
+        word = ntohl(word);
+        uint8_t type = (word & 0xff000000) >> 24;
+        uint32_t flen = word & LLNET_LENGTH_MASK;
+
+        // Bundles can't be nested, and frames can't run off the end
+        if (type == LLNET_TYPE_BUNDLE || flen > length - pos - LLNET_HEADER_LENGTH) {
+            break;
+        }
+        pos += LLNET_HEADER_LENGTH;
+
+        // Each frame is limited on its own type
+        if (!_llnet_ratelimit_accept(worker, type)) {
+            pos += flen;
+            continue;
+        }
+
+        IntermediateTLV_t* tlv = malloc(sizeof(IntermediateTLV_t));
+        tlv->type = type;
+        tlv->length = flen;
+        tlv->timestamp = ntohl(timestamp);
+        tlv->data = malloc(flen);
+        memcpy(tlv->data, bundle->data + pos, flen);
+        pos += flen;
+        count += 1;
+
+        _llnet_deliver(worker, tlv, (word & LLNET_FLAG_COMPRESSED) != 0);
+    }
+
+    if (pos != length) {
+        dbg_warning("invalid bundle (length=%u, decoded=%u)\n", length, pos);
+        _llnet_stat_add(worker, rx_dropped_invalid, 1);
+    }
+
+    // The listener counted the bundle as one packet
+    if (count > 1) {
+        _llnet_stat_add(worker, rx_packets, count - 1);
+    }
+    llnet_packet_free(bundle);
+}
+
+/**
+ * Finishes decoding a packet and hands it to the connection's handler. Control
+ * frames are consumed here, and compressed payloads are expanded.
+ *
+ * @param worker the connection the packet came in on
+ * @param tlv the packet, with the payload as it was sent over the wire
+ * @param compressed true if the compressed flag was set in the header
+ */
+static void _llnet_deliver(WorkerConnection_t* worker, IntermediateTLV_t* tlv, bool compressed) {
+    // Expand compressed payloads
+    if (compressed) {
+        uint32_t orig_len = 0;
+        if (tlv->length >= _LLNET_COMPRESS_HEADER_LENGTH) {
+            memcpy(&orig_len, tlv->data, sizeof(uint32_t));
+            orig_len = ntohl(orig_len);
+        }
+        if (tlv->length < _LLNET_COMPRESS_HEADER_LENGTH || orig_len > LLNET_LENGTH_MASK) {
+            dbg_warning("invalid compressed packet (length=%u)\n", tlv->length);
+            _llnet_stat_add(worker, rx_dropped_invalid, 1);
+            llnet_packet_free(tlv);
+            return;
+        }
+
+        uint8_t* data = malloc(orig_len);
+        int32_t n = llnet_decompress(tlv->data + _LLNET_COMPRESS_HEADER_LENGTH,
+            tlv->length - _LLNET_COMPRESS_HEADER_LENGTH, data, orig_len);
+        if (n < 0 || (uint32_t) n != orig_len) {
+            dbg_warning("could not decompress packet (type=0x%02x)\n", tlv->type);
+            _llnet_stat_add(worker, rx_dropped_invalid, 1);
+            free(data);
+            llnet_packet_free(tlv);
+            return;
+        }
+        free(tlv->data);
+        tlv->data = data;
+        tlv->length = orig_len;
+    }
+
+    // Control frames are for us, not the handler
+    if (tlv->type == LLNET_TYPE_CONTROL) {
+        _llnet_handle_control(worker, tlv);
+        return;
+    }
+
+    // Bundles are split back into the frames they carry
+    if (tlv->type == LLNET_TYPE_BUNDLE) {
+        _llnet_split_bundle(worker, tlv);
+        return;
+    }
+
+    // Reliable channel messages are acknowledged and put back in order
+    if (tlv->type == LLNET_TYPE_RELIABLE) {
+        _llnet_handle_reliable(worker, tlv);
+        return;
+    }
+
+    worker->on_packet(worker->connection_id, tlv);
+}
+
+/**
+ * Reads exactly the requested number of bytes from a stream socket
+ *
+ * @param fd the socket to read from
+ * @param buf the buffer to read into
+ * @param len the number of bytes to read
+ * @returns the number of bytes read, or a value <= 0 on error/disconnect
+ */
+static int _llnet_read_full(int fd, void* buf, uint32_t len) {
+    uint32_t tread = 0;
+    while (tread < len) {
+        int nread = read(fd, ((uint8_t*) buf) + tread, len - tread);
+        if (nread <= 0) {
+            return nread;
+        }
+        tread += nread;
+    }
+    return tread;
+}
+
+/**
+ * Reads and throws away the given number of bytes from a stream socket
+ *
+ * @param fd the socket to read from
+ * @param len the number of bytes to throw away
+ * @returns the number of bytes read, or a value <= 0 on error/disconnect
+ */
+static int _llnet_discard(int fd, uint32_t len) {
+    uint8_t scratch[512];
+    uint32_t tread = 0;
+    while (tread < len) {
+        int nread = _llnet_read_full(fd, scratch, min(len - tread, (uint32_t) sizeof(scratch)));
+        if (nread <= 0) {
+            return nread;
+        }
+        tread += nread;
+    }
+    return tread;
+}
+
+/**
+ * Listens for incoming TCP data, decodes the data, then hands them to the handler
+ *
+ * @param _targs the connection to listen on
+ * @returns NULL
+ */
+static void* _llnet_listener_tcp(void* _targs) {
+    WorkerConnection_t* worker = (WorkerConnection_t*) _targs;
+    worker->tcp_status = ls_OKAY;
+
+    // Enable deferred cancelling (this is default, but expected behavior)
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+
+    while (true) {
+        // Read the header
+        uint32_t header[2];
+        int nread = _llnet_read_full(worker->tcp_fd, header, LLNET_HEADER_LENGTH);
+
+        // Handle errors from the read
+        if (nread <= 0) {
+            // Handle an unexpected error
+            if (nread < 0) {
+                dbg_info("error reading TCP socket: %s\n", strerror(errno));
+            }
+            break;
+        }
+
+        // Start the decode
+        uint32_t word = ntohl(header[0]);
+        uint8_t type = (word & 0xff000000) >> 24;
+        uint32_t length = word & LLNET_LENGTH_MASK;
+
+        // Enforce rate limits before any memory is handed out
+        if (!_llnet_ratelimit_accept(worker, type)) {
+            if (_llnet_discard(worker->tcp_fd, length) <= 0 && length > 0) {
+                break;
+            }
+            continue;
+        }
+
+        // Get some memory to store the data
+        IntermediateTLV_t* tlv = malloc(sizeof(IntermediateTLV_t));
+        tlv->type = type;
+        tlv->length = length;
+        tlv->timestamp = ntohl(header[1]);
+
+        // Read the rest of the data into the packet
+        tlv->data = malloc(length);
+        nread = _llnet_read_full(worker->tcp_fd, tlv->data, length);
+        if (length > 0 && nread <= 0) {
+            // Handle an unexpected error
+            if (nread < 0) {
+                dbg_info("error reading TCP socket: %s\n", strerror(errno));
+            }
+
+            // Generic clean-up
+            free(tlv->data);
+            free(tlv);
+            break;
+        }
+        _llnet_stat_add(worker, rx_packets, 1);
+        _llnet_stat_add(worker, rx_bytes, length + LLNET_HEADER_LENGTH);
+
+        // Call the handler
+        _llnet_deliver(worker, tlv, (word & LLNET_FLAG_COMPRESSED) != 0);
+    }
+
+    // The other side is gone, finish up without being interrupted
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    worker->tcp_status = ls_DISCONNECTED;
+    _llnet_registry_remove(worker);
+    if (worker->on_disconnect != NULL) {
+        worker->on_disconnect(worker);
+    }
+
+    // Accepted connections are owned by llnet, so give everything back now
+    if (worker->accepter != NULL) {
+        _llnet_reclaim(worker);
+    }
+    return NULL;
+}
+
+/**
+ * Decodes a single frame from a buffer and hands it to the handler
+ *
+ * @param worker the connection the frame came in on
+ * @param frame the frame (header and payload)
+ * @param len the length of the frame
+ * @param count true to count the frame as a received packet
+ */
+static void _llnet_frame_deliver(WorkerConnection_t* worker, uint8_t* frame, uint32_t len, bool count) {
+    // Start the decode
+    uint32_t header = ntohl(((uint32_t*) frame)[0]);
+    uint8_t type = (header & 0xff000000) >> 24;
+
+    // Enforce rate limits before any memory is handed out
+    if (!_llnet_ratelimit_accept(worker, type)) {
+        return;
+    }
+
+    // Get some memory to store the data
+    IntermediateTLV_t* tlv = malloc(sizeof(IntermediateTLV_t));
+    tlv->type = type;
+    tlv->length = (header & LLNET_LENGTH_MASK);
+
+    // Decode the timestamp
+    uint32_t timestamp = ((uint32_t*) frame)[1];
+    tlv->timestamp = ntohl(timestamp);
+
+    // Save the rest of the data
+    tlv->data = malloc(tlv->length);
+    uint32_t t = tlv->length; // trick gcc that this isn't a bit-field
+    memcpy(tlv->data, (frame + LLNET_HEADER_LENGTH), min(t, len - LLNET_HEADER_LENGTH));
+    if (count) {
+        _llnet_stat_add(worker, rx_packets, 1);
+        _llnet_stat_add(worker, rx_bytes, len);
+    }
+
+    // Call the handler
+    _llnet_deliver(worker, tlv, (header & LLNET_FLAG_COMPRESSED) != 0);
+}
+
+/**
+ * Tells the other side how many FEC frames are being lost, if it's time to
+ *
+ * @param worker the connection to report on
+ */
+static void _llnet_fec_report(WorkerConnection_t* worker) {
+    LLNetFecDecoder_t* dec = &worker->fec->rx;
+    if (!dec->report_due) {
+        return;
+    }
+    dec->report_due = false;
+
+    uint8_t data[_LLNET_CTRL_FEC_REPORT_LENGTH] = {0};
+    data[0] = _LLNET_CTRL_FEC_REPORT;
+    uint32_t loss_net = htonl(dec->loss);
+    memcpy(data + 4, &loss_net, sizeof(uint32_t));
+
+    IntermediateTLV_t pckt;
+    pckt.type = LLNET_TYPE_CONTROL;
+    pckt.length = _LLNET_CTRL_FEC_REPORT_LENGTH;
+    pckt.data = data;
+    llnet_connection_send(worker, np_TCP, &pckt);
+}
+
+/**
+ * Listens for incoming UDP data, decodes the data, the hands them to the handler
+ *
+ * @param _targs the connection to listen to
+ * @returns NULL
+ */
+static void* _llnet_listener_udp(void* _targs) {
+    WorkerConnection_t* worker = (WorkerConnection_t*) _targs;
+    worker->udp_status = ls_OKAY;
+
+    // Frames rebuilt by FEC go after the receive buffer
+    uint8_t* buf = malloc(_LLNET_UDP_BUFFER_LENGTH + LLNET_FEC_MAX_FRAME);
+    uint8_t* rebuilt = buf + _LLNET_UDP_BUFFER_LENGTH;
+
+    // Enable deferred cancelling (this is default, but expected behavior)
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+
+    // The thread is normally stopped by a cancel, so the buffer is freed by a handler
+    pthread_cleanup_push(free, buf);
+
+    // The kernel's drop counter comes along with each datagram
+    union {
+        struct cmsghdr align;
+        uint8_t buf[CMSG_SPACE(sizeof(uint32_t))];
+    } control;
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = _LLNET_UDP_BUFFER_LENGTH;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    while (true) {
+        // Get the UDP packet in full
+        msg.msg_name = &worker->other_addr;
+        msg.msg_namelen = sizeof(struct sockaddr_in);
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        int nread = recvmsg(worker->udp_fd, &msg, MSG_WAITALL);
+        worker->other_addr_len = msg.msg_namelen;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                uint32_t dropped;
+                memcpy(&dropped, CMSG_DATA(cmsg), sizeof(uint32_t));
+                __atomic_store_n(&worker->stats.rx_dropped_kernel, dropped, __ATOMIC_RELAXED);
+            }
+        }
+
+        // Handle errors from the read
+        if (nread <= 0) {
+            // Handle an unexpected error
+            if (nread < 0) {
+                dbg_info("error reading UDP socket: %s\n", strerror(errno));
+            }
+            break;
+        }
+        if (nread < LLNET_HEADER_LENGTH) {
+            dbg_warning("invalid header length %u\n", nread);
+            _llnet_stat_add(worker, rx_dropped_invalid, 1);
+            continue;
+        }
+
+        uint32_t header = ntohl(((uint32_t*) buf)[0]);
+        uint32_t length = header & LLNET_LENGTH_MASK;
+
+        // Parity frames are for us, and may rebuild a frame that was lost
+        if ((header >> 24) == LLNET_TYPE_FEC) {
+            if (worker->fec != NULL) {
+                int32_t rlen = fec_decode_parity(&worker->fec->rx, buf + LLNET_HEADER_LENGTH,
+                    min(length, (uint32_t) (nread - LLNET_HEADER_LENGTH)), rebuilt);
+                if (rlen > 0) {
+                    _llnet_stat_add(worker, rx_fec_recovered, 1);
+                    _llnet_frame_deliver(worker, rebuilt, rlen, true);
+                }
+                _llnet_fec_report(worker);
+            }
+            continue;
+        }
+
+        // Strip the FEC tag, leaving the frame exactly as it was before it was protected
+        uint8_t* frame = buf;
+        uint32_t frame_len = nread;
+        if (header & LLNET_FLAG_FEC) {
+            if (nread < LLNET_HEADER_LENGTH + LLNET_FEC_TAG_LENGTH || length < LLNET_FEC_TAG_LENGTH) {
+                dbg_warning("invalid FEC frame length %u\n", nread);
+                _llnet_stat_add(worker, rx_dropped_invalid, 1);
+                continue;
+            }
+            uint8_t tag[LLNET_FEC_TAG_LENGTH];
+            memcpy(tag, buf + LLNET_HEADER_LENGTH, LLNET_FEC_TAG_LENGTH);
+            memmove(buf + LLNET_HEADER_LENGTH, buf + 4, sizeof(uint32_t)); // timestamp
+            uint32_t word = htonl((header & ~(LLNET_FLAG_FEC | LLNET_LENGTH_MASK)) | (length - LLNET_FEC_TAG_LENGTH));
+            memcpy(buf + 4, &word, sizeof(uint32_t));
+            frame = buf + LLNET_FEC_TAG_LENGTH;
+            frame_len = nread - LLNET_FEC_TAG_LENGTH;
+
+            if (worker->fec != NULL && frame_len <= LLNET_FEC_MAX_FRAME) {
+                fec_decode_data(&worker->fec->rx, tag, frame, frame_len);
+                _llnet_fec_report(worker);
+            }
+        }
+
+        _llnet_frame_deliver(worker, frame, frame_len, true);
+    }
+
+    worker->udp_status = ls_DISCONNECTED;
+    pthread_cleanup_pop(true);
+    return NULL;
+}
+
+/**
+ * Creates the default context
+ */
+static void _llnet_default_context_init() {
+    default_context = llnet_context_init();
+}
+
+/**
+ * Puts a worker in an empty slot of its context's registry and gives it the
+ * connection ID for that slot
+ *
+ * @param worker the connection to register
+ */
+static void _llnet_registry_add(WorkerConnection_t* worker) {
+    LLNetContext_t* context = worker->context;
+    uint32_t shard_idx = __atomic_fetch_add(&context->next_connection_id, 1, __ATOMIC_RELAXED) % LLNET_REGISTRY_SHARDS;
+    LLNetRegistryShard_t* shard = &context->registry[shard_idx];
+
+    pthread_mutex_lock(&shard->mutex);
+
+    // Reuse an empty slot if there is one, otherwise grow the shard
+    uint32_t pos = 0;
+    while (pos < shard->length && shard->slots[pos] != NULL) {
+        pos += 1;
+    }
+    if (pos == shard->length) {
+        uint32_t length = (shard->length == 0)? 8 : shard->length * 2;
+        shard->slots = realloc(shard->slots, length * sizeof(WorkerConnection_t*));
+        shard->generations = realloc(shard->generations, length * sizeof(uint16_t));
+        for (uint32_t i = shard->length; i < length; i += 1) {
+            shard->slots[i] = NULL;
+            shard->generations[i] = 1;
+        }
+        shard->length = length;
+    }
+
+    shard->slots[pos] = worker;
+    uint32_t index = (pos * LLNET_REGISTRY_SHARDS) + shard_idx;
+    worker->connection_id = ((uint32_t) shard->generations[pos] << LLNET_ID_INDEX_BITS) | index;
+
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+/**
+ * Finds the registry shard and slot for a connection ID
+ *
+ * @param context the context the ID belongs to
+ * @param id the connection ID
+ * @param pos set to the slot within the shard
+ * @returns the shard
+ */
+static LLNetRegistryShard_t* _llnet_registry_slot(LLNetContext_t* context, uint32_t id, uint32_t* pos) {
+    uint32_t index = id & LLNET_ID_INDEX_MASK;
+    *pos = index / LLNET_REGISTRY_SHARDS;
+    return &context->registry[index % LLNET_REGISTRY_SHARDS];
+}
+
+/**
+ * Removes a worker from its context's registry, retiring its connection ID.
+ * Does nothing if the worker has already been removed.
+ *
+ * @param worker the connection to remove
+ */
+static void _llnet_registry_remove(WorkerConnection_t* worker) {
+    uint32_t pos;
+    LLNetRegistryShard_t* shard = _llnet_registry_slot(worker->context, worker->connection_id, &pos);
+
+    pthread_mutex_lock(&shard->mutex);
+    if (pos < shard->length && shard->slots[pos] == worker) {
+        shard->slots[pos] = NULL;
+        uint16_t gen = (shard->generations[pos] + 1) & LLNET_ID_GENERATION_MASK;
+        shard->generations[pos] = (gen == 0)? 1 : gen;
+    }
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+/**
+ * Drops a reference to an accepted worker, closing the sockets and freeing the
+ * memory once nothing holds one
+ *
+ * @param worker the connection to release
+ */
+static void _llnet_worker_release(WorkerConnection_t* worker) {
+    if (__atomic_sub_fetch(&worker->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
+    close(worker->tcp_fd);
+    close(worker->udp_fd);
+    if (worker->limiter != NULL) {
+        ratelimit_free(worker->limiter);
+    }
+    if (worker->fec != NULL) {
+        fec_free(worker->fec);
+    }
+    pthread_mutex_destroy(&worker->tcp_write_mutex);
+    pthread_mutex_destroy(&worker->sender_mutex);
+    free(worker);
+}
+
+/**
+ * Reclaims an accepted worker once its TCP listener has seen the other side
+ * leave: stops the sender, bundler, reliable channel and UDP listener, then
+ * drops the listener's reference (so the memory goes once nobody else holds it).
+ * Must be called from the worker's TCP listener thread.
+ *
+ * @param worker the connection to reclaim
+ */
+static void _llnet_reclaim(WorkerConnection_t* worker) {
+    AccepterConnection_t* accepter = worker->accepter;
+
+    // Nobody will join this thread, so let it clean up after itself
+    pthread_detach(pthread_self());
+
+    // The other side is gone, so anything queued, waiting to be bundled or acknowledged is too late
+    _llnet_sender_stop(worker, false);
+    _llnet_bundler_stop(worker, false);
+
+    pthread_cancel(worker->udp_thread);
+    pthread_join(worker->udp_thread, NULL);
+    _llnet_reliable_stop(worker); // the UDP thread uses the channel, so it must be gone first
+    _llnet_fec_stop(worker);
+
+    // Anyone still holding the connection can't send on it over TCP
+    shutdown(worker->tcp_fd, SHUT_RDWR);
+    _llnet_worker_release(worker);
+
+    // Must be last, the accepter may be freed as soon as this reaches zero
+    pthread_mutex_lock(&accepter->live_mutex);
+    accepter->live_workers -= 1;
+    if (accepter->live_workers == 0) {
+        pthread_cond_broadcast(&accepter->live_cond);
+    }
+    pthread_mutex_unlock(&accepter->live_mutex);
+}
+
+/**
+ * Sets a socket's buffer size, if one is given
+ *
+ * @param fd the socket
+ * @param option SO_RCVBUF or SO_SNDBUF
+ * @param size the size, zero to leave the buffer alone
+ */
+static void _llnet_set_buffer(int fd, int option, uint32_t size) {
+    if (fd < 0 || size == 0) {
+        return;
+    }
+    int value = (int) size;
+    if (setsockopt(fd, SOL_SOCKET, option, &value, sizeof(int)) < 0) {
+        dbg_warning("could not set socket buffer: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * Sets the buffer sizes of a pair of sockets
+ *
+ * @param tcp_fd the TCP socket, or -1 to skip it
+ * @param udp_fd the UDP socket, or -1 to skip it
+ * @param sizes the sizes to use
+ */
+static void _llnet_apply_buffers(int tcp_fd, int udp_fd, LLNetBufferSizes_t* sizes) {
+    _llnet_set_buffer(tcp_fd, SO_RCVBUF, sizes->tcp_rcvbuf);
+    _llnet_set_buffer(tcp_fd, SO_SNDBUF, sizes->tcp_sndbuf);
+    _llnet_set_buffer(udp_fd, SO_RCVBUF, sizes->udp_rcvbuf);
+    _llnet_set_buffer(udp_fd, SO_SNDBUF, sizes->udp_sndbuf);
+}
+
+/**
+ * Attaches a connection's UDP filter to its socket, letting llnet's own frame
+ * types through along with the connection's
+ *
+ * @param connection the connection to filter
+ * @returns zero on success, or -1 on error (errno is set)
+ */
+static int _llnet_udp_filter_attach(NetConnection_t* connection) {
+    uint32_t types[LLNET_SOCKFILTER_WORDS];
+    memcpy(types, connection->udp_types, sizeof(types));
+    uint8_t internal[] = { LLNET_TYPE_CONTROL, LLNET_TYPE_FEC, LLNET_TYPE_BUNDLE, LLNET_TYPE_RELIABLE };
+    for (size_t i = 0; i < sizeof(internal); i += 1) {
+        types[internal[i] / 32] |= (1U << (internal[i] % 32));
+    }
+    return sockfilter_attach(connection->udp_fd, types);
+}
+
+/**
+ * Starts the listener threads for a worker
+ *
+ * @param worker the connection to start listening on
+ * @param cpu the core to pin the threads to, or -1 to let the OS decide
+ */
+static void _llnet_start_listeners(WorkerConnection_t* worker, int cpu) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &set);
+    }
+
+    pthread_create(&worker->tcp_thread, &attr, &_llnet_listener_tcp, (void*) worker);
+    pthread_create(&worker->udp_thread, &attr, &_llnet_listener_udp, (void*) worker);
+    pthread_attr_destroy(&attr);
+}
+
+/**
+ * Accepts incoming connections over TCP, creates the necessary data structures
+ * for the connection, and start the listener threads.
+ *
+ * @param _targs the accepter shard to use
+ * @returns NULL
+ */
+static void* _llnet_accepter_thread(void* _targs) {
+    AccepterShard_t* shard = (AccepterShard_t*) _targs;
+    AccepterConnection_t* accepter = shard->accepter;
+
+    // Enable deferred cancelling (this is default, but expected behavior)
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+
+    // Loop until someone tells us not to
+    while (true) {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+        // Make a data structure
+        WorkerConnection_t* worker = calloc(1, sizeof(WorkerConnection_t));
+        pthread_mutex_init(&worker->tcp_write_mutex, NULL);
+        pthread_mutex_init(&worker->sender_mutex, NULL);
+        worker->refs = 1; // held by the TCP listener until it reclaims the connection
+        worker->udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+        // Make sure the socket request was successful
+        if (worker->udp_fd < 0) {
+            dbg_error("UDP socket creation failed: %s\n", strerror(errno));
+            close(worker->udp_fd);
+            free(worker);
+            exit(EXIT_FAILURE); // for now, exit on error
+        }
+
+        // Set the SO_REUSEADDR and SO_REUSEPORT flags (because resource leaks *will* happen)
+        int opt_value = 1;
+        int err = setsockopt(worker->udp_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt_value, sizeof(int));
+        if (err < 0) {
+            dbg_error("could not set socket options: %s\n", strerror(errno));
+            close(worker->udp_fd);
+            free(worker);
+            exit(EXIT_FAILURE);
+        }
+        if (setsockopt(worker->udp_fd, SOL_SOCKET, SO_RXQ_OVFL, &opt_value, sizeof(int)) < 0) {
+            dbg_warning("could not enable drop counting: %s\n", strerror(errno));
+        }
+
+        // Fill in everything else
+        worker->on_packet = accepter->on_packet;
+        worker->on_disconnect = accepter->on_disconnect;
+        worker->accepter = accepter;
+        worker->context = accepter->context;
+        worker->caps = accepter->caps;
+        worker->compress_threshold = accepter->compress_threshold;
+        worker->peer_caps = 0;
+        worker->tcp_status = ls_NOT_STARTED;
+        worker->udp_status = ls_NOT_STARTED;
+
+        // Accept the connection
+        worker->other_addr_len = sizeof(struct sockaddr_in);
+        worker->tcp_fd = accept(shard->tcp_fd, (struct sockaddr*) &worker->other_addr, &worker->other_addr_len);
+
+        // Handle error: unexpected error
+        if (worker->tcp_fd < 0) {
+            dbg_warning("could not accept client: %s\n", strerror(errno));
+            close(worker->udp_fd);
+            free(worker);
+            continue;
+        }
+
+        // Don't get cancelled with a half-made worker
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        // Bind the UDP socket so that the OS knows to give us data
+        err = bind(worker->udp_fd, (struct sockaddr*) &worker->other_addr, sizeof(struct sockaddr_in));
+        if (err < 0) {
+            dbg_warning("bind failed: %s\n", strerror(errno));
+            close(worker->tcp_fd);
+            close(worker->udp_fd);
+            free(worker);
+            continue;
+        }
+
+        // Take a copy of the accepter's limits (with fresh buckets)
+        worker->limiter = (accepter->limiter != NULL)? ratelimit_copy(accepter->limiter) : NULL;
+        if (worker->caps & llcap_FEC) {
+            _llnet_fec_start(worker);
+        }
+        worker->bundle_window_us = accepter->bundle_window_us;
+        memcpy(worker->udp_types, accepter->udp_types, sizeof(worker->udp_types));
+        worker->buffers = accepter->buffers;
+        _llnet_apply_buffers(worker->tcp_fd, worker->udp_fd, &worker->buffers);
+        if (sockfilter_enabled(worker->udp_types) && _llnet_udp_filter_attach((NetConnection_t*) worker) < 0) {
+            dbg_warning("could not attach UDP filter: %s\n", strerror(errno));
+        }
+
+        // Oficially a complete worker
+        worker->state = cs_WORKER;
+
+        // Let the other side know what we support
+        if (worker->caps != 0) {
+            _llnet_send_hello(worker);
+        }
+        if (worker->caps & llcap_BUNDLE) {
+            _llnet_bundler_start(worker);
+        }
+        if (worker->caps & llcap_RELIABLE) {
+            _llnet_reliable_start(worker);
+        }
+
+        // Register the connection, then notify the handler that we got one
+        pthread_mutex_lock(&accepter->live_mutex);
+        accepter->live_workers += 1;
+        pthread_mutex_unlock(&accepter->live_mutex);
+        _llnet_registry_add(worker);
+        if (accepter->on_connect != NULL) {
+            accepter->on_connect(worker);
+        }
+
+        // Start listener threads on this shard's core
+        _llnet_start_listeners(worker, shard->cpu);
+    }
+
+    return NULL;
+}
+
+/**
+ * @inherit
+ */
+LLNetContext_t* llnet_context_init() {
+    LLNetContext_t* context = malloc(sizeof(LLNetContext_t));
+    if (context == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < LLNET_REGISTRY_SHARDS; i += 1) {
+        pthread_mutex_init(&context->registry[i].mutex, NULL);
+        context->registry[i].length = 0;
+        context->registry[i].slots = NULL;
+        context->registry[i].generations = NULL;
+    }
+    context->time_offset = 0;
+    context->next_connection_id = 1;
+    pthread_mutex_init(&context->resolver_mutex, NULL);
+    memset(context->resolver, 0, sizeof(context->resolver));
+
+    // The sampler's deadlines are on the monotonic clock
+    pthread_mutex_init(&context->sampler_mutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&context->sampler_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    context->sample_period_ms = 0;
+    context->sampler_started = false;
+    context->stats_shm = NULL;
+    return context;
+}
+
+/**
+ * @inherit
+ */
+LLNetContext_t* llnet_context_default() {
+    pthread_once(&default_context_once, _llnet_default_context_init);
+    return default_context;
+}
+
+/**
+ * @inherit
+ */
+void llnet_context_set_time_offset(LLNetContext_t* context, int32_t offset) {
+    __atomic_store_n(&context->time_offset, offset, __ATOMIC_RELAXED);
+}
+
+/**
+ * @inherit
+ */
+uint32_t llnet_context_timestamp(LLNetContext_t* context) {
+    // Get the time and convert to milliseconds
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int32_t offset = __atomic_load_n(&context->time_offset, __ATOMIC_RELAXED);
+    return (uint32_t) ((ts.tv_sec * 1000) + round(ts.tv_nsec / 1.0e6) + offset);
+}
+
+/**
+ * @inherit
+ */
+uint32_t llnet_context_foreach(LLNetContext_t* context, void (*fn)(WorkerConnection_t*, void*), void* arg) {
+    uint32_t count = 0;
+    for (size_t i = 0; i < LLNET_REGISTRY_SHARDS; i += 1) {
+        // Holding the shard's lock keeps its connections from being reclaimed
+        LLNetRegistryShard_t* shard = &context->registry[i];
+        pthread_mutex_lock(&shard->mutex);
+        for (uint32_t pos = 0; pos < shard->length; pos += 1) {
+            if (shard->slots[pos] != NULL) {
+                fn(shard->slots[pos], arg);
+                count += 1;
+            }
+        }
+        pthread_mutex_unlock(&shard->mutex);
+    }
+    return count;
+}
+
+/**
+ * @inherit
+ */
+void llnet_context_free(LLNetContext_t* context) {
+    pthread_mutex_destroy(&context->resolver_mutex);
+
+    // Stop sampling (and publishing)
+    llnet_context_set_sample_period(context, 0);
+    llnet_context_publish_stats(context, NULL);
+    pthread_mutex_destroy(&context->sampler_mutex);
+    pthread_cond_destroy(&context->sampler_cond);
+
+    for (size_t i = 0; i < LLNET_REGISTRY_SHARDS; i += 1) {
+        pthread_mutex_destroy(&context->registry[i].mutex);
+        free(context->registry[i].slots);
+        free(context->registry[i].generations);
+        context->registry[i].slots = NULL;
+        context->registry[i].generations = NULL;
+    }
+    free(context);
+}
+
+/**
+ * @inherit
+ */
+NetConnection_t* llnet_connection_init() {
+    return llnet_connection_init_context(llnet_context_default());
+}
+
+/**
+ * @inherit
+ */
+NetConnection_t* llnet_connection_init_context(LLNetContext_t* context) {
+    // Get memory and set state to nothing
+    NetConnection_t* connection = malloc(sizeof(NetConnection_t));
+    connection->state = cs_NOTHING;
+    connection->context = context;
+    connection->on_packet = NULL;
+    connection->on_disconnect = NULL;
+    connection->caps = 0;
+    connection->compress_threshold = LLNET_COMPRESS_DEFAULT_THRESHOLD;
+    connection->bundle_window_us = 0;
+    connection->limiter = NULL;
+    memset(connection->udp_types, 0, sizeof(connection->udp_types));
+    memset(&connection->buffers, 0, sizeof(LLNetBufferSizes_t));
+
+    // Setup the TCP socket
+    connection->tcp_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connection->tcp_fd < 0) {
+        dbg_error("TCP socket creation failed: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // Set the SO_REUSEADDR and SO_REUSEPORT flags (because resource leaks *will* happen)
+    int opt_value = 1;
+    int err = setsockopt(connection->tcp_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt_value, sizeof(int));
+    if (err < 0) {
+        dbg_error("could not set socket options: %s\n", strerror(errno));
+        close(connection->tcp_fd);
+        free(connection);
+        exit(EXIT_FAILURE); // for now, exit on error
+    }
+
+    // Disable Nagle's algorithm: this will decrease OS buffering of TCP packets
+    err = setsockopt(connection->tcp_fd, IPPROTO_TCP, TCP_NODELAY, &opt_value, sizeof(int));
+    if (err < 0) {
+        dbg_error("could not set socket options: %s\n", strerror(errno));
+        close(connection->tcp_fd);
+        free(connection);
+        exit(EXIT_FAILURE); // for now, exit on error
+    }
+
+    // Setup the UDP socket
+    connection->udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (connection->udp_fd < 0) {
+        dbg_error("error: UDP socket creation failed: %s\n", strerror(errno));
+        close(connection->udp_fd);
+        free(connection);
+        exit(EXIT_FAILURE); // for now, exit on error
+    }
+
+    // Set the SO_REUSEADDR and SO_REUSEPORT flags (because resource leaks *will* happen)
+    err = setsockopt(connection->udp_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt_value, sizeof(int));
+    if (err < 0) {
+        dbg_error("could not set socket options: %s\n", strerror(errno));
+        close(connection->tcp_fd);
+        close(connection->udp_fd);
+        free(connection);
+        exit(EXIT_FAILURE);
+    }
+
+    // Have the kernel report datagrams it drops because the buffer is full
+    if (setsockopt(connection->udp_fd, SOL_SOCKET, SO_RXQ_OVFL, &opt_value, sizeof(int)) < 0) {
+        dbg_warning("could not enable drop counting: %s\n", strerror(errno));
+    }
+
+    // all finished
+    return connection;    
+}
+
+/**
+ * @inherit
+ */
+WorkerConnection_t* llnet_connection_get(uint32_t id) {
+    return llnet_context_get(llnet_context_default(), id);
+}
+
+/**
+ * @inherit
+ */
+WorkerConnection_t* llnet_context_get(LLNetContext_t* context, uint32_t id) {
+    uint32_t pos;
+    LLNetRegistryShard_t* shard = _llnet_registry_slot(context, id, &pos);
+
+    // The slot only matches if it's still on the same generation
+    WorkerConnection_t* res = NULL;
+    pthread_mutex_lock(&shard->mutex);
+    if (pos < shard->length && shard->slots[pos] != NULL && shard->slots[pos]->connection_id == id) {
+        res = shard->slots[pos];
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    return res;
+}
+
+/**
+ * @inherit
+ */
+WorkerConnection_t* llnet_context_retain(LLNetContext_t* context, uint32_t id) {
+    uint32_t pos;
+    LLNetRegistryShard_t* shard = _llnet_registry_slot(context, id, &pos);
+
+    // Take the reference under the lock, so it can't be reclaimed in between
+    WorkerConnection_t* res = NULL;
+    pthread_mutex_lock(&shard->mutex);
+    if (pos < shard->length && shard->slots[pos] != NULL && shard->slots[pos]->connection_id == id) {
+        res = shard->slots[pos];
+        llnet_connection_retain(res);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    return res;
+}
+
+/**
+ * @inherit
+ */
+void llnet_connection_retain(WorkerConnection_t* connection) {
+    if (connection->accepter != NULL) {
+        __atomic_fetch_add(&connection->refs, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @inherit
+ */
+void llnet_connection_release(WorkerConnection_t* connection) {
+    if (connection->accepter != NULL) {
+        _llnet_worker_release(connection);
+    }
+}
+
+/**
+ * @inherit
+ */
+NetConnection_t* llnet_connection_init_from(NetConnection_t* other) {
+    NetConnection_t* connection = llnet_connection_init_context(other->context);
+    connection->on_disconnect = other->on_disconnect;
+    connection->caps = other->caps;
+    connection->compress_threshold = other->compress_threshold;
+    connection->bundle_window_us = other->bundle_window_us;
+    connection->limiter = (other->limiter != NULL)? ratelimit_copy(other->limiter) : NULL;
+    llnet_connection_set_buffers(connection, &other->buffers);
+    if (sockfilter_enabled(other->udp_types)) {
+        memcpy(connection->udp_types, other->udp_types, sizeof(connection->udp_types));
+        if (_llnet_udp_filter_attach(connection) < 0) {
+            dbg_warning("could not attach UDP filter: %s\n", strerror(errno));
+        }
+    }
+    return connection;
+}
+
+/**
+ * Looks up the address of a host, using the context's remembered lookups
+ * when they're fresh. If the lookup fails, the last known address is used.
+ *
+ * @param context the context to remember the lookup in
+ * @param host the host to look up
+ * @param addr set to the host's address
+ * @returns zero on success, or -1 if the host has no known address
+ */
+static int _llnet_resolve(LLNetContext_t* context, char* host, struct in_addr* addr) {
+    uint64_t now = _llnet_now_ns();
+    bool cacheable = strlen(host) < LLNET_RESOLVER_HOST_LENGTH;
+
+    // Use the remembered address if it's still fresh
+    LLNetResolverEntry_t* entry = NULL;
+    if (cacheable) {
+        pthread_mutex_lock(&context->resolver_mutex);
+        for (size_t i = 0; i < LLNET_RESOLVER_ENTRIES; i += 1) {
+            if (strcmp(context->resolver[i].host, host) == 0) {
+                entry = &context->resolver[i];
+                break;
+            }
+        }
+        if (entry != NULL && entry->expires_ns > now) {
+            *addr = entry->addr;
+            pthread_mutex_unlock(&context->resolver_mutex);
+            return 0;
+        }
+        pthread_mutex_unlock(&context->resolver_mutex);
+    }
+
+    // Look the host up (without holding the lock, this can take a while)
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = NULL;
+    int err = getaddrinfo(host, NULL, &hints, &result);
+    if (err != 0 || result == NULL) {
+        dbg_warning("getaddrinfo failed: %s\n", gai_strerror(err));
+        if (!cacheable) {
+            return -1;
+        }
+
+        // Fall back on the last known address, if there is one
+        int rc = -1;
+        pthread_mutex_lock(&context->resolver_mutex);
+        for (size_t i = 0; i < LLNET_RESOLVER_ENTRIES; i += 1) {
+            if (strcmp(context->resolver[i].host, host) == 0) {
+                *addr = context->resolver[i].addr;
+                rc = 0;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&context->resolver_mutex);
+        return rc;
+    }
+    *addr = ((struct sockaddr_in*) result->ai_addr)->sin_addr;
+    freeaddrinfo(result);
+
+    // Remember it, replacing the entry for this host or the one closest to expiring
+    if (cacheable) {
+        pthread_mutex_lock(&context->resolver_mutex);
+        LLNetResolverEntry_t* slot = &context->resolver[0];
+        for (size_t i = 0; i < LLNET_RESOLVER_ENTRIES; i += 1) {
+            if (strcmp(context->resolver[i].host, host) == 0) {
+                slot = &context->resolver[i];
+                break;
+            }
+            if (context->resolver[i].expires_ns < slot->expires_ns) {
+                slot = &context->resolver[i];
+            }
+        }
+        strcpy(slot->host, host);
+        slot->addr = *addr;
+        slot->expires_ns = now + ((uint64_t) LLNET_RESOLVER_TTL_MS * 1000000);
+        pthread_mutex_unlock(&context->resolver_mutex);
+    }
+    return 0;
+}
+
+/**
+ * Connects a socket, giving up after a timeout
+ *
+ * @param fd the socket to connect
+ * @param addr the address to connect to
+ * @param timeout_ms the longest to wait
+ * @returns zero on success, or -1 on error (errno is set)
+ */
+static int _llnet_connect_timeout(int fd, struct sockaddr_in* addr, uint32_t timeout_ms) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    int err = connect(fd, (struct sockaddr*) addr, sizeof(struct sockaddr_in));
+    if (err < 0 && errno == EINPROGRESS) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        err = poll(&pfd, 1, (int) timeout_ms);
+        if (err == 0) {
+            errno = ETIMEDOUT;
+            err = -1;
+        } else if (err > 0) {
+            // The connect finished, find out how it went
+            int so_error = 0;
+            socklen_t len = sizeof(int);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+            errno = so_error;
+            err = (so_error == 0)? 0 : -1;
+        }
+    }
+
+    int saved = errno;
+    fcntl(fd, F_SETFL, flags);
+    errno = saved;
+    return err;
+}
+
+/**
+ * @inherit
+ */
+WorkerConnection_t* llnet_connection_connect(NetConnection_t* connection, char* host, void (*handler)(uint32_t, IntermediateTLV_t*)) {
+    return llnet_connection_connect_timeout(connection, host, handler, LLNET_CONNECT_DEFAULT_TIMEOUT_MS);
+}
+
+/**
+ * @inherit
+ */
+WorkerConnection_t* llnet_connection_connect_timeout(NetConnection_t* connection, char* host,
+        void (*handler)(uint32_t, IntermediateTLV_t*), uint32_t timeout_ms) {
+    return llnet_connection_connect_client(connection, host, handler, timeout_ms, NULL);
+}
+
+/**
+ * @inherit
+ */
+WorkerConnection_t* llnet_connection_connect_client(NetConnection_t* connection, char* host,
+        void (*handler)(uint32_t, IntermediateTLV_t*), uint32_t timeout_ms, struct LLNetClient* client) {
+    // Make sure this connection isn't already setup
+    if (connection->state != cs_NOTHING) {
+        dbg_warning("connection already made (state=0x%02x), returning...\n", connection->state);
+        return (WorkerConnection_t*) connection;
+    }
+
+    // Update this structure to a WorkerConnection
+    WorkerConnection_t* worker = realloc(connection, sizeof(WorkerConnection_t));
+    connection = NULL;
+    worker->tcp_status = ls_NOT_STARTED;
+    worker->udp_status = ls_NOT_STARTED;
+
+    worker->on_packet = handler;
+    worker->accepter = NULL;
+    worker->fec = NULL;
+    worker->bundler = NULL;
+    worker->reliable = NULL;
+    worker->client = client; // set before the listeners start, they may call on_disconnect straight away
+    pthread_mutex_init(&worker->tcp_write_mutex, NULL);
+    pthread_mutex_init(&worker->sender_mutex, NULL);
+    worker->sender_started = false;
+    worker->sender_closed = false;
+    worker->sender_drop = false;
+    worker->send_queue = NULL;
+    worker->peer_caps = 0;
+    memset(&worker->stats, 0, sizeof(LLNetStats_t));
+    memset(&worker->other_addr, 0, sizeof(struct sockaddr_in));
+    worker->other_addr_len = sizeof(struct sockaddr_in);
+    worker->connection_id = 0; // not a valid ID until the connection is registered
+
+    // Need to get the address for the given host
+    struct in_addr host_addr;
+    if (_llnet_resolve(worker->context, host, &host_addr) < 0) {
+        dbg_warning("could not find address of %s\n", host);
+        return worker;
+    }
+
+    // Setup the server address
+    worker->other_addr_len = sizeof(worker->other_addr);
+    worker->other_addr.sin_family = AF_INET;
+    worker->other_addr.sin_port = htons(PORT_NUMBER);
+    worker->other_addr.sin_addr = host_addr;
+
+    // Create the TCP connection to the FMS
+    int err = _llnet_connect_timeout(worker->tcp_fd, &worker->other_addr, timeout_ms);
+    if (err < 0) {
+        dbg_warning("connect failed: %s\n", strerror(errno));
+        return worker;
+    }
+
+    // Bind the UDP socket so that the OS knows to give us data
+    err = bind(worker->udp_fd, (struct sockaddr*) &worker->other_addr, sizeof(struct sockaddr_in));
+    if (err < 0) {
+        dbg_warning("bind failed: %s\n", strerror(errno));
+        return worker;
+    }
+
+    // Connection was successful
+    worker->state = cs_WORKER;
+    if (worker->caps & llcap_FEC) {
+        _llnet_fec_start(worker);
+    }
+
+    // Let the other side know what we support
+    if (worker->caps != 0) {
+        _llnet_send_hello(worker);
+    }
+    if (worker->caps & llcap_BUNDLE) {
+        _llnet_bundler_start(worker);
+    }
+    if (worker->caps & llcap_RELIABLE) {
+        _llnet_reliable_start(worker);
+    }
+
+    // Add this connection to the registry, then start listener threads
+    _llnet_registry_add(worker);
+    _llnet_start_listeners(worker, -1);
+
+    return worker;
+}
+
+/**
+ * @inherit
+ */
+uint32_t llnet_connection_send(WorkerConnection_t* connection, NetworkProtocol_t proto, IntermediateTLV_t* packet) {
+    // Check to make sure this is actually a worker connection
+    if (connection->state != cs_WORKER) {
+        dbg_error("connection is not a worker client\n");
+        return -1;
+    }
+    if (!_llnet_length_ok(packet->length)) {
+        return -1;
+    }
+
+    uint32_t* rc = malloc(sizeof(uint32_t)); // get some memory for the return value
+
+    // Make the "thread arguments"
+    SendThreadArgs* stargs = malloc(sizeof(SendThreadArgs));
+    stargs->connection = connection;
+    stargs->proto = proto;
+    stargs->packet = packet;
+    stargs->rc = rc;
+    stargs->finished = NULL;
+    stargs->handle = NULL;
+
+    _llnet_pckt_send((void*) stargs);
+
+    uint32_t ret = *(rc);
+    free(rc);
+    return ret;
+}
+
+/**
+ * @inherit
+ */
+void llnet_connection_send_thread(WorkerConnection_t* connection, NetworkProtocol_t proto, IntermediateTLV_t* packet, uint32_t* rc, bool* finished) {
+    // Check to make sure this is actually a worker connection
+    if (connection->state != cs_WORKER) {
+        dbg_error("connection is not a worker client\n");
+        *(rc) = -1;
+        return;
+    }
+    if (!_llnet_length_ok(packet->length)) {
+        *(rc) = -1;
+        return;
+    }
+
+    // Make the thread arguments
+    SendThreadArgs* stargs = malloc(sizeof(SendThreadArgs));
+    stargs->connection = connection;
+    stargs->proto = proto;
+    stargs->packet = packet;
+    stargs->rc = rc;
+    stargs->finished = finished;
+    stargs->handle = NULL;
+
+    // Start the thread, holding the connection until it's done
+    llnet_connection_retain(connection);
+    pthread_t t;
+    pthread_create(&t, NULL, _llnet_pckt_send_held, (void*) stargs);
+    pthread_detach(t); // automatically releases resources when finished
+}
+
+/**
+ * @inherit
+ */
+int llnet_connection_write_frame(WorkerConnection_t* connection, NetworkProtocol_t proto, const uint8_t* frame,
+        uint32_t len) {
+    int err;
+    if (proto == np_TCP) {
+        // Someone else is part way through a frame, so the stream is busy (and its buffer likely full)
+        if (pthread_mutex_trylock(&connection->tcp_write_mutex) != 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        err = send(connection->tcp_fd, frame, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (err > 0 && (uint32_t) err < len) {
+            // Part of the frame is in the stream, so the rest has to follow or the other side loses its framing
+            if (_llnet_finish_write(connection->tcp_fd, frame + err, len - err, LLNET_WRITE_FINISH_MS) < 0) {
+                dbg_warning("could not finish a frame, shutting the connection down\n");
+                shutdown(connection->tcp_fd, SHUT_RDWR);
+                errno = EPIPE;
+                err = -1;
+            } else {
+                err = len;
+            }
+        }
+        pthread_mutex_unlock(&connection->tcp_write_mutex);
+    } else {
+        err = sendto(connection->udp_fd, frame, len, MSG_DONTWAIT,
+            (struct sockaddr*) &connection->other_addr, sizeof(struct sockaddr_in));
+    }
+    if (err >= 0 && (uint32_t) err == len) {
+        _llnet_stat_add(connection, tx_packets, 1);
+        _llnet_stat_add(connection, tx_bytes, len);
+    }
+    return err;
+}
+
+/**
+ * @inherit
+ */
+uint32_t llnet_connection_send_packed(WorkerConnection_t* connection, NetworkProtocol_t proto, uint8_t* frame,
+        uint32_t len) {
+    // Check to make sure this is actually a worker connection
+    if (connection->state != cs_WORKER) {
+        dbg_error("connection is not a worker client\n");
+        return -1;
+    }
+    if (len < LLNET_HEADER_LENGTH || !_llnet_length_ok(len - LLNET_HEADER_LENGTH)) {
+        return -1;
+    }
+
+    // Stamp the frame with the send time, everything else is already in place
+    uint32_t timestamp = htonl(llnet_context_timestamp(connection->context));
+    memcpy(frame + 4, &timestamp, sizeof(uint32_t));
+
+    int err = _llnet_send_encoded(connection, proto, frame, len);
+    return (err < 0)? err : 0;
+}
+
+/**
+ * @inherit
+ */
+uint32_t llnet_connection_send_reliable(WorkerConnection_t* connection, IntermediateTLV_t* packet) {
+    // Check to make sure both sides have a reliable channel
+    if (connection->state != cs_WORKER || connection->reliable == NULL ||
+            !(_llnet_peer_caps(connection) & llcap_RELIABLE)) {
+        dbg_error("connection does not have a reliable channel\n");
+        return -1;
+    }
+
+    // Wrap the frame in a data message
+    uint32_t reserve = LLNET_HEADER_LENGTH + LLNET_RELIABLE_DATA_HEADER;
+    uint32_t frame_len;
+    uint8_t* buf = _llnet_encode(connection, packet, reserve, &frame_len);
+    uint32_t len = reserve + frame_len;
+    if (len > _LLNET_UDP_MAX_DATAGRAM) {
+        dbg_error("packet too large for the reliable channel (length=%u)\n", len);
+        free(buf);
+        return -1;
+    }
+    uint32_t word = htonl((LLNET_TYPE_RELIABLE << 24) | (len - LLNET_HEADER_LENGTH));
+    memcpy(buf, &word, sizeof(uint32_t));
+    memcpy(buf + 4, buf + reserve + 4, sizeof(uint32_t)); // the frame's timestamp
+    memset(buf + LLNET_HEADER_LENGTH, 0, LLNET_RELIABLE_DATA_HEADER);
+    buf[LLNET_HEADER_LENGTH] = rk_DATA;
+
+    // Number it and send it, the timer thread takes care of resends
+    LLNetReliable_t* rel = connection->reliable;
+    pthread_mutex_lock(&rel->mutex);
+    int64_t seq = reliable_track(rel, buf, len, _llnet_now_ns());
+    if (seq < 0) {
+        pthread_mutex_unlock(&rel->mutex);
+        dbg_warning("reliable channel window is full\n");
+        free(buf);
+        return -1;
+    }
+    uint32_t seq_net = htonl((uint32_t) seq);
+    memcpy(buf + LLNET_HEADER_LENGTH + 4, &seq_net, sizeof(uint32_t));
+    int err = _llnet_write(connection, np_UDP, buf, len);
+    pthread_cond_signal(&rel->cond);
+    pthread_mutex_unlock(&rel->mutex);
+
+    if (err >= 0) {
+        _llnet_stat_add(connection, tx_packets, 1);
+        _llnet_stat_add(connection, tx_bytes, len);
+    }
+    return 0;
+}
+
+/**
+ * @inherit
+ */
+LLNetSendHandle_t* llnet_connection_send_async(WorkerConnection_t* connection, NetworkProtocol_t proto,
+        IntermediateTLV_t* packet, LLNetCompletionQueue_t* cq) {
+    // Setup the handle
+    LLNetSendHandle_t* handle = malloc(sizeof(LLNetSendHandle_t));
+    pthread_mutex_init(&handle->mutex, NULL);
+    pthread_cond_init(&handle->cond, NULL);
+    handle->finished = false;
+    handle->rc = 0;
+    handle->packet = packet;
+    handle->cq = cq;
+
+    // Check to make sure this is actually a worker connection
+    if (connection->state != cs_WORKER) {
+        dbg_error("connection is not a worker client\n");
+        _llnet_send_complete(handle, -1);
+        return handle;
+    }
+    if (!_llnet_length_ok(packet->length)) {
+        _llnet_send_complete(handle, -1);
+        return handle;
+    }
+
+    // Make sure this connection has a sender running (held until the send is queued, so it can't be stopped under us)
+    pthread_mutex_lock(&connection->sender_mutex);
+    if (connection->sender_closed) {
+        pthread_mutex_unlock(&connection->sender_mutex);
+        _llnet_send_complete(handle, -1);
+        return handle;
+    }
+    if (!connection->sender_started) {
+        connection->send_queue = queue_init();
+        pthread_create(&connection->sender_thread, NULL, &_llnet_sender_thread, (void*) connection);
+        connection->sender_started = true;
+    }
+
+    // Queue the send
+    SendThreadArgs* stargs = malloc(sizeof(SendThreadArgs));
+    stargs->connection = connection;
+    stargs->proto = proto;
+    stargs->packet = packet;
+    stargs->rc = NULL;
+    stargs->finished = NULL;
+    stargs->handle = handle;
+    queue_enqueue(connection->send_queue, stargs);
+    pthread_mutex_unlock(&connection->sender_mutex);
+
+    return handle;
+}
+
+/**
+ * @inherit
+ */
+bool llnet_send_wait(LLNetSendHandle_t* handle, int32_t timeout_ms, uint32_t* rc) {
+    // Work out when to give up
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    if (timeout_ms > 0) {
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&handle->mutex);
+    while (!handle->finished && timeout_ms != 0) {
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&handle->cond, &handle->mutex);
+        } else if (pthread_cond_timedwait(&handle->cond, &handle->mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    bool finished = handle->finished;
+    if (finished && rc != NULL) {
+        *rc = handle->rc;
+    }
+    pthread_mutex_unlock(&handle->mutex);
+
+    return finished;
+}
+
+/**
+ * @inherit
+ */
+void llnet_send_handle_free(LLNetSendHandle_t* handle) {
+    pthread_mutex_destroy(&handle->mutex);
+    pthread_cond_destroy(&handle->cond);
+    free(handle);
+}
+
+/**
+ * @inherit
+ */
+LLNetCompletionQueue_t* llnet_cq_init() {
+    LLNetCompletionQueue_t* cq = malloc(sizeof(LLNetCompletionQueue_t));
+    if (cq == NULL) {
+        return NULL;
+    }
+    cq->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    cq->completed = queue_init();
+    return cq;
+}
+
+/**
+ * @inherit
+ */
+uint32_t llnet_cq_harvest(LLNetCompletionQueue_t* cq, LLNetSendHandle_t** handles, uint32_t max) {
+    // Reset the eventfd counter, anything left over re-arms it below
+    uint64_t count;
+    if (read(cq->event_fd, &count, sizeof(uint64_t)) < 0 && errno != EAGAIN) {
+        dbg_warning("could not read completion queue: %s\n", strerror(errno));
+    }
+
+    // Pull off as many completions as were asked for
+    uint32_t n = 0;
+    while (n < max) {
+        LLNetSendHandle_t* handle = queue_dequeue(cq->completed);
+        if (handle == NULL) {
+            break;
+        }
+
+        // The sender may still hold the handle, wait for it to let go so the caller can free it
+        pthread_mutex_lock(&handle->mutex);
+        pthread_mutex_unlock(&handle->mutex);
+        handles[n] = handle;
+        n += 1;
+    }
+
+    // Keep the eventfd readable if there are still completions waiting
+    if (queue_size(cq->completed) > 0) {
+        uint64_t one = 1;
+        if (write(cq->event_fd, &one, sizeof(uint64_t)) < 0) {
+            dbg_warning("could not signal completion queue: %s\n", strerror(errno));
+        }
+    }
+    return n;
+}
+
+/**
+ * @inherit
+ */
+void llnet_cq_free(LLNetCompletionQueue_t* cq) {
+    close(cq->event_fd);
+    queue_free(cq->completed);
+    free(cq);
+}
+
+/**
+ * @inherit
+ */
+AccepterConnection_t* llnet_connection_listen(NetConnection_t* connection, void (*on_connect)(WorkerConnection_t*), void (*on_packet)(uint32_t, IntermediateTLV_t*)) {
+    return llnet_connection_listen_sharded(connection, 1, on_connect, on_packet);
+}
+
+/**
+ * Creates and binds an additional listening socket for an accepter shard
+ *
+ * @param addr the address to bind to
+ * @returns the socket's file descriptor, or -1 on error
+ */
+static int _llnet_shard_socket(struct sockaddr_in* addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        dbg_error("TCP socket creation failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // Every shard shares the port, and the kernel spreads connections across them
+    int opt_value = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt_value, sizeof(int)) < 0 ||
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt_value, sizeof(int)) < 0) {
+        dbg_error("could not set socket options: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr*) addr, sizeof(struct sockaddr_in)) < 0) {
+        dbg_error("could not bind socket: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    listen(fd, 0xfff);
+    return fd;
+}
+
+/**
+ * @inherit
+ */
+AccepterConnection_t* llnet_connection_listen_sharded(NetConnection_t* connection, uint32_t num_shards,
+        void (*on_connect)(WorkerConnection_t*), void (*on_packet)(uint32_t, IntermediateTLV_t*)) {
+    // Make sure the connection isn't already setup
+    if (connection->state != cs_NOTHING) {
+        dbg_warning("connection already made (state=0x%02x)\n", connection->state);
+        return (AccepterConnection_t*) connection;
+    }
+    if (num_shards == 0) {
+        num_shards = 1;
+    }
+
+    // Update the structure to an AccepterConnection
+    AccepterConnection_t* accepter = realloc(connection, sizeof(AccepterConnection_t));
+    connection = NULL;
+    accepter->state = cs_ACCEPTER;
+    accepter->on_packet = on_packet;
+    accepter->on_connect = on_connect;
+    pthread_mutex_init(&accepter->live_mutex, NULL);
+    pthread_cond_init(&accepter->live_cond, NULL);
+    accepter->live_workers = 0;
+
+    // Setup the socket address struct (IPv4 only, on port PORT_NUMBER, accept any host)
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT_NUMBER);
+    addr.sin_addr.s_addr = INADDR_ANY;
+
+    // Bind the socket to accept any incoming connections for the FMS
+    int err = bind(accepter->tcp_fd, (struct sockaddr*) &addr, sizeof(struct sockaddr_in));
+    if (err < 0) {
+        fprintf(stderr, "error: could not bind socket: %s\n", strerror(errno));
+        close(accepter->tcp_fd);
+        exit(EXIT_FAILURE);
+    }
 
-        // Oficially a complete worker
-        worker->state = cs_WORKER;
+    // Setup the listen queue with a length of 4095 (MORE than enough)
+    listen(accepter->tcp_fd, 0xfff);
 
-        // Notify the handler that we got one
-        if (accepter->on_connect != NULL) {
-            accepter->on_connect(worker);
+    // Setup the shards, the first shard uses the original socket
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    accepter->num_shards = num_shards;
+    accepter->shards = calloc(num_shards, sizeof(AccepterShard_t));
+    for (uint32_t i = 0; i < num_shards; i += 1) {
+        AccepterShard_t* shard = &accepter->shards[i];
+        shard->accepter = accepter;
+        shard->tcp_fd = (i == 0)? accepter->tcp_fd : _llnet_shard_socket(&addr);
+        shard->cpu = (num_shards > 1 && num_cpus > 0)? (int) (i % num_cpus) : -1;
+        if (shard->tcp_fd < 0) {
+            exit(EXIT_FAILURE); // for now, exit on error
         }
-        arraylist_add(connections, worker);
+        _llnet_apply_buffers(shard->tcp_fd, -1, &accepter->buffers); // accepted sockets start with these
+    }
 
-        // Start listener threads
-        pthread_create(&worker->tcp_thread, NULL, &_llnet_listener_tcp, (void*) worker);
-        pthread_create(&worker->udp_thread, NULL, &_llnet_listener_udp, (void*) worker);
+    // Spin up the acceptor threads, each pinned to its core
+    for (uint32_t i = 0; i < num_shards; i += 1) {
+        AccepterShard_t* shard = &accepter->shards[i];
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (shard->cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(shard->cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &set);
+        }
+        pthread_create(&shard->thread, &attr, &_llnet_accepter_thread, (void*) shard);
+        pthread_attr_destroy(&attr);
     }
+    accepter->accepter_thread = accepter->shards[0].thread;
 
-    return NULL;
+    return accepter;
 }
 
 /**
  * @inherit
  */
-NetConnection_t* llnet_connection_init() {
-    // Get memory and set state to nothing
-    NetConnection_t* connection = malloc(sizeof(NetConnection_t));
-    connection->state = cs_NOTHING;
-    connection->on_packet = NULL;
-
-    // Setup the TCP socket
-    connection->tcp_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (connection->tcp_fd < 0) {
-        dbg_error("TCP socket creation failed: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+void llnet_connection_set_compression(NetConnection_t* connection, bool enabled, uint32_t threshold) {
+    if (enabled) {
+        connection->caps |= llcap_COMPRESSION;
+    } else {
+        connection->caps &= ~llcap_COMPRESSION;
     }
+    connection->compress_threshold = threshold;
 
-    // Set the SO_REUSEADDR and SO_REUSEPORT flags (because resource leaks *will* happen)
-    int opt_value = 1;
-    int err = setsockopt(connection->tcp_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt_value, sizeof(int));
-    if (err < 0) {
-        dbg_error("could not set socket options: %s\n", strerror(errno));
-        close(connection->tcp_fd);
-        free(connection);
-        exit(EXIT_FAILURE); // for now, exit on error
+    // Workers need to tell the other side about the change
+    if (connection->state == cs_WORKER) {
+        _llnet_send_hello((WorkerConnection_t*) connection);
     }
+}
 
-    // Disable Nagle's algorithm: this will decrease OS buffering of TCP packets
-    err = setsockopt(connection->tcp_fd, IPPROTO_TCP, TCP_NODELAY, &opt_value, sizeof(int));
-    if (err < 0) {
-        dbg_error("could not set socket options: %s\n", strerror(errno));
-        close(connection->tcp_fd);
-        free(connection);
-        exit(EXIT_FAILURE); // for now, exit on error
+/**
+ * @inherit
+ */
+void llnet_connection_set_fec(NetConnection_t* connection, bool enabled) {
+    if (enabled) {
+        connection->caps |= llcap_FEC;
+    } else {
+        connection->caps &= ~llcap_FEC;
     }
 
-    // Setup the UDP socket
-    connection->udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (connection->udp_fd < 0) {
-        dbg_error("error: UDP socket creation failed: %s\n", strerror(errno));
-        close(connection->udp_fd);
-        free(connection);
-        exit(EXIT_FAILURE); // for now, exit on error
+    // Workers need their FEC state before telling the other side about the change
+    if (connection->state == cs_WORKER) {
+        WorkerConnection_t* worker = (WorkerConnection_t*) connection;
+        if (enabled) {
+            _llnet_fec_start(worker);
+        }
+        _llnet_send_hello(worker);
     }
+}
 
-    // Set the SO_REUSEADDR and SO_REUSEPORT flags (because resource leaks *will* happen)
-    err = setsockopt(connection->udp_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt_value, sizeof(int));
-    if (err < 0) {
-        dbg_error("could not set socket options: %s\n", strerror(errno));
-        close(connection->tcp_fd);
-        close(connection->udp_fd);
-        free(connection);
-        exit(EXIT_FAILURE);
+/**
+ * @inherit
+ */
+void llnet_connection_set_bundling(NetConnection_t* connection, uint32_t window_us) {
+    connection->bundle_window_us = window_us;
+    if (window_us > 0) {
+        connection->caps |= llcap_BUNDLE;
+    } else {
+        connection->caps &= ~llcap_BUNDLE;
     }
 
-    // all finished
-    return connection;    
+    // Workers need a bundler before telling the other side about the change. Once
+    // disabled, the next frame sent flushes anything still waiting.
+    if (connection->state == cs_WORKER) {
+        WorkerConnection_t* worker = (WorkerConnection_t*) connection;
+        if (window_us > 0) {
+            _llnet_bundler_start(worker);
+        }
+        _llnet_send_hello(worker);
+    }
 }
 
 /**
  * @inherit
  */
-WorkerConnection_t* llnet_connection_get(uint32_t id) {
-    // Make sure we have a list to search
-    if (connections == NULL) {
-        return NULL;
+uint32_t llnet_connection_set_udp_filter(NetConnection_t* connection, const uint8_t* types, uint32_t num_types) {
+    memset(connection->udp_types, 0, sizeof(connection->udp_types));
+    for (uint32_t i = 0; types != NULL && i < num_types; i += 1) {
+        connection->udp_types[types[i] / 32] |= (1U << (types[i] % 32));
     }
 
-    // Check all connections
-    WorkerConnection_t* res = NULL;
-    for (size_t i = 0; i < arraylist_size(connections); i += 1) {
-        WorkerConnection_t* w = (WorkerConnection_t*) arraylist_get(connections, i);
-        if (w->connection_id == id) {
-            res = w;
-            break;
+    // Accepters don't receive on their UDP socket, their workers are filtered as they're made
+    if (connection->state == cs_ACCEPTER) {
+        return 0;
+    }
+
+    int err;
+    if (sockfilter_enabled(connection->udp_types)) {
+        err = _llnet_udp_filter_attach(connection);
+    } else {
+        err = sockfilter_detach(connection->udp_fd);
+        if (err < 0 && errno == ENOENT) {
+            err = 0; // there wasn't a filter to remove
         }
     }
-    return res;
+    if (err < 0) {
+        dbg_error("could not set UDP filter: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
 }
 
 /**
  * @inherit
  */
-WorkerConnection_t* llnet_connection_connect(NetConnection_t* connection, char* host, void (*handler)(uint32_t, IntermediateTLV_t*)) {
-    // Make sure this connection isn't already setup
-    if (connection->state != cs_NOTHING) {
-        dbg_warning("connection already made (state=0x%02x), returning...\n", connection->state);
-        return (WorkerConnection_t*) connection;
+void llnet_connection_set_reliable(NetConnection_t* connection, bool enabled) {
+    if (enabled) {
+        connection->caps |= llcap_RELIABLE;
+    } else {
+        connection->caps &= ~llcap_RELIABLE;
     }
 
-    // Update this structure to a WorkerConnection
-    WorkerConnection_t* worker = realloc(connection, sizeof(WorkerConnection_t));
-    connection = NULL;
-    worker->tcp_status = ls_NOT_STARTED;
-    worker->udp_status = ls_NOT_STARTED;
-
-    worker->on_packet = handler;
-    memset(&worker->other_addr, 0, sizeof(struct sockaddr_in));
-    worker->other_addr_len = sizeof(struct sockaddr_in);
+    // Workers need the channel before telling the other side about it. The
+    // channel is kept until the connection is freed, so nothing sent is lost.
+    if (connection->state == cs_WORKER) {
+        WorkerConnection_t* worker = (WorkerConnection_t*) connection;
+        if (enabled) {
+            _llnet_reliable_start(worker);
+        }
+        _llnet_send_hello(worker);
+    }
+}
 
-    // Add this connection to the list
-    if (connections == NULL) {
-        connections = arraylist_init();
+/**
+ * @inherit
+ */
+void llnet_connection_set_ratelimit(NetConnection_t* connection, int32_t type, uint32_t rate, uint32_t burst) {
+    if (connection->limiter == NULL) {
+        connection->limiter = ratelimit_init();
     }
-    arraylist_add(connections, worker);
+    ratelimit_set(connection->limiter, type, rate, burst);
+}
 
-    // Get the connection_id lock, save it's value, increment, and return the lock
-    pthread_mutex_lock(&next_connection_id_mutex);
-    worker->connection_id = next_connection_id;
-    next_connection_id += 1;
-    pthread_mutex_unlock(&next_connection_id_mutex);
+/**
+ * @inherit
+ */
+void llnet_connection_get_stats(WorkerConnection_t* connection, LLNetStats_t* stats) {
+    // Every field is a 64-bit counter, so read them one at a time
+    uint64_t* src = (uint64_t*) &connection->stats;
+    uint64_t* dst = (uint64_t*) stats;
+    for (size_t i = 0; i < sizeof(LLNetStats_t) / sizeof(uint64_t); i += 1) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
 
-    // Need to get the address for the given host
-    struct hostent* host_addr = gethostbyname(host);
-    if (host_addr == NULL) {
-        dbg_warning("gethostbyname failed: %s\n", hstrerror(h_errno));
-        return worker;
+/**
+ * @inherit
+ */
+uint64_t llnet_connection_get_ratelimit_drops(WorkerConnection_t* connection, uint8_t type) {
+    if (connection->limiter == NULL) {
+        return 0;
     }
+    pthread_mutex_lock(&connection->limiter->mutex);
+    uint64_t drops = connection->limiter->drops[type];
+    pthread_mutex_unlock(&connection->limiter->mutex);
+    return drops;
+}
 
-// Debugging: print gethostbyname data
-#if false
-    dbg_info("struct hostent {\n");
-    dbg_info("\th_name=%s\n", host_addr->h_name);
-    dbg_info("\th_addrtype=%d\n", host_addr->h_addrtype);
-    dbg_info("\th_length=%d\n", host_addr->h_length);
-    dbg_info("\th_addr_list[0]=%s\n", inet_ntoa(*((struct in_addr*) host_addr->h_addr_list[0])));
-    dbg_info("}\n");
-#endif
+/**
+ * @inherit
+ */
+void llnet_connection_set_buffers(NetConnection_t* connection, LLNetBufferSizes_t* sizes) {
+    connection->buffers = *sizes;
 
-    // Setup the server address
-    worker->other_addr_len = sizeof(worker->other_addr);
-    worker->other_addr.sin_family = AF_INET;
-    worker->other_addr.sin_port = htons(PORT_NUMBER);
-    worker->other_addr.sin_addr = *((struct in_addr*) host_addr->h_addr_list[0]);
+    // Accepters size their listening sockets, the rest size their own
+    if (connection->state == cs_ACCEPTER) {
+        AccepterConnection_t* accepter = (AccepterConnection_t*) connection;
+        for (uint32_t i = 0; i < accepter->num_shards; i += 1) {
+            _llnet_apply_buffers(accepter->shards[i].tcp_fd, -1, sizes);
+        }
+    } else {
+        _llnet_apply_buffers(connection->tcp_fd, connection->udp_fd, sizes);
+    }
+}
 
-    // Create the TCP connection to the FMS
-    int err = connect(worker->tcp_fd, (struct sockaddr*) &worker->other_addr, sizeof(struct sockaddr_in));
-    if (err < 0) {
-        dbg_warning("connect failed: %s\n", strerror(errno));
-        return worker;
+/**
+ * Reads a socket's buffer size
+ *
+ * @param fd the socket
+ * @param option SO_RCVBUF or SO_SNDBUF
+ * @returns the size, or zero if it couldn't be read
+ */
+static uint64_t _llnet_get_buffer(int fd, int option) {
+    int value = 0;
+    socklen_t len = sizeof(int);
+    if (getsockopt(fd, SOL_SOCKET, option, &value, &len) < 0) {
+        return 0;
     }
+    return (uint64_t) value;
+}
 
-    // Bind the UDP socket so that the OS knows to give us data
-    err = bind(worker->udp_fd, (struct sockaddr*) &worker->other_addr, sizeof(struct sockaddr_in));
-    if (err < 0) {
-        dbg_warning("bind failed: %s\n", strerror(errno));
-        return worker;
+/**
+ * Samples the kernel's state for a worker's sockets into the worker
+ *
+ * @param worker the connection to sample
+ * @param _shm the stats segment to publish the sample into, or NULL
+ */
+static void _llnet_sample_sockets(WorkerConnection_t* worker, void* _shm) {
+    LLNetSocketStats_t sample;
+    memset(&sample, 0, sizeof(LLNetSocketStats_t));
+
+    // Queue lengths
+    int value;
+    if (ioctl(worker->tcp_fd, SIOCINQ, &value) == 0) {
+        sample.tcp_rx_queued = value;
+    }
+    if (ioctl(worker->tcp_fd, SIOCOUTQ, &value) == 0) {
+        sample.tcp_tx_queued = value;
+    }
+    if (ioctl(worker->udp_fd, SIOCINQ, &value) == 0) {
+        sample.udp_rx_next = value;
+    }
+    if (ioctl(worker->udp_fd, SIOCOUTQ, &value) == 0) {
+        sample.udp_tx_queued = value;
+    }
+    uint32_t meminfo[SK_MEMINFO_VARS];
+    socklen_t len = sizeof(meminfo);
+    if (getsockopt(worker->udp_fd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == 0) {
+        sample.udp_rx_mem = meminfo[SK_MEMINFO_RMEM_ALLOC];
     }
 
-    // Connection was successful
-    worker->state = cs_WORKER;
+    // Buffer sizes
+    sample.tcp_rcvbuf = _llnet_get_buffer(worker->tcp_fd, SO_RCVBUF);
+    sample.tcp_sndbuf = _llnet_get_buffer(worker->tcp_fd, SO_SNDBUF);
+    sample.udp_rcvbuf = _llnet_get_buffer(worker->udp_fd, SO_RCVBUF);
+    sample.udp_sndbuf = _llnet_get_buffer(worker->udp_fd, SO_SNDBUF);
+
+    // How TCP thinks the path is doing
+    struct tcp_info info;
+    len = sizeof(struct tcp_info);
+    if (getsockopt(worker->tcp_fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+        sample.tcp_rtt_us = info.tcpi_rtt;
+        sample.tcp_rttvar_us = info.tcpi_rttvar;
+        sample.tcp_retransmits = info.tcpi_total_retrans;
+        sample.tcp_lost = info.tcpi_lost;
+        sample.tcp_snd_cwnd = info.tcpi_snd_cwnd;
+    }
+    sample.sampled_ns = _llnet_now_ns();
 
-    // Start listener threads
-    pthread_create(&worker->tcp_thread, NULL, &_llnet_listener_tcp, (void*) worker);
-    pthread_create(&worker->udp_thread, NULL, &_llnet_listener_udp, (void*) worker);
+    // Every field is a 64-bit value, so write them one at a time
+    uint64_t* src = (uint64_t*) &sample;
+    uint64_t* dst = (uint64_t*) &worker->socket_stats;
+    for (size_t i = 0; i < sizeof(LLNetSocketStats_t) / sizeof(uint64_t); i += 1) {
+        __atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+    }
 
-    return worker;
+    // Publish the sample along with the connection's counters
+    if (_shm != NULL) {
+        LLNetStats_t stats;
+        llnet_connection_get_stats(worker, &stats);
+        statshm_write((LLNetStatsShm_t*) _shm, worker->connection_id, _llnet_peer_caps(worker), &worker->other_addr, &stats,
+            &sample);
+    }
 }
 
 /**
  * @inherit
  */
-uint32_t llnet_connection_send(WorkerConnection_t* connection, NetworkProtocol_t proto, IntermediateTLV_t* packet) {
-    // Check to make sure this is actually a worker connection
-    if (connection->state != cs_WORKER) {
-        dbg_error("connection is not a worker client\n");
-        return -1;
+void llnet_connection_sample_sockets(WorkerConnection_t* connection, LLNetSocketStats_t* stats) {
+    _llnet_sample_sockets(connection, NULL);
+    if (stats != NULL) {
+        llnet_connection_get_socket_stats(connection, stats);
     }
+}
 
-    uint32_t* rc = malloc(sizeof(uint32_t)); // get some memory for the return value
+/**
+ * @inherit
+ */
+void llnet_connection_get_socket_stats(WorkerConnection_t* connection, LLNetSocketStats_t* stats) {
+    // Every field is a 64-bit value, so read them one at a time
+    uint64_t* src = (uint64_t*) &connection->socket_stats;
+    uint64_t* dst = (uint64_t*) stats;
+    for (size_t i = 0; i < sizeof(LLNetSocketStats_t) / sizeof(uint64_t); i += 1) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
 
-    // Make the "thread arguments"
-    SendThreadArgs* stargs = malloc(sizeof(SendThreadArgs));
-    stargs->connection = connection;
-    stargs->proto = proto;
-    stargs->packet = packet;
-    stargs->rc = rc;
-    stargs->finished = NULL;
+/**
+ * Samples the kernel's state for every connection in a context, until sampling
+ * is turned off
+ *
+ * @param _targs the context to sample
+ * @returns NULL
+ */
+static void* _llnet_sampler_thread(void* _targs) {
+    LLNetContext_t* context = (LLNetContext_t*) _targs;
+
+    // Sampling may be turned off and back on before this thread wakes, only the current sampler keeps going
+    pthread_mutex_lock(&context->sampler_mutex);
+    while (context->sampler_started && pthread_equal(context->sampler_thread, pthread_self())) {
+        // The lock is held for the round, so the stats segment can't go away under it
+        LLNetStatsShm_t* shm = context->stats_shm;
+        if (shm != NULL) {
+            statshm_begin(shm);
+        }
+        llnet_context_foreach(context, &_llnet_sample_sockets, shm);
+        if (shm != NULL) {
+            statshm_end(shm, _llnet_now_ns());
+        }
 
-    _llnet_pckt_send((void*) stargs);
+        // Sleep until the next sample is due, or the period changes
+        uint64_t deadline = _llnet_now_ns() + ((uint64_t) context->sample_period_ms * 1000000);
+        struct timespec ts;
+        ts.tv_sec = deadline / 1000000000ULL;
+        ts.tv_nsec = deadline % 1000000000ULL;
+        pthread_cond_timedwait(&context->sampler_cond, &context->sampler_mutex, &ts);
+    }
+    pthread_mutex_unlock(&context->sampler_mutex);
 
-    uint32_t ret = *(rc);
-    free(rc);
-    return ret;
+    return NULL;
 }
 
 /**
  * @inherit
  */
-void llnet_connection_send_thread(WorkerConnection_t* connection, NetworkProtocol_t proto, IntermediateTLV_t* packet, uint32_t* rc, bool* finished) {
-    // Check to make sure this is actually a worker connection
-    if (connection->state != cs_WORKER) {
-        dbg_error("connection is not a worker client\n");
-        *(rc) = -1;
-        return;
+void llnet_context_set_sample_period(LLNetContext_t* context, uint32_t period_ms) {
+    pthread_mutex_lock(&context->sampler_mutex);
+    context->sample_period_ms = period_ms;
+    pthread_cond_broadcast(&context->sampler_cond);
+    bool join = period_ms == 0 && context->sampler_started;
+    pthread_t sampler = context->sampler_thread; // copied under the lock, a concurrent start replaces it
+    if (period_ms != 0 && !context->sampler_started) {
+        context->sampler_started = true;
+        pthread_create(&context->sampler_thread, NULL, &_llnet_sampler_thread, (void*) context);
     }
+    if (join) {
+        context->sampler_started = false;
+    }
+    pthread_mutex_unlock(&context->sampler_mutex);
 
-    // Make the thread arguments
-    SendThreadArgs* stargs = malloc(sizeof(SendThreadArgs));
-    stargs->connection = connection;
-    stargs->proto = proto;
-    stargs->packet = packet;
-    stargs->rc = rc;
-    stargs->finished = finished;
-
-    // Start the thread
-    pthread_t t;
-    pthread_create(&t, NULL, _llnet_pckt_send, (void*) stargs);
-    pthread_detach(t); // automatically releases resources when finished
+    if (join) {
+        pthread_join(sampler, NULL);
+    }
 }
 
 /**
  * @inherit
  */
-AccepterConnection_t* llnet_connection_listen(NetConnection_t* connection, void (*on_connect)(WorkerConnection_t*), void (*on_packet)(uint32_t, IntermediateTLV_t*)) {
-    // Make sure the connection isn't already setup
-    if (connection->state != cs_NOTHING) {
-        dbg_warning("connection already made (state=0x%02x)\n", connection->state);
-        return (AccepterConnection_t*) connection;
+int llnet_context_publish_stats(LLNetContext_t* context, const char* name) {
+    LLNetStatsShm_t* shm = NULL;
+    if (name != NULL) {
+        shm = statshm_create(name, LLNET_STATSHM_SLOTS);
+        if (shm == NULL) {
+            dbg_error("could not create stats segment %s: %s\n", name, strerror(errno));
+            return -1;
+        }
     }
 
-    // Update the structure to an AccepterConnection
-    AccepterConnection_t* accepter = realloc(connection, sizeof(AccepterConnection_t));
-    connection = NULL;
-    accepter->state = cs_ACCEPTER;
-    accepter->on_packet = on_packet;
-    accepter->on_connect = on_connect;
-
-    // Setup the socket address struct (IPv4 only, on port PORT_NUMBER, accept any host)
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(PORT_NUMBER);
-    addr.sin_addr.s_addr = INADDR_ANY;
-
-    // Bind the socket to accept any incoming connections for the FMS
-    int err = bind(accepter->tcp_fd, (struct sockaddr*) &addr, sizeof(struct sockaddr_in));
-    if (err < 0) {
-        fprintf(stderr, "error: could not bind socket: %s\n", strerror(errno));
-        close(accepter->tcp_fd);
-        exit(EXIT_FAILURE);
+    // Swap the segments
+    pthread_mutex_lock(&context->sampler_mutex);
+    LLNetStatsShm_t* old = context->stats_shm;
+    context->stats_shm = shm;
+    bool sampling = context->sample_period_ms != 0;
+    pthread_mutex_unlock(&context->sampler_mutex);
+    if (old != NULL) {
+        statshm_close(old);
     }
 
-    // Setup the listen queue with a length of 4095 (MORE than enough)
-    listen(accepter->tcp_fd, 0xfff);
+    if (shm != NULL && !sampling) {
+        llnet_context_set_sample_period(context, LLNET_PUBLISH_DEFAULT_PERIOD_MS);
+    }
+    return 0;
+}
 
-    // Create the connections list
-    connections = arraylist_init();
+/**
+ * @inherit
+ */
+void llnet_connection_set_on_disconnect(NetConnection_t* connection, void (*on_disconnect)(WorkerConnection_t*)) {
+    connection->on_disconnect = on_disconnect;
+}
 
-    // Spin up the acceptor thread
-    pthread_create(&accepter->accepter_thread, NULL, &_llnet_accepter_thread, (void*) accepter);
+/**
+ * Disconnects every connection an accepter has handed out and waits for their
+ * listeners to reclaim them
+ *
+ * @param accepter the accepter to disconnect the connections of
+ */
+static void _llnet_disconnect_accepted(AccepterConnection_t* accepter) {
+    LLNetContext_t* context = accepter->context;
+    for (size_t i = 0; i < LLNET_REGISTRY_SHARDS; i += 1) {
+        LLNetRegistryShard_t* shard = &context->registry[i];
+        pthread_mutex_lock(&shard->mutex);
+        for (uint32_t pos = 0; pos < shard->length; pos += 1) {
+            if (shard->slots[pos] != NULL && shard->slots[pos]->accepter == accepter) {
+                shutdown(shard->slots[pos]->tcp_fd, SHUT_RDWR);
+            }
+        }
+        pthread_mutex_unlock(&shard->mutex);
+    }
 
-    return accepter;
+    pthread_mutex_lock(&accepter->live_mutex);
+    while (accepter->live_workers > 0) {
+        pthread_cond_wait(&accepter->live_cond, &accepter->live_mutex);
+    }
+    pthread_mutex_unlock(&accepter->live_mutex);
 }
 
 /**
@@ -604,6 +3033,16 @@ void llnet_connection_free(NetConnection_t* connection) {
         // Do worker specific clean-up
         WorkerConnection_t* worker = (WorkerConnection_t*) connection;
 
+        // Accepted connections are reclaimed by their listener once disconnected
+        if (worker->accepter != NULL) {
+            shutdown(worker->tcp_fd, SHUT_RDWR);
+            return;
+        }
+
+        // Send anything still queued or waiting to be bundled
+        _llnet_sender_stop(worker, true);
+        _llnet_bundler_stop(worker, true);
+
         // Clean the TCP thread: cancel it and free resources by calling join
         pthread_cancel(worker->tcp_thread);
         pthread_join(worker->tcp_thread, NULL);
@@ -611,13 +3050,37 @@ void llnet_connection_free(NetConnection_t* connection) {
         // Clean the UDP thread: cancel it and free resources by calling join
         pthread_cancel(worker->udp_thread);
         pthread_join(worker->udp_thread, NULL);
+        _llnet_reliable_stop(worker);
+        _llnet_fec_stop(worker);
+
+        _llnet_registry_remove(worker);
+        if (worker->fec != NULL) {
+            fec_free(worker->fec);
+            worker->fec = NULL;
+        }
+        pthread_mutex_destroy(&worker->tcp_write_mutex);
+        pthread_mutex_destroy(&worker->sender_mutex);
     } else if (connection-> state == cs_ACCEPTER) {
         // Do accepter specific clean-up
         AccepterConnection_t* accepter = (AccepterConnection_t*) connection;
 
-        // Clean the thread: cancel it and free resources by calling join
-        pthread_cancel(accepter->accepter_thread);
-        pthread_join(accepter->accepter_thread, NULL);
+        // Clean the threads: cancel them and free resources by calling join
+        for (uint32_t i = 0; i < accepter->num_shards; i += 1) {
+            pthread_cancel(accepter->shards[i].thread);
+            pthread_join(accepter->shards[i].thread, NULL);
+
+            // The first shard's socket is closed with the rest of the connection
+            if (i != 0) {
+                close(accepter->shards[i].tcp_fd);
+            }
+        }
+        free(accepter->shards);
+        accepter->shards = NULL;
+
+        // Nothing new can come in, so reclaim everything that did
+        _llnet_disconnect_accepted(accepter);
+        pthread_mutex_destroy(&accepter->live_mutex);
+        pthread_cond_destroy(&accepter->live_cond);
     }
 
     close(connection->tcp_fd);
@@ -626,6 +3089,11 @@ void llnet_connection_free(NetConnection_t* connection) {
     close(connection->udp_fd);
     connection->udp_fd = 0;
 
+    if (connection->limiter != NULL) {
+        ratelimit_free(connection->limiter);
+        connection->limiter = NULL;
+    }
+
     free(connection);
 }
 
@@ -16,11 +16,48 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 
+// includes the rate limiter, forward error correction, the reliable channel and socket filters
+#include "ratelimit.h"
+#include "fec.h"
+#include "reliable.h"
+#include "sockfilter.h"
+
+// includes threading types
+#include <pthread.h>
+
 // includes networking types
 #include <sys/socket.h>
 #include <netinet/ip.h>
 
 #define LLNET_HEADER_LENGTH (8)
+#define LLNET_LENGTH_MASK (0x3fffff) // largest payload that can be described by the header
+#define LLNET_FLAG_COMPRESSED (0x800000) // set in the length field when the payload is compressed
+#define LLNET_FLAG_FEC (0x400000) // set in the length field when the payload starts with a FEC tag
+#define LLNET_TYPE_CONTROL (0xfe) // type used for llnet control frames, these never reach on_packet
+#define LLNET_TYPE_FEC (0xfd) // type used for FEC parity frames, these never reach on_packet
+#define LLNET_TYPE_BUNDLE (0xfc) // type used for bundles of frames, these are split before reaching on_packet
+#define LLNET_TYPE_RELIABLE (0xfb) // type used for the reliable UDP channel, these are unwrapped before reaching on_packet
+#define LLNET_BUNDLE_MAX_UDP (1200) // largest bundle sent over UDP (fits in a single datagram on the field)
+#define LLNET_BUNDLE_MAX_TCP (16384) // largest bundle sent over TCP
+#define LLNET_COMPRESS_DEFAULT_THRESHOLD (256) // payloads at least this long are compressed
+#define LLNET_REGISTRY_SHARDS (16) // number of parts a context's connection registry is split into
+#define LLNET_ID_INDEX_BITS (20) // low bits of a connection id select the registry slot, the rest are the generation
+#define LLNET_ID_INDEX_MASK ((1 << LLNET_ID_INDEX_BITS) - 1)
+#define LLNET_ID_GENERATION_MASK (0xfff) // generations wrap around (skipping zero, so no id is zero)
+#define LLNET_CONNECT_DEFAULT_TIMEOUT_MS (1000) // longest llnet_connection_connect waits for the server
+#define LLNET_RESOLVER_ENTRIES (8) // number of host names a context remembers the address of
+#define LLNET_PUBLISH_DEFAULT_PERIOD_MS (100) // sample period used when publishing stats starts sampling
+#define LLNET_RESOLVER_HOST_LENGTH (64) // longest host name that is remembered
+#define LLNET_WRITE_FINISH_MS (5) // longest a non-blocking TCP write waits to finish a frame it started
+#define LLNET_RESOLVER_TTL_MS (30000) // how long a remembered address is used before looking it up again
+
+// Defines the optional features a connection can advertise to the other side
+typedef enum LLNetCapability {
+    llcap_COMPRESSION = 0x01,
+    llcap_FEC         = 0x02,
+    llcap_BUNDLE      = 0x04,
+    llcap_RELIABLE    = 0x08
+} LLNetCapability_t;
 
 // Define an enum that keeps track of the current state of a listener
 typedef enum ListenerStatus {
@@ -42,6 +79,51 @@ typedef enum ConnectionState {
     cs_WORKER
 } ConnectionState_t;
 
+// Defines the counters kept for each worker connection
+// @note every field must be a uint64_t, so that the structure can be read counter-by-counter
+typedef struct LLNetStats {
+    uint64_t rx_packets; // packets handed up the stack
+    uint64_t rx_bytes; // bytes received (including headers)
+    uint64_t tx_packets; // packets sent
+    uint64_t tx_bytes; // bytes sent (including headers)
+    uint64_t rx_dropped_invalid; // packets dropped because they could not be decoded
+    uint64_t rx_dropped_ratelimit; // packets dropped by the rate limiter
+    uint64_t rx_fec_recovered; // lost UDP packets rebuilt from FEC parity
+    uint64_t tx_bundles; // bundles sent (each carrying several packets)
+    uint64_t tx_retransmits; // reliable channel messages sent again
+    uint64_t tx_reliable_failed; // reliable channel messages given up on
+    uint64_t rx_dropped_kernel; // datagrams the kernel dropped because the UDP socket's buffer was full
+} LLNetStats_t;
+
+// Defines the socket buffer sizes for a connection, zero leaves a buffer at the OS default
+// @note the kernel doubles the requested size, and caps it at net.core.rmem_max/wmem_max
+typedef struct LLNetBufferSizes {
+    uint32_t tcp_rcvbuf;
+    uint32_t tcp_sndbuf;
+    uint32_t udp_rcvbuf;
+    uint32_t udp_sndbuf;
+} LLNetBufferSizes_t;
+
+// Defines a sample of the kernel's state for a worker's sockets
+// @note every field must be a uint64_t, so that the structure can be read field-by-field
+typedef struct LLNetSocketStats {
+    uint64_t sampled_ns; // when the sample was taken (monotonic clock), zero if never sampled
+    uint64_t tcp_rx_queued; // bytes waiting to be read from the TCP socket (SIOCINQ)
+    uint64_t tcp_tx_queued; // bytes sent but not yet acknowledged by the other side (SIOCOUTQ)
+    uint64_t udp_rx_next; // length of the next datagram waiting to be read (SIOCINQ)
+    uint64_t udp_rx_mem; // memory used by every datagram waiting to be read
+    uint64_t udp_tx_queued; // bytes waiting to be sent from the UDP socket (SIOCOUTQ)
+    uint64_t tcp_rcvbuf; // actual buffer sizes (after the kernel's adjustments)
+    uint64_t tcp_sndbuf;
+    uint64_t udp_rcvbuf;
+    uint64_t udp_sndbuf;
+    uint64_t tcp_rtt_us; // smoothed round trip time (TCP_INFO)
+    uint64_t tcp_rttvar_us; // round trip time variation
+    uint64_t tcp_retransmits; // segments sent again over the life of the connection
+    uint64_t tcp_lost; // segments currently thought to be lost
+    uint64_t tcp_snd_cwnd; // congestion window, in segments
+} LLNetSocketStats_t;
+
 // Defines a structure to store a minimally decoded packet
 typedef struct IntermediateTLV {
     uint32_t type:8;
@@ -51,6 +133,74 @@ typedef struct IntermediateTLV {
     uint8_t* data;
 } IntermediateTLV_t;
 
+// Defines one part of a context's connection registry. Connections live in
+// slots, and a slot's generation is bumped every time it is emptied so that the
+// ids handed out for an old connection stop resolving.
+typedef struct LLNetRegistryShard {
+    pthread_mutex_t mutex;
+    uint32_t length; // number of slots
+    struct WorkerConnection** slots; // connection in each slot, NULL when empty
+    uint16_t* generations; // current generation of each slot
+} LLNetRegistryShard_t;
+
+// Defines a remembered host name lookup
+typedef struct LLNetResolverEntry {
+    char host[LLNET_RESOLVER_HOST_LENGTH]; // empty if the entry is unused
+    struct in_addr addr;
+    uint64_t expires_ns; // when the address should be looked up again (monotonic clock)
+} LLNetResolverEntry_t;
+
+// Defines the state shared by a set of connections (e.g. one field). Connections
+// in different contexts share nothing, so several can run in one process.
+typedef struct LLNetContext {
+    LLNetRegistryShard_t registry[LLNET_REGISTRY_SHARDS]; // connections, stored by id
+    int32_t time_offset; // this value is added to the timestamp on a send
+    uint32_t next_connection_id; // spreads new connections across the registry
+
+    // host name lookups are remembered, so reconnects don't wait on DNS
+    pthread_mutex_t resolver_mutex;
+    LLNetResolverEntry_t resolver[LLNET_RESOLVER_ENTRIES];
+
+    // socket state is sampled for every connection by a sampler thread
+    pthread_mutex_t sampler_mutex;
+    pthread_cond_t sampler_cond; // signalled when the period changes
+    uint32_t sample_period_ms; // zero if sampling is off
+    bool sampler_started;
+    pthread_t sampler_thread;
+    struct LLNetStatsShm* stats_shm; // where each sample is published, NULL if it isn't
+} LLNetContext_t;
+
+// Defines a queue that finished asynchronous sends are posted to. The eventfd
+// becomes readable whenever completions are waiting, so it can be added to a
+// caller's own poll/epoll loop.
+typedef struct LLNetCompletionQueue {
+    int event_fd; // readable when there are completions to harvest
+    struct Queue* completed; // finished send handles
+} LLNetCompletionQueue_t;
+
+// Defines a handle to an asynchronous send
+typedef struct LLNetSendHandle {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool finished; // true once the send is finished
+    uint32_t rc; // return code of the send (zero on success), valid once finished
+    IntermediateTLV_t* packet; // the packet being sent
+    LLNetCompletionQueue_t* cq; // queue to post to when finished, or NULL
+} LLNetSendHandle_t;
+
+// Defines the frames waiting to be sent together on a connection, one bundle
+// per protocol (indexed by NetworkProtocol_t)
+typedef struct LLNetBundler {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // signalled when a bundle is started or the bundler is stopped
+    bool stop;
+    pthread_t thread; // sends bundles once their window is up
+    uint8_t* pending[2]; // bundle being built, starting with space for its header
+    uint32_t pending_len[2]; // length of each bundle, including the header space
+    uint32_t pending_frames[2]; // number of frames in each bundle (counted as sent once the bundle is)
+    uint64_t deadline_ns[2]; // when each bundle must be sent (monotonic clock)
+} LLNetBundler_t;
+
 // Defines an "abstract" structure to store network connection information
 typedef struct NetConnection {
 #pragma pack(push, 1) // disable struct packing
@@ -60,6 +210,14 @@ typedef struct NetConnection {
     int tcp_fd; // file descriptor of the tcp socket
     int udp_fd; // file descriptor of the udp socket
     void (*on_packet)(uint32_t, IntermediateTLV_t*); // handler function for incoming packets
+    void (*on_disconnect)(struct WorkerConnection*); // handler function for lost connections, may be NULL
+    uint32_t caps; // capabilities this side advertises (see LLNetCapability_t)
+    uint32_t compress_threshold; // minimum payload length that will be compressed
+    uint32_t bundle_window_us; // longest a frame waits to be bundled, zero if bundling is off
+    LLNetLimiter_t* limiter; // incoming packet rate limits, NULL if unlimited
+    LLNetContext_t* context; // context this connection belongs to
+    uint32_t udp_types[LLNET_SOCKFILTER_WORDS]; // types let through the UDP socket filter, all zero if unfiltered
+    LLNetBufferSizes_t buffers; // socket buffer sizes
 
 #pragma pack(pop) // return struct packing
 } NetConnection_t;
@@ -74,6 +232,14 @@ typedef struct WorkerConnection {
     int tcp_fd;
     int udp_fd;
     void (*on_packet)(uint32_t, IntermediateTLV_t*); // handler function for incoming packets
+    void (*on_disconnect)(struct WorkerConnection*);
+    uint32_t caps;
+    uint32_t compress_threshold;
+    uint32_t bundle_window_us;
+    LLNetLimiter_t* limiter;
+    LLNetContext_t* context;
+    uint32_t udp_types[LLNET_SOCKFILTER_WORDS];
+    LLNetBufferSizes_t buffers;
 #pragma pack(pop) // return struct packing
 
     // address of the other connection (used for TCP and UDP)
@@ -86,10 +252,59 @@ typedef struct WorkerConnection {
     ListenerStatus_t udp_status;
     pthread_t udp_thread;
 
-    // connection id
+    // connection id (generation-tagged, see LLNET_ID_INDEX_BITS)
     uint32_t connection_id;
+
+    // accepter that created this connection (which owns and reclaims it), or
+    // NULL if the connection was made with llnet_connection_connect
+    struct AccepterConnection* accepter;
+
+    // references held on an accepted connection (one by its TCP listener, the rest by
+    // llnet_connection_retain), its memory is freed when the last is released
+    uint32_t refs;
+
+    // capabilities advertised by the other side of the connection
+    uint32_t peer_caps;
+
+    // counters for this connection (see llnet_connection_get_stats)
+    LLNetStats_t stats;
+
+    // last sample of the kernel's socket state (see llnet_connection_get_socket_stats)
+    LLNetSocketStats_t socket_stats;
+
+    // forward error correction state, NULL unless FEC is enabled on this side
+    LLNetFec_t* fec;
+
+    // frames waiting to be bundled, NULL unless bundling is enabled on this side
+    LLNetBundler_t* bundler;
+
+    // reliable UDP channel, NULL unless it is enabled on this side
+    LLNetReliable_t* reliable;
+
+    // client that manages (and reconnects) this connection, or NULL
+    struct LLNetClient* client;
+
+    // serializes writes to the TCP stream, so frames from different threads never interleave
+    pthread_mutex_t tcp_write_mutex;
+
+    // asynchronous sends are queued and sent in order by this connection's sender thread,
+    // which is started by the first one
+    pthread_mutex_t sender_mutex; // guards starting and stopping the sender thread
+    bool sender_started;
+    bool sender_closed; // set once the sender is stopped, later sends fail straight away
+    bool sender_drop; // set when queued sends should fail instead of being sent
+    pthread_t sender_thread;
+    struct Queue* send_queue;
 } WorkerConnection_t;
 
+// Defines a single accepter shard: one listening socket and the thread accepting on it
+typedef struct AccepterShard {
+    struct AccepterConnection* accepter; // the accepter this shard belongs to
+    int tcp_fd; // listening socket (all shards share the port using SO_REUSEPORT)
+    int cpu; // core the shard's threads are pinned to, or -1 if not pinned
+    pthread_t thread; // accepter thread
+} AccepterShard_t;
+
 // Defines a structure to store connection information for acceptor threads
 //@inherit from NetConnection_t
 typedef struct AccepterConnection {
@@ -99,30 +314,163 @@ typedef struct AccepterConnection {
     int tcp_fd;
     int udp_fd;
     void (*on_packet)(uint32_t, IntermediateTLV_t*); // handler function for incoming packets
+    void (*on_disconnect)(struct WorkerConnection*);
+    uint32_t caps;
+    uint32_t compress_threshold;
+    uint32_t bundle_window_us;
+    LLNetLimiter_t* limiter;
+    LLNetContext_t* context;
+    uint32_t udp_types[LLNET_SOCKFILTER_WORDS];
+    LLNetBufferSizes_t buffers;
 #pragma pack(pop) // return struct packing
 
     // incoming connection handler
     void (*on_connect)(WorkerConnection_t*);
 
     // thread data
-    pthread_t accepter_thread;
+    pthread_t accepter_thread; // the first shard's thread
+
+    // listening shards
+    uint32_t num_shards;
+    AccepterShard_t* shards;
+
+    // number of accepted connections that have not been reclaimed yet
+    pthread_mutex_t live_mutex;
+    pthread_cond_t live_cond; // signalled when live_workers reaches zero
+    uint32_t live_workers;
 } AccepterConnection_t;
 
 /**
- * Initializes a network connection data structure
+ * Creates a new, empty networking context
+ *
+ * @return the context, or NULL if a memory request failed
+ */
+LLNetContext_t* llnet_context_init();
+
+/**
+ * Gets the default context, which is used by the functions that do not take
+ * a context (e.g. llnet_connection_init)
+ *
+ * @return the default context
+ */
+LLNetContext_t* llnet_context_default();
+
+/**
+ * Sets the offset added to the timestamp of every packet sent in a context
+ *
+ * @param context the context to update
+ * @param offset the offset (in milliseconds)
+ */
+void llnet_context_set_time_offset(LLNetContext_t* context, int32_t offset);
+
+/**
+ * Cleans up a context. All connections in the context must be freed first
+ * (accepted connections are freed with their accepter).
+ *
+ * @param context the context to clean up
+ */
+void llnet_context_free(LLNetContext_t* context);
+
+/**
+ * Initializes a network connection data structure in the default context
  *
  * @return the "abstract" connection data structure
  */
 NetConnection_t* llnet_connection_init();
 
 /**
- * Gets the matching connection for this connection ID
+ * Initializes a network connection data structure in the given context
+ *
+ * @param context the context the connection (and any connection it accepts)
+ *        belongs to
+ * @return the "abstract" connection data structure
+ */
+NetConnection_t* llnet_connection_init_context(LLNetContext_t* context);
+
+/**
+ * Gets the matching connection for this connection ID in the default context
  *
  * @param id the connection ID that needs to be resolved
  * @returns the matching connection for this ID, or NULL if one does not exist
+ *          (including when the connection has disconnected)
  */
 WorkerConnection_t* llnet_connection_get(uint32_t id);
 
+/**
+ * Gets the matching connection for this connection ID in the given context.
+ * Lookups are constant time, and IDs of disconnected connections never
+ * resolve to a newer connection that reuses the slot.
+ *
+ * @param context the context to search
+ * @param id the connection ID that needs to be resolved
+ * @returns the matching connection for this ID, or NULL if one does not exist
+ *          (including when the connection has disconnected)
+ */
+WorkerConnection_t* llnet_context_get(LLNetContext_t* context, uint32_t id);
+
+/**
+ * Gets the matching connection for this connection ID in the given context,
+ * and holds a reference to it (see llnet_connection_retain). Unlike
+ * llnet_context_get, the connection can't be freed while it's being used.
+ *
+ * @param context the context to search
+ * @param id the connection ID that needs to be resolved
+ * @returns the matching connection for this ID, or NULL if one does not exist.
+ *          A connection that is returned must be passed to
+ *          llnet_connection_release once it's no longer needed.
+ */
+WorkerConnection_t* llnet_context_retain(LLNetContext_t* context, uint32_t id);
+
+/**
+ * Holds a reference to an accepted connection, so that its memory is not freed
+ * when it is reclaimed. Must only be called while the connection is known to be
+ * alive (e.g. from its on_connect or on_disconnect handler, or from
+ * llnet_context_foreach). Connections made with llnet_connection_connect are
+ * not reference counted, they are freed by llnet_connection_free.
+ *
+ * @param connection the connection to hold
+ * @note sends on a connection that has been reclaimed fail (or are lost, for UDP)
+ */
+void llnet_connection_retain(WorkerConnection_t* connection);
+
+/**
+ * Releases a reference held by llnet_connection_retain or llnet_context_retain.
+ * The connection must not be used afterwards.
+ *
+ * @param connection the connection to release
+ */
+void llnet_connection_release(WorkerConnection_t* connection);
+
+/**
+ * Gets the timestamp a packet sent now would have (milliseconds, including the
+ * context's time offset)
+ *
+ * @param context the context to get the time of
+ * @returns the timestamp
+ */
+uint32_t llnet_context_timestamp(LLNetContext_t* context);
+
+/**
+ * Calls a function on every connected worker in a context. Connections can't
+ * be reclaimed while the function runs on them, but connections may not be
+ * made or lost from inside the function.
+ *
+ * @param context the context to go through
+ * @param (*fn) the function to call, passed the connection and arg
+ * @param arg passed to the function
+ * @returns the number of connections the function was called on
+ */
+uint32_t llnet_context_foreach(LLNetContext_t* context, void (*fn)(WorkerConnection_t*, void*), void* arg);
+
+/**
+ * Creates a new (unconnected) connection with the same context and settings
+ * as another, e.g. to try connecting again after a connection is lost
+ *
+ * @param other the connection to copy the settings of
+ * @return the new connection
+ */
+NetConnection_t* llnet_connection_init_from(NetConnection_t* other);
+
 /**
  * Connects the client to a server. This process converts the connection to a 
  * client connection, connects to the server over TCP and configures the UDP
@@ -139,12 +487,48 @@ WorkerConnection_t* llnet_connection_get(uint32_t id);
  *        contains the recieved data.
  * @note If the router is configured as a DNS server (and is used as the DNS
  *       server) where DHCP connections are registered as DNS entries, this will 
- *       allow hostnames ("ritfirst-fms") to successfully lookup.
- * @returns the converted network connection structure.
+ *       allow hostnames ("ritfirst-fms") to successfully lookup. Lookups are
+ *       remembered by the context (see LLNET_RESOLVER_TTL_MS), and the last
+ *       known address is used if a lookup fails.
+ * @note This waits at most LLNET_CONNECT_DEFAULT_TIMEOUT_MS for the server.
+ *       It used to block until the OS gave up, which takes over a minute
+ *       with the default SYN retries. Callers that relied on the long wait
+ *       (e.g. a server that takes a while to come up) should use
+ *       llnet_connection_connect_timeout with a larger timeout.
+ * @returns the converted network connection structure. If the connection could
+ *          not be made, its state is not cs_WORKER and it should be freed.
  */
 WorkerConnection_t* llnet_connection_connect(NetConnection_t* connection, 
     char* host, void (*handler)(uint32_t, IntermediateTLV_t*));
 
+/**
+ * Connects the client to a server, giving up if the server doesn't answer in
+ * time (see llnet_connection_connect)
+ *
+ * @param connection the network connection to use to connect
+ * @param host the host to connect to
+ * @param (*handler) the handler function that gets called on every incoming packet
+ * @param timeout_ms the longest to wait for the server to answer
+ * @returns the converted network connection structure
+ */
+WorkerConnection_t* llnet_connection_connect_timeout(NetConnection_t* connection,
+    char* host, void (*handler)(uint32_t, IntermediateTLV_t*), uint32_t timeout_ms);
+
+/**
+ * Connects a client's connection to a server (see llnet_connection_connect_timeout).
+ * The client is attached before the listener threads start, so on_disconnect
+ * can't see the connection without it.
+ *
+ * @param connection the network connection to use to connect
+ * @param host the host to connect to
+ * @param (*handler) the handler function that gets called on every incoming packet
+ * @param timeout_ms the longest to wait for the server to answer
+ * @param client the client that manages the connection
+ * @returns the converted network connection structure
+ */
+WorkerConnection_t* llnet_connection_connect_client(NetConnection_t* connection,
+    char* host, void (*handler)(uint32_t, IntermediateTLV_t*), uint32_t timeout_ms, struct LLNetClient* client);
+
 /**
  * Sends a packet over the network
  *
@@ -154,13 +538,65 @@ WorkerConnection_t* llnet_connection_connect(NetConnection_t* connection,
  * @param proto the protocol to use (TCP vs UDP); this should match the definition
  *        in the control protocol.
  * @param packet the packet to send out, in IntermediateTLV form. The timestamp
- *        value in this packet is overwritten with the sent time.
+ *        value in this packet is overwritten with the sent time. Payloads longer
+ *        than LLNET_LENGTH_MASK can't be described by the header, and are refused.
  * @returns the error code from the failed OS interaction, if one occured. A result
  *          of zero indicates success.
  */
 uint32_t llnet_connection_send(WorkerConnection_t* connection,
     NetworkProtocol_t proto, IntermediateTLV_t* packet);
 
+/**
+ * Sends a frame that was encoded in place (see the pack functions in
+ * packethandlers.h). The frame is stamped with the send time and goes out the
+ * same way as llnet_connection_send, except that it is never compressed and
+ * the payload is not copied unless the frame is bundled.
+ *
+ * @param connection the connection to send the frame out using
+ * @param proto the protocol to use (TCP vs UDP)
+ * @param frame the frame, header first. The timestamp in the header is
+ *        overwritten with the sent time.
+ * @param len the length of the frame (header and payload). Frames with a
+ *        payload longer than LLNET_LENGTH_MASK are refused.
+ * @returns the error code from the failed OS interaction, if one occured. A
+ *          result of zero indicates success.
+ */
+uint32_t llnet_connection_send_packed(WorkerConnection_t* connection, NetworkProtocol_t proto, uint8_t* frame,
+    uint32_t len);
+
+/**
+ * Writes an already encoded frame straight to a connection's socket, skipping
+ * compression, bundling, FEC and the send queues. The write doesn't block: if
+ * the socket's buffer is full, or another thread is writing to the TCP stream,
+ * the frame is not sent. A TCP frame that only partly fits is finished (waiting
+ * at most LLNET_WRITE_FINISH_MS), and if it can't be, the connection is shut
+ * down rather than left out of step with its framing.
+ *
+ * @param connection the connection to write to
+ * @param proto the socket to write to
+ * @param frame the frame (header and payload), sent as-is
+ * @param len the length of the frame
+ * @returns the length of the frame once all of it is written, or -1 (with errno set)
+ */
+int llnet_connection_write_frame(WorkerConnection_t* connection, NetworkProtocol_t proto, const uint8_t* frame,
+    uint32_t len);
+
+/**
+ * Sends a packet over the connection's reliable UDP channel. The packet is
+ * numbered, and sent again until the other side acknowledges it, so it
+ * arrives without waiting behind anything on the TCP socket. The other side
+ * hands reliable packets to on_packet in the order they were sent.
+ *
+ * @param connection the connection to send the packet out using. Both sides
+ *        must have enabled the reliable channel (see llnet_connection_set_reliable).
+ * @param packet the packet to send out, in IntermediateTLV form. The packet
+ *        is copied, so it can be freed as soon as this returns.
+ * @returns zero once the packet is sent (lost sends are retried), or an error
+ *          code if there is no reliable channel or too many packets are still
+ *          waiting to be acknowledged
+ */
+uint32_t llnet_connection_send_reliable(WorkerConnection_t* connection, IntermediateTLV_t* packet);
+
 /**
  * Sends a packet over the network in a new thread
  *
@@ -177,6 +613,73 @@ uint32_t llnet_connection_send(WorkerConnection_t* connection,
 void llnet_connection_send_thread(WorkerConnection_t* connection,
     NetworkProtocol_t proto, IntermediateTLV_t* packet, uint32_t* rc, bool* finished);
 
+/**
+ * Sends a packet over the network asynchronously. Sends are queued and sent in
+ * order by a sender thread owned by the connection, so a slow connection
+ * doesn't hold up sends on any other. The thread is started by the first
+ * asynchronous send on the connection.
+ *
+ * @param connection the connection to send the packet out using
+ * @param proto the protocol to use (TCP vs UDP)
+ * @param packet the packet to send out, in IntermediateTLV form. The packet
+ *        must not be changed or freed until the send has finished. Payloads
+ *        longer than LLNET_LENGTH_MASK are refused (the send finishes at once
+ *        with an error).
+ * @param cq the completion queue to post the handle to when the send finishes,
+ *        or NULL to only use llnet_send_wait
+ * @returns the handle for the send, which must be freed with
+ *          llnet_send_handle_free once the send has finished. If a cq was
+ *          given, the handle must only be freed after it has been taken off
+ *          the cq by llnet_cq_harvest.
+ */
+LLNetSendHandle_t* llnet_connection_send_async(WorkerConnection_t* connection,
+    NetworkProtocol_t proto, IntermediateTLV_t* packet, LLNetCompletionQueue_t* cq);
+
+/**
+ * Waits for an asynchronous send to finish
+ *
+ * @param handle the send to wait for
+ * @param timeout_ms the longest time to wait (in milliseconds). Zero checks
+ *        without waiting, a negative value waits forever.
+ * @param rc set to the return code of the send if it has finished (may be NULL)
+ * @returns true if the send has finished, false if the wait timed out
+ */
+bool llnet_send_wait(LLNetSendHandle_t* handle, int32_t timeout_ms, uint32_t* rc);
+
+/**
+ * Cleans up the handle of a finished asynchronous send. A handle bound to a
+ * completion queue must not be freed until llnet_cq_harvest has returned it,
+ * even if llnet_send_wait has already seen it finish.
+ *
+ * @param handle the handle to clean up
+ */
+void llnet_send_handle_free(LLNetSendHandle_t* handle);
+
+/**
+ * Creates a completion queue for asynchronous sends
+ *
+ * @return the completion queue, or NULL if a memory request failed
+ */
+LLNetCompletionQueue_t* llnet_cq_init();
+
+/**
+ * Takes finished sends off of a completion queue. The returned handles are
+ * finished and no longer used by the library, so they can be freed.
+ *
+ * @param cq the completion queue
+ * @param handles array to store the finished handles in
+ * @param max the length of the handles array
+ * @returns the number of handles stored
+ */
+uint32_t llnet_cq_harvest(LLNetCompletionQueue_t* cq, LLNetSendHandle_t** handles, uint32_t max);
+
+/**
+ * Cleans up a completion queue. Any handles still on it are not freed.
+ *
+ * @param cq the completion queue to clean up
+ */
+void llnet_cq_free(LLNetCompletionQueue_t* cq);
+
 /**
  * Sets this network connection to an acceptor connection. This is done by
  * reconfiguring the TCP and UDP sockets as necessary and spinning up an acceptor
@@ -200,10 +703,207 @@ void llnet_connection_send_thread(WorkerConnection_t* connection,
 AccepterConnection_t* llnet_connection_listen(NetConnection_t* connection,
     void (*on_connect)(WorkerConnection_t*), void (*on_packet)(uint32_t, IntermediateTLV_t*));
 
+/**
+ * Enables or disables payload compression on a connection. Compression is only
+ * used once both sides of a connection have enabled it, and is transparent to
+ * the packet handlers (payloads are decompressed before on_packet is called).
+ *
+ * @param connection the connection to configure. If this is an accepter, all
+ *        connections accepted afterwards inherit the setting. If this is a
+ *        worker, the new setting is advertised to the other side immediately.
+ * @param enabled true to allow compression on this connection
+ * @param threshold the minimum payload length (in bytes) that will be compressed
+ */
+void llnet_connection_set_compression(NetConnection_t* connection, bool enabled, uint32_t threshold);
+
+/**
+ * Enables or disables forward error correction on a connection's UDP traffic.
+ * Small frames are sent in groups followed by an XOR parity frame, so a single
+ * lost frame per group is rebuilt by the receiver without a resend. The group
+ * size shrinks (more parity) as the other side reports more loss. FEC is only
+ * used once both sides have enabled it.
+ *
+ * @param connection the connection to configure. If this is an accepter, all
+ *        connections accepted afterwards inherit the setting. If this is a
+ *        worker, the new setting is advertised to the other side immediately.
+ * @param enabled true to allow FEC on this connection
+ */
+void llnet_connection_set_fec(NetConnection_t* connection, bool enabled);
+
+/**
+ * Enables or disables bundling on a connection. Small frames sent within the
+ * window are packed into a single TCP write or UDP datagram, and split back
+ * into separate on_packet calls by the other side. Bundling is only used once
+ * both sides have enabled it.
+ *
+ * @param connection the connection to configure. If this is an accepter, all
+ *        connections accepted afterwards inherit the setting. If this is a
+ *        worker, the new setting is advertised to the other side immediately.
+ * @param window_us the longest time (in microseconds) a frame waits for others
+ *        to be bundled with, zero to disable bundling
+ * @note while bundling, llnet_connection_send returns once the frame is waiting,
+ *       so errors from the eventual write are only counted, not returned
+ */
+void llnet_connection_set_bundling(NetConnection_t* connection, uint32_t window_us);
+
+/**
+ * Filters the UDP socket of a connection in the kernel. Datagrams that are
+ * shorter than a header, have a type that isn't listed, or have a length field
+ * that doesn't match the datagram are dropped before they are copied out of
+ * the kernel. llnet's own frame types are always let through.
+ *
+ * @param connection the connection to filter. If this is an accepter, all
+ *        connections accepted afterwards are filtered.
+ * @param types the packet types to let through (see PACKET_TYPES), or NULL to
+ *        remove the filter
+ * @param num_types the number of types
+ * @returns zero on success, or an error code if the filter couldn't be attached
+ */
+uint32_t llnet_connection_set_udp_filter(NetConnection_t* connection, const uint8_t* types, uint32_t num_types);
+
+/**
+ * Enables or disables the reliable UDP channel on a connection (see
+ * llnet_connection_send_reliable). The channel is only used once both sides
+ * have enabled it.
+ *
+ * @param connection the connection to configure. If this is an accepter, all
+ *        connections accepted afterwards inherit the setting. If this is a
+ *        worker, the new setting is advertised to the other side immediately.
+ * @param enabled true to allow the reliable channel on this connection
+ */
+void llnet_connection_set_reliable(NetConnection_t* connection, bool enabled);
+
+/**
+ * Limits the rate of incoming packets on a connection. Packets over the limit
+ * are dropped as soon as their header is decoded, before any memory is
+ * allocated for them.
+ *
+ * @param connection the connection to limit. If this is an accepter, all
+ *        connections accepted afterwards get their own copy of the limits.
+ * @param type the packet type to limit, or LLNET_RATELIMIT_ALL to limit every
+ *        packet on the connection
+ * @param rate the number of packets per second to allow, zero for no limit
+ * @param burst the number of packets that may arrive back-to-back
+ */
+void llnet_connection_set_ratelimit(NetConnection_t* connection, int32_t type, uint32_t rate, uint32_t burst);
+
+/**
+ * Gets a snapshot of a connection's counters
+ *
+ * @param connection the connection to get the counters for
+ * @param stats the structure to copy the counters into
+ */
+void llnet_connection_get_stats(WorkerConnection_t* connection, LLNetStats_t* stats);
+
+/**
+ * Gets the number of packets of a given type dropped by the rate limiter
+ *
+ * @param connection the connection to check
+ * @param type the packet type
+ * @returns the number of dropped packets
+ */
+uint64_t llnet_connection_get_ratelimit_drops(WorkerConnection_t* connection, uint8_t type);
+
+/**
+ * Sets the socket buffer sizes of a connection. Larger UDP receive buffers let
+ * a connection ride out bursts without the kernel dropping datagrams (see
+ * rx_dropped_kernel in the stats).
+ *
+ * @param connection the connection to configure. If this is an accepter, the
+ *        sizes are used for every connection it accepts (so the FMS and the
+ *        robots can be sized separately). TCP buffers are best set before
+ *        connecting, as they decide the window the connection starts with.
+ * @param sizes the sizes to use (copied)
+ */
+void llnet_connection_set_buffers(NetConnection_t* connection, LLNetBufferSizes_t* sizes);
+
+/**
+ * Samples the kernel's state for a connection's sockets now
+ *
+ * @param connection the connection to sample
+ * @param stats the structure to copy the sample into, may be NULL
+ */
+void llnet_connection_sample_sockets(WorkerConnection_t* connection, LLNetSocketStats_t* stats);
+
+/**
+ * Gets the last sample of the kernel's state for a connection's sockets (see
+ * llnet_context_set_sample_period and llnet_connection_sample_sockets)
+ *
+ * @param connection the connection to get the sample for
+ * @param stats the structure to copy the sample into
+ */
+void llnet_connection_get_socket_stats(WorkerConnection_t* connection, LLNetSocketStats_t* stats);
+
+/**
+ * Samples the kernel's state for every connection in a context periodically
+ *
+ * @param context the context to sample
+ * @param period_ms the time between samples, zero to stop sampling
+ */
+void llnet_context_set_sample_period(LLNetContext_t* context, uint32_t period_ms);
+
+/**
+ * Publishes every connection's counters and socket sample into a shared memory
+ * segment after each sample, for tools like llnet-top to read. Publishing only
+ * copies the counters the connections already keep, so packets are never slowed
+ * down by it.
+ *
+ * @param context the context to publish
+ * @param name the name of the segment (see LLNET_STATSHM_DEFAULT_NAME), or NULL
+ *        to stop publishing. If the context isn't being sampled, sampling is
+ *        started every LLNET_PUBLISH_DEFAULT_PERIOD_MS.
+ * @returns 0 on success, -1 if the segment couldn't be created
+ */
+int llnet_context_publish_stats(LLNetContext_t* context, const char* name);
+
+/**
+ * Sets this network connection to a sharded acceptor connection. This works
+ * the same as llnet_connection_listen, but opens several listening sockets on
+ * the same port (using SO_REUSEPORT) so the kernel spreads new connections
+ * across them. Each shard has its own accepter thread, and that thread and the
+ * listener threads of every connection it accepts are pinned to one core.
+ *
+ * @param connection the network connection to use to accept new connections.
+ *        This structure will be converted to a AccepterConnection structure,
+ *        it's memory will be realloc'd by this function and returned.
+ * @param num_shards the number of listening sockets to open (usually the
+ *        number of cores to spread connection handling across)
+ * @param (*on_connect) the handler function that is called after every new
+ *        connection (may be called from any shard's thread)
+ * @param (*on_packet) the handler function that gets called on every incoming packet
+ * @returns the converted network connection structure.
+ * @note connection IDs stay unique across all shards, so llnet_connection_get
+ *       works the same as it does with a single shard
+ */
+AccepterConnection_t* llnet_connection_listen_sharded(NetConnection_t* connection, uint32_t num_shards,
+    void (*on_connect)(WorkerConnection_t*), void (*on_packet)(uint32_t, IntermediateTLV_t*));
+
+/**
+ * Sets the handler called when the other side of a connection goes away. The
+ * handler runs on the connection's TCP listener thread, after the connection
+ * has been removed from the registry.
+ *
+ * @param connection the connection to watch. If this is an accepter, all
+ *        connections accepted afterwards use the handler.
+ * @param (*on_disconnect) the handler function, or NULL to remove it
+ * @note connections made by an accepter are reclaimed (threads joined, then
+ *       sockets closed and memory freed) as soon as the handler returns, so they
+ *       must not be used afterwards. Holding a reference with
+ *       llnet_connection_retain puts off closing and freeing until it's released.
+ *       Asynchronous sends still queued on them fail (their handles finish with
+ *       an error) rather than being sent.
+ */
+void llnet_connection_set_on_disconnect(NetConnection_t* connection, void (*on_disconnect)(WorkerConnection_t*));
+
 /**
  * Cleans up the network connection
  *
  * @param connection the network connection structure to clean up
+ * @note freeing an accepter disconnects and reclaims every connection it
+ *       accepted. Freeing an accepted connection only disconnects it, it is
+ *       then reclaimed like any other lost connection. Freeing a connection made
+ *       with llnet_connection_connect sends any asynchronous sends still queued
+ *       on it first.
  */
 void llnet_connection_free(NetConnection_t* connection);
 
@@ -1,70 +1,49 @@
 //
 // Created by Alex Kneipp on 2/15/20.
 //
+#include <stdlib.h>
+#include <stdbool.h>
 #include "messagehandler.h"
-#include "hashtable.h"
-#include "queue.h"
+#include "packethandlers.h"
 
-//Global static array so we can iterate over every type of packet easily
-static PacketType_t PTYPES[NUM_PACKET_TYPES] = {
-    pt_INIT,
-    pt_STATE_REQUEST,
-    pt_STATE_RESPONSE,
-    pt_STATE_UPDATE,
-    pt_CONFIG_REQUEST,
-    pt_CONFIG_RESPONSE,
-    pt_CONFIG_UPDATE,
-    pt_USER_DATA,
-    pt_UPDATE_STATUS,
-    pt_DEBUG
+//The dispatch table, indexed by the packet type byte.  Types without an unpacker are unknown.
+static MHDispatchEntry_t dispatch[MH_DISPATCH_ENTRIES] = {
+    [pt_INIT]            = { unpackInit,           destroyInit,           NULL, NULL },
+    [pt_STATE_REQUEST]   = { unpackStateRequest,   destroyStateRequest,   NULL, NULL },
+    [pt_STATE_RESPONSE]  = { unpackStateResponse,  destroyStateResponse,  NULL, NULL },
+    [pt_STATE_UPDATE]    = { unpackStateUpdate,    destroyStateUpdate,    NULL, NULL },
+    [pt_CONFIG_REQUEST]  = { unpackConfigRequest,  destroyConfigRequest,  NULL, NULL },
+    [pt_CONFIG_RESPONSE] = { unpackConfigResponse, destroyConfigResponse, NULL, NULL },
+    [pt_CONFIG_UPDATE]   = { unpackConfigUpdate,   destroyConfigUpdate,   NULL, NULL },
+    [pt_USER_DATA]       = { unpackUserData,       destroyUserData,       NULL, NULL },
+    [pt_UPDATE_STATUS]   = { unpackUpdateStatus,   destroyUpdateStatus,   NULL, NULL },
+    [pt_DEBUG]           = { unpackDebug,          destroyDebug,          NULL, NULL }
 };
 
-// Key type = PacketType_t, Value type = Queue_t* <PTLVData_Base*>
-static HashTable_t buckets = NULL;
-
-static uint32_t hash_PacketType(void* pt)
-{
-    return (uint32_t)((PacketType_t)(pt));
-}
+//Global static array so we can iterate over every type of packet easily
+static const PacketType_t PTYPES[NUM_PACKET_TYPES] = PACKET_TYPES;
 
-static int equals_PacketType(void* pt1, void* pt2)
-{
-    return (pt1 == pt2)
-}
+static bool initialized = false;
 
+//Packets dropped because nothing knows how to unpack them
+static uint64_t unknownCount = 0;
 
 int mh_init()
 {
-    if(buckets != NULL)
+    if(initialized)
     {
         return MH_ERR_ALREADY_INITIALIZED;
     }
-    //Initialize the buckets hashtable
-    //Use 2 times NUM_PACKET_TYPES as this is the smallest integer multiplication to ensure the table doesn't rehash
-    buckets = hashtable_initSize(hash_PacketType, equals_PacketType, NULL, 2 * NUM_PACKET_TYPES);
-    //Buckets failed to initialize, this error is non-recoverable.  Return err.
-    if(buckets == NULL)
-    {
-        return MH_ERR_INITIALIZATION_FAILED;
-    }
+    initialized = true;
     // Assume we'll succeed from this point
     int rval = MH_SUCCESS;
     // Create a bucket for each packet type
     for(int i = 0; i < NUM_PACKET_TYPES; i++)
     {
         //Create the queue for this packet type
-        Queue_t* bucketQueue = queue_init();
-        //Queue creation succeeded
-        if (bucketQueue != NULL)
-        {
-            //hashtable insertion failed, but this is potentially recoverable, return a warning but continue
-            if(hashtable_put(buckets, PTYPES[i], bucketQueue) == 0)
-            {
-                rval = MH_WRN_INITIALIZATION_INCOMPLETE;
-            }
-        }
+        dispatch[PTYPES[i]].bucket = queue_init();
         //Queue creation failed, but this is potentially recoverable, return a warning but continue
-        else
+        if(dispatch[PTYPES[i]].bucket == NULL)
         {
             rval = MH_WRN_INITIALIZATION_INCOMPLETE;
         }
@@ -73,32 +52,104 @@ int mh_init()
     return rval;
 }
 
-void sort_packet(IntermediateTLV_t* packet)
+void mh_sort_packet(uint32_t connectionId, IntermediateTLV_t* packet)
+{
+    MHDispatchEntry_t* entry = &dispatch[packet->type];
+    //Nothing knows how to unpack this type, drop it
+    if(entry->unpack == NULL)
+    {
+        __atomic_fetch_add(&unknownCount, 1, __ATOMIC_RELAXED);
+        llnet_packet_free(packet);
+        return;
+    }
+
+    //The unpacker always frees the raw packet
+    PacketTLV_t* unpacked = entry->unpack(packet);
+    if(unpacked == NULL)
+    {
+        return;
+    }
+
+    //Hand it to the user if they asked for this type
+    MHHandler_t handler = __atomic_load_n(&entry->handler, __ATOMIC_ACQUIRE);
+    if(handler != NULL)
+    {
+        handler(connectionId, unpacked);
+        return;
+    }
+
+    //Otherwise it waits in the bucket, try to repair a bucket that failed to initialize
+    Queue_t* bucket = __atomic_load_n(&entry->bucket, __ATOMIC_ACQUIRE);
+    if(bucket == NULL)
+    {
+        Queue_t* fresh = queue_init();
+        //Another thread may have repaired it first
+        if(fresh != NULL && !__atomic_compare_exchange_n(&entry->bucket, &bucket, fresh, false, __ATOMIC_ACQ_REL,
+                __ATOMIC_ACQUIRE))
+        {
+            queue_free(fresh);
+        }
+        else
+        {
+            bucket = fresh;
+        }
+    }
+    if(bucket == NULL || queue_enqueue(bucket, unpacked) != LIST_OKAY)
+    {
+        entry->destroy(unpacked);
+    }
+}
+
+int mh_set_handler(PacketType_t type, MHHandler_t handler)
+{
+    MHDispatchEntry_t* entry = &dispatch[type & 0xff];
+    if(entry->unpack == NULL)
+    {
+        return MH_ERR_UNKNOWN_TYPE;
+    }
+    __atomic_store_n(&entry->handler, handler, __ATOMIC_RELEASE);
+    return MH_SUCCESS;
+}
+
+PacketTLV_t* mh_get_packet(PacketType_t type)
 {
-    //TODO Get packet from ll interface,
-    //Pass IntermediateTLV_t* to the correct unpacker,
-    //Get the unpacked packet and put it in the correct bucket.
-    switch(packet->type)
+    Queue_t* bucket = dispatch[type & 0xff].bucket;
+    if(bucket == NULL)
     {
-        case pt_INIT:
-            break;
-        case pt_STATE_REQUEST:
-            break;
-        case pt_STATE_RESPONSE:
-            break;
-        case pt_STATE_UPDATE:
-            break;
-        case pt_CONFIG_REQUEST:
-            break;
-        case pt_CONFIG_RESPONSE:
-            break;
-        case pt_CONFIG_UPDATE:
-            break;
-        case pt_USER_DATA:
-            break;
-        case pt_UPDATE_STATUS:
-            break;
-        case pt_DEBUG:
-            break;
+        return NULL;
+    }
+    return (PacketTLV_t*)queue_dequeue(bucket);
+}
+
+void mh_destroy_packet(PacketTLV_t* packet)
+{
+    dispatch[packet->type].destroy(packet);
+}
+
+uint64_t mh_get_unknown_count()
+{
+    return __atomic_load_n(&unknownCount, __ATOMIC_RELAXED);
+}
+
+void mh_free()
+{
+    for(int i = 0; i < NUM_PACKET_TYPES; i++)
+    {
+        MHDispatchEntry_t* entry = &dispatch[PTYPES[i]];
+        entry->handler = NULL;
+        if(entry->bucket == NULL)
+        {
+            continue;
+        }
+        //Destroy anything nobody picked up
+        PacketTLV_t* packet;
+        while((packet = queue_dequeue(entry->bucket)) != NULL)
+        {
+            entry->destroy(packet);
+        }
+        queue_free(entry->bucket);
+        entry->bucket = NULL;
     }
+    unknownCount = 0;
+    initialized = false;
 }
@@ -2,16 +2,49 @@
 // Created by Alex Kneipp on 2/15/20.
 //
 
+/**
+ * @file messagehandler.h
+ * Routes packets from the low-level network interface to the right unpacker, then either to a user handler or to a
+ * bucket for that packet type.  Routing is done with a 256-entry table indexed by the packet's type byte, so every
+ * packet costs one indexed load and one indirect call no matter how many types there are.
+ */
+
 #ifndef INC_2020_CORE_CODE_MESSAGEHANDLER_H
 #define INC_2020_CORE_CODE_MESSAGEHANDLER_H
 
+#include <stdint.h>
 #include "packet.h"
 #include "lowlevel.h"
+#include "../collections/queue.h"
 
 #define MH_SUCCESS 0
 #define MH_ERR_ALREADY_INITIALIZED 1
 #define MH_ERR_INITIALIZATION_FAILED 2
 #define MH_WRN_INITIALIZATION_INCOMPLETE 3
+#define MH_ERR_UNKNOWN_TYPE 4
+
+#define MH_DISPATCH_ENTRIES 256
+
+/**
+ * Function called with each unpacked packet of a type.  The handler owns the packet and must give it back with
+ * mh_destroy_packet().
+ */
+typedef void (*MHHandler_t)(uint32_t connectionId, PacketTLV_t* packet);
+
+/**
+ * One entry in the dispatch table.
+ */
+typedef struct MHDispatchEntry
+{
+    //Turns the raw packet into a PacketTLV_t*, NULL if the type is unknown
+    PacketTLV_t* (*unpack)(IntermediateTLV_t*);
+    //Cleans up a packet returned by unpack
+    void (*destroy)(PacketTLV_t*);
+    //Unpacked packets wait here when there is no handler, Queue_t* <PacketTLV_t*>
+    Queue_t* bucket;
+    //Optional user handler, takes the place of the bucket
+    MHHandler_t handler;
+} MHDispatchEntry_t;
 
 /**
  * Initializes internal memory for the message handler.
@@ -30,4 +63,55 @@
  */
 int mh_init();
 
+/**
+ * Unpacks a packet and routes it to the handler for its type, or to its type's bucket if there is no handler.
+ * Packets of unknown types are counted and dropped.  This has the same signature as the low-level on_packet callback,
+ * so it can be given to the low-level interface directly.
+ * This function will always attempt to free \p packet.
+ * @param connectionId
+ *  The connection the packet came in on.
+ * @param packet
+ *  The packet which was received by the low-level network interface.
+ */
+void mh_sort_packet(uint32_t connectionId, IntermediateTLV_t* packet);
+
+/**
+ * Sets the handler for a packet type.  Packets of that type skip the bucket and go straight to the handler.
+ * @param type
+ *  The packet type to handle.
+ * @param handler
+ *  The handler, or NULL to go back to putting packets in the bucket.
+ * @return
+ *  MH_SUCCESS, or MH_ERR_UNKNOWN_TYPE if there is no unpacker for \p type
+ */
+int mh_set_handler(PacketType_t type, MHHandler_t handler);
+
+/**
+ * Takes the oldest packet out of a type's bucket.
+ * @param type
+ *  The packet type to get.
+ * @return
+ *  The packet (to be given back with mh_destroy_packet()), or NULL if the bucket is empty.
+ */
+PacketTLV_t* mh_get_packet(PacketType_t type);
+
+/**
+ * Cleans up a packet from mh_get_packet() or a handler, using the destroyer for its type.
+ * @param packet
+ *  The packet to clean up.
+ */
+void mh_destroy_packet(PacketTLV_t* packet);
+
+/**
+ * Gets the number of packets dropped because their type was unknown.
+ * @return
+ *  The number of packets.
+ */
+uint64_t mh_get_unknown_count();
+
+/**
+ * Cleans up the message handler, destroying any packets still in the buckets.  mh_init() may be called again after.
+ */
+void mh_free();
+
 #endif //INC_2020_CORE_CODE_MESSAGEHANDLER_H
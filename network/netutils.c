@@ -4,6 +4,8 @@
  */
 
 #include "netutils.h"
+#include "keyintern.h"
+#include "packetview.h"
 #include <string.h>
 #include <malloc.h>
 
@@ -17,8 +19,17 @@ KVPairTLV_t* KVPairTLV_create(const char* key, KVPair_Type_t type, size_t length
         //TODO log message
         return NULL;
     }
-    kvPair->key = (char*) malloc(strlen(key) + 1);
-    strcpy(kvPair->key, key);
+    //Keys are interned, so the same key is only ever copied once; if the table is full, keep our own copy
+    uint32_t keyId = intern_key(key, strlen(key));
+    if(keyId != INTERN_NONE)
+    {
+        kvPair->key = (char*)intern_name(keyId);
+    }
+    else
+    {
+        kvPair->key = (char*) malloc(strlen(key) + 1);
+        strcpy(kvPair->key, key);
+    }
     //Copy the type
     kvPair->type = type;
     kvPair->length = length;
@@ -34,50 +45,30 @@ KVPairTLV_t* KVPairTLV_create(const char* key, KVPair_Type_t type, size_t length
 }
 
 ///Create a new KVPairTLV from a buffer in memory
-KVPairTLV_t* KVPairTLV_createFromMemory(const char* start, char** end)
+KVPairTLV_t* KVPairTLV_createFromMemory(const char* start, const char* limit, char** end)
 {
-    const char* key = (const char*)start;
-    size_t keyLen = strlen(key);
-    if(keyLen == 0)
+    //Decode with the same checks as a received packet, so nothing is read past the limit
+    PViewKVIter_t iter;
+    iter.pos = (const uint8_t*)start;
+    iter.end = (const uint8_t*)limit;
+    iter.malformed = false;
+    PViewKV_t kv;
+    KVPair_Value_u value;
+    if(start >= limit || !pview_kv_next(&iter, &kv) || !pview_kv_value(&kv, &value))
     {
         *end = NULL;
         return NULL;
     }
-    //The start of the value is at the start of the buffer + length of the key + nul terminator.
-    const char* TLVStart = (char*)start+keyLen+1;
-    //The type is just the first byte of the buffer
-    KVPair_Type_t type = (KVPair_Type_t)(*(TLVStart));
-    //Next 3 bytes are length of full TLV, so subtract 4 for header
-    size_t valueLength = (TLVStart[1] << 16 | TLVStart[2] << 8 | TLVStart[3]) - 4;
-    KVPair_Value_u value;
-    char* valStart = (char*)(TLVStart + 4);
-    switch(type)
-    {
-        case kv_CString:
-            value.CString = valStart;
-            break;
-        case kv_Integer:
-            value.Integer = *((int32_t*)(valStart));
-            break;
-        case kv_Double:
-            value.Double = *((double*)(valStart));
-            break;
-        case kv_Float:
-            value.Float = *((float*)(valStart));
-            break;
-        case kv_Boolean:
-            value.Boolean = *((int8_t*)(valStart));
-            break;
-    }
-    *end = valStart+valueLength;
-    return KVPairTLV_create(key, type, valueLength+4, value);
+    *end = (char*)(kv.value + kv.value_length);
+    return KVPairTLV_create(kv.key, kv.type, kv.value_length + 4, value);
 }
 
 ///Check if two KVPairTLV's are equal
 bool KVPairTLV_equals(KVPairTLV_t* kv1, KVPairTLV_t* kv2)
 {
     //If the metadata isn't equal, it doesn't make sense to check the values
-    if(strcmp(kv1->key, kv2->key))
+    //Pairs with the same interned key share the pointer, so only compare the strings if they don't
+    if(kv1->key != kv2->key && strcmp(kv1->key, kv2->key))
     {
         return false;
     }
@@ -113,7 +104,11 @@ bool KVPairTLV_equals(KVPairTLV_t* kv1, KVPairTLV_t* kv2)
 ///Free the memory used by a KVPairTLV_t*
 void KVPairTLV_destroy(KVPairTLV_t* pairToDestroy)
 {
-    free(pairToDestroy->key);
+    //Interned keys are shared, so only free a key that isn't the table's copy
+    if(!intern_owns(pairToDestroy->key))
+    {
+        free(pairToDestroy->key);
+    }
     //Only kv_CString types allocate additional memory for the value.
     if(pairToDestroy->type == kv_CString)
     {
@@ -19,7 +19,8 @@ extern "C" {
 /**
  * Create a new KVPairTLV.
  * @param key
- *  The key in the KV pair. This can be safely free'd after this function returns
+ *  The key in the KV pair. This can be safely free'd after this function returns.  The pair's key is the interned
+ *  copy (see keyintern.h), so pairs with the same key share it.
  * @param type
  *  The type of Value the KV pair holds
  * @param length
@@ -36,16 +37,18 @@ KVPairTLV_t* KVPairTLV_create(const char* key, KVPair_Type_t type, size_t length
  * Create a new KVPairTLV from a memory address containing a KV-TLV as defined in the protocol definition
  * @param start
  *  A pointer to the start of a KVPairTLV in a buffer.
+ * @param limit
+ *  A pointer to the byte after the end of the buffer.  Nothing at or past it is read.
  * @param end
  *  A pointer to the byte after the last byte of the KVPairTLV pointed to by start.
- *  This will be set to NULL if the most recent call did not contain a KVPairTLV structure.
+ *  This will be set to NULL if the most recent call did not contain a whole, valid KVPairTLV structure.
  * @return
- *  A pointer to a new KVPairTLV_t with values extracted from memory.
+ *  A pointer to a new KVPairTLV_t with values extracted from memory, or NULL if there wasn't one.
  */
-KVPairTLV_t* KVPairTLV_createFromMemory(const char* start, char** end);
+KVPairTLV_t* KVPairTLV_createFromMemory(const char* start, const char* limit, char** end);
 
 /**
- * Check if two KVPairTLV's are equal.
+ * Check if two KVPairTLV's are equal.  Interned keys are compared by id.
  * @param kv1
  *  The first KVPairTLV to compare.
  * @param kv2
@@ -56,7 +59,8 @@ KVPairTLV_t* KVPairTLV_createFromMemory(const char* start, char** end);
 bool KVPairTLV_equals(KVPairTLV_t* kv1, KVPairTLV_t* kv2);
 
 /**
- * Destroy a KVPairTLV*.  If the type is kv_CString, the value field will be free'd.
+ * Destroy a KVPairTLV*.  If the type is kv_CString, the value field will be free'd.  The key is only free'd if it
+ * wasn't interned.
  * @param pairToDestroy
  *  The KV pair to free the memory of.
  */
@@ -0,0 +1,163 @@
+/**
+ * core/network/nulscan.c
+ *
+ * Finds the nul bytes that delimit strings and keys in packet payloads
+ *
+ * @author agent <agent@local>
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "nulscan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define _NULSCAN_X86
+#include <immintrin.h>
+#endif
+
+// Scans a range for nuls, see nulscan
+typedef uint32_t (*NulScanFn_t)(const uint8_t*, uint32_t, uint32_t, uint32_t*, uint32_t);
+
+/**
+ * Records the nuls marked in a block's bitmask
+ *
+ * @param mask one bit per byte of the block, set for nuls
+ * @param base the offset of the block
+ * @param offsets where offsets are recorded
+ * @param found the number already recorded, updated
+ * @param max the most to record
+ * @returns true if max was reached
+ */
+static inline bool _nulscan_emit(uint32_t mask, uint32_t base, uint32_t* offsets, uint32_t* found, uint32_t max) {
+    while (mask != 0) {
+        if (*found == max) {
+            return true;
+        }
+        offsets[*found] = base + __builtin_ctz(mask);
+        *found += 1;
+        mask &= mask - 1; // clear the lowest bit
+    }
+    return false;
+}
+
+/**
+ * Scans a byte at a time, takes the same arguments as nulscan
+ */
+static uint32_t _nulscan_scalar(const uint8_t* data, uint32_t start, uint32_t length, uint32_t* offsets,
+        uint32_t max) {
+    uint32_t found = 0;
+    for (uint32_t i = start; i < length && found < max; i += 1) {
+        if (data[i] == '\0') {
+            offsets[found] = i;
+            found += 1;
+        }
+    }
+    return found;
+}
+
+#ifdef _NULSCAN_X86
+/**
+ * Scans 16 bytes at a time, takes the same arguments as nulscan
+ */
+__attribute__((target("sse2")))
+static uint32_t _nulscan_sse2(const uint8_t* data, uint32_t start, uint32_t length, uint32_t* offsets,
+        uint32_t max) {
+    uint32_t found = 0;
+    uint32_t i = start;
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (data + i));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(block, zero));
+        if (_nulscan_emit(mask, i, offsets, &found, max)) {
+            return found;
+        }
+    }
+    return found + _nulscan_scalar(data, i, length, offsets + found, max - found);
+}
+
+/**
+ * Scans 32 bytes at a time, takes the same arguments as nulscan
+ */
+__attribute__((target("avx2")))
+static uint32_t _nulscan_avx2(const uint8_t* data, uint32_t start, uint32_t length, uint32_t* offsets,
+        uint32_t max) {
+    uint32_t found = 0;
+    uint32_t i = start;
+    const __m256i zero = _mm256_setzero_si256();
+    for (; i + 32 <= length; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*) (data + i));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zero));
+        if (_nulscan_emit(mask, i, offsets, &found, max)) {
+            return found;
+        }
+    }
+    return found + _nulscan_sse2(data, i, length, offsets + found, max - found);
+}
+#endif
+
+static NulScanFn_t scan_fn = NULL;
+static NulScanImpl_t scan_impl = nsi_AUTO;
+
+/**
+ * @inherit
+ */
+NulScanImpl_t nulscan_set_impl(NulScanImpl_t impl) {
+    NulScanFn_t fn = _nulscan_scalar;
+    NulScanImpl_t picked = nsi_SCALAR;
+#ifdef _NULSCAN_X86
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2");
+    bool sse2 = __builtin_cpu_supports("sse2");
+    if ((impl == nsi_AUTO || impl == nsi_AVX2) && avx2) {
+        fn = _nulscan_avx2;
+        picked = nsi_AVX2;
+    } else if (impl != nsi_SCALAR && sse2) {
+        fn = _nulscan_sse2;
+        picked = nsi_SSE2;
+    }
+#else
+    (void) impl;
+#endif
+    __atomic_store_n(&scan_impl, picked, __ATOMIC_RELAXED);
+    __atomic_store_n(&scan_fn, fn, __ATOMIC_RELEASE);
+    return picked;
+}
+
+/**
+ * @inherit
+ */
+NulScanImpl_t nulscan_get_impl() {
+    if (__atomic_load_n(&scan_fn, __ATOMIC_ACQUIRE) == NULL) {
+        return nulscan_set_impl(nsi_AUTO);
+    }
+    return __atomic_load_n(&scan_impl, __ATOMIC_RELAXED);
+}
+
+/**
+ * @inherit
+ */
+uint32_t nulscan(const uint8_t* data, uint32_t start, uint32_t length, uint32_t* offsets, uint32_t max) {
+    // Picking an implementation is idempotent, so racing first calls are fine
+    NulScanFn_t fn = __atomic_load_n(&scan_fn, __ATOMIC_ACQUIRE);
+    if (fn == NULL) {
+        nulscan_set_impl(nsi_AUTO);
+        fn = __atomic_load_n(&scan_fn, __ATOMIC_ACQUIRE);
+    }
+    if (start >= length || max == 0) {
+        return 0;
+    }
+    return fn(data, start, length, offsets, max);
+}
+
+/**
+ * @inherit
+ */
+const uint8_t* nulscan_find(const uint8_t* data, const uint8_t* end) {
+    if (data >= end) {
+        return NULL;
+    }
+    uint32_t offset;
+    uint32_t found = nulscan(data, 0, (uint32_t) (end - data), &offset, 1);
+    return (found == 1)? data + offset : NULL;
+}
@@ -0,0 +1,73 @@
+/**
+ * core/network/nulscan.h
+ *
+ * Finds the nul bytes that delimit strings and keys in packet payloads. The
+ * scan is done 32 (AVX2) or 16 (SSE2) bytes at a time when the CPU supports
+ * it, falling back to a byte at a time; the implementation is picked the
+ * first time a scan runs. Every scan is bounded by the length it is given, so
+ * a payload missing its last nul is never read past.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_NULSCAN
+#define __CORE_NETWORK_NULSCAN
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Defines the ways a scan can be done
+typedef enum NulScanImpl {
+    nsi_AUTO   = 0x00, // pick the best the CPU supports
+    nsi_SCALAR = 0x01,
+    nsi_SSE2   = 0x02,
+    nsi_AVX2   = 0x03
+} NulScanImpl_t;
+
+/**
+ * Finds the nul bytes in part of a buffer, in order
+ *
+ * @param data the buffer
+ * @param start where to start looking
+ * @param length the length of the buffer (nothing at or past this is read)
+ * @param offsets set to the offsets (from data) of the nuls found
+ * @param max the most offsets to find; to keep going, scan again from one
+ *        past the last offset found
+ * @returns the number of offsets found, less than max once the end of the
+ *          buffer is reached
+ */
+uint32_t nulscan(const uint8_t* data, uint32_t start, uint32_t length, uint32_t* offsets, uint32_t max);
+
+/**
+ * Finds the first nul byte in a range
+ *
+ * @param data where to start looking
+ * @param end the end of the range (not read)
+ * @returns the nul, or NULL if there isn't one before end
+ */
+const uint8_t* nulscan_find(const uint8_t* data, const uint8_t* end);
+
+/**
+ * Picks how scans are done, mostly for testing and benchmarks
+ *
+ * @param impl the implementation, or nsi_AUTO for the best the CPU supports
+ * @returns the implementation now in use (nsi_AUTO is never returned, and an
+ *          implementation the CPU can't run falls back to the best it can)
+ */
+NulScanImpl_t nulscan_set_impl(NulScanImpl_t impl);
+
+/**
+ * Gets how scans are done
+ *
+ * @returns the implementation in use
+ */
+NulScanImpl_t nulscan_get_impl();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,6 +4,9 @@
  * Defines the layout and constants used to transmit data between the robots 
  * and the FMS according to the definition in core/doc.
  *
+ * These structs are the decoded form; where each field sits on the wire is
+ * described once, in packetschema.h.
+ *
  * @author Connor Henley, @thatging3rkid
  */
 #ifndef __CORE_PACKET_CONSTANTS
@@ -34,6 +37,10 @@ typedef enum PacketType {
     pt_DEBUG           = 0xff
 } PacketType_t;
 
+// Initializer listing every packet type, e.g. for llnet_connection_set_udp_filter(...)
+#define PACKET_TYPES { pt_INIT, pt_STATE_REQUEST, pt_STATE_RESPONSE, pt_STATE_UPDATE, pt_CONFIG_REQUEST, \
+    pt_CONFIG_RESPONSE, pt_CONFIG_UPDATE, pt_USER_DATA, pt_UPDATE_STATUS, pt_DEBUG }
+
 // Defines the "abstract" struct for data sent in a packet
 typedef struct PTLVData_Base {
     // empty
@@ -74,12 +81,35 @@ typedef union KVPair_Value {
 
 // Defines a key-value pair TLV for network transmission
 typedef struct KVPairTLV {
-    char* key;
+    char* key; // may be an interned name (see intern_owns in keyintern.h), which is never changed or freed
     KVPair_Type_t type:8;
     uint32_t length:24;
     KVPair_Value_u value;
 } KVPairTLV_t;
 
+// The width in bits of every fixed field, as packetschema.h decodes it (the
+// schema fails to compile if a field's width there doesn't match)
+#define PTLV_BITS_INIT_robot_uuid               (32)
+#define PTLV_BITS_STATE_RESPONSE_state          (8)
+#define PTLV_BITS_STATE_RESPONSE_reserved       (24)
+#define PTLV_BITS_STATE_UPDATE_new_state        (8)
+#define PTLV_BITS_STATE_UPDATE_reserved         (24)
+#define PTLV_BITS_USER_DATA_left_stick_x        (8)
+#define PTLV_BITS_USER_DATA_left_stick_y        (8)
+#define PTLV_BITS_USER_DATA_right_stick_x       (8)
+#define PTLV_BITS_USER_DATA_right_stick_y       (8)
+#define PTLV_BITS_USER_DATA_button_a            (1)
+#define PTLV_BITS_USER_DATA_button_b            (1)
+#define PTLV_BITS_USER_DATA_controller_uuid     (16)
+#define PTLV_BITS_UPDATE_STATUS_code            (8)
+#define PTLV_BITS_UPDATE_STATUS_reserved        (24)
+#define PTLV_BITS_DEBUG_code_status             (4)
+#define PTLV_BITS_DEBUG_commit_hash             (28)
+#define PTLV_BITS_DEBUG_robot_uuid              (32)
+#define PTLV_BITS_DEBUG_state                   (8)
+#define PTLV_BITS_DEBUG_reserved                (8)
+#define PTLV_BITS_DEBUG_config_entries          (16)
+
 // Defines the INIT packet struct, which "extends" the PTLVData_Base struct
 typedef struct PTLVData_INIT {
     uint32_t robot_uuid;
@@ -92,15 +122,15 @@ typedef struct PTLVData_STATE_REQUEST {
 
 // Defines the STATE_RESPONSE struct, which "extends" the PTLVData_Base struct
 typedef struct PTLVData_STATE_RESPONSE {
-    RobotState_t state:8;
-    uint32_t reserved:24;
+    RobotState_t state:PTLV_BITS_STATE_RESPONSE_state;
+    uint32_t reserved:PTLV_BITS_STATE_RESPONSE_reserved;
     void* arbitrary;
 } PTLVData_STATE_RESPONSE_t;
 
 // Defines the STATE_UPDATE struct, which "extends" the PTLVData_Base struct
 typedef struct PTLVData_STATE_UPDATE {
-    RobotState_t new_state:8;
-    uint32_t reserved:24;
+    RobotState_t new_state:PTLV_BITS_STATE_UPDATE_new_state;
+    uint32_t reserved:PTLV_BITS_STATE_UPDATE_reserved;
     void* arbitrary;
 } PTLVData_STATE_UPDATE_t;
 
@@ -125,8 +155,8 @@ typedef struct PTLVData_USER_DATA {
     uint8_t left_stick_y;
     uint8_t right_stick_x;
     uint8_t right_stick_y;
-    bool button_a:1;
-    bool button_b:1;
+    bool button_a:PTLV_BITS_USER_DATA_button_a;
+    bool button_b:PTLV_BITS_USER_DATA_button_b;
     uint16_t controller_uuid;
 } PTLVData_USER_DATA_t;
 
@@ -139,8 +169,8 @@ typedef enum UpdateStatusCode {
 
 // Defines the UPDATE_STATUS struct, which "extends" the PTLVData_Base struct
 typedef struct PTLVData_UPDATE_STATUS {
-    UpdateStatusCode_t code:8;
-    uint32_t reserved:24;
+    UpdateStatusCode_t code:PTLV_BITS_UPDATE_STATUS_code;
+    uint32_t reserved:PTLV_BITS_UPDATE_STATUS_reserved;
 } PTLVData_UPDATE_STATUS_t;
 
 // Defines the possible code statuses in a DEBUG packet
@@ -151,10 +181,10 @@ typedef enum DebugCodeStatus {
 
 // Defines the DEBUG struct, which "extends" the PTLVData_Base struct
 typedef struct PTLVData_DEBUG {
-    DebugCodeStatus_t code_status:4;
-    uint32_t commit_hash:28;
+    DebugCodeStatus_t code_status:PTLV_BITS_DEBUG_code_status;
+    uint32_t commit_hash:PTLV_BITS_DEBUG_commit_hash;
     uint32_t robot_uuid;
-    RobotState_t state:8;
+    RobotState_t state:PTLV_BITS_DEBUG_state;
     uint8_t reserved;
     uint16_t config_entries;
     void* arbitrary;
@@ -0,0 +1,127 @@
+/**
+ * core/network/packetbatch.c
+ *
+ * Decodes batches of packets into per-type columns
+ *
+ * @author agent <agent@local>
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packetbatch.h"
+#include "packetschema.h"
+
+/**
+ * Rounds a column's size up, so the next column starts suitably aligned
+ */
+static size_t _pbatch_align(size_t size) {
+    size_t align = _Alignof(max_align_t);
+    return (size + align - 1) & ~(align - 1);
+}
+
+#define _PBATCH_SIZE(type, name, kind) \
+    size += _pbatch_align(sizeof(PTLVData_##type##_t) * capacity) + _pbatch_align(sizeof(uint32_t) * capacity);
+
+#define _PBATCH_PLACE(type, name, kind) \
+    batch->name = (PTLVData_##type##_t*) (storage + offset); \
+    offset += _pbatch_align(sizeof(PTLVData_##type##_t) * capacity); \
+    batch->name##_packets = (uint32_t*) (storage + offset); \
+    offset += _pbatch_align(sizeof(uint32_t) * capacity); \
+    batch->name##_count = 0;
+
+/**
+ * @inherit
+ */
+bool pbatch_init(PacketBatch_t* batch, uint32_t capacity) {
+    size_t size = 0;
+    PBATCH_TYPES(_PBATCH_SIZE)
+    memset(batch, 0, sizeof(PacketBatch_t));
+    uint8_t* storage = malloc((size > 0)? size : 1);
+    if (storage == NULL) {
+        return false;
+    }
+
+    size_t offset = 0;
+    batch->capacity = capacity;
+    batch->storage = storage;
+    PBATCH_TYPES(_PBATCH_PLACE)
+    return true;
+}
+
+#define _PBATCH_RESET(type, name, kind) \
+    batch->name##_count = 0;
+
+/**
+ * @inherit
+ */
+void pbatch_reset(PacketBatch_t* batch) {
+    batch->seen = 0;
+    PBATCH_TYPES(_PBATCH_RESET)
+}
+
+// Points an entry's arbitrary data into its packet, NULL if there isn't any
+#define _PBATCH_FINISH_ARBITRARY(entry, packet, fixed) \
+    (entry)->arbitrary = ((packet)->length > (fixed))? (packet)->data + (fixed) : NULL;
+
+#define _PBATCH_FINISH_FIXED(entry, packet, fixed)
+
+#define _PBATCH_DECODE(type, name, kind) \
+    case pt_##type: { \
+        if (batch->name##_count == batch->capacity) { \
+            return pbs_FULL; \
+        } \
+        PTLVData_##type##_t* entry = &batch->name[batch->name##_count]; \
+        if (!pschema_decode_##type(packet->data, packet->length, entry)) { \
+            return pbs_SHORT; \
+        } \
+        _PBATCH_FINISH_##kind(entry, packet, PSCHEMA_FIXED_##type) \
+        batch->name##_packets[batch->name##_count] = index; \
+        batch->name##_count += 1; \
+        return pbs_DECODED; \
+    }
+
+/**
+ * Decodes one packet into its column
+ *
+ * @param batch the batch
+ * @param packet the packet
+ * @param index where the packet is in the batch
+ * @returns what happened to it
+ */
+static PBatchStatus_t _pbatch_decode_one(PacketBatch_t* batch, const IntermediateTLV_t* packet, uint32_t index) {
+    if (packet == NULL) {
+        return pbs_UNSUPPORTED;
+    }
+    switch (packet->type) {
+        PBATCH_TYPES(_PBATCH_DECODE)
+    }
+    return pbs_UNSUPPORTED;
+}
+
+/**
+ * @inherit
+ */
+uint32_t pbatch_decode(PacketBatch_t* batch, IntermediateTLV_t* const* packets, uint32_t count,
+        PBatchStatus_t* status) {
+    uint32_t decoded = 0;
+    for (uint32_t i = 0; i < count; i += 1) {
+        PBatchStatus_t result = _pbatch_decode_one(batch, packets[i], batch->seen);
+        batch->seen += 1;
+        decoded += (result == pbs_DECODED);
+        if (status != NULL) {
+            status[i] = result;
+        }
+    }
+    return decoded;
+}
+
+/**
+ * @inherit
+ */
+void pbatch_free(PacketBatch_t* batch) {
+    free(batch->storage);
+    memset(batch, 0, sizeof(PacketBatch_t));
+}
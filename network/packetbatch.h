@@ -0,0 +1,105 @@
+/**
+ * core/network/packetbatch.h
+ *
+ * Decodes a tick's worth of packets at once. Instead of one unpack call (and
+ * its allocation) per packet, each fixed-layout packet is decoded with the
+ * schema codecs into a column holding every packet of its type, so a whole
+ * tick of USER_DATA can be handled with one linear scan over contiguous
+ * memory. Columns are allocated once, when the batch is set up, and reused
+ * every tick.
+ *
+ * Packets with key-value or string lists (CONFIG_*) have no fixed size, so
+ * they aren't batched; use the unpackers or a view for those.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_PACKETBATCH
+#define __CORE_NETWORK_PACKETBATCH
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "packet.h"
+#include "lowlevel.h"
+
+// TYPE(packet type, column name, ARBITRARY if arbitrary data can follow or FIXED)
+#define PBATCH_TYPES(TYPE) \
+    TYPE(INIT,           init,           FIXED) \
+    TYPE(STATE_RESPONSE, state_response, ARBITRARY) \
+    TYPE(STATE_UPDATE,   state_update,   ARBITRARY) \
+    TYPE(USER_DATA,      user_data,      FIXED) \
+    TYPE(UPDATE_STATUS,  update_status,  FIXED) \
+    TYPE(DEBUG,          debug,          ARBITRARY)
+
+// Defines what happened to each packet handed to pbatch_decode
+typedef enum PBatchStatus {
+    pbs_DECODED     = 0x00, // added to its type's column
+    pbs_SHORT       = 0x01, // too short for its fixed fields (dropped)
+    pbs_FULL        = 0x02, // its type's column was full (not decoded, try again after a reset)
+    pbs_UNSUPPORTED = 0x03  // not a fixed-layout type (or NULL), use an unpacker or a view
+} PBatchStatus_t;
+
+// Each column is the decoded packets of one type, in the order they were given,
+// plus where each one was in the batch (counting every packet handed to
+// pbatch_decode since the last reset)
+#define _PBATCH_COLUMN(type, name, kind) \
+    PTLVData_##type##_t* name; \
+    uint32_t* name##_packets; \
+    uint32_t name##_count;
+
+// Defines a batch of decoded packets
+typedef struct PacketBatch {
+    uint32_t capacity; // room in each column
+    uint32_t seen; // packets handed to pbatch_decode since the last reset
+    void* storage; // every column lives in this one block
+    PBATCH_TYPES(_PBATCH_COLUMN)
+} PacketBatch_t;
+
+/**
+ * Sets up an empty batch
+ *
+ * @param batch the batch
+ * @param capacity the number of packets each column can hold
+ * @returns false if the columns couldn't be allocated
+ */
+bool pbatch_init(PacketBatch_t* batch, uint32_t capacity);
+
+/**
+ * Empties a batch, keeping its columns (call it at the start of every tick)
+ *
+ * @param batch the batch
+ */
+void pbatch_reset(PacketBatch_t* batch);
+
+/**
+ * Decodes packets into the end of a batch's columns. The packets are only read:
+ * the caller still owns them, and arbitrary data in the columns points into
+ * them (its length is the packet's length less the fixed fields), so they have
+ * to outlive the batch's current contents.
+ *
+ * @param batch the batch
+ * @param packets the packets
+ * @param count the number of packets
+ * @param status if not NULL, set to what happened to each packet (count entries)
+ * @returns the number of packets decoded
+ */
+uint32_t pbatch_decode(PacketBatch_t* batch, IntermediateTLV_t* const* packets, uint32_t count,
+    PBatchStatus_t* status);
+
+/**
+ * Frees a batch's columns
+ *
+ * @param batch the batch
+ */
+void pbatch_free(PacketBatch_t* batch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
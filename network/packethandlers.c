@@ -3,119 +3,315 @@
 //
 
 #include <stdlib.h>
-#include <errno.h>
+#include <stddef.h>
+#include <stdbool.h>
 #include <string.h>
+#include <arpa/inet.h>
 #include "packethandlers.h"
+#include "packetview.h"
+#include "packetschema.h"
+#include "nulscan.h"
+#include "keyintern.h"
 #include "../collections/arraylist.h"
-#include "netutils.h"
+
+//Objects in an arena start on this boundary, strings are packed in after them
+#define ARENA_ALIGN (_Alignof(max_align_t))
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/**
+ * One allocation holding everything a decoded packet points to.  The PacketTLV_t is always first, so freeing the
+ * packet frees the whole arena.
+ */
+typedef struct PacketArena
+{
+    uint8_t* base;
+    size_t used;
+    size_t size;
+} PacketArena_t;
 
 /**
- * Creates a PacketTLV_t* from a ll packet.
- * The returned packet contains the type, length, and timestamp from the LL packet.
+ * Takes the next \p size bytes from an arena.
+ * @param arena
+ *  The arena, sized up front so this never runs out.
+ * @param size
+ *  The number of bytes needed.
+ * @param aligned
+ *  True to start on an ARENA_ALIGN boundary (for structures), false for strings and raw bytes.
+ * @return
+ *  A pointer into the arena.
+ */
+static void* arenaTake(PacketArena_t* arena, size_t size, bool aligned)
+{
+    if(aligned)
+    {
+        arena->used = ARENA_ROUND(arena->used);
+    }
+    void* taken = arena->base + arena->used;
+    arena->used += size;
+    return taken;
+}
+
+/**
+ * Creates a PacketTLV_t* from a ll packet, in a new arena.
+ * The returned packet contains the type, length, and timestamp from the LL packet, and its data field points to
+ * zeroed room for the type-specific structure.
  * @param rawPacket
  *  An IntermediateTLV_t* packet from the low-level network interface
+ * @param arena
+ *  Set up to point at the new arena, with the packet and data structure already taken from it.
+ * @param dataSize
+ *  The size of the type-specific data structure, 0 if the type has none.
+ * @param extraSize
+ *  The room needed after the data structure, for lists and copies of packet data.
  * @return
- *  A PacketTLV_t* with the type, length, and timestamp set, and the data field set to null.
- *  This function returns NULL if the memory allocation for the return packet fails.
+ *  A PacketTLV_t* with the type, length, and timestamp set.
+ *  This function returns NULL if the memory allocation for the arena fails.
  */
-static PacketTLV_t* createBasePacket(IntermediateTLV_t* rawPacket)
+static PacketTLV_t* createBasePacket(IntermediateTLV_t* rawPacket, PacketArena_t* arena, size_t dataSize,
+        size_t extraSize)
 {
-    //Allocate memory for the packet and check for success
-    PacketTLV_t* packet = malloc(sizeof(PacketTLV_t));
-    if(packet == NULL)
+    //Allocate memory for the whole packet and check for success
+    arena->size = ARENA_ROUND(sizeof(PacketTLV_t)) + ARENA_ROUND(dataSize) + extraSize;
+    arena->used = 0;
+    arena->base = malloc(arena->size);
+    if(arena->base == NULL)
     {
         return NULL;
     }
+    PacketTLV_t* packet = arenaTake(arena, sizeof(PacketTLV_t), true);
 
     //Copy the data from the intermediate packet into the proper packet
     packet->type = rawPacket->type;
     packet->length = rawPacket->length;
     packet->timestamp = rawPacket->timestamp;
-    //Zero out the data field for safety's sake
     packet->data = NULL;
+    if(dataSize > 0)
+    {
+        packet->data = arenaTake(arena, dataSize, true);
+        memset(packet->data, 0, dataSize);
+    }
     return packet;
 }
 
 /**
- * Parses a key-value list as defined by the network protocol definition into a List of KV pairs.
- * @param rawList
- *  A byte array which encodes a list of KV pairs.
- * @param kvListLen
- *  The length of the rawList character array.
+ * Gets the length of the arbitrary data following a packet's fixed fields.
+ * @param rawPacket
+ *  The packet.
+ * @param fixedLen
+ *  The length of the fixed fields.
  * @return
- *  A List* of KVPairTLV_t* or NULL if there was an error
+ *  The length of the arbitrary data, 0 if there is none.
  */
-static List_t* parseKVList(char* rawList, size_t kvListLen)
+static size_t arbitraryLength(IntermediateTLV_t* rawPacket, size_t fixedLen)
 {
-    //TODO consider doing format validation and setting ERRNO appropriately
-    ArrayList_t* kvList = arraylist_init();
-    //Failure in list creation
-    if(kvList == NULL)
+    return (rawPacket->length > fixedLen) ? rawPacket->length - fixedLen : 0;
+}
+
+/**
+ * Copies a packet's arbitrary data into its arena.
+ * @return
+ *  The copy, or NULL if there is no arbitrary data.
+ */
+static void* copyArbitrary(PacketArena_t* arena, IntermediateTLV_t* rawPacket, size_t fixedLen)
+{
+    size_t len = arbitraryLength(rawPacket, fixedLen);
+    if(len == 0)
     {
         return NULL;
     }
-    KVPairTLV_t* pair = NULL;
-    char* kvString = rawList;
-    //While we still have things to parse
+    void* copy = arenaTake(arena, len, false);
+    memcpy(copy, rawPacket->data + fixedLen, len);
+    return copy;
+}
+
+/**
+ * Works out the arena room needed for a key-value list, checking every pair on the way.
+ * @param view
+ *  A view of the packet holding the list.
+ * @param count
+ *  Set to the number of pairs.
+ * @return
+ *  The number of bytes needed after the packet's data structure, or 0 if the list is malformed.
+ */
+static size_t sizeKVList(const PacketView_t* view, uint32_t* count)
+{
+    PViewKVIter_t iter;
+    PViewKV_t kv;
+    KVPair_Value_u value;
+    size_t strings = 0;
+    *count = 0;
+    pview_kv_begin(view, &iter);
+    while(pview_kv_next(&iter, &kv))
+    {
+        if(!pview_kv_value(&kv, &value))
+        {
+            return 0;
+        }
+        //Room for every key for now, and for the value only if it's a CString
+        strings += kv.key_length + 1;
+        strings += (kv.type == kv_CString) ? kv.value_length : 0;
+        *count += 1;
+    }
+    if(iter.malformed)
+    {
+        return 0;
+    }
+    //The list is good, so its keys can be interned; those don't need copying
+    pview_kv_begin(view, &iter);
+    while(pview_kv_next(&iter, &kv))
+    {
+        if(intern_key(kv.key, kv.key_length) != INTERN_NONE)
+        {
+            strings -= kv.key_length + 1;
+        }
+    }
+    return ARENA_ROUND(sizeof(ArrayList_t)) + ARENA_ROUND(sizeof(void*) * *count) +
+            (ARENA_ROUND(sizeof(KVPairTLV_t)) * *count) + strings;
+}
+
+/**
+ * Parses a key-value list as defined by the network protocol definition into a List of KV pairs, in the packet's
+ * arena.  The list was already checked by sizeKVList().
+ * @param arena
+ *  The arena, with the room sizeKVList() asked for.
+ * @param view
+ *  A view of the packet holding the list.
+ * @param count
+ *  The number of pairs, from sizeKVList().
+ * @return
+ *  A fixed List* of KVPairTLV_t*
+ */
+static List_t* parseKVList(PacketArena_t* arena, const PacketView_t* view, uint32_t count)
+{
+    ArrayList_t* kvList = arenaTake(arena, sizeof(ArrayList_t), true);
+    void** elements = arenaTake(arena, sizeof(void*) * count, true);
+    arraylist_init_fixed(kvList, elements, count);
+
+    //Place the pairs together, then the strings after them
+    KVPairTLV_t* pairs = arenaTake(arena, ARENA_ROUND(sizeof(KVPairTLV_t)) * count, true);
+    PViewKVIter_t iter;
+    PViewKV_t kv;
+    pview_kv_begin(view, &iter);
+    for(uint32_t i = 0; i < count && pview_kv_next(&iter, &kv); i++)
+    {
+        KVPairTLV_t* pair = (KVPairTLV_t*)((uint8_t*)pairs + ARENA_ROUND(sizeof(KVPairTLV_t)) * i);
+        //sizeKVList() interned the key, and nothing leaves the table, so this only misses if it couldn't be
+        uint32_t keyId = intern_find(kv.key, kv.key_length);
+        if(keyId != INTERN_NONE)
+        {
+            pair->key = (char*)intern_name(keyId);
+        }
+        else
+        {
+            pair->key = arenaTake(arena, kv.key_length + 1, false);
+            memcpy(pair->key, kv.key, kv.key_length + 1);
+        }
+        pair->type = kv.type;
+        pair->length = kv.value_length + 4;
+        pview_kv_value(&kv, &pair->value);
+        //CString values point into the raw packet, so they need to be copied too
+        if(kv.type == kv_CString)
+        {
+            pair->value.CString = arenaTake(arena, kv.value_length, false);
+            memcpy(pair->value.CString, kv.value, kv.value_length);
+        }
+        //Nothing else can see the list yet, so skip the locking in arraylist_add()
+        elements[kvList->len++] = pair;
+    }
+    return (List_t*)kvList;
+}
+
+//Nul offsets are found this many at a time
+#define SCAN_CHUNK 64
+
+/**
+ * Walks a list of nul-terminated strings in one bounded scan, optionally copying them into a packet's arena.
+ * Sequential nul bytes will be interpreted as an empty string, and skipped.  A string missing its nul at the end of
+ * the packet is left out.
+ * @param rawPacket
+ *  The packet holding the strings.
+ * @param arena
+ *  The arena to copy the strings into, or NULL to only count them.
+ * @param strings
+ *  The list to add the copies to (ignored if \p arena is NULL).
+ * @param count
+ *  Set to the number of non-empty strings.
+ * @return
+ *  The number of bytes the strings take, nul terminators included.
+ */
+static size_t walkStrings(IntermediateTLV_t* rawPacket, PacketArena_t* arena, ArrayList_t* strings, uint32_t* count)
+{
+    uint32_t offsets[SCAN_CHUNK];
+    uint32_t found;
+    uint32_t stringStart = 0;
+    size_t bytes = 0;
+    *count = 0;
     do
     {
-        pair = KVPairTLV_createFromMemory(kvString, &kvString);
-        //Critical Failure! Or we ran into padding.
-        if(pair == NULL)
+        found = nulscan(rawPacket->data, stringStart, rawPacket->length, offsets, SCAN_CHUNK);
+        for(uint32_t i = 0; i < found; i++)
         {
-            //We ran into padding, break out of the parsing loop.
-            if(kvString == NULL)
-                break;
-            //Actual critical failure
-            //TODO should probably log this
-            for(unsigned int i = 0; i < arraylist_size(kvList); i++)
+            uint32_t len = offsets[i] - stringStart;
+            //Only keep the string if it isn't empty
+            if(len > 0)
             {
-                KVPairTLV_destroy(arraylist_get(kvList, i));
+                if(arena != NULL)
+                {
+                    char* str = arenaTake(arena, len + 1, false);
+                    memcpy(str, rawPacket->data + stringStart, len + 1);
+                    //Nothing else can see the list yet, so skip the locking in arraylist_add()
+                    strings->array[strings->len++] = str;
+                }
+                bytes += len + 1;
+                *count += 1;
             }
-            arraylist_free(kvList);
-            return NULL;
+            //Move to the next string
+            stringStart = offsets[i] + 1;
         }
-        arraylist_add(kvList, pair);
-        //Jump over the semicolon delimiter.
-        kvString++;
-    } while(kvString != NULL && kvString < rawList + kvListLen);
-    return (List_t*)kvList;
+    } while(found == SCAN_CHUNK);
+    return bytes;
 }
 
 /**
- * Grabs several nul-terminated strings out of an array of bytes.
- * Sequential nul bytes will be interpreted as an empty string.
- * @param rawList
- *  The raw list of nul-terminated strings.
- * @param rawLen
- *  The length of the byte array.
+ * Grabs several nul-terminated strings out of a packet into its arena.
+ * @param arena
+ *  The arena, with room for the list and the strings.
+ * @param rawPacket
+ *  The packet holding the strings.
+ * @param count
+ *  The number of strings, from walkStrings().
  * @return
- *  A List_t* of strings found in \p rawList.
+ *  A fixed List_t* of strings found in the packet.
  */
-static List_t* getStringsFromArbitraryData(char* rawList, size_t rawLen)
-{
-    ArrayList_t* strings = arraylist_init();
-    char* currentString = rawList;
-    //While the packet length says there's still data to process
-    while(currentString < rawList + rawLen)
-    {
-        size_t len = strlen(currentString);
-        //Only copy the string if it isn't empty
-        if(len > 0) {
-            //String length plus nul terminator
-            char *str = malloc(sizeof(char) * (len + 1));
-            strcpy(str, currentString);
-            arraylist_add(strings, str);
-        }
-        //Move the pointer we're currently processing to the next string
-        currentString += len + 1;
-    }
-    return (List_t*) strings;
+static List_t* getStringsFromArbitraryData(PacketArena_t* arena, IntermediateTLV_t* rawPacket, uint32_t count)
+{
+    ArrayList_t* strings = arenaTake(arena, sizeof(ArrayList_t), true);
+    void** elements = arenaTake(arena, sizeof(void*) * count, true);
+    arraylist_init_fixed(strings, elements, count);
+    walkStrings(rawPacket, arena, strings, &count);
+    return (List_t*)strings;
+}
+
+/**
+ * Cleans up after a packet too short to hold its fixed fields.
+ * @param packet
+ *  The partly unpacked packet.
+ * @param rawPacket
+ *  The raw packet.
+ * @return
+ *  NULL, for the unpacker to return.
+ */
+static PacketTLV_t* rejectShort(PacketTLV_t* packet, IntermediateTLV_t* rawPacket)
+{
+    free(packet);
+    llnet_packet_free(rawPacket);
+    return NULL;
 }
 
 PacketTLV_t* unpackInit(IntermediateTLV_t* rawPacket)
 {
-    PacketTLV_t* packet = createBasePacket(rawPacket);
+    PacketArena_t arena;
+    PacketTLV_t* packet = createBasePacket(rawPacket, &arena, sizeof(PTLVData_INIT_t), 0);
     if (packet == NULL)
     {
         //Free the raw packet
@@ -123,21 +319,11 @@ PacketTLV_t* unpackInit(IntermediateTLV_t* rawPacket)
         return NULL;
     }
 
-    PTLVData_INIT_t* unpacked = malloc(sizeof(PTLVData_INIT_t));
-    //Allocation failed
-    if(unpacked == NULL)
+    PTLVData_INIT_t* unpacked = (PTLVData_INIT_t*)packet->data;
+    if(!pschema_decode_INIT(rawPacket->data, rawPacket->length, unpacked))
     {
-        //packet allocation succeeded, so free that memory
-        free(packet);
-        //Free the raw packet
-        llnet_packet_free(rawPacket);
-        return NULL;
+        return rejectShort(packet, rawPacket);
     }
-
-    //Unpack the UUID from the raw data
-    unpacked->robot_uuid = ((uint32_t*)(rawPacket->data))[0];
-    //Dump it in the packet
-    packet->data = (PTLVData_Base_t*)unpacked;
     //We own the packet memory, free it
     llnet_packet_free(rawPacket);
     return packet;
@@ -145,16 +331,9 @@ PacketTLV_t* unpackInit(IntermediateTLV_t* rawPacket)
 
 PacketTLV_t* unpackStateRequest(IntermediateTLV_t* rawPacket)
 {
-    PacketTLV_t* packet = createBasePacket(rawPacket);
-    if (packet == NULL)
-    {
-        //Free the raw packet
-        llnet_packet_free(rawPacket);
-        return NULL;
-    }
-
-    //An empty struct has 0 size, so don't bother allocating memory for the data portion
-    packet->data = NULL;
+    //An empty struct has 0 size, so don't bother making room for the data portion
+    PacketArena_t arena;
+    PacketTLV_t* packet = createBasePacket(rawPacket, &arena, 0, 0);
     //We own the packet memory, free it
     llnet_packet_free(rawPacket);
     return packet;
@@ -162,7 +341,9 @@ PacketTLV_t* unpackStateRequest(IntermediateTLV_t* rawPacket)
 
 PacketTLV_t* unpackStateResponse(IntermediateTLV_t* rawPacket)
 {
-    PacketTLV_t* packet = createBasePacket(rawPacket);
+    PacketArena_t arena;
+    PacketTLV_t* packet = createBasePacket(rawPacket, &arena, sizeof(PTLVData_STATE_RESPONSE_t),
+            arbitraryLength(rawPacket, PSCHEMA_FIXED_STATE_RESPONSE));
     if (packet == NULL)
     {
         //Free the raw packet
@@ -170,39 +351,13 @@ PacketTLV_t* unpackStateResponse(IntermediateTLV_t* rawPacket)
         return NULL;
     }
 
-    errno = 0;
-    PTLVData_STATE_RESPONSE_t* unpacked = calloc(1,sizeof(PTLVData_STATE_RESPONSE_t));
-    //Allocation failed
-    if(unpacked == NULL && errno != 0)
+    PTLVData_STATE_RESPONSE_t* unpacked = (PTLVData_STATE_RESPONSE_t*)packet->data;
+    if(!pschema_decode_STATE_RESPONSE(rawPacket->data, rawPacket->length, unpacked))
     {
-        //packet allocation succeeded, so free that memory
-        free(packet);
-        //Free the raw packet
-        llnet_packet_free(rawPacket);
-        return NULL;
+        return rejectShort(packet, rawPacket);
     }
-    //Byte one is the state
-    unpacked->state = (RobotState_t)rawPacket->data[0];
-    //The reserved isn't currently used, but we can use it in the future, so unpack it
-    unpacked->reserved = (uint32_t)(rawPacket->data[1]) << 16 |
-            (uint32_t)(rawPacket->data[2]) << 8 | rawPacket->data[3];
-    //Total packet size - defined data size
-    size_t arbitrarySize = rawPacket->length - 4;
-    void* arbitraryData = NULL;
-    //There's arbitrary data here!
-    if(arbitrarySize > 0)
-    {
-        //Allocate memory for the arbitrary data and copy it into the new buffer.
-        //Note, if allocation fails we just dump the data
-        arbitraryData = calloc(arbitrarySize, 1);
-        if(arbitraryData != NULL)
-        {
-            memcpy(arbitraryData, rawPacket->data + 4, arbitrarySize);
-        }
-    }
-    unpacked->arbitrary = arbitraryData;
-    //Dump it in the packet
-    packet->data = (PTLVData_Base_t*)unpacked;
+    //Total packet size - defined data size, NULL if there isn't any
+    unpacked->arbitrary = copyArbitrary(&arena, rawPacket, PSCHEMA_FIXED_STATE_RESPONSE);
     //We own the packet memory, free it
     llnet_packet_free(rawPacket);
     return packet;
@@ -210,7 +365,9 @@ PacketTLV_t* unpackStateResponse(IntermediateTLV_t* rawPacket)
 
 PacketTLV_t* unpackStateUpdate(IntermediateTLV_t* rawPacket)
 {
-    PacketTLV_t* packet = createBasePacket(rawPacket);
+    PacketArena_t arena;
+    PacketTLV_t* packet = createBasePacket(rawPacket, &arena, sizeof(PTLVData_STATE_UPDATE_t),
+            arbitraryLength(rawPacket, PSCHEMA_FIXED_STATE_UPDATE));
     if (packet == NULL)
     {
         //Free the raw packet
@@ -218,39 +375,13 @@ PacketTLV_t* unpackStateUpdate(IntermediateTLV_t* rawPacket)
         return NULL;
     }
 
-    errno = 0;
-    PTLVData_STATE_UPDATE_t* unpacked = calloc(1,sizeof(PTLVData_STATE_UPDATE_t));
-    //Allocation failed
-    if(unpacked == NULL && errno != 0)
+    PTLVData_STATE_UPDATE_t* unpacked = (PTLVData_STATE_UPDATE_t*)packet->data;
+    if(!pschema_decode_STATE_UPDATE(rawPacket->data, rawPacket->length, unpacked))
     {
-        //packet allocation succeeded, so free that memory
-        free(packet);
-        //Free the raw packet
-        llnet_packet_free(rawPacket);
-        return NULL;
+        return rejectShort(packet, rawPacket);
     }
-    //Byte one is the state
-    unpacked->new_state = (RobotState_t)rawPacket->data[0];
-    //The reserved isn't currently used, but we can use it in the future, so unpack it
-    unpacked->reserved = (uint32_t)(rawPacket->data[1]) << 16 |
-                         (uint32_t)(rawPacket->data[2]) << 8 | rawPacket->data[3];
-    //Total packet size - defined data size
-    size_t arbitrarySize = rawPacket->length - 4;
-    void* arbitraryData = NULL;
-    //There's arbitrary data here!
-    if(arbitrarySize > 0)
-    {
-        //Allocate memory for the arbitrary data and copy it into the new buffer.
-        //Note, if allocation fails we just dump the data
-        arbitraryData = calloc(arbitrarySize, 1);
-        if(arbitraryData != NULL)
-        {
-            memcpy(arbitraryData, rawPacket->data + 4, arbitrarySize);
-        }
-    }
-    unpacked->arbitrary = arbitraryData;
-    //Dump it in the packet
-    packet->data = (PTLVData_Base_t*)unpacked;
+    //Total packet size - defined data size, NULL if there isn't any
+    unpacked->arbitrary = copyArbitrary(&arena, rawPacket, PSCHEMA_FIXED_STATE_UPDATE);
     //We own the packet memory, free it
     llnet_packet_free(rawPacket);
     return packet;
@@ -258,27 +389,21 @@ PacketTLV_t* unpackStateUpdate(IntermediateTLV_t* rawPacket)
 
 PacketTLV_t* unpackConfigRequest(IntermediateTLV_t* rawPacket)
 {
-    PacketTLV_t* packet = createBasePacket(rawPacket);
-    if (packet == NULL)
-    {
-        //Free the raw packet
-        llnet_packet_free(rawPacket);
-        return NULL;
-    }
+    //Count the keys first, so the arena can be sized exactly
+    uint32_t count;
+    size_t stringBytes = walkStrings(rawPacket, NULL, NULL, &count);
+    size_t listSize = ARENA_ROUND(sizeof(ArrayList_t)) + ARENA_ROUND(sizeof(void*) * count) + stringBytes;
 
-    errno = 0;
-    PTLVData_CONFIG_REQUEST_t* unpacked = calloc(1,sizeof(PTLVData_CONFIG_REQUEST_t));
-    //Allocation failed
-    if(unpacked == NULL && errno != 0)
+    PacketArena_t arena;
+    PacketTLV_t* packet = createBasePacket(rawPacket, &arena, sizeof(PTLVData_CONFIG_REQUEST_t), listSize);
+    if (packet == NULL)
     {
-        //packet allocation succeeded, so free that memory
-        free(packet);
         //Free the raw packet
         llnet_packet_free(rawPacket);
         return NULL;
     }
-    packet->data = (PTLVData_Base_t*)unpacked;
-    unpacked->keys = getStringsFromArbitraryData((char*)rawPacket->data, rawPacket->length);
+    PTLVData_CONFIG_REQUEST_t* unpacked = (PTLVData_CONFIG_REQUEST_t*)packet->data;
+    unpacked->keys = getStringsFromArbitraryData(&arena, rawPacket, count);
 
     llnet_packet_free(rawPacket);
     return packet;
@@ -286,38 +411,56 @@ PacketTLV_t* unpackConfigRequest(IntermediateTLV_t* rawPacket)
 
 PacketTLV_t* unpackConfigResponse(IntermediateTLV_t* rawPacket)
 {
-    PacketTLV_t* packet = createBasePacket(rawPacket);
+    //Check and count the pairs first, so the arena can be sized exactly
+    PacketView_t view;
+    pview_init(&view, rawPacket, false);
+    uint32_t count;
+    size_t listSize = sizeKVList(&view, &count);
+
+    PacketArena_t arena;
+    PacketTLV_t* packet = createBasePacket(rawPacket, &arena, sizeof(PTLVData_CONFIG_RESPONSE_t), listSize);
     if (packet == NULL)
     {
         //Free the raw packet
         llnet_packet_free(rawPacket);
         return NULL;
     }
+    PTLVData_CONFIG_RESPONSE_t* unpacked = (PTLVData_CONFIG_RESPONSE_t*)packet->data;
+    //Note that this is NULL if the list is malformed
+    unpacked->pairs = (listSize > 0) ? parseKVList(&arena, &view, count) : NULL;
+
+    llnet_packet_free(rawPacket);
+    return packet;
+}
 
-    errno = 0;
-    PTLVData_CONFIG_RESPONSE_t* unpacked = calloc(1,sizeof(PTLVData_CONFIG_RESPONSE_t));
-    //Allocation failed
-    if(unpacked == NULL && errno != 0)
+PacketTLV_t* unpackConfigUpdate(IntermediateTLV_t* rawPacket)
+{
+    //Check and count the pairs first, so the arena can be sized exactly
+    PacketView_t view;
+    pview_init(&view, rawPacket, false);
+    uint32_t count;
+    size_t listSize = sizeKVList(&view, &count);
+
+    PacketArena_t arena;
+    PacketTLV_t* packet = createBasePacket(rawPacket, &arena, sizeof(PTLVData_CONFIG_UPDATE_t), listSize);
+    if (packet == NULL)
     {
-        //packet allocation succeeded, so free that memory
-        free(packet);
         //Free the raw packet
         llnet_packet_free(rawPacket);
         return NULL;
     }
-    packet->type = rawPacket->type;
-    packet->timestamp = rawPacket->timestamp;
-    packet->length = rawPacket->length;
-    packet->data = (PTLVData_Base_t*)unpacked;
-    unpacked->pairs = parseKVList((char*)rawPacket->data, rawPacket->length);
+    PTLVData_CONFIG_UPDATE_t* unpacked = (PTLVData_CONFIG_UPDATE_t*)packet->data;
+    //Note that this is NULL if the list is malformed
+    unpacked->new_pairs = (listSize > 0) ? parseKVList(&arena, &view, count) : NULL;
 
     llnet_packet_free(rawPacket);
     return packet;
 }
 
-PacketTLV_t* unpackConfigUpdate(IntermediateTLV_t* rawPacket)
+PacketTLV_t* unpackUserData(IntermediateTLV_t* rawPacket)
 {
-    PacketTLV_t* packet = createBasePacket(rawPacket);
+    PacketArena_t arena;
+    PacketTLV_t* packet = createBasePacket(rawPacket, &arena, sizeof(PTLVData_USER_DATA_t), 0);
     if (packet == NULL)
     {
         //Free the raw packet
@@ -325,32 +468,20 @@ PacketTLV_t* unpackConfigUpdate(IntermediateTLV_t* rawPacket)
         return NULL;
     }
 
-    errno = 0;
-    PTLVData_CONFIG_UPDATE_t* unpacked = calloc(1,sizeof(PTLVData_CONFIG_UPDATE_t));
-    //Allocation failed
-    if(unpacked == NULL && errno != 0)
+    PTLVData_USER_DATA_t* unpacked = (PTLVData_USER_DATA_t*)packet->data;
+    if(!pschema_decode_USER_DATA(rawPacket->data, rawPacket->length, unpacked))
     {
-        //packet allocation succeeded, so free that memory
-        free(packet);
-        //Free the raw packet
-        llnet_packet_free(rawPacket);
-        return NULL;
+        return rejectShort(packet, rawPacket);
     }
-    packet->length = rawPacket->length;
-    packet->timestamp = rawPacket->timestamp;
-    packet->type = rawPacket->type;
-    packet->data = (PTLVData_Base_t*)unpacked;
-
-    //Note that this may be NULL if there's a failure
-    unpacked->new_pairs = parseKVList((char*)rawPacket->data, rawPacket->length);
 
     llnet_packet_free(rawPacket);
     return packet;
 }
 
-PacketTLV_t* unpackUserData(IntermediateTLV_t* rawPacket)
+PacketTLV_t* unpackUpdateStatus(IntermediateTLV_t* rawPacket)
 {
-    PacketTLV_t* packet = createBasePacket(rawPacket);
+    PacketArena_t arena;
+    PacketTLV_t* packet = createBasePacket(rawPacket, &arena, sizeof(PTLVData_UPDATE_STATUS_t), 0);
     if (packet == NULL)
     {
         //Free the raw packet
@@ -358,35 +489,21 @@ PacketTLV_t* unpackUserData(IntermediateTLV_t* rawPacket)
         return NULL;
     }
 
-    errno = 0;
-    PTLVData_USER_DATA_t* unpacked = calloc(1,sizeof(PTLVData_USER_DATA_t));
-    //Allocation failed
-    if(unpacked == NULL && errno != 0)
+    PTLVData_UPDATE_STATUS_t* unpacked = (PTLVData_UPDATE_STATUS_t*)packet->data;
+    if(!pschema_decode_UPDATE_STATUS(rawPacket->data, rawPacket->length, unpacked))
     {
-        //packet allocation succeeded, so free that memory
-        free(packet);
-        //Free the raw packet
-        llnet_packet_free(rawPacket);
-        return NULL;
+        return rejectShort(packet, rawPacket);
     }
-
-    packet->data = (PTLVData_Base_t*)unpacked;
-
-    unpacked->left_stick_x = rawPacket->data[0];
-    unpacked->left_stick_y = rawPacket->data[1];
-    unpacked->right_stick_x = rawPacket->data[2];
-    unpacked->right_stick_y = rawPacket->data[3];
-    unpacked->button_a = (rawPacket->data[4] & 0x80) != 0;
-    unpacked->button_b = (rawPacket->data[4] & 0x40) != 0;
-    unpacked->controller_uuid = (((uint16_t)(rawPacket->data[6])) << 8) | rawPacket->data[7];
-
+    //We own the packet memory, free it
     llnet_packet_free(rawPacket);
     return packet;
 }
 
 PacketTLV_t* unpackDebug(IntermediateTLV_t* rawPacket)
 {
-    PacketTLV_t* packet = createBasePacket(rawPacket);
+    PacketArena_t arena;
+    PacketTLV_t* packet = createBasePacket(rawPacket, &arena, sizeof(PTLVData_DEBUG_t),
+            arbitraryLength(rawPacket, PSCHEMA_FIXED_DEBUG));
     if (packet == NULL)
     {
         //Free the raw packet
@@ -394,213 +511,439 @@ PacketTLV_t* unpackDebug(IntermediateTLV_t* rawPacket)
         return NULL;
     }
 
-    errno = 0;
-    PTLVData_DEBUG_t* unpacked = calloc(1,sizeof(PTLVData_DEBUG_t));
-    //Allocation failed
-    if(unpacked == NULL && errno != 0)
+    PTLVData_DEBUG_t* unpacked = (PTLVData_DEBUG_t*)packet->data;
+    if(!pschema_decode_DEBUG(rawPacket->data, rawPacket->length, unpacked))
     {
-        //packet allocation succeeded, so free that memory
-        free(packet);
-        //Free the raw packet
-        llnet_packet_free(rawPacket);
-        return NULL;
-    }
-
-    packet->data = (PTLVData_Base_t*)unpacked;
-    uint8_t* workingPtr = rawPacket->data;
-    unpacked->code_status = (workingPtr[0] & 0xF0) >> 4;
-    unpacked->commit_hash = (workingPtr[0] & 0x0F) << 24 | workingPtr[1] << 16 | workingPtr[2] << 8 | workingPtr[3];
-
-    //Move the working pointer to the next word
-    workingPtr += 4;
-    unpacked->robot_uuid = *((uint32_t*)(workingPtr));
-
-    //Move the working pointer to the next word
-    workingPtr += 4;
-    unpacked->state = (RobotState_t)(*workingPtr);
-    unpacked->reserved = workingPtr[1];
-    unpacked->config_entries = workingPtr[2] << 8 | workingPtr[3];
-
-    //Move the working pointer to the beginning of the arbitrary data;
-    workingPtr += 4;
-    //Size of data - size of well defined part
-    size_t dataSize = rawPacket->length - 12;
-    unpacked->arbitrary = malloc(dataSize);
-    if(unpacked->arbitrary != NULL) {
-        memcpy(unpacked->arbitrary, workingPtr, dataSize);
+        return rejectShort(packet, rawPacket);
     }
+    //Size of data - size of well defined part, NULL if there isn't any
+    unpacked->arbitrary = copyArbitrary(&arena, rawPacket, PSCHEMA_FIXED_DEBUG);
 
     llnet_packet_free(rawPacket);
     return packet;
 }
 
+//Everything a decoded packet points to lives in its arena, which starts with the packet itself
 void destroyInit(PacketTLV_t* initPacket)
 {
-    if(initPacket->type != pt_INIT)
-    {
-        //TODO log error message like other checks
-    }
-    free(initPacket->data);
-    initPacket->data = NULL;
     free(initPacket);
 }
 void destroyStateRequest(PacketTLV_t* stateRequestPacket)
 {
-    if(stateRequestPacket->type != pt_STATE_REQUEST)
-    {
-        //TODO log error message like other checks
-    }
-    free(stateRequestPacket->data);
-    stateRequestPacket->data = NULL;
     free(stateRequestPacket);
 }
 void destroyStateResponse(PacketTLV_t* stateResponsePacket)
 {
-    if(stateResponsePacket->type == pt_STATE_RESPONSE)
-    {
-        PTLVData_STATE_RESPONSE_t* data = (PTLVData_STATE_RESPONSE_t*)stateResponsePacket->data;
-        free(data->arbitrary);
-        data->arbitrary = NULL;
-        //We're guaranteed to free this later
-        data = NULL;
-    }
-    else
-    {
-        //Incorrect packet type or corrupted packet, refusing to free possibly non-existent packet-specific data.
-        //This may cause data leaks!
-        //TODO log error message
-        //TODO log packet type and what type the programmer wants us to free
-    }
-    //Free the packet structure shared by all packets
-    free(stateResponsePacket->data);
-    stateResponsePacket->data = NULL;
     free(stateResponsePacket);
 }
 void destroyStateUpdate(PacketTLV_t* stateUpdatePacket)
 {
-    if(stateUpdatePacket->type == pt_STATE_UPDATE)
-    {
-        PTLVData_STATE_UPDATE_t* data = (PTLVData_STATE_UPDATE_t*)stateUpdatePacket->data;
-        free(data->arbitrary);
-        data->arbitrary = NULL;
-        //We're guaranteed to free this later
-        data = NULL;
-    }
-    else
-    {
-        //Incorrect packet type or corrupted packet, refusing to free possibly non-existent packet-specific data.
-        //This may cause data leaks!
-        //TODO log error message
-        //TODO log packet type and what type the programmer wants us to free
-    }
-    free(stateUpdatePacket->data);
-    stateUpdatePacket->data = NULL;
     free(stateUpdatePacket);
 }
 void destroyConfigRequest(PacketTLV_t* configRequestPacket)
 {
     if(configRequestPacket->type == pt_CONFIG_REQUEST)
     {
+        //The list's memory is in the arena, but its mutex still needs cleaning up
         PTLVData_CONFIG_REQUEST_t* data = (PTLVData_CONFIG_REQUEST_t*)configRequestPacket->data;
-        for (unsigned int i = 0; i < list_size(data->keys); i++)
-        {
-            free(list_get(data->keys, i));
-        }
         list_free(data->keys);
-        data->keys = NULL;
-        //We're guaranteed to free this later
-        data = NULL;
-    }
-    else
-    {
-        //Incorrect packet type or corrupted packet, refusing to free possibly non-existent packet-specific data.
-        //This may cause data leaks!
-        //TODO log error message
-        //TODO log packet type and what type the programmer wants us to free
     }
-    free(configRequestPacket->data);
-    configRequestPacket->data = NULL;
     free(configRequestPacket);
 }
 void destroyConfigResponse(PacketTLV_t* configResponsePacket)
 {
     if(configResponsePacket->type == pt_CONFIG_RESPONSE)
     {
+        //The list's memory is in the arena, but its mutex still needs cleaning up
         PTLVData_CONFIG_RESPONSE_t* data = (PTLVData_CONFIG_RESPONSE_t*)configResponsePacket->data;
-        //Free all of the KV pairs
-        for(unsigned int i = 0; i < list_size(data->pairs); i++)
+        if(data->pairs != NULL)
         {
-            KVPairTLV_destroy(list_get(data->pairs, i));
+            list_free(data->pairs);
         }
-        list_free(data->pairs);
-        data->pairs = NULL;
-        //We're guaranteed to free this later
-        data = NULL;
-    }
-    else
-    {
-        //Incorrect packet type or corrupted packet, refusing to free possibly non-existent packet-specific data.
-        //This may cause data leaks!
-        //TODO log error message
-        //TODO log packet type and what type the programmer wants us to free
     }
-    free(configResponsePacket->data);
-    configResponsePacket->data = NULL;
     free(configResponsePacket);
 }
 void destroyConfigUpdate(PacketTLV_t* configUpdatePacket)
 {
     if(configUpdatePacket->type == pt_CONFIG_UPDATE)
     {
+        //The list's memory is in the arena, but its mutex still needs cleaning up
         PTLVData_CONFIG_UPDATE_t* data = (PTLVData_CONFIG_UPDATE_t*)configUpdatePacket->data;
-        for(unsigned int i = 0; i < list_size(data->new_pairs); i++)
+        if(data->new_pairs != NULL)
         {
-            KVPairTLV_destroy(list_get(data->new_pairs, i));
+            list_free(data->new_pairs);
         }
-        list_free(data->new_pairs);
-        data->new_pairs = NULL;
-        data = NULL;
-        //We're guaranteed to free this later
-    }
-    else
-    {
-        //Incorrect packet type or corrupted packet, refusing to free possibly non-existent packet-specific data.
-        //This may cause data leaks!
-        //TODO log error message
-        //TODO log packet type and what type the programmer wants us to free
     }
-    free(configUpdatePacket->data);
-    configUpdatePacket->data = NULL;
     free(configUpdatePacket);
 }
 void destroyUserData(PacketTLV_t* userDataPacket)
 {
-    if(userDataPacket->type != pt_USER_DATA)
-    {
-        //TODO log error message like other checks
-    }
-    free(userDataPacket->data);
-    userDataPacket->data = NULL;
     free(userDataPacket);
 }
+void destroyUpdateStatus(PacketTLV_t* updateStatusPacket)
+{
+    free(updateStatusPacket);
+}
 void destroyDebug(PacketTLV_t* debugPacket)
 {
-    if(debugPacket->type == pt_DEBUG)
+    free(debugPacket);
+}
+
+/**
+ * Writes the header of a packed frame.  The timestamp is left for llnet_connection_send_packed() to fill in.
+ * @param buffer
+ *  The start of the frame.
+ * @param type
+ *  The packet type.
+ * @param payloadLength
+ *  The length of the payload after the header.
+ * @return
+ *  The length of the frame.
+ */
+static uint32_t packHeader(uint8_t* buffer, PacketType_t type, uint32_t payloadLength)
+{
+    uint32_t word = htonl(((uint32_t)type << 24) | payloadLength);
+    memcpy(buffer, &word, sizeof(uint32_t));
+    memset(buffer + 4, 0, sizeof(uint32_t));
+    return LLNET_HEADER_LENGTH + payloadLength;
+}
+
+/**
+ * Writes a 24-bit big-endian value.
+ */
+static void packU24(uint8_t* buffer, uint32_t value)
+{
+    buffer[0] = (value >> 16) & 0xFF;
+    buffer[1] = (value >> 8) & 0xFF;
+    buffer[2] = value & 0xFF;
+}
+
+/**
+ * Gets the length of a pair's value on the wire, which depends only on its type.
+ */
+static uint32_t packedValueLength(const KVPairTLV_t* pair)
+{
+    switch(pair->type)
+    {
+        case kv_Integer:
+            return sizeof(int32_t);
+        case kv_Float:
+            return sizeof(float);
+        case kv_Double:
+            return sizeof(double);
+        case kv_Boolean:
+            return sizeof(int8_t);
+        case kv_CString:
+            return strlen(pair->value.CString) + 1;
+    }
+    return 0;
+}
+
+/**
+ * Rounds a CONFIG_* payload up to its padded length.
+ */
+static uint32_t padConfigLength(uint32_t length)
+{
+    return (length + PACK_CONFIG_ALIGN - 1) & ~(uint32_t)(PACK_CONFIG_ALIGN - 1);
+}
+
+/**
+ * Gets the payload length of a list of nul-terminated strings, padding included.
+ */
+static uint32_t packedStringsLength(List_t* strings)
+{
+    uint32_t length = 0;
+    uint32_t count = (strings == NULL) ? 0 : list_size(strings);
+    for(uint32_t i = 0; i < count; i++)
     {
-        PTLVData_DEBUG_t* debugData = (PTLVData_DEBUG_t*)(debugPacket->data);
-        free(debugData->arbitrary);
-        debugData->arbitrary = NULL;
-        //We're guaranteed to free this later.
-        debugData = NULL;
+        size_t len = strlen(list_get(strings, i));
+        //Empty strings would read back as padding, so they're left out
+        if(len > 0)
+        {
+            length += len + 1;
+        }
     }
-    else
+    return padConfigLength(length);
+}
+
+/**
+ * Gets the payload length of a key-value list, padding included.
+ */
+static uint32_t packedKVListLength(List_t* pairs)
+{
+    uint32_t length = 0;
+    uint32_t count = (pairs == NULL) ? 0 : list_size(pairs);
+    for(uint32_t i = 0; i < count; i++)
     {
-        //Incorrect packet type or corrupted packet, refusing to free possibly non-existent packet-specific data.
-        //This may cause data leaks!
-        //TODO log error message
-        //TODO log packet type and what type the programmer wants us to free
+        KVPairTLV_t* pair = list_get(pairs, i);
+        //Key, nul, header and value, with a separator between pairs
+        length += strlen(pair->key) + 1 + 4 + packedValueLength(pair) + ((i > 0) ? 1 : 0);
     }
-    free(debugPacket->data);
-    debugPacket->data = NULL;
-    free(debugPacket);
+    return padConfigLength(length);
+}
+
+/**
+ * Packs a list of nul-terminated strings, the buffer has already been checked.
+ */
+static void packStrings(List_t* strings, uint8_t* payload, uint32_t payloadLength)
+{
+    uint8_t* pos = payload;
+    uint32_t count = (strings == NULL) ? 0 : list_size(strings);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        const char* str = list_get(strings, i);
+        size_t len = strlen(str);
+        if(len > 0)
+        {
+            memcpy(pos, str, len + 1);
+            pos += len + 1;
+        }
+    }
+    //Pad with nuls, which read back as empty strings
+    memset(pos, 0, payload + payloadLength - pos);
+}
+
+/**
+ * Packs a key-value list, the buffer has already been checked.
+ */
+static void packKVList(List_t* pairs, uint8_t* payload, uint32_t payloadLength)
+{
+    uint8_t* pos = payload;
+    uint32_t count = (pairs == NULL) ? 0 : list_size(pairs);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        KVPairTLV_t* pair = list_get(pairs, i);
+        if(i > 0)
+        {
+            *pos++ = ';';
+        }
+        size_t keyLen = strlen(pair->key);
+        memcpy(pos, pair->key, keyLen + 1);
+        pos += keyLen + 1;
+
+        //Type, then the length of the value plus this header
+        uint32_t valueLen = packedValueLength(pair);
+        pos[0] = (uint8_t)pair->type;
+        packU24(pos + 1, valueLen + 4);
+        pos += 4;
+        memcpy(pos, (pair->type == kv_CString) ? (const void*)pair->value.CString : (const void*)&pair->value,
+                valueLen);
+        pos += valueLen;
+    }
+    //Pad with nuls, an empty key ends the list
+    memset(pos, 0, payload + payloadLength - pos);
+}
+
+uint32_t packedLength(PacketType_t type, const PTLVData_Base_t* data, uint32_t arbitraryLength)
+{
+    uint32_t payload;
+    PSchemaTrailing_t trailing;
+    if(!pschema_layout(type, &payload, &trailing))
+    {
+        return 0;
+    }
+    //The fixed fields, then whatever follows them
+    switch(trailing)
+    {
+        case pst_NONE:
+            break;
+        case pst_ARBITRARY:
+            payload += arbitraryLength;
+            break;
+        case pst_STRINGS:
+            payload += packedStringsLength(((const PTLVData_CONFIG_REQUEST_t*)data)->keys);
+            break;
+        case pst_KV_LIST:
+            //CONFIG_RESPONSE and CONFIG_UPDATE only differ in the name of their list
+            payload += packedKVListLength((type == pt_CONFIG_RESPONSE) ?
+                    ((const PTLVData_CONFIG_RESPONSE_t*)data)->pairs : ((const PTLVData_CONFIG_UPDATE_t*)data)->new_pairs);
+            break;
+    }
+    //Anything longer can't be described by the header
+    if(payload > LLNET_LENGTH_MASK)
+    {
+        return 0;
+    }
+    return LLNET_HEADER_LENGTH + payload;
+}
+
+uint32_t packInit(const PTLVData_INIT_t* data, uint8_t* buffer, uint32_t bufferLength)
+{
+    uint32_t frameLength = packedLength(pt_INIT, (const PTLVData_Base_t*)data, 0);
+    if(bufferLength < frameLength)
+    {
+        return 0;
+    }
+    pschema_encode_INIT(data, buffer + LLNET_HEADER_LENGTH);
+    return packHeader(buffer, pt_INIT, frameLength - LLNET_HEADER_LENGTH);
+}
+
+uint32_t packStateRequest(uint8_t* buffer, uint32_t bufferLength)
+{
+    if(bufferLength < LLNET_HEADER_LENGTH)
+    {
+        return 0;
+    }
+    return packHeader(buffer, pt_STATE_REQUEST, 0);
+}
+
+uint32_t packStateResponse(const PTLVData_STATE_RESPONSE_t* data, uint32_t arbitraryLength, uint8_t* buffer,
+        uint32_t bufferLength)
+{
+    uint32_t frameLength = packedLength(pt_STATE_RESPONSE, (const PTLVData_Base_t*)data, arbitraryLength);
+    if(frameLength == 0 || bufferLength < frameLength)
+    {
+        return 0;
+    }
+    uint8_t* payload = buffer + LLNET_HEADER_LENGTH;
+    pschema_encode_STATE_RESPONSE(data, payload);
+    if(arbitraryLength > 0)
+    {
+        memcpy(payload + PSCHEMA_FIXED_STATE_RESPONSE, data->arbitrary, arbitraryLength);
+    }
+    return packHeader(buffer, pt_STATE_RESPONSE, PSCHEMA_FIXED_STATE_RESPONSE + arbitraryLength);
+}
+
+uint32_t packStateUpdate(const PTLVData_STATE_UPDATE_t* data, uint32_t arbitraryLength, uint8_t* buffer,
+        uint32_t bufferLength)
+{
+    uint32_t frameLength = packedLength(pt_STATE_UPDATE, (const PTLVData_Base_t*)data, arbitraryLength);
+    if(frameLength == 0 || bufferLength < frameLength)
+    {
+        return 0;
+    }
+    uint8_t* payload = buffer + LLNET_HEADER_LENGTH;
+    pschema_encode_STATE_UPDATE(data, payload);
+    if(arbitraryLength > 0)
+    {
+        memcpy(payload + PSCHEMA_FIXED_STATE_UPDATE, data->arbitrary, arbitraryLength);
+    }
+    return packHeader(buffer, pt_STATE_UPDATE, PSCHEMA_FIXED_STATE_UPDATE + arbitraryLength);
+}
+
+uint32_t packConfigRequest(const PTLVData_CONFIG_REQUEST_t* data, uint8_t* buffer, uint32_t bufferLength)
+{
+    uint32_t frameLength = packedLength(pt_CONFIG_REQUEST, (const PTLVData_Base_t*)data, 0);
+    if(frameLength == 0 || bufferLength < frameLength)
+    {
+        return 0;
+    }
+    packStrings(data->keys, buffer + LLNET_HEADER_LENGTH, frameLength - LLNET_HEADER_LENGTH);
+    return packHeader(buffer, pt_CONFIG_REQUEST, frameLength - LLNET_HEADER_LENGTH);
+}
+
+uint32_t packConfigResponse(const PTLVData_CONFIG_RESPONSE_t* data, uint8_t* buffer, uint32_t bufferLength)
+{
+    uint32_t frameLength = packedLength(pt_CONFIG_RESPONSE, (const PTLVData_Base_t*)data, 0);
+    if(frameLength == 0 || bufferLength < frameLength)
+    {
+        return 0;
+    }
+    packKVList(data->pairs, buffer + LLNET_HEADER_LENGTH, frameLength - LLNET_HEADER_LENGTH);
+    return packHeader(buffer, pt_CONFIG_RESPONSE, frameLength - LLNET_HEADER_LENGTH);
+}
+
+uint32_t packConfigUpdate(const PTLVData_CONFIG_UPDATE_t* data, uint8_t* buffer, uint32_t bufferLength)
+{
+    uint32_t frameLength = packedLength(pt_CONFIG_UPDATE, (const PTLVData_Base_t*)data, 0);
+    if(frameLength == 0 || bufferLength < frameLength)
+    {
+        return 0;
+    }
+    packKVList(data->new_pairs, buffer + LLNET_HEADER_LENGTH, frameLength - LLNET_HEADER_LENGTH);
+    return packHeader(buffer, pt_CONFIG_UPDATE, frameLength - LLNET_HEADER_LENGTH);
+}
+
+uint32_t packUserData(const PTLVData_USER_DATA_t* data, uint8_t* buffer, uint32_t bufferLength)
+{
+    uint32_t frameLength = packedLength(pt_USER_DATA, (const PTLVData_Base_t*)data, 0);
+    if(bufferLength < frameLength)
+    {
+        return 0;
+    }
+    pschema_encode_USER_DATA(data, buffer + LLNET_HEADER_LENGTH);
+    return packHeader(buffer, pt_USER_DATA, frameLength - LLNET_HEADER_LENGTH);
+}
+
+uint32_t packUpdateStatus(const PTLVData_UPDATE_STATUS_t* data, uint8_t* buffer, uint32_t bufferLength)
+{
+    uint32_t frameLength = packedLength(pt_UPDATE_STATUS, (const PTLVData_Base_t*)data, 0);
+    if(bufferLength < frameLength)
+    {
+        return 0;
+    }
+    pschema_encode_UPDATE_STATUS(data, buffer + LLNET_HEADER_LENGTH);
+    return packHeader(buffer, pt_UPDATE_STATUS, frameLength - LLNET_HEADER_LENGTH);
+}
+
+uint32_t packDebug(const PTLVData_DEBUG_t* data, uint32_t arbitraryLength, uint8_t* buffer, uint32_t bufferLength)
+{
+    uint32_t frameLength = packedLength(pt_DEBUG, (const PTLVData_Base_t*)data, arbitraryLength);
+    if(frameLength == 0 || bufferLength < frameLength)
+    {
+        return 0;
+    }
+    uint8_t* payload = buffer + LLNET_HEADER_LENGTH;
+    pschema_encode_DEBUG(data, payload);
+    if(arbitraryLength > 0)
+    {
+        memcpy(payload + PSCHEMA_FIXED_DEBUG, data->arbitrary, arbitraryLength);
+    }
+    return packHeader(buffer, pt_DEBUG, PSCHEMA_FIXED_DEBUG + arbitraryLength);
+}
+
+PackPool_t* packPoolInit(uint32_t count, uint32_t bufferLength)
+{
+    PackPool_t* pool = malloc(sizeof(PackPool_t));
+    if(pool == NULL)
+    {
+        return NULL;
+    }
+    pool->memory = malloc((size_t)count * bufferLength);
+    pool->free = malloc(sizeof(uint8_t*) * count);
+    if((pool->memory == NULL || pool->free == NULL) && count > 0)
+    {
+        free(pool->memory);
+        free(pool->free);
+        free(pool);
+        return NULL;
+    }
+    pool->bufferLength = bufferLength;
+    pool->count = count;
+    pool->available = count;
+    for(uint32_t i = 0; i < count; i++)
+    {
+        pool->free[i] = pool->memory + ((size_t)i * bufferLength);
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    return pool;
+}
+
+uint8_t* packPoolTake(PackPool_t* pool)
+{
+    uint8_t* buffer = NULL;
+    pthread_mutex_lock(&pool->mutex);
+    if(pool->available > 0)
+    {
+        pool->available--;
+        buffer = pool->free[pool->available];
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return buffer;
+}
+
+void packPoolGive(PackPool_t* pool, uint8_t* buffer)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->free[pool->available] = buffer;
+    pool->available++;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void packPoolFree(PackPool_t* pool)
+{
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->free);
+    free(pool->memory);
+    free(pool);
 }
@@ -4,17 +4,43 @@
 
 /**
  * @file packethandlers.h
- * Header file defining the functions used to unpack packets received from the low-level network interface.
- * Note that these should not be called by user code.  This file is primarily meant as an aggregation of functions
- * used by the messagehandler.
+ * Header file defining the functions used to unpack packets received from the low-level network interface, and to
+ * pack packets to send with it.
+ * Note that the unpackers should not be called by user code.  This file is primarily meant as an aggregation of
+ * functions used by the messagehandler.
+ *
+ * Each unpacker makes exactly one allocation, sized from the raw packet, and places the PacketTLV_t, its data structure
+ * and everything they point to (lists, keys, strings, arbitrary data) in it.  The lists handed out are fixed-size
+ * ArrayLists and must not be added to.  Cleaning a packet up is a single free.
  */
 
 #ifndef INC_2020_CORE_CODE_PACKETHANDLERS_H
 #define INC_2020_CORE_CODE_PACKETHANDLERS_H
 
+#include <pthread.h>
 #include "packet.h"
 #include "lowlevel.h"
 
+//Packed frames are padded to a multiple of this for the CONFIG_* types
+#define PACK_CONFIG_ALIGN 4
+
+/**
+ * A pool of fixed-size buffers to pack frames into.
+ */
+typedef struct PackPool
+{
+    pthread_mutex_t mutex;
+    //Length of each buffer
+    uint32_t bufferLength;
+    //Number of buffers in the pool, and how many are available
+    uint32_t count;
+    uint32_t available;
+    //Stack of available buffers
+    uint8_t** free;
+    //All of the buffers, in one allocation
+    uint8_t* memory;
+} PackPool_t;
+
 /**
  * Handler function to unpack an INIT packet when received by the low-level network interface.
  * This function will always attempt to free \p rawPacket.
@@ -46,7 +72,7 @@ PacketTLV_t* unpackStateRequest(IntermediateTLV_t* rawPacket);
  * @return
  *  A PacketTLV_t* containing the information contained in the packet header.
  *  If the function fails (Usually during memory allocation) it returns NULL.
- *  The arbitrary data field is always a pointer to memory, which the consumer should handle or ignore.
+ *  The arbitrary data field points to the data after the fixed fields, or is NULL if there is none.
  */
 PacketTLV_t* unpackStateResponse(IntermediateTLV_t* rawPacket);
 
@@ -58,7 +84,7 @@ PacketTLV_t* unpackStateResponse(IntermediateTLV_t* rawPacket);
  * @return
  *  A PacketTLV_t* containing the information contained in the packet header.
  *  If the function fails (Usually during memory allocation) it returns NULL.
- *  The arbitrary data field is always a pointer to memory, which the consumer should handle or ignore.
+ *  The arbitrary data field points to the data after the fixed fields, or is NULL if there is none.
  */
 PacketTLV_t* unpackStateUpdate(IntermediateTLV_t* rawPacket);
 
@@ -80,7 +106,8 @@ PacketTLV_t* unpackConfigRequest(IntermediateTLV_t* rawPacket);
  *  The packet which was received by the low-level network interface.  It should have a \p type of pt_CONFIG_RESPONSE.
  * @return
  *  A PacketTLV_t* containing the information contained in the packet header.
- *  If the function fails (Usually during memory allocation) it returns NULL.
+ *  If the function fails (Usually during memory allocation) it returns NULL.  If the pair list is malformed, the
+ *  \p pairs field is NULL.
  */
 PacketTLV_t* unpackConfigResponse(IntermediateTLV_t* rawPacket);
 
@@ -91,7 +118,8 @@ PacketTLV_t* unpackConfigResponse(IntermediateTLV_t* rawPacket);
  *  The packet which was received by the low-level network interface.  It should have a \p type of pt_CONFIG_UPDATE.
  * @return
  *  A PacketTLV_t* containing the information contained in the packet header.
- *  If the function fails (Usually during memory allocation) it returns NULL.
+ *  If the function fails (Usually during memory allocation) it returns NULL.  If the pair list is malformed, the
+ *  \p new_pairs field is NULL.
  */
 PacketTLV_t* unpackConfigUpdate(IntermediateTLV_t* rawPacket);
 
@@ -106,6 +134,17 @@ PacketTLV_t* unpackConfigUpdate(IntermediateTLV_t* rawPacket);
  */
 PacketTLV_t* unpackUserData(IntermediateTLV_t* rawPacket);
 
+/**
+ * Handler function to unpack an UPDATE_STATUS packet when received by the low-level network interface. This function
+ * will always attempt to free \p rawPacket.
+ * @param rawPacket
+ *  The packet which was received by the low-level network interface.  It should have a \p type of pt_UPDATE_STATUS.
+ * @return
+ *  A PacketTLV_t* containing the information contained in the packet header.
+ *  If the function fails (Usually during memory allocation) it returns NULL.
+ */
+PacketTLV_t* unpackUpdateStatus(IntermediateTLV_t* rawPacket);
+
 /**
  * Handler function to unpack a DEBUG packet when received by the low-level network interface. This function
  * will always attempt to free \p rawPacket.
@@ -114,8 +153,8 @@ PacketTLV_t* unpackUserData(IntermediateTLV_t* rawPacket);
  * @return
  *  A PacketTLV_t* containing the information contained in the packet header.
  *  If the function fails (Usually during memory allocation) it returns NULL.
- *  The arbitrary data field will always be a pointer to memory.  The consumer should handle or ignore the data as
- *  necessary.
+ *  The arbitrary data field points to the data after the fixed fields, or is NULL if there is none.  The consumer
+ *  should handle or ignore the data as necessary.
  */
 PacketTLV_t* unpackDebug(IntermediateTLV_t* rawPacket);
 
@@ -176,6 +215,13 @@ void destroyConfigUpdate(PacketTLV_t* configUpdatePacket);
  */
 void destroyUserData(PacketTLV_t* userDataPacket);
 
+/**
+ * Cleans up an UPDATE_STATUS packet.
+ * @param updateStatusPacket
+ *  A packet returned by unpackUpdateStatus()
+ */
+void destroyUpdateStatus(PacketTLV_t* updateStatusPacket);
+
 /**
  * Cleans up a DEBUG packet.
  * @param debugPacket
@@ -183,4 +229,110 @@ void destroyUserData(PacketTLV_t* userDataPacket);
  */
 void destroyDebug(PacketTLV_t* debugPacket);
 
+/**
+ * Works out how long a packed frame will be, so a buffer can be sized before packing.
+ * @param type
+ *  The packet type.
+ * @param data
+ *  The packet's data structure (may be NULL for STATE_REQUEST).
+ * @param arbitraryLength
+ *  The length of the arbitrary data, for STATE_RESPONSE, STATE_UPDATE and DEBUG.  Ignored for other types.
+ * @return
+ *  The length of the frame, including LLNET_HEADER_LENGTH bytes for the header, or 0 if the type can't be packed.
+ */
+uint32_t packedLength(PacketType_t type, const PTLVData_Base_t* data, uint32_t arbitraryLength);
+
+/*
+ * The pack functions encode a packet straight into \p buffer, as a frame ready for llnet_connection_send_packed():
+ * the first LLNET_HEADER_LENGTH bytes are the header (the timestamp is filled in when the frame is sent), and the
+ * payload follows.  Each returns the length of the frame, or 0 if \p bufferLength is too short (see packedLength()).
+ * Nothing is allocated.
+ */
+
+/**
+ * Packs an INIT packet.
+ */
+uint32_t packInit(const PTLVData_INIT_t* data, uint8_t* buffer, uint32_t bufferLength);
+
+/**
+ * Packs a STATE_REQUEST packet, which is only a header.
+ */
+uint32_t packStateRequest(uint8_t* buffer, uint32_t bufferLength);
+
+/**
+ * Packs a STATE_RESPONSE packet.
+ * @param arbitraryLength
+ *  The length of \p data->arbitrary (may be 0).
+ */
+uint32_t packStateResponse(const PTLVData_STATE_RESPONSE_t* data, uint32_t arbitraryLength, uint8_t* buffer,
+        uint32_t bufferLength);
+
+/**
+ * Packs a STATE_UPDATE packet.
+ * @param arbitraryLength
+ *  The length of \p data->arbitrary (may be 0).
+ */
+uint32_t packStateUpdate(const PTLVData_STATE_UPDATE_t* data, uint32_t arbitraryLength, uint8_t* buffer,
+        uint32_t bufferLength);
+
+/**
+ * Packs a CONFIG_REQUEST packet, empty keys are left out.
+ */
+uint32_t packConfigRequest(const PTLVData_CONFIG_REQUEST_t* data, uint8_t* buffer, uint32_t bufferLength);
+
+/**
+ * Packs a CONFIG_RESPONSE packet.
+ */
+uint32_t packConfigResponse(const PTLVData_CONFIG_RESPONSE_t* data, uint8_t* buffer, uint32_t bufferLength);
+
+/**
+ * Packs a CONFIG_UPDATE packet.
+ */
+uint32_t packConfigUpdate(const PTLVData_CONFIG_UPDATE_t* data, uint8_t* buffer, uint32_t bufferLength);
+
+/**
+ * Packs a USER_DATA packet.
+ */
+uint32_t packUserData(const PTLVData_USER_DATA_t* data, uint8_t* buffer, uint32_t bufferLength);
+
+/**
+ * Packs an UPDATE_STATUS packet.
+ */
+uint32_t packUpdateStatus(const PTLVData_UPDATE_STATUS_t* data, uint8_t* buffer, uint32_t bufferLength);
+
+/**
+ * Packs a DEBUG packet.
+ * @param arbitraryLength
+ *  The length of \p data->arbitrary (may be 0).
+ */
+uint32_t packDebug(const PTLVData_DEBUG_t* data, uint32_t arbitraryLength, uint8_t* buffer, uint32_t bufferLength);
+
+/**
+ * Creates a pool of buffers to pack frames into, so senders don't allocate for every packet.
+ * @param count
+ *  The number of buffers.
+ * @param bufferLength
+ *  The length of each buffer, including the header.
+ * @return
+ *  The pool, or NULL if the memory allocation fails.
+ */
+PackPool_t* packPoolInit(uint32_t count, uint32_t bufferLength);
+
+/**
+ * Takes a buffer from a pool.  It is bufferLength bytes long, and must be given back with packPoolGive().
+ * @return
+ *  The buffer, or NULL if every buffer is in use.
+ */
+uint8_t* packPoolTake(PackPool_t* pool);
+
+/**
+ * Gives a buffer back to the pool it came from.
+ */
+void packPoolGive(PackPool_t* pool, uint8_t* buffer);
+
+/**
+ * Cleans up a pool.  Every buffer must have been given back.
+ */
+void packPoolFree(PackPool_t* pool);
+
 #endif //INC_2020_CORE_CODE_PACKETHANDLERS_H
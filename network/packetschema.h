@@ -0,0 +1,243 @@
+/**
+ * core/network/packetschema.h
+ *
+ * The one description of how every packet's fixed fields sit on the wire,
+ * following the tables in doc/ControlProtocol. Each field is read as a 1 to 4
+ * byte word at a fixed offset, then shifted and masked, so fields that share
+ * bytes (flags, the DEBUG code status and commit hash) are described the same
+ * way as whole ones.
+ *
+ * The decoders and encoders below are expanded from the schema, so the
+ * unpackers, views and packers can't disagree about a layout. Offsets and
+ * widths are constants, so each codec compiles down to straight-line loads and
+ * stores; the only check left at run time is the payload length, and a field
+ * that doesn't fit its packet fails to compile.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_PACKETSCHEMA
+#define __CORE_NETWORK_PACKETSCHEMA
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "packet.h"
+
+// Defines the byte orders a field can be in
+#define PSCHEMA_BE   (0) // big-endian (network order)
+#define PSCHEMA_HOST (1) // the sender's order, copied as-is
+
+// Defines what can follow a packet's fixed fields
+typedef enum PSchemaTrailing {
+    pst_NONE      = 0x00,
+    pst_ARBITRARY = 0x01, // opaque bytes, to the end of the packet
+    pst_STRINGS   = 0x02, // nul-terminated strings (CONFIG_REQUEST)
+    pst_KV_LIST   = 0x03  // key-value pairs (CONFIG_RESPONSE and CONFIG_UPDATE)
+} PSchemaTrailing_t;
+
+// PACKET(type, length of the fixed fields, what follows them)
+#define PACKET_SCHEMA(PACKET) \
+    PACKET(INIT,             4, pst_NONE) \
+    PACKET(STATE_REQUEST,    0, pst_NONE) \
+    PACKET(STATE_RESPONSE,   4, pst_ARBITRARY) \
+    PACKET(STATE_UPDATE,     4, pst_ARBITRARY) \
+    PACKET(CONFIG_REQUEST,   0, pst_STRINGS) \
+    PACKET(CONFIG_RESPONSE,  0, pst_KV_LIST) \
+    PACKET(CONFIG_UPDATE,    0, pst_KV_LIST) \
+    PACKET(USER_DATA,        8, pst_NONE) \
+    PACKET(UPDATE_STATUS,    4, pst_NONE) \
+    PACKET(DEBUG,           12, pst_ARBITRARY)
+
+// FIELD(packet type, name, byte offset, word size in bytes, byte order, shift, bits),
+// where bits has to match the field's PTLV_BITS_ width in packet.h
+#define PSCHEMA_FIELDS_INIT(FIELD) \
+    FIELD(INIT,           robot_uuid,      0, 4, PSCHEMA_HOST, 0, 32)
+
+#define PSCHEMA_FIELDS_STATE_REQUEST(FIELD)
+
+#define PSCHEMA_FIELDS_STATE_RESPONSE(FIELD) \
+    FIELD(STATE_RESPONSE, state,           0, 1, PSCHEMA_BE,   0,  8) \
+    FIELD(STATE_RESPONSE, reserved,        1, 3, PSCHEMA_BE,   0, 24)
+
+#define PSCHEMA_FIELDS_STATE_UPDATE(FIELD) \
+    FIELD(STATE_UPDATE,   new_state,       0, 1, PSCHEMA_BE,   0,  8) \
+    FIELD(STATE_UPDATE,   reserved,        1, 3, PSCHEMA_BE,   0, 24)
+
+#define PSCHEMA_FIELDS_CONFIG_REQUEST(FIELD)
+#define PSCHEMA_FIELDS_CONFIG_RESPONSE(FIELD)
+#define PSCHEMA_FIELDS_CONFIG_UPDATE(FIELD)
+
+#define PSCHEMA_FIELDS_USER_DATA(FIELD) \
+    FIELD(USER_DATA,      left_stick_x,    0, 1, PSCHEMA_BE,   0,  8) \
+    FIELD(USER_DATA,      left_stick_y,    1, 1, PSCHEMA_BE,   0,  8) \
+    FIELD(USER_DATA,      right_stick_x,   2, 1, PSCHEMA_BE,   0,  8) \
+    FIELD(USER_DATA,      right_stick_y,   3, 1, PSCHEMA_BE,   0,  8) \
+    FIELD(USER_DATA,      button_a,        4, 1, PSCHEMA_BE,   7,  1) \
+    FIELD(USER_DATA,      button_b,        4, 1, PSCHEMA_BE,   6,  1) \
+    FIELD(USER_DATA,      controller_uuid, 6, 2, PSCHEMA_BE,   0, 16)
+
+#define PSCHEMA_FIELDS_UPDATE_STATUS(FIELD) \
+    FIELD(UPDATE_STATUS,  code,            0, 1, PSCHEMA_BE,   0,  8) \
+    FIELD(UPDATE_STATUS,  reserved,        1, 3, PSCHEMA_BE,   0, 24)
+
+#define PSCHEMA_FIELDS_DEBUG(FIELD) \
+    FIELD(DEBUG,          code_status,     0, 1, PSCHEMA_BE,   4,  4) \
+    FIELD(DEBUG,          commit_hash,     0, 4, PSCHEMA_BE,   0, 28) \
+    FIELD(DEBUG,          robot_uuid,      4, 4, PSCHEMA_HOST, 0, 32) \
+    FIELD(DEBUG,          state,           8, 1, PSCHEMA_BE,   0,  8) \
+    FIELD(DEBUG,          reserved,        9, 1, PSCHEMA_BE,   0,  8) \
+    FIELD(DEBUG,          config_entries, 10, 2, PSCHEMA_BE,   0, 16)
+
+// Gives every type's fixed length a name, e.g. PSCHEMA_FIXED_DEBUG
+#define _PSCHEMA_FIXED_LENGTH(type, fixed, trailing) \
+    PSCHEMA_FIXED_##type = (fixed),
+
+enum {
+    PACKET_SCHEMA(_PSCHEMA_FIXED_LENGTH)
+};
+
+#define _PSCHEMA_MASK(bits) (0xffffffffu >> (32 - (bits)))
+
+/**
+ * Reads a field's word
+ *
+ * @param data where the word starts
+ * @param size the size of the word (1 to 4 bytes)
+ * @param order the byte order (PSCHEMA_BE or PSCHEMA_HOST)
+ * @returns the word
+ */
+static inline uint32_t _pschema_load(const uint8_t* data, uint32_t size, int order) {
+    uint32_t word = 0;
+    if (order == PSCHEMA_HOST) {
+        memcpy(&word, data, size);
+        return word;
+    }
+    for (uint32_t i = 0; i < size; i += 1) {
+        word = (word << 8) | data[i];
+    }
+    return word;
+}
+
+/**
+ * Merges bits into a field's word (so fields sharing bytes can each be written)
+ *
+ * @param data where the word starts
+ * @param size the size of the word (1 to 4 bytes)
+ * @param order the byte order (PSCHEMA_BE or PSCHEMA_HOST)
+ * @param bits the bits to set, already shifted into place
+ */
+static inline void _pschema_merge(uint8_t* data, uint32_t size, int order, uint32_t bits) {
+    if (order == PSCHEMA_HOST) {
+        uint32_t word;
+        memcpy(&word, data, size);
+        word |= bits;
+        memcpy(data, &word, size);
+        return;
+    }
+    for (uint32_t i = 0; i < size; i += 1) {
+        data[i] |= (uint8_t) (bits >> (8 * (size - 1 - i)));
+    }
+}
+
+/**
+ * Checks a payload is long enough for a packet's fixed fields
+ *
+ * @param length the length of the payload
+ * @param fixed_length the length of the fixed fields
+ * @returns true if they fit
+ */
+static inline bool _pschema_fits(uint32_t length, uint32_t fixed_length) {
+    return length >= fixed_length;
+}
+
+#define _PSCHEMA_CHECK_FIELD(type, name, offset, size, order, shift, bits) \
+    _Static_assert((size) >= 1 && (size) <= 4 && (offset) + (size) <= _PSCHEMA_FIXED, \
+        "field " #name " runs past its packet's fixed fields"); \
+    _Static_assert((bits) >= 1 && (shift) + (bits) <= (size) * 8, "field " #name " doesn't fit its word"); \
+    _Static_assert((order) == PSCHEMA_BE || (size) == 4, "host-order field " #name " must be a whole word"); \
+    _Static_assert((bits) == PTLV_BITS_##type##_##name, "field " #name " doesn't match its width in packet.h");
+
+#define _PSCHEMA_DECODE_FIELD(type, name, offset, size, order, shift, bits) \
+    out->name = (_pschema_load(payload + (offset), (size), (order)) >> (shift)) & _PSCHEMA_MASK(bits);
+
+#define _PSCHEMA_ENCODE_FIELD(type, name, offset, size, order, shift, bits) \
+    _pschema_merge(payload + (offset), (size), (order), ((uint32_t) in->name & _PSCHEMA_MASK(bits)) << (shift));
+
+// Expands into pschema_decode_<type>(...) and pschema_encode_<type>(...)
+#define _PSCHEMA_CODECS(type, fixed, trailing) \
+    static inline bool pschema_decode_##type(const uint8_t* payload, uint32_t length, PTLVData_##type##_t* out) { \
+        enum { _PSCHEMA_FIXED = PSCHEMA_FIXED_##type }; \
+        PSCHEMA_FIELDS_##type(_PSCHEMA_CHECK_FIELD) \
+        (void) payload; \
+        (void) out; \
+        if (!_pschema_fits(length, _PSCHEMA_FIXED)) { \
+            return false; \
+        } \
+        PSCHEMA_FIELDS_##type(_PSCHEMA_DECODE_FIELD) \
+        return true; \
+    } \
+    static inline void pschema_encode_##type(const PTLVData_##type##_t* in, uint8_t* payload) { \
+        (void) in; \
+        memset(payload, 0, PSCHEMA_FIXED_##type); \
+        PSCHEMA_FIELDS_##type(_PSCHEMA_ENCODE_FIELD) \
+    }
+
+/*
+ * bool pschema_decode_<type>(const uint8_t* payload, uint32_t length, PTLVData_<type>_t* out)
+ *   Decodes a packet's fixed fields (not its arbitrary data or lists), returning
+ *   false if the payload is too short to hold them
+ *
+ * void pschema_encode_<type>(const PTLVData_<type>_t* in, uint8_t* payload)
+ *   Encodes a packet's fixed fields, zeroing any bytes no field covers; the
+ *   payload must have room for them
+ */
+PACKET_SCHEMA(_PSCHEMA_CODECS)
+
+// Bitfields are declared with their PTLV_BITS_ width, so the codecs' checks
+// cover them; the rest have to be as wide as their member
+#define _PSCHEMA_CHECK_WHOLE(type, name) \
+    _Static_assert(sizeof(((PTLVData_##type##_t*) 0)->name) * 8 == PTLV_BITS_##type##_##name, \
+        "field " #name " isn't as wide as its member in packet.h");
+
+_PSCHEMA_CHECK_WHOLE(INIT, robot_uuid)
+_PSCHEMA_CHECK_WHOLE(USER_DATA, left_stick_x)
+_PSCHEMA_CHECK_WHOLE(USER_DATA, left_stick_y)
+_PSCHEMA_CHECK_WHOLE(USER_DATA, right_stick_x)
+_PSCHEMA_CHECK_WHOLE(USER_DATA, right_stick_y)
+_PSCHEMA_CHECK_WHOLE(USER_DATA, controller_uuid)
+_PSCHEMA_CHECK_WHOLE(DEBUG, robot_uuid)
+_PSCHEMA_CHECK_WHOLE(DEBUG, reserved)
+_PSCHEMA_CHECK_WHOLE(DEBUG, config_entries)
+
+#define _PSCHEMA_LAYOUT(type, fixed, follows) \
+    case pt_##type: \
+        *fixed_length = (fixed); \
+        *trailing = (follows); \
+        return true;
+
+/**
+ * Gets the layout of a packet type
+ *
+ * @param type the packet type
+ * @param fixed_length set to the length of its fixed fields
+ * @param trailing set to what follows them
+ * @returns false if the type isn't known
+ */
+static inline bool pschema_layout(uint8_t type, uint32_t* fixed_length, PSchemaTrailing_t* trailing) {
+    switch (type) {
+        PACKET_SCHEMA(_PSCHEMA_LAYOUT)
+    }
+    return false;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
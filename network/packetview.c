@@ -0,0 +1,267 @@
+/**
+ * core/network/packetview.c
+ *
+ * Zero-copy views of packets from the low-level network interface
+ *
+ * @author agent <agent@local>
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "packetview.h"
+#include "packetschema.h"
+
+#define _KV_HEADER_LENGTH (4) // type, length (24 bits, including the header)
+#define _KV_SEPARATOR (';')
+
+/**
+ * Gets the shortest a packet of a type can be
+ *
+ * @param type the packet type
+ * @returns the length of the type's fixed fields
+ */
+static uint32_t _pview_min_length(uint8_t type) {
+    uint32_t fixed_length;
+    PSchemaTrailing_t trailing;
+    return pschema_layout(type, &fixed_length, &trailing)? fixed_length : 0;
+}
+
+/**
+ * Reads a 24-bit big-endian value
+ *
+ * @param data where the value starts
+ * @returns the value
+ */
+static uint32_t _pview_u24(const uint8_t* data) {
+    return ((uint32_t) data[0] << 16) | ((uint32_t) data[1] << 8) | data[2];
+}
+
+/**
+ * @inherit
+ */
+bool pview_init(PacketView_t* view, IntermediateTLV_t* packet, bool take) {
+    if (packet->length < _pview_min_length(packet->type)) {
+        return false;
+    }
+    view->type = packet->type;
+    view->timestamp = packet->timestamp;
+    view->data = packet->data;
+    view->length = packet->length;
+    view->owned = take? packet : NULL;
+    return true;
+}
+
+/**
+ * @inherit
+ */
+IntermediateTLV_t* pview_detach(PacketView_t* view) {
+    IntermediateTLV_t* packet = view->owned;
+    view->owned = NULL;
+    return packet;
+}
+
+/**
+ * @inherit
+ */
+void pview_release(PacketView_t* view) {
+    if (view->owned != NULL) {
+        llnet_packet_free(view->owned);
+        view->owned = NULL;
+    }
+    view->data = NULL;
+    view->length = 0;
+}
+
+/**
+ * @inherit
+ */
+bool pview_get_init(const PacketView_t* view, PTLVData_INIT_t* out) {
+    return view->type == pt_INIT && pschema_decode_INIT(view->data, view->length, out);
+}
+
+/**
+ * @inherit
+ */
+bool pview_get_state_response(const PacketView_t* view, PTLVData_STATE_RESPONSE_t* out, uint32_t* arbitrary_length) {
+    if (view->type != pt_STATE_RESPONSE || !pschema_decode_STATE_RESPONSE(view->data, view->length, out)) {
+        return false;
+    }
+    out->arbitrary = (view->length > PSCHEMA_FIXED_STATE_RESPONSE)?
+        (void*) (view->data + PSCHEMA_FIXED_STATE_RESPONSE) : NULL;
+    if (arbitrary_length != NULL) {
+        *arbitrary_length = view->length - PSCHEMA_FIXED_STATE_RESPONSE;
+    }
+    return true;
+}
+
+/**
+ * @inherit
+ */
+bool pview_get_state_update(const PacketView_t* view, PTLVData_STATE_UPDATE_t* out, uint32_t* arbitrary_length) {
+    if (view->type != pt_STATE_UPDATE || !pschema_decode_STATE_UPDATE(view->data, view->length, out)) {
+        return false;
+    }
+    out->arbitrary = (view->length > PSCHEMA_FIXED_STATE_UPDATE)?
+        (void*) (view->data + PSCHEMA_FIXED_STATE_UPDATE) : NULL;
+    if (arbitrary_length != NULL) {
+        *arbitrary_length = view->length - PSCHEMA_FIXED_STATE_UPDATE;
+    }
+    return true;
+}
+
+/**
+ * @inherit
+ */
+bool pview_get_user_data(const PacketView_t* view, PTLVData_USER_DATA_t* out) {
+    return view->type == pt_USER_DATA && pschema_decode_USER_DATA(view->data, view->length, out);
+}
+
+/**
+ * @inherit
+ */
+bool pview_get_update_status(const PacketView_t* view, PTLVData_UPDATE_STATUS_t* out) {
+    return view->type == pt_UPDATE_STATUS && pschema_decode_UPDATE_STATUS(view->data, view->length, out);
+}
+
+/**
+ * @inherit
+ */
+bool pview_get_debug(const PacketView_t* view, PTLVData_DEBUG_t* out, uint32_t* arbitrary_length) {
+    if (view->type != pt_DEBUG || !pschema_decode_DEBUG(view->data, view->length, out)) {
+        return false;
+    }
+    out->arbitrary = (view->length > PSCHEMA_FIXED_DEBUG)?
+        (void*) (view->data + PSCHEMA_FIXED_DEBUG) : NULL;
+    if (arbitrary_length != NULL) {
+        *arbitrary_length = view->length - PSCHEMA_FIXED_DEBUG;
+    }
+    return true;
+}
+
+/**
+ * @inherit
+ */
+bool pview_strings_begin(const PacketView_t* view, PViewStringIter_t* iter) {
+    if (view->type != pt_CONFIG_REQUEST) {
+        return false;
+    }
+    iter->pos = (const char*) view->data;
+    iter->end = (const char*) view->data + view->length;
+    return true;
+}
+
+/**
+ * @inherit
+ */
+const char* pview_strings_next(PViewStringIter_t* iter, size_t* length) {
+    while (iter->pos < iter->end) {
+        const char* str = iter->pos;
+        const char* nul = memchr(str, '\0', iter->end - str);
+        if (nul == NULL) {
+            iter->pos = iter->end; // unterminated, so it can't be handed out
+            return NULL;
+        }
+        iter->pos = nul + 1;
+
+        // Sequential nuls are empty strings (or padding), skip them
+        if (nul != str) {
+            if (length != NULL) {
+                *length = nul - str;
+            }
+            return str;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @inherit
+ */
+bool pview_kv_begin(const PacketView_t* view, PViewKVIter_t* iter) {
+    if (view->type != pt_CONFIG_RESPONSE && view->type != pt_CONFIG_UPDATE) {
+        return false;
+    }
+    iter->pos = view->data;
+    iter->end = view->data + view->length;
+    iter->malformed = false;
+    return true;
+}
+
+/**
+ * @inherit
+ */
+bool pview_kv_next(PViewKVIter_t* iter, PViewKV_t* kv) {
+    // An empty key is padding, the end of the list
+    if (iter->pos >= iter->end || *iter->pos == '\0') {
+        iter->pos = iter->end;
+        return false;
+    }
+
+    // The key, then the value's header
+    const uint8_t* nul = memchr(iter->pos, '\0', iter->end - iter->pos);
+    if (nul == NULL || (size_t) (iter->end - (nul + 1)) < _KV_HEADER_LENGTH) {
+        iter->malformed = true;
+        iter->pos = iter->end;
+        return false;
+    }
+    const uint8_t* header = nul + 1;
+    uint32_t tlv_length = _pview_u24(header + 1);
+    if (tlv_length < _KV_HEADER_LENGTH || tlv_length > (size_t) (iter->end - header)) {
+        iter->malformed = true;
+        iter->pos = iter->end;
+        return false;
+    }
+
+    kv->key = (const char*) iter->pos;
+    kv->key_length = nul - iter->pos;
+    kv->type = (KVPair_Type_t) header[0];
+    kv->value = header + _KV_HEADER_LENGTH;
+    kv->value_length = tlv_length - _KV_HEADER_LENGTH;
+
+    // Step over the value and the separator
+    iter->pos = header + tlv_length;
+    if (iter->pos < iter->end && *iter->pos == _KV_SEPARATOR) {
+        iter->pos += 1;
+    }
+    return true;
+}
+
+/**
+ * @inherit
+ */
+bool pview_kv_value(const PViewKV_t* kv, KVPair_Value_u* value) {
+    switch (kv->type) {
+        case kv_Integer:
+            if (kv->value_length != sizeof(int32_t)) {
+                return false;
+            }
+            memcpy(&value->Integer, kv->value, sizeof(int32_t));
+            return true;
+        case kv_Float:
+            if (kv->value_length != sizeof(float)) {
+                return false;
+            }
+            memcpy(&value->Float, kv->value, sizeof(float));
+            return true;
+        case kv_Double:
+            if (kv->value_length != sizeof(double)) {
+                return false;
+            }
+            memcpy(&value->Double, kv->value, sizeof(double));
+            return true;
+        case kv_Boolean:
+            if (kv->value_length != sizeof(int8_t)) {
+                return false;
+            }
+            value->Boolean = (int8_t) kv->value[0];
+            return true;
+        case kv_CString:
+            if (kv->value_length == 0 || memchr(kv->value, '\0', kv->value_length) == NULL) {
+                return false;
+            }
+            value->CString = (char*) kv->value;
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,193 @@
+/**
+ * core/network/packetview.h
+ *
+ * Zero-copy views of packets from the low-level network interface. Unlike the
+ * unpackers in packethandlers.h, a view never allocates: fixed fields are read
+ * straight out of the packet's data, arbitrary data and strings point into it,
+ * and key-value lists are decoded one pair at a time as they are iterated.
+ * Everything a view hands out is only valid while the packet it looks at is.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_PACKETVIEW
+#define __CORE_NETWORK_PACKETVIEW
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "packet.h"
+#include "lowlevel.h"
+
+// Defines a view of a packet
+typedef struct PacketView {
+    PacketType_t type;
+    uint32_t timestamp;
+    const uint8_t* data;
+    uint32_t length;
+    IntermediateTLV_t* owned; // the packet, if the view owns it (NULL if borrowed)
+} PacketView_t;
+
+// Defines a position in a list of nul-terminated strings (CONFIG_REQUEST)
+typedef struct PViewStringIter {
+    const char* pos;
+    const char* end;
+} PViewStringIter_t;
+
+// Defines a key-value pair, pointing into the packet
+typedef struct PViewKV {
+    const char* key; // nul-terminated
+    size_t key_length; // not including the nul
+    KVPair_Type_t type;
+    const uint8_t* value;
+    uint32_t value_length;
+} PViewKV_t;
+
+// Defines a position in a key-value list (CONFIG_RESPONSE and CONFIG_UPDATE)
+typedef struct PViewKVIter {
+    const uint8_t* pos;
+    const uint8_t* end;
+    bool malformed; // set if the list ended part way through a pair
+} PViewKVIter_t;
+
+/**
+ * Sets up a view of a packet, checking it is long enough for its type
+ *
+ * @param view the view to set up
+ * @param packet the packet to look at
+ * @param take true to hand ownership of the packet to the view (see pview_release),
+ *        false to borrow it (the packet must outlive the view)
+ * @returns true if the view was set up, false if the packet is too short for its
+ *          type (the caller keeps ownership of the packet)
+ */
+bool pview_init(PacketView_t* view, IntermediateTLV_t* packet, bool take);
+
+/**
+ * Takes ownership of the packet back from a view
+ *
+ * @param view the view
+ * @returns the packet, or NULL if the view didn't own it
+ */
+IntermediateTLV_t* pview_detach(PacketView_t* view);
+
+/**
+ * Cleans up a view, freeing the packet if the view owns it
+ *
+ * @param view the view
+ */
+void pview_release(PacketView_t* view);
+
+/**
+ * Gets the fixed fields of an INIT packet
+ *
+ * @param view the view
+ * @param out the structure to fill in
+ * @returns false if the packet is a different type
+ */
+bool pview_get_init(const PacketView_t* view, PTLVData_INIT_t* out);
+
+/**
+ * Gets the fields of a STATE_RESPONSE packet, out->arbitrary points into the packet
+ *
+ * @param view the view
+ * @param out the structure to fill in
+ * @param arbitrary_length set to the length of the arbitrary data, may be NULL
+ * @returns false if the packet is a different type
+ */
+bool pview_get_state_response(const PacketView_t* view, PTLVData_STATE_RESPONSE_t* out, uint32_t* arbitrary_length);
+
+/**
+ * Gets the fields of a STATE_UPDATE packet, out->arbitrary points into the packet
+ *
+ * @param view the view
+ * @param out the structure to fill in
+ * @param arbitrary_length set to the length of the arbitrary data, may be NULL
+ * @returns false if the packet is a different type
+ */
+bool pview_get_state_update(const PacketView_t* view, PTLVData_STATE_UPDATE_t* out, uint32_t* arbitrary_length);
+
+/**
+ * Gets the fields of a USER_DATA packet
+ *
+ * @param view the view
+ * @param out the structure to fill in
+ * @returns false if the packet is a different type
+ */
+bool pview_get_user_data(const PacketView_t* view, PTLVData_USER_DATA_t* out);
+
+/**
+ * Gets the fields of an UPDATE_STATUS packet
+ *
+ * @param view the view
+ * @param out the structure to fill in
+ * @returns false if the packet is a different type
+ */
+bool pview_get_update_status(const PacketView_t* view, PTLVData_UPDATE_STATUS_t* out);
+
+/**
+ * Gets the fields of a DEBUG packet, out->arbitrary points into the packet
+ *
+ * @param view the view
+ * @param out the structure to fill in
+ * @param arbitrary_length set to the length of the arbitrary data, may be NULL
+ * @returns false if the packet is a different type
+ */
+bool pview_get_debug(const PacketView_t* view, PTLVData_DEBUG_t* out, uint32_t* arbitrary_length);
+
+/**
+ * Starts iterating over the keys in a CONFIG_REQUEST packet
+ *
+ * @param view the view
+ * @param iter the iterator to set up
+ * @returns false if the packet is a different type
+ */
+bool pview_strings_begin(const PacketView_t* view, PViewStringIter_t* iter);
+
+/**
+ * Gets the next non-empty string, a string missing its nul at the end of the
+ * packet is left out
+ *
+ * @param iter the iterator
+ * @param length set to the length of the string (not including the nul), may be NULL
+ * @returns the string (pointing into the packet), or NULL if there are no more
+ */
+const char* pview_strings_next(PViewStringIter_t* iter, size_t* length);
+
+/**
+ * Starts iterating over the pairs in a CONFIG_RESPONSE or CONFIG_UPDATE packet
+ *
+ * @param view the view
+ * @param iter the iterator to set up
+ * @returns false if the packet is a different type
+ */
+bool pview_kv_begin(const PacketView_t* view, PViewKVIter_t* iter);
+
+/**
+ * Decodes the next pair
+ *
+ * @param iter the iterator
+ * @param kv the pair to fill in
+ * @returns true if a pair was decoded, false at the end of the list (or if the
+ *          rest of the list is malformed, see iter->malformed)
+ */
+bool pview_kv_next(PViewKVIter_t* iter, PViewKV_t* kv);
+
+/**
+ * Gets the value of a pair, CString values point into the packet
+ *
+ * @param kv the pair
+ * @param value set to the value
+ * @returns false if the value is the wrong length for its type (or a CString is missing its nul)
+ */
+bool pview_kv_value(const PViewKV_t* kv, KVPair_Value_u* value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,155 @@
+/**
+ * core/network/ratelimit.c
+ *
+ * Token bucket rate limiting for incoming packets
+ *
+ * @author agent <agent@local>
+ */
+#define _DEFAULT_SOURCE // needed for clock_gettime(...)
+#include <stdint.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ratelimit.h"
+
+#define _TOKEN (1000000ULL) // tokens are stored in millionths
+
+/**
+ * Gets the current monotonic time
+ *
+ * @returns the time in nanoseconds
+ */
+static uint64_t _ratelimit_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * Refills a bucket based on the time since the last refill
+ *
+ * @param bucket the bucket to refill
+ * @param now the current time (in nanoseconds)
+ */
+static void _bucket_refill(TokenBucket_t* bucket, uint64_t now) {
+    uint64_t cap = bucket->burst * _TOKEN;
+    uint64_t elapsed = now - bucket->last_ns;
+    bucket->last_ns = now;
+
+    // After long enough the bucket is full anyway, so clamp before multiplying to avoid overflow
+    uint64_t fill_ns = (cap * 1000) / bucket->rate;
+    if (elapsed > fill_ns) {
+        elapsed = fill_ns + 1;
+    }
+
+    // rate tokens/s is rate millionths-of-a-token per millisecond
+    bucket->tokens += (elapsed * bucket->rate) / 1000;
+    if (bucket->tokens > cap) {
+        bucket->tokens = cap;
+    }
+}
+
+/**
+ * Resets a bucket to full
+ *
+ * @param bucket the bucket to reset
+ * @param now the current time (in nanoseconds)
+ */
+static void _bucket_reset(TokenBucket_t* bucket, uint64_t now) {
+    bucket->tokens = bucket->burst * _TOKEN;
+    bucket->last_ns = now;
+}
+
+/**
+ * @inherit
+ */
+LLNetLimiter_t* ratelimit_init() {
+    LLNetLimiter_t* limiter = calloc(1, sizeof(LLNetLimiter_t));
+    if (limiter == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&limiter->mutex, NULL);
+    return limiter;
+}
+
+/**
+ * @inherit
+ */
+LLNetLimiter_t* ratelimit_copy(LLNetLimiter_t* other) {
+    LLNetLimiter_t* limiter = ratelimit_init();
+    if (limiter == NULL) {
+        return NULL;
+    }
+
+    // Copy the limits, but start with full buckets and no drops
+    uint64_t now = _ratelimit_now();
+    pthread_mutex_lock(&other->mutex);
+    limiter->connection.rate = other->connection.rate;
+    limiter->connection.burst = other->connection.burst;
+    _bucket_reset(&limiter->connection, now);
+    for (size_t i = 0; i < 256; i += 1) {
+        limiter->types[i].rate = other->types[i].rate;
+        limiter->types[i].burst = other->types[i].burst;
+        _bucket_reset(&limiter->types[i], now);
+    }
+    pthread_mutex_unlock(&other->mutex);
+
+    return limiter;
+}
+
+/**
+ * @inherit
+ */
+void ratelimit_set(LLNetLimiter_t* limiter, int32_t type, uint32_t rate, uint32_t burst) {
+    pthread_mutex_lock(&limiter->mutex);
+    TokenBucket_t* bucket = (type == LLNET_RATELIMIT_ALL)? &limiter->connection : &limiter->types[type & 0xff];
+    bucket->rate = rate;
+    bucket->burst = (burst == 0)? 1 : burst;
+    _bucket_reset(bucket, _ratelimit_now());
+    pthread_mutex_unlock(&limiter->mutex);
+}
+
+/**
+ * @inherit
+ */
+bool ratelimit_accept(LLNetLimiter_t* limiter, uint8_t type) {
+    TokenBucket_t* conn = &limiter->connection;
+    TokenBucket_t* bucket = &limiter->types[type];
+    uint64_t now = _ratelimit_now();
+
+    pthread_mutex_lock(&limiter->mutex);
+
+    // Refill any limited buckets
+    if (conn->rate != 0) {
+        _bucket_refill(conn, now);
+    }
+    if (bucket->rate != 0) {
+        _bucket_refill(bucket, now);
+    }
+
+    // Only take tokens if both buckets have one to give
+    bool accept = (conn->rate == 0 || conn->tokens >= _TOKEN) && (bucket->rate == 0 || bucket->tokens >= _TOKEN);
+    if (accept) {
+        if (conn->rate != 0) {
+            conn->tokens -= _TOKEN;
+        }
+        if (bucket->rate != 0) {
+            bucket->tokens -= _TOKEN;
+        }
+    } else {
+        limiter->drops[type] += 1;
+    }
+
+    pthread_mutex_unlock(&limiter->mutex);
+    return accept;
+}
+
+/**
+ * @inherit
+ */
+void ratelimit_free(LLNetLimiter_t* limiter) {
+    pthread_mutex_destroy(&limiter->mutex);
+    free(limiter);
+}
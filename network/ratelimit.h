@@ -0,0 +1,85 @@
+/**
+ * core/network/ratelimit.h
+ *
+ * Token bucket rate limiting for incoming packets, used to keep a single
+ * misbehaving connection from starving the rest of the field.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_RATELIMIT
+#define __CORE_NETWORK_RATELIMIT
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define LLNET_RATELIMIT_ALL (-1) // pass as the packet type to limit the whole connection
+
+// Defines a single token bucket
+typedef struct TokenBucket {
+    uint32_t rate; // tokens added per second, zero means unlimited
+    uint32_t burst; // maximum number of tokens the bucket can hold
+    uint64_t tokens; // current number of tokens, in millionths of a token
+    uint64_t last_ns; // last time the bucket was refilled
+} TokenBucket_t;
+
+// Defines the set of buckets used to limit a connection
+typedef struct LLNetLimiter {
+    pthread_mutex_t mutex;
+    TokenBucket_t connection; // applies to every packet
+    TokenBucket_t types[256]; // applies per packet type
+    uint64_t drops[256]; // number of dropped packets per type
+} LLNetLimiter_t;
+
+/**
+ * Creates a limiter with no limits set
+ *
+ * @return the limiter, or NULL if a memory request failed
+ */
+LLNetLimiter_t* ratelimit_init();
+
+/**
+ * Creates a limiter with the same limits as another, with full buckets
+ *
+ * @param other the limiter to copy the limits from
+ * @return the limiter, or NULL if a memory request failed
+ */
+LLNetLimiter_t* ratelimit_copy(LLNetLimiter_t* other);
+
+/**
+ * Sets a limit
+ *
+ * @param limiter the limiter to update
+ * @param type the packet type to limit, or LLNET_RATELIMIT_ALL for the connection
+ * @param rate the number of packets per second allowed, zero to remove the limit
+ * @param burst the number of packets that can be sent back-to-back
+ */
+void ratelimit_set(LLNetLimiter_t* limiter, int32_t type, uint32_t rate, uint32_t burst);
+
+/**
+ * Checks if a packet is allowed through the limiter, taking a token if so.
+ * Drops are counted by type.
+ *
+ * @param limiter the limiter to check
+ * @param type the type of the packet
+ * @return true if the packet should be accepted, false if it should be dropped
+ */
+bool ratelimit_accept(LLNetLimiter_t* limiter, uint8_t type);
+
+/**
+ * Cleans up a limiter
+ *
+ * @param limiter the limiter to clean up
+ */
+void ratelimit_free(LLNetLimiter_t* limiter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,247 @@
+/**
+ * core/network/reliable.c
+ *
+ * State for a reliable message channel over UDP
+ *
+ * @author agent <agent@local>
+ */
+#define _DEFAULT_SOURCE // needed for pthread_condattr_setclock(...)
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "reliable.h"
+
+#define _SEQ_BEFORE(a, b) (((int32_t) ((a) - (b))) < 0) // true if sequence number a comes before b
+
+/**
+ * @inherit
+ */
+LLNetReliable_t* reliable_init() {
+    LLNetReliable_t* rel = calloc(1, sizeof(LLNetReliable_t));
+    if (rel == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&rel->mutex, NULL);
+
+    // Timers are on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&rel->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    rel->rto_us = LLNET_RELIABLE_INITIAL_RTO_US;
+    return rel;
+}
+
+/**
+ * @inherit
+ */
+int64_t reliable_track(LLNetReliable_t* rel, uint8_t* buf, uint32_t len, uint64_t now) {
+    if (rel->next_seq - rel->base >= LLNET_RELIABLE_WINDOW) {
+        return -1;
+    }
+    uint32_t seq = rel->next_seq;
+    LLNetReliableEntry_t* entry = &rel->sent[seq % LLNET_RELIABLE_WINDOW];
+    entry->buf = buf;
+    entry->len = len;
+    entry->seq = seq;
+    entry->sent_ns = now;
+    entry->retries = 0;
+    rel->next_seq += 1;
+    return seq;
+}
+
+/**
+ * Folds a round trip time sample into the estimate (see RFC 6298)
+ *
+ * @param rel the channel
+ * @param sample_us the measured round trip time
+ */
+static void _reliable_rtt_sample(LLNetReliable_t* rel, uint32_t sample_us) {
+    if (!rel->rtt_valid) {
+        rel->srtt_us = sample_us;
+        rel->rttvar_us = sample_us / 2;
+        rel->rtt_valid = true;
+    } else {
+        uint32_t delta = (rel->srtt_us > sample_us)? rel->srtt_us - sample_us : sample_us - rel->srtt_us;
+        rel->rttvar_us = ((rel->rttvar_us * 3) + delta) / 4;
+        rel->srtt_us = ((rel->srtt_us * 7) + sample_us) / 8;
+    }
+
+    uint32_t rto = rel->srtt_us + (4 * rel->rttvar_us);
+    if (rto < LLNET_RELIABLE_MIN_RTO_US) {
+        rto = LLNET_RELIABLE_MIN_RTO_US;
+    } else if (rto > LLNET_RELIABLE_MAX_RTO_US) {
+        rto = LLNET_RELIABLE_MAX_RTO_US;
+    }
+    rel->rto_us = rto;
+}
+
+/**
+ * Moves the window past every message that is no longer waiting
+ *
+ * @param rel the channel
+ */
+static void _reliable_advance(LLNetReliable_t* rel) {
+    while (rel->base != rel->next_seq && rel->sent[rel->base % LLNET_RELIABLE_WINDOW].buf == NULL) {
+        rel->base += 1;
+    }
+}
+
+/**
+ * @inherit
+ */
+uint32_t reliable_ack(LLNetReliable_t* rel, uint32_t next_expected, uint64_t sack, uint64_t now) {
+    uint32_t acked = 0;
+    for (uint32_t seq = rel->base; seq != rel->next_seq; seq += 1) {
+        LLNetReliableEntry_t* entry = &rel->sent[seq % LLNET_RELIABLE_WINDOW];
+        if (entry->buf == NULL) {
+            continue;
+        }
+
+        // Acknowledged either cumulatively or selectively
+        bool is_acked = _SEQ_BEFORE(seq, next_expected);
+        if (!is_acked && seq != next_expected) {
+            uint32_t bit = seq - next_expected - 1;
+            is_acked = bit < 64 && (sack & (1ULL << bit));
+        }
+        if (!is_acked) {
+            continue;
+        }
+
+        // Only messages that were sent once give a trustworthy sample (Karn's algorithm)
+        if (entry->retries == 0) {
+            _reliable_rtt_sample(rel, (uint32_t) ((now - entry->sent_ns) / 1000));
+        }
+        free(entry->buf);
+        entry->buf = NULL;
+        acked += 1;
+    }
+
+    _reliable_advance(rel);
+    return acked;
+}
+
+/**
+ * Gets when an entry needs to be sent again, backing off with each resend
+ *
+ * @param rel the channel
+ * @param entry the entry
+ * @returns the time (in nanoseconds)
+ */
+static uint64_t _reliable_deadline(LLNetReliable_t* rel, LLNetReliableEntry_t* entry) {
+    uint64_t rto = (uint64_t) rel->rto_us << entry->retries;
+    if (rto > LLNET_RELIABLE_MAX_RTO_US) {
+        rto = LLNET_RELIABLE_MAX_RTO_US;
+    }
+    return entry->sent_ns + (rto * 1000);
+}
+
+/**
+ * @inherit
+ */
+LLNetReliableEntry_t* reliable_next_due(LLNetReliable_t* rel, uint64_t now, uint32_t* failed) {
+    for (uint32_t seq = rel->base; seq != rel->next_seq; seq += 1) {
+        LLNetReliableEntry_t* entry = &rel->sent[seq % LLNET_RELIABLE_WINDOW];
+        if (entry->buf == NULL || _reliable_deadline(rel, entry) > now) {
+            continue;
+        }
+
+        // Give up on messages the other side never acknowledges
+        if (entry->retries >= LLNET_RELIABLE_MAX_RETRIES) {
+            free(entry->buf);
+            entry->buf = NULL;
+            *failed += 1;
+            continue;
+        }
+
+        entry->retries += 1;
+        entry->sent_ns = now;
+        return entry;
+    }
+
+    _reliable_advance(rel);
+    return NULL;
+}
+
+/**
+ * @inherit
+ */
+uint64_t reliable_next_deadline(LLNetReliable_t* rel) {
+    uint64_t deadline = UINT64_MAX;
+    for (uint32_t seq = rel->base; seq != rel->next_seq; seq += 1) {
+        LLNetReliableEntry_t* entry = &rel->sent[seq % LLNET_RELIABLE_WINDOW];
+        if (entry->buf != NULL) {
+            uint64_t d = _reliable_deadline(rel, entry);
+            if (d < deadline) {
+                deadline = d;
+            }
+        }
+    }
+    return deadline;
+}
+
+/**
+ * @inherit
+ */
+bool reliable_receive(LLNetReliable_t* rel, uint32_t seq, const uint8_t* data, uint32_t len) {
+    // Only keep messages that haven't been handed up yet, and fit in the window
+    if (_SEQ_BEFORE(seq, rel->expected) || seq - rel->expected >= LLNET_RELIABLE_WINDOW) {
+        return false;
+    }
+    uint32_t idx = seq % LLNET_RELIABLE_WINDOW;
+    if (rel->held[idx] != NULL) {
+        return false;
+    }
+
+    rel->held[idx] = malloc(len);
+    memcpy(rel->held[idx], data, len);
+    rel->held_len[idx] = len;
+    return true;
+}
+
+/**
+ * @inherit
+ */
+uint8_t* reliable_pop(LLNetReliable_t* rel, uint32_t* len) {
+    uint32_t idx = rel->expected % LLNET_RELIABLE_WINDOW;
+    uint8_t* data = rel->held[idx];
+    if (data == NULL) {
+        return NULL;
+    }
+    *len = rel->held_len[idx];
+    rel->held[idx] = NULL;
+    rel->expected += 1;
+    return data;
+}
+
+/**
+ * @inherit
+ */
+void reliable_ack_state(LLNetReliable_t* rel, uint32_t* next_expected, uint64_t* sack) {
+    uint64_t bits = 0;
+    for (uint32_t i = 0; i < LLNET_RELIABLE_WINDOW - 1; i += 1) {
+        if (rel->held[(rel->expected + 1 + i) % LLNET_RELIABLE_WINDOW] != NULL) {
+            bits |= (1ULL << i);
+        }
+    }
+    *next_expected = rel->expected;
+    *sack = bits;
+}
+
+/**
+ * @inherit
+ */
+void reliable_free(LLNetReliable_t* rel) {
+    for (size_t i = 0; i < LLNET_RELIABLE_WINDOW; i += 1) {
+        free(rel->sent[i].buf);
+        free(rel->held[i]);
+    }
+    pthread_mutex_destroy(&rel->mutex);
+    pthread_cond_destroy(&rel->cond);
+    free(rel);
+}
@@ -0,0 +1,160 @@
+/**
+ * core/network/reliable.h
+ *
+ * State for a reliable message channel over UDP. Messages are numbered, the
+ * receiver acknowledges them with a cumulative ACK and a bitmap of the
+ * messages after it (a selective ACK), and only the messages that were not
+ * acknowledged in time are sent again. Messages are handed up in order, but
+ * since they share the UDP socket with everything else, a lost message only
+ * holds up other reliable messages.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_RELIABLE
+#define __CORE_NETWORK_RELIABLE
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define LLNET_RELIABLE_WINDOW (64) // most messages that can be unacknowledged (and the size of the SACK bitmap)
+#define LLNET_RELIABLE_DATA_HEADER (8) // kind, 3 reserved bytes, sequence number
+#define LLNET_RELIABLE_ACK_LENGTH (16) // kind, 3 reserved bytes, next expected sequence number, SACK bitmap
+#define LLNET_RELIABLE_INITIAL_RTO_US (200000) // retransmission timeout before the RTT has been measured
+#define LLNET_RELIABLE_MIN_RTO_US (20000)
+#define LLNET_RELIABLE_MAX_RTO_US (2000000)
+#define LLNET_RELIABLE_MAX_RETRIES (8) // messages are given up on after this many resends
+
+// Defines the kinds of message on the reliable channel (first byte of the payload)
+typedef enum LLNetReliableKind {
+    rk_DATA = 0x01,
+    rk_ACK  = 0x02
+} LLNetReliableKind_t;
+
+// Defines a message that has been sent but not acknowledged
+typedef struct LLNetReliableEntry {
+    uint8_t* buf; // the datagram as sent, NULL if the slot is empty
+    uint32_t len;
+    uint32_t seq;
+    uint64_t sent_ns; // when the datagram was last sent
+    uint32_t retries; // number of times the datagram was sent again
+} LLNetReliableEntry_t;
+
+// Defines the state of both directions of a reliable channel
+typedef struct LLNetReliable {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // signalled when a message is sent or the channel is stopped
+    bool stop;
+    pthread_t thread; // resends messages that were not acknowledged in time
+
+    // sending
+    uint32_t next_seq; // sequence number of the next message
+    uint32_t base; // oldest unacknowledged sequence number
+    LLNetReliableEntry_t sent[LLNET_RELIABLE_WINDOW]; // indexed by sequence number
+    uint32_t srtt_us; // smoothed round trip time
+    uint32_t rttvar_us; // round trip time variation
+    uint32_t rto_us; // retransmission timeout
+    bool rtt_valid; // true once the round trip time has been measured
+
+    // receiving
+    uint32_t expected; // next sequence number to hand up
+    uint8_t* held[LLNET_RELIABLE_WINDOW]; // messages that arrived out of order, indexed by sequence number
+    uint32_t held_len[LLNET_RELIABLE_WINDOW];
+} LLNetReliable_t;
+
+/**
+ * Creates the state for a reliable channel
+ *
+ * @return the state, or NULL if a memory request failed
+ */
+LLNetReliable_t* reliable_init();
+
+/**
+ * Starts tracking a message that is about to be sent
+ *
+ * @param rel the channel
+ * @param buf the datagram to send (ownership is taken, it is freed once acknowledged)
+ * @param len the length of the datagram
+ * @param now the current time (in nanoseconds)
+ * @returns the sequence number for the message, or -1 if the window is full
+ */
+int64_t reliable_track(LLNetReliable_t* rel, uint8_t* buf, uint32_t len, uint64_t now);
+
+/**
+ * Handles an acknowledgement from the other side
+ *
+ * @param rel the channel
+ * @param next_expected the next sequence number the other side is waiting for
+ *        (everything before it has arrived)
+ * @param sack bitmap of the messages after next_expected that have arrived (bit
+ *        i is sequence number next_expected + 1 + i)
+ * @param now the current time (in nanoseconds)
+ * @returns the number of messages newly acknowledged
+ */
+uint32_t reliable_ack(LLNetReliable_t* rel, uint32_t next_expected, uint64_t sack, uint64_t now);
+
+/**
+ * Gets the next message that needs to be sent again, updating its timer. Messages
+ * that have been sent too many times are given up on.
+ *
+ * @param rel the channel
+ * @param now the current time (in nanoseconds)
+ * @param failed incremented for each message given up on
+ * @returns the message to send again, or NULL if none are due
+ */
+LLNetReliableEntry_t* reliable_next_due(LLNetReliable_t* rel, uint64_t now, uint32_t* failed);
+
+/**
+ * Gets the time the next message will need to be sent again
+ *
+ * @param rel the channel
+ * @returns the time (in nanoseconds), or UINT64_MAX if nothing is waiting
+ */
+uint64_t reliable_next_deadline(LLNetReliable_t* rel);
+
+/**
+ * Handles a message from the other side
+ *
+ * @param rel the channel
+ * @param seq the message's sequence number
+ * @param data the message (copied if kept)
+ * @param len the length of the message
+ * @returns true if the message is new, false if it was a duplicate or outside the window
+ */
+bool reliable_receive(LLNetReliable_t* rel, uint32_t seq, const uint8_t* data, uint32_t len);
+
+/**
+ * Takes the next in-order message off the channel
+ *
+ * @param rel the channel
+ * @param len set to the length of the message
+ * @returns the message (to be freed by the caller), or NULL if the next message hasn't arrived
+ */
+uint8_t* reliable_pop(LLNetReliable_t* rel, uint32_t* len);
+
+/**
+ * Gets the acknowledgement to send to the other side
+ *
+ * @param rel the channel
+ * @param next_expected set to the next sequence number waiting to arrive
+ * @param sack set to the bitmap of the messages after it that have arrived
+ */
+void reliable_ack_state(LLNetReliable_t* rel, uint32_t* next_expected, uint64_t* sack);
+
+/**
+ * Cleans up the state for a reliable channel
+ *
+ * @param rel the state to clean up
+ */
+void reliable_free(LLNetReliable_t* rel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
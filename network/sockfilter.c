@@ -0,0 +1,110 @@
+/**
+ * core/network/sockfilter.c
+ *
+ * Classic BPF filters for the UDP sockets
+ *
+ * @author agent <agent@local>
+ */
+#define _DEFAULT_SOURCE // needed for SO_ATTACH_FILTER
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <netinet/udp.h>
+#include <linux/filter.h>
+
+#include "sockfilter.h"
+#include "lowlevel.h"
+
+#define _STMT(code, k) ((struct sock_filter) BPF_STMT((code), (k)))
+#define _JUMP(code, k, jt, jf) ((struct sock_filter) BPF_JUMP((code), (k), (jt), (jf)))
+
+// The kernel runs UDP socket filters with the UDP header still in front
+#define _FRAME (sizeof(struct udphdr))
+
+// Where each part of the program starts
+#define _DISPATCH (10) // jumps on the type's word in the bitmap
+#define _BLOCKS (_DISPATCH + LLNET_SOCKFILTER_WORDS + 1) // tests the type's bit, 3 instructions per word
+#define _LENGTH (_BLOCKS + (3 * LLNET_SOCKFILTER_WORDS)) // checks the length field against the datagram
+#define _ACCEPT (_LENGTH + 5)
+#define _DROP (_ACCEPT + 1)
+
+/**
+ * @inherit
+ */
+void sockfilter_build(const uint32_t types[LLNET_SOCKFILTER_WORDS], struct sock_filter* prog) {
+    uint32_t pc = 0;
+
+    // Drop anything shorter than a header
+    prog[pc++] = _STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+    prog[pc] = _JUMP(BPF_JMP | BPF_JGE | BPF_K, _FRAME + LLNET_HEADER_LENGTH, 0, _DROP - (pc + 1));
+    pc += 1;
+
+    // M[0] = 1 << (type % 32), A = type / 32
+    prog[pc++] = _STMT(BPF_LD | BPF_B | BPF_ABS, _FRAME);
+    prog[pc++] = _STMT(BPF_ALU | BPF_AND | BPF_K, 31);
+    prog[pc++] = _STMT(BPF_MISC | BPF_TAX, 0);
+    prog[pc++] = _STMT(BPF_LD | BPF_IMM, 1);
+    prog[pc++] = _STMT(BPF_ALU | BPF_LSH | BPF_X, 0);
+    prog[pc++] = _STMT(BPF_ST, 0);
+    prog[pc++] = _STMT(BPF_LD | BPF_B | BPF_ABS, _FRAME);
+    prog[pc++] = _STMT(BPF_ALU | BPF_RSH | BPF_K, 5);
+
+    // Jump to the block for the type's word
+    for (uint32_t i = 0; i < LLNET_SOCKFILTER_WORDS; i += 1) {
+        prog[pc] = _JUMP(BPF_JMP | BPF_JEQ | BPF_K, i, (_BLOCKS + (3 * i)) - (pc + 1), 0);
+        pc += 1;
+    }
+    prog[pc++] = _STMT(BPF_RET | BPF_K, 0);
+
+    // Drop the datagram unless the type's bit is set
+    for (uint32_t i = 0; i < LLNET_SOCKFILTER_WORDS; i += 1) {
+        prog[pc++] = _STMT(BPF_LD | BPF_MEM, 0);
+        prog[pc++] = _STMT(BPF_ALU | BPF_AND | BPF_K, types[i]);
+        prog[pc] = _JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, _DROP - (pc + 1), _LENGTH - (pc + 1));
+        pc += 1;
+    }
+
+    // The header and the length field must cover the datagram exactly
+    prog[pc++] = _STMT(BPF_LD | BPF_W | BPF_ABS, _FRAME);
+    prog[pc++] = _STMT(BPF_ALU | BPF_AND | BPF_K, LLNET_LENGTH_MASK);
+    prog[pc++] = _STMT(BPF_ALU | BPF_ADD | BPF_K, _FRAME + LLNET_HEADER_LENGTH);
+    prog[pc++] = _STMT(BPF_LDX | BPF_W | BPF_LEN, 0);
+    prog[pc] = _JUMP(BPF_JMP | BPF_JEQ | BPF_X, 0, _ACCEPT - (pc + 1), _DROP - (pc + 1));
+    pc += 1;
+
+    prog[pc++] = _STMT(BPF_RET | BPF_K, 0xffffffff); // keep the whole datagram
+    prog[pc++] = _STMT(BPF_RET | BPF_K, 0);
+}
+
+/**
+ * @inherit
+ */
+int sockfilter_attach(int fd, const uint32_t types[LLNET_SOCKFILTER_WORDS]) {
+    struct sock_filter prog[LLNET_SOCKFILTER_LENGTH];
+    sockfilter_build(types, prog);
+
+    struct sock_fprog fprog;
+    fprog.len = LLNET_SOCKFILTER_LENGTH;
+    fprog.filter = prog;
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(struct sock_fprog));
+}
+
+/**
+ * @inherit
+ */
+int sockfilter_detach(int fd) {
+    int unused = 0;
+    return setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(int));
+}
+
+/**
+ * @inherit
+ */
+bool sockfilter_enabled(const uint32_t types[LLNET_SOCKFILTER_WORDS]) {
+    for (uint32_t i = 0; i < LLNET_SOCKFILTER_WORDS; i += 1) {
+        if (types[i] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,63 @@
+/**
+ * core/network/sockfilter.h
+ *
+ * Classic BPF filters for the UDP sockets. The kernel runs the filter on each
+ * datagram before it's queued, so datagrams that can't be a frame (too short,
+ * unknown type, or a length that doesn't match the datagram) are dropped
+ * without waking up or copying into the listener.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_SOCKFILTER
+#define __CORE_NETWORK_SOCKFILTER
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/filter.h>
+
+#define LLNET_SOCKFILTER_LENGTH (50) // number of instructions in a filter
+#define LLNET_SOCKFILTER_WORDS (8) // 32-bit words in a type bitmap (one bit per type)
+
+/**
+ * Builds a filter program
+ *
+ * @param types bitmap of the types to let through (bit t % 32 of word t / 32)
+ * @param prog set to the program, must hold LLNET_SOCKFILTER_LENGTH instructions
+ */
+void sockfilter_build(const uint32_t types[LLNET_SOCKFILTER_WORDS], struct sock_filter* prog);
+
+/**
+ * Attaches a filter to a socket, replacing any filter already there
+ *
+ * @param fd the socket
+ * @param types bitmap of the types to let through
+ * @returns zero on success, or -1 on error (errno is set)
+ */
+int sockfilter_attach(int fd, const uint32_t types[LLNET_SOCKFILTER_WORDS]);
+
+/**
+ * Removes the filter from a socket
+ *
+ * @param fd the socket
+ * @returns zero on success, or -1 on error (errno is set)
+ */
+int sockfilter_detach(int fd);
+
+/**
+ * Checks if a type bitmap has any types set (an empty bitmap means no filter)
+ *
+ * @param types the bitmap
+ * @returns true if any type is let through
+ */
+bool sockfilter_enabled(const uint32_t types[LLNET_SOCKFILTER_WORDS]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,235 @@
+/**
+ * core/network/statshm.c
+ *
+ * Publishes connection counters into a POSIX shared memory segment
+ *
+ * @author agent <agent@local>
+ */
+#define _DEFAULT_SOURCE // needed for shm_open(...) and ftruncate(...)
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "statshm.h"
+
+#define _WORDS(type) (sizeof(type) / sizeof(uint64_t))
+
+/**
+ * Maps a segment and fills in the handle for it
+ *
+ * @param fd the segment's file descriptor (closed)
+ * @param name the segment's name
+ * @param size the size of the segment
+ * @param writer true to map it writable
+ * @returns the handle, or NULL if the mapping failed
+ */
+static LLNetStatsShm_t* _statshm_map(int fd, const char* name, size_t size, bool writer) {
+    void* base = mmap(NULL, size, writer? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    LLNetStatsShm_t* shm = calloc(1, sizeof(LLNetStatsShm_t));
+    if (shm == NULL) {
+        munmap(base, size);
+        return NULL;
+    }
+    shm->header = (LLNetStatsHeader_t*) base;
+    shm->slots = (LLNetStatsSlot_t*) ((uint8_t*) base + sizeof(LLNetStatsHeader_t));
+    shm->size = size;
+    shm->writer = writer;
+    strncpy(shm->name, name, sizeof(shm->name) - 1);
+    return shm;
+}
+
+/**
+ * Checks whether an existing segment was left behind, rather than belonging to
+ * a process that is still publishing
+ *
+ * @param name the segment's name
+ * @returns true if it's safe to replace
+ */
+static bool _statshm_stale(const char* name) {
+    LLNetStatsShm_t* other = statshm_open(name);
+    if (other == NULL) {
+        return true; // not a segment we understand (or only half made)
+    }
+    pid_t pid = (pid_t) other->header->pid;
+    statshm_close(other);
+    return pid <= 0 || (kill(pid, 0) < 0 && errno == ESRCH);
+}
+
+/**
+ * @inherit
+ */
+LLNetStatsShm_t* statshm_create(const char* name, uint32_t capacity) {
+    size_t size = sizeof(LLNetStatsHeader_t) + ((size_t) capacity * sizeof(LLNetStatsSlot_t));
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        // Only take over a segment whose publisher is gone
+        if (!_statshm_stale(name)) {
+            errno = EEXIST;
+            return NULL;
+        }
+        shm_unlink(name);
+        fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    LLNetStatsShm_t* shm = _statshm_map(fd, name, size, true);
+    if (shm == NULL) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // The segment starts zeroed, so only the header needs filling in (magic last, so readers see a full header)
+    shm->header->version = LLNET_STATSHM_VERSION;
+    shm->header->capacity = capacity;
+    shm->header->pid = getpid();
+    __atomic_store_n(&shm->header->magic, LLNET_STATSHM_MAGIC, __ATOMIC_RELEASE);
+    return shm;
+}
+
+/**
+ * @inherit
+ */
+LLNetStatsShm_t* statshm_open(const char* name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(LLNetStatsHeader_t)) {
+        close(fd);
+        return NULL;
+    }
+    LLNetStatsShm_t* shm = _statshm_map(fd, name, st.st_size, false);
+    if (shm == NULL) {
+        return NULL;
+    }
+
+    // Make sure this is a segment we understand, and that every slot is there
+    LLNetStatsHeader_t* header = shm->header;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != LLNET_STATSHM_MAGIC ||
+            header->version != LLNET_STATSHM_VERSION ||
+            sizeof(LLNetStatsHeader_t) + ((size_t) header->capacity * sizeof(LLNetStatsSlot_t)) > shm->size) {
+        statshm_close(shm);
+        return NULL;
+    }
+    return shm;
+}
+
+/**
+ * @inherit
+ */
+void statshm_begin(LLNetStatsShm_t* shm) {
+    shm->next = 0;
+}
+
+/**
+ * @inherit
+ */
+bool statshm_write(LLNetStatsShm_t* shm, uint32_t id, uint8_t caps, struct sockaddr_in* addr, LLNetStats_t* stats,
+    LLNetSocketStats_t* sockets) {
+    if (shm->next >= shm->header->capacity) {
+        return false;
+    }
+    LLNetStatsSlot_t* slot = &shm->slots[shm->next];
+    shm->next += 1;
+
+    // Mark the slot as changing before touching anything in it
+    uint32_t seq = slot->seq;
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&slot->connection_id, id, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->peer_addr, addr->sin_addr.s_addr, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->peer_port, addr->sin_port, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->peer_caps, caps, __ATOMIC_RELAXED);
+    uint64_t* src = (uint64_t*) stats;
+    uint64_t* dst = (uint64_t*) &slot->stats;
+    for (size_t i = 0; i < _WORDS(LLNetStats_t); i += 1) {
+        __atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+    }
+    src = (uint64_t*) sockets;
+    dst = (uint64_t*) &slot->sockets;
+    for (size_t i = 0; i < _WORDS(LLNetSocketStats_t); i += 1) {
+        __atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @inherit
+ */
+void statshm_end(LLNetStatsShm_t* shm, uint64_t now) {
+    __atomic_store_n(&shm->header->num_slots, shm->next, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm->header->updated_ns, now, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shm->header->rounds, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @inherit
+ */
+bool statshm_read(LLNetStatsShm_t* shm, uint32_t index, LLNetStatsSlot_t* slot) {
+    if (index >= __atomic_load_n(&shm->header->num_slots, __ATOMIC_ACQUIRE) || index >= shm->header->capacity) {
+        return false;
+    }
+    LLNetStatsSlot_t* src = &shm->slots[index];
+
+    for (uint32_t attempt = 0; attempt < LLNET_STATSHM_READ_RETRIES; attempt += 1) {
+        uint32_t seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue; // being written right now
+        }
+
+        slot->connection_id = __atomic_load_n(&src->connection_id, __ATOMIC_RELAXED);
+        slot->peer_addr = __atomic_load_n(&src->peer_addr, __ATOMIC_RELAXED);
+        slot->peer_port = __atomic_load_n(&src->peer_port, __ATOMIC_RELAXED);
+        slot->peer_caps = __atomic_load_n(&src->peer_caps, __ATOMIC_RELAXED);
+        uint64_t* from = (uint64_t*) &src->stats;
+        uint64_t* to = (uint64_t*) &slot->stats;
+        for (size_t i = 0; i < _WORDS(LLNetStats_t); i += 1) {
+            to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+        }
+        from = (uint64_t*) &src->sockets;
+        to = (uint64_t*) &slot->sockets;
+        for (size_t i = 0; i < _WORDS(LLNetSocketStats_t); i += 1) {
+            to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+        }
+
+        // Only keep the copy if nothing was written while it was made
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&src->seq, __ATOMIC_RELAXED) == seq) {
+            slot->seq = seq;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @inherit
+ */
+void statshm_close(LLNetStatsShm_t* shm) {
+    munmap(shm->header, shm->size);
+    if (shm->writer) {
+        shm_unlink(shm->name);
+    }
+    free(shm);
+}
@@ -0,0 +1,136 @@
+/**
+ * core/network/statshm.h
+ *
+ * Publishes connection counters into a POSIX shared memory segment, so tools
+ * like llnet-top can watch a running process without asking it for anything.
+ * Each connection gets a slot guarded by a sequence lock: the writer makes the
+ * sequence number odd while it updates the slot, and readers retry if it was
+ * odd or changed while they were copying. Neither side ever blocks the other.
+ *
+ * @author agent <agent@local>
+ */
+#ifndef __CORE_NETWORK_STATSHM
+#define __CORE_NETWORK_STATSHM
+
+// allow C++ to parse this
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include "lowlevel.h"
+
+#define LLNET_STATSHM_MAGIC (0x4c4c4e54) // "LLNT"
+#define LLNET_STATSHM_VERSION (1)
+#define LLNET_STATSHM_DEFAULT_NAME "/llnet-stats"
+#define LLNET_STATSHM_SLOTS (64) // most connections that are published
+#define LLNET_STATSHM_READ_RETRIES (64) // times a reader retries a slot that keeps changing
+
+// Defines the start of a stats segment
+typedef struct LLNetStatsHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity; // number of slots in the segment
+    uint32_t num_slots; // number of slots filled in by the last round
+    uint64_t pid; // the process publishing
+    uint64_t rounds; // number of times the slots have been published
+    uint64_t updated_ns; // when the last round finished (monotonic clock)
+} LLNetStatsHeader_t;
+
+// Defines the counters published for a connection
+typedef struct LLNetStatsSlot {
+    uint32_t seq; // odd while the slot is being written
+    uint32_t connection_id;
+    uint32_t peer_addr; // IPv4 address of the other side (network order)
+    uint16_t peer_port; // (network order)
+    uint8_t peer_caps;
+    uint8_t _reserved;
+    LLNetStats_t stats;
+    LLNetSocketStats_t sockets;
+} LLNetStatsSlot_t;
+
+// Defines an attached stats segment
+typedef struct LLNetStatsShm {
+    LLNetStatsHeader_t* header;
+    LLNetStatsSlot_t* slots;
+    size_t size; // size of the mapping
+    bool writer; // true if this side created the segment (and removes it)
+    uint32_t next; // next slot to write in the current round
+    char name[64];
+} LLNetStatsShm_t;
+
+/**
+ * Creates a stats segment to publish into, replacing one left behind by a
+ * process that has gone. A segment whose publisher is still running is left
+ * alone.
+ *
+ * @param name the name of the segment (starts with a '/')
+ * @param capacity the number of slots
+ * @returns the segment, or NULL if it couldn't be created (errno is EEXIST if
+ *          another live process is publishing under the name)
+ */
+LLNetStatsShm_t* statshm_create(const char* name, uint32_t capacity);
+
+/**
+ * Attaches to a stats segment read-only
+ *
+ * @param name the name of the segment
+ * @returns the segment, or NULL if it doesn't exist or isn't a stats segment
+ */
+LLNetStatsShm_t* statshm_open(const char* name);
+
+/**
+ * Starts a round of publishing
+ *
+ * @param shm the segment
+ */
+void statshm_begin(LLNetStatsShm_t* shm);
+
+/**
+ * Publishes a connection's counters into the next slot of the round
+ *
+ * @param shm the segment
+ * @param id the connection's ID
+ * @param caps the other side's capabilities
+ * @param addr the other side's address
+ * @param stats the connection's counters
+ * @param sockets the connection's last socket sample
+ * @returns true if the counters were published, false if the segment is full
+ */
+bool statshm_write(LLNetStatsShm_t* shm, uint32_t id, uint8_t caps, struct sockaddr_in* addr, LLNetStats_t* stats,
+    LLNetSocketStats_t* sockets);
+
+/**
+ * Finishes a round of publishing, slots past the last one written are dropped
+ *
+ * @param shm the segment
+ * @param now the current time (in nanoseconds, monotonic clock)
+ */
+void statshm_end(LLNetStatsShm_t* shm, uint64_t now);
+
+/**
+ * Copies a consistent snapshot of a slot
+ *
+ * @param shm the segment
+ * @param index the slot to copy
+ * @param slot the structure to copy into
+ * @returns true if the slot was copied, false if it isn't in use or kept changing
+ */
+bool statshm_read(LLNetStatsShm_t* shm, uint32_t index, LLNetStatsSlot_t* slot);
+
+/**
+ * Detaches from a stats segment, removing it if this side created it
+ *
+ * @param shm the segment
+ */
+void statshm_close(LLNetStatsShm_t* shm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * core/test/bench-dispatch.c
+ *
+ * Measures the cost of routing a packet through the messagehandler's dispatch
+ * table, against calling the right unpacker from a switch directly. Packets are
+ * built before the clock starts, so only unpacking and routing are timed.
+ *
+ * @author agent <agent@local>
+ */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "../network/lowlevel.h"
+#include "../network/packet.h"
+#include "../network/packethandlers.h"
+#include "../network/messagehandler.h"
+
+#define BENCH_PACKETS (200000)
+#define BENCH_ROUNDS (5)
+
+// Packets in the mix, each with enough data for its unpacker
+static const uint8_t MIX_TYPES[] = { pt_USER_DATA, pt_USER_DATA, pt_USER_DATA, pt_STATE_UPDATE, pt_INIT,
+    pt_UPDATE_STATUS, pt_DEBUG };
+static const uint8_t MIX_DATA[16] = { 0x55, 0xaa, 0xcc, 0x33, 0x80, 0x00, 0xff, 0x00, 0x01, 0x02, 0x03, 0x04 };
+
+static IntermediateTLV_t* packets[BENCH_PACKETS];
+
+/**
+ * Gets the current monotonic time
+ *
+ * @returns the time in nanoseconds
+ */
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * Builds the packets for a round
+ *
+ * @param known true to use the mix of known types, false for a type nothing handles
+ */
+static void build(bool known) {
+    for (size_t i = 0; i < BENCH_PACKETS; i += 1) {
+        IntermediateTLV_t* p = malloc(sizeof(IntermediateTLV_t));
+        p->type = known? MIX_TYPES[i % sizeof(MIX_TYPES)] : 0x55;
+        p->length = sizeof(MIX_DATA);
+        p->timestamp = 0;
+        p->data = malloc(sizeof(MIX_DATA));
+        memcpy(p->data, MIX_DATA, sizeof(MIX_DATA));
+        packets[i] = p;
+    }
+}
+
+/**
+ * Handler for every type: just gives the packet back
+ */
+static void on_packet(uint32_t id, PacketTLV_t* packet) {
+    (void) id;
+    mh_destroy_packet(packet);
+}
+
+/**
+ * The old way of routing: a switch to the right unpacker and destroyer
+ */
+static void switch_dispatch(IntermediateTLV_t* raw) {
+    PacketTLV_t* packet = NULL;
+    switch (raw->type) {
+        case pt_INIT:
+            packet = unpackInit(raw);
+            destroyInit(packet);
+            break;
+        case pt_STATE_UPDATE:
+            packet = unpackStateUpdate(raw);
+            destroyStateUpdate(packet);
+            break;
+        case pt_USER_DATA:
+            packet = unpackUserData(raw);
+            destroyUserData(packet);
+            break;
+        case pt_UPDATE_STATUS:
+            packet = unpackUpdateStatus(raw);
+            destroyUpdateStatus(packet);
+            break;
+        case pt_DEBUG:
+            packet = unpackDebug(raw);
+            destroyDebug(packet);
+            break;
+        default:
+            llnet_packet_free(raw);
+            break;
+    }
+}
+
+/**
+ * Runs one timed round
+ *
+ * @param known true to use the mix of known types
+ * @param table true to route through the dispatch table, false to use the switch
+ * @returns the time per packet (in nanoseconds)
+ */
+static double run(bool known, bool table) {
+    build(known);
+    uint64_t start = now_ns();
+    if (table) {
+        for (size_t i = 0; i < BENCH_PACKETS; i += 1) {
+            mh_sort_packet(1, packets[i]);
+        }
+    } else {
+        for (size_t i = 0; i < BENCH_PACKETS; i += 1) {
+            switch_dispatch(packets[i]);
+        }
+    }
+    return (double) (now_ns() - start) / BENCH_PACKETS;
+}
+
+/**
+ * Runs several rounds and keeps the best
+ */
+static double best_of(bool known, bool table) {
+    double best = 1e18;
+    for (size_t i = 0; i < BENCH_ROUNDS; i += 1) {
+        double ns = run(known, table);
+        if (ns < best) {
+            best = ns;
+        }
+    }
+    return best;
+}
+
+/**
+ * Entry point to the program
+ */
+int main() {
+    mh_init();
+    for (size_t i = 0; i < sizeof(MIX_TYPES); i += 1) {
+        mh_set_handler(MIX_TYPES[i], on_packet);
+    }
+
+    double table_known = best_of(true, true);
+    double switch_known = best_of(true, false);
+    double table_unknown = best_of(false, true);
+    double switch_unknown = best_of(false, false);
+
+    printf("dispatch, %u packets, best of %u rounds\n", BENCH_PACKETS, BENCH_ROUNDS);
+    printf("  known types (unpack + handler + destroy): table %6.1f ns/packet  switch %6.1f ns/packet\n",
+        table_known, switch_known);
+    printf("  unknown type (drop):                      table %6.1f ns/packet  switch %6.1f ns/packet\n",
+        table_unknown, switch_unknown);
+    uint64_t unknown = mh_get_unknown_count();
+    printf("  unknown packets counted: %lu\n", (unsigned long) unknown);
+
+    // Every unknown packet routed through the table should have been counted
+    mh_free();
+    return (unknown == (uint64_t) BENCH_PACKETS * BENCH_ROUNDS)? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,146 @@
+/**
+ * core/test/bench-estop.c
+ *
+ * Measures the e-stop fast path with a full field of robots: how long it takes
+ * to write every e-stop frame, and how long until every robot has responded.
+ * Exits with an error if the last response comes later after the trigger than
+ * the bound allows.
+ *
+ * @author agent <agent@local>
+ */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "test-utils.h"
+#include "../network/lowlevel.h"
+#include "../network/packet.h"
+#include "../network/estop.h"
+
+#define BENCH_ROBOTS (32) // a full field
+#define BENCH_ROUNDS (200)
+#define BENCH_BOUND_US (10000) // worst trigger-to-response latency allowed (for the whole field)
+#define BENCH_ROUND_TIMEOUT_MS (1000)
+
+static LLNetEstop_t* estop = NULL;
+static uint32_t connected = 0;
+
+/**
+ * Gets the current monotonic time
+ *
+ * @returns the time in nanoseconds
+ */
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * Robot side: answers an e-stop with an UPDATE_STATUS
+ */
+static void robot_on_packet(uint32_t id, IntermediateTLV_t* pckt) {
+    if (pckt->type == pt_STATE_UPDATE && pckt->length >= 1 && pckt->data[0] == rs_E_STOPPED) {
+        uint32_t status = 0;
+        IntermediateTLV_t response;
+        response.type = pt_UPDATE_STATUS;
+        response.length = sizeof(uint32_t);
+        response.data = (uint8_t*) &status;
+        WorkerConnection_t* worker = llnet_connection_get(id);
+        if (worker != NULL) {
+            llnet_connection_send(worker, np_TCP, &response);
+        }
+    }
+    llnet_packet_free(pckt);
+}
+
+/**
+ * FMS side: times the responses
+ */
+static void fms_on_packet(uint32_t id, IntermediateTLV_t* pckt) {
+    llnet_estop_observe(estop, id, pckt);
+    llnet_packet_free(pckt);
+}
+
+/**
+ * FMS side: counts the robots on the field
+ */
+static void fms_on_connect(WorkerConnection_t* c) {
+    (void) c;
+    __atomic_fetch_add(&connected, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Compares two latencies (for qsort)
+ */
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Entry point to the program
+ */
+int main() {
+    // Bring up the FMS in its own context, then fill the field
+    LLNetContext_t* fms = llnet_context_init();
+    estop = llnet_estop_init(fms, BENCH_ROBOTS);
+    AccepterConnection_t* accepter = llnet_connection_listen(llnet_connection_init_context(fms), fms_on_connect,
+        fms_on_packet);
+    msleep(5);
+
+    WorkerConnection_t* robots[BENCH_ROBOTS];
+    for (size_t i = 0; i < BENCH_ROBOTS; i += 1) {
+        robots[i] = llnet_connection_connect(llnet_connection_init(), "localhost", robot_on_packet);
+    }
+    for (size_t i = 0; i < 1000 && __atomic_load_n(&connected, __ATOMIC_RELAXED) < BENCH_ROBOTS; i += 1) {
+        msleep(1);
+    }
+
+    uint64_t send_ns[BENCH_ROUNDS];
+    uint64_t worst_ns[BENCH_ROUNDS];
+    uint32_t missed = 0;
+    for (size_t round = 0; round < BENCH_ROUNDS; round += 1) {
+        uint64_t start = now_ns();
+        uint32_t count = llnet_estop_trigger(estop);
+        send_ns[round] = estop->sent_ns - start;
+        if (count != BENCH_ROBOTS) {
+            fprintf(stderr, "round %zu reached %u robots\n", round, count);
+            missed += 1;
+        }
+
+        uint64_t deadline = start + ((uint64_t) BENCH_ROUND_TIMEOUT_MS * 1000000);
+        while (llnet_estop_pending(estop) > 0 && now_ns() < deadline) {
+            usleep(10);
+        }
+        missed += llnet_estop_pending(estop);
+        worst_ns[round] = llnet_estop_worst_latency(estop);
+        msleep(1); // let the duplicate (UDP) e-stops settle
+    }
+
+    qsort(send_ns, BENCH_ROUNDS, sizeof(uint64_t), compare_u64);
+    qsort(worst_ns, BENCH_ROUNDS, sizeof(uint64_t), compare_u64);
+    printf("e-stop, %u robots, %u rounds\n", BENCH_ROBOTS, BENCH_ROUNDS);
+    printf("  write all frames:         p50 %6.1f us  p99 %6.1f us  max %6.1f us\n", send_ns[BENCH_ROUNDS / 2] / 1e3,
+        send_ns[(BENCH_ROUNDS * 99) / 100] / 1e3, send_ns[BENCH_ROUNDS - 1] / 1e3);
+    printf("  trigger to last response: p50 %6.1f us  p99 %6.1f us  max %6.1f us  (bound %u us)\n",
+        worst_ns[BENCH_ROUNDS / 2] / 1e3, worst_ns[(BENCH_ROUNDS * 99) / 100] / 1e3,
+        worst_ns[BENCH_ROUNDS - 1] / 1e3, BENCH_BOUND_US);
+    printf("  missed responses: %u\n", missed);
+
+    // Clean up
+    for (size_t i = 0; i < BENCH_ROBOTS; i += 1) {
+        llnet_connection_free((NetConnection_t*) robots[i]);
+    }
+    llnet_connection_free((NetConnection_t*) accepter);
+    llnet_estop_free(estop);
+    llnet_context_free(fms);
+
+    bool ok = missed == 0 && worst_ns[BENCH_ROUNDS - 1] <= (uint64_t) BENCH_BOUND_US * 1000;
+    printf("%s\n", ok? "within bound" : "^^^ bound exceeded");
+    return ok? EXIT_SUCCESS : EXIT_FAILURE;
+}
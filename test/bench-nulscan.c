@@ -0,0 +1,176 @@
+/**
+ * core/test/bench-nulscan.c
+ *
+ * Measures how fast the nuls in a large CONFIG_REQUEST key list are found,
+ * with the old strlen-per-string walk and each nulscan implementation, then
+ * how long unpacking the whole packet takes with each implementation.
+ *
+ * @author agent <agent@local>
+ */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "../network/lowlevel.h"
+#include "../network/packet.h"
+#include "../network/packethandlers.h"
+#include "../network/nulscan.h"
+
+#define BENCH_KEYS (4096)
+#define BENCH_SCANS (2000)
+#define BENCH_UNPACKS (500)
+#define BENCH_ROUNDS (5)
+#define BENCH_CHUNK (64)
+
+static uint8_t* payload;
+static uint32_t payload_len;
+
+/**
+ * Gets the current monotonic time
+ *
+ * @returns the time in nanoseconds
+ */
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * Builds a key list like a robot's full config request: keys of 8 to 40
+ * characters, padded with nuls to a multiple of four
+ */
+static void build() {
+    payload = malloc(BENCH_KEYS * 41 + 4);
+    payload_len = 0;
+    srand(45);
+    for (uint32_t i = 0; i < BENCH_KEYS; i += 1) {
+        uint32_t len = 8 + (rand() % 33);
+        int prefix = snprintf((char*) payload + payload_len, len + 1, "robot.subsystem_%u.", i);
+        for (uint32_t j = (uint32_t) prefix; j < len; j += 1) {
+            payload[payload_len + j] = 'a' + (rand() % 26);
+        }
+        payload[payload_len + len] = '\0';
+        payload_len += len + 1;
+    }
+    while (payload_len % 4 != 0) {
+        payload[payload_len] = '\0';
+        payload_len += 1;
+    }
+}
+
+/**
+ * Counts the keys the way the parser used to: strlen from each string to the next
+ *
+ * @returns the number of non-empty keys
+ */
+static uint32_t count_strlen() {
+    uint32_t count = 0;
+    const char* pos = (const char*) payload;
+    while (pos < (const char*) payload + payload_len) {
+        size_t len = strlen(pos);
+        count += (len > 0)? 1 : 0;
+        pos += len + 1;
+    }
+    return count;
+}
+
+/**
+ * Counts the keys with nulscan, a chunk of offsets at a time
+ *
+ * @returns the number of non-empty keys
+ */
+static uint32_t count_nulscan() {
+    uint32_t offsets[BENCH_CHUNK];
+    uint32_t count = 0;
+    uint32_t start = 0;
+    uint32_t found;
+    do {
+        found = nulscan(payload, start, payload_len, offsets, BENCH_CHUNK);
+        for (uint32_t i = 0; i < found; i += 1) {
+            count += (offsets[i] > start)? 1 : 0;
+            start = offsets[i] + 1;
+        }
+    } while (found == BENCH_CHUNK);
+    return count;
+}
+
+/**
+ * Times one way of counting the keys
+ *
+ * @param use_strlen true for the strlen walk, false for nulscan
+ * @returns the best throughput (in MB/s)
+ */
+static double scan_rate(bool use_strlen) {
+    double best = 0;
+    volatile uint32_t sink = 0;
+    for (uint32_t r = 0; r < BENCH_ROUNDS; r += 1) {
+        uint64_t start = now_ns();
+        for (uint32_t i = 0; i < BENCH_SCANS; i += 1) {
+            sink += use_strlen? count_strlen() : count_nulscan();
+        }
+        double rate = ((double) payload_len * BENCH_SCANS * 1000.0) / (double) (now_ns() - start);
+        best = (rate > best)? rate : best;
+    }
+    (void) sink;
+    return best;
+}
+
+/**
+ * Times unpacking the key list as a CONFIG_REQUEST
+ *
+ * @returns the best time per packet (in microseconds)
+ */
+static double unpack_time() {
+    double best = 1e18;
+    for (uint32_t r = 0; r < BENCH_ROUNDS; r += 1) {
+        uint64_t elapsed = 0;
+        for (uint32_t i = 0; i < BENCH_UNPACKS; i += 1) {
+            IntermediateTLV_t* raw = malloc(sizeof(IntermediateTLV_t));
+            raw->type = pt_CONFIG_REQUEST;
+            raw->length = payload_len;
+            raw->timestamp = 0;
+            raw->data = malloc(payload_len);
+            memcpy(raw->data, payload, payload_len);
+
+            uint64_t start = now_ns();
+            PacketTLV_t* packet = unpackConfigRequest(raw);
+            destroyConfigRequest(packet);
+            elapsed += now_ns() - start;
+        }
+        double us = (double) elapsed / BENCH_UNPACKS / 1000.0;
+        best = (us < best)? us : best;
+    }
+    return best;
+}
+
+/**
+ * Entry point to the program
+ */
+int main() {
+    build();
+    uint32_t expected = count_strlen();
+    printf("nulscan, %u keys (%u bytes), best of %u rounds\n", BENCH_KEYS, payload_len, BENCH_ROUNDS);
+    printf("  strlen walk:  %8.1f MB/s\n", scan_rate(true));
+
+    static const char* NAMES[] = { "auto", "scalar", "sse2", "avx2" };
+    const NulScanImpl_t impls[] = { nsi_SCALAR, nsi_SSE2, nsi_AVX2 };
+    bool correct = true;
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i += 1) {
+        if (nulscan_set_impl(impls[i]) != impls[i]) {
+            printf("  %-6s        not supported\n", NAMES[impls[i]]);
+            continue;
+        }
+        correct = correct && (count_nulscan() == expected);
+        printf("  nulscan %-6s %8.1f MB/s   unpack %7.2f us/packet\n", NAMES[impls[i]], scan_rate(false),
+            unpack_time());
+    }
+    nulscan_set_impl(nsi_AUTO);
+
+    free(payload);
+    return correct? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,446 @@
+/**
+ * core/test/bench-packethandlers.c
+ *
+ * Measures every packet codec: ns/packet and allocations/packet for each
+ * unpack and destroy pair, and for each packer, across realistic payload
+ * sizes (CONFIG packets from a handful of pairs up to a full robot config).
+ * CONFIG_RESPONSE payloads are also decoded through a ConfigStore and the
+ * known-key path, and fixed-layout packets through a PacketBatch, for
+ * comparison.
+ *
+ * Allocations are counted by wrapping malloc, calloc and realloc at link time
+ * (see the bench-packethandlers recipe), so nothing in the codecs changes to
+ * be measured. Packets are built before the clock starts.
+ *
+ * @author agent <agent@local>
+ */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "../network/lowlevel.h"
+#include "../network/packet.h"
+#include "../network/packethandlers.h"
+#include "../network/messagehandler.h"
+#include "../network/packetview.h"
+#include "../network/packetbatch.h"
+#include "../network/configstore.h"
+#include "../network/configknown.h"
+#include "../network/netutils.h"
+#include "../collections/arraylist.h"
+
+#define BENCH_ROUNDS (5)
+#define BENCH_BYTES (4000000) // about how much payload each round decodes
+#define BENCH_MIN_ITERS (200)
+#define BENCH_MAX_ITERS (100000)
+
+// Defines a packet to measure
+typedef struct BenchCase {
+    char name[40];
+    uint8_t type;
+    uint8_t* payload;
+    uint32_t length;
+    PacketTLV_t* decoded; // for the packer
+    uint32_t arbitrary_length;
+} BenchCase_t;
+
+// Defines one measurement
+typedef struct BenchResult {
+    double ns;
+    double allocs;
+} BenchResult_t;
+
+static uint64_t alloc_count = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+/**
+ * Counts an allocation, then makes it
+ */
+void* __wrap_malloc(size_t size) {
+    alloc_count += 1;
+    return __real_malloc(size);
+}
+
+/**
+ * Counts an allocation, then makes it
+ */
+void* __wrap_calloc(size_t count, size_t size) {
+    alloc_count += 1;
+    return __real_calloc(count, size);
+}
+
+/**
+ * Counts an allocation, then makes it
+ */
+void* __wrap_realloc(void* ptr, size_t size) {
+    alloc_count += 1;
+    return __real_realloc(ptr, size);
+}
+
+/**
+ * Gets the current monotonic time
+ *
+ * @returns the time in nanoseconds
+ */
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * Picks how many packets a round of a case decodes
+ *
+ * @param length the payload length
+ * @returns the number of packets
+ */
+static uint32_t iterations(uint32_t length) {
+    uint32_t iters = BENCH_BYTES / (length + 16);
+    iters = (iters < BENCH_MIN_ITERS)? BENCH_MIN_ITERS : iters;
+    return (iters > BENCH_MAX_ITERS)? BENCH_MAX_ITERS : iters;
+}
+
+/**
+ * Makes a raw packet, as the low-level interface hands them over
+ *
+ * @param c the case
+ * @returns the packet
+ */
+static IntermediateTLV_t* make_raw(const BenchCase_t* c) {
+    IntermediateTLV_t* raw = malloc(sizeof(IntermediateTLV_t));
+    raw->type = c->type;
+    raw->length = c->length;
+    raw->timestamp = 0;
+    raw->data = malloc(c->length);
+    memcpy(raw->data, c->payload, c->length);
+    return raw;
+}
+
+/**
+ * Unpacks and destroys a packet with the codec for its type
+ *
+ * @param raw the packet (freed)
+ */
+static void unpack_destroy(IntermediateTLV_t* raw) {
+    switch (raw->type) {
+        case pt_INIT:            destroyInit(unpackInit(raw)); break;
+        case pt_STATE_REQUEST:   destroyStateRequest(unpackStateRequest(raw)); break;
+        case pt_STATE_RESPONSE:  destroyStateResponse(unpackStateResponse(raw)); break;
+        case pt_STATE_UPDATE:    destroyStateUpdate(unpackStateUpdate(raw)); break;
+        case pt_CONFIG_REQUEST:  destroyConfigRequest(unpackConfigRequest(raw)); break;
+        case pt_CONFIG_RESPONSE: destroyConfigResponse(unpackConfigResponse(raw)); break;
+        case pt_CONFIG_UPDATE:   destroyConfigUpdate(unpackConfigUpdate(raw)); break;
+        case pt_USER_DATA:       destroyUserData(unpackUserData(raw)); break;
+        case pt_UPDATE_STATUS:   destroyUpdateStatus(unpackUpdateStatus(raw)); break;
+        case pt_DEBUG:           destroyDebug(unpackDebug(raw)); break;
+        default:                 llnet_packet_free(raw); break;
+    }
+}
+
+/**
+ * Packs a decoded packet with the packer for its type
+ *
+ * @param c the case
+ * @param buffer where to pack it
+ * @param length the length of the buffer
+ * @returns the frame length
+ */
+static uint32_t pack(const BenchCase_t* c, uint8_t* buffer, uint32_t length) {
+    const void* data = c->decoded->data;
+    switch (c->type) {
+        case pt_INIT:            return packInit(data, buffer, length);
+        case pt_STATE_REQUEST:   return packStateRequest(buffer, length);
+        case pt_STATE_RESPONSE:  return packStateResponse(data, c->arbitrary_length, buffer, length);
+        case pt_STATE_UPDATE:    return packStateUpdate(data, c->arbitrary_length, buffer, length);
+        case pt_CONFIG_REQUEST:  return packConfigRequest(data, buffer, length);
+        case pt_CONFIG_RESPONSE: return packConfigResponse(data, buffer, length);
+        case pt_CONFIG_UPDATE:   return packConfigUpdate(data, buffer, length);
+        case pt_USER_DATA:       return packUserData(data, buffer, length);
+        case pt_UPDATE_STATUS:   return packUpdateStatus(data, buffer, length);
+        case pt_DEBUG:           return packDebug(data, c->arbitrary_length, buffer, length);
+    }
+    return 0;
+}
+
+// Defines the ways a case can be decoded
+typedef enum BenchPath {
+    bp_UNPACK,
+    bp_PACK,
+    bp_STORE, // config_store_from_view
+    bp_KNOWN, // config_known_apply
+    bp_BATCH  // pbatch_decode, a round at a time
+} BenchPath_t;
+
+/**
+ * Runs one timed round
+ *
+ * @param c the case
+ * @param path how to decode it
+ * @returns the time and allocations per packet
+ */
+static BenchResult_t run(const BenchCase_t* c, BenchPath_t path) {
+    uint32_t iters = iterations(c->length);
+    IntermediateTLV_t** raws = malloc(sizeof(IntermediateTLV_t*) * iters);
+    uint32_t frame_length = LLNET_HEADER_LENGTH + c->length;
+    uint8_t* frame = malloc(frame_length);
+    for (uint32_t i = 0; i < iters; i += 1) {
+        raws[i] = (path == bp_PACK)? NULL : make_raw(c);
+    }
+
+    ConfigKnown_t known;
+    PacketBatch_t batch;
+    config_known_init(&known);
+    pbatch_init(&batch, (path == bp_BATCH)? iters : 0);
+    volatile uint32_t sink = 0;
+    uint64_t allocs = alloc_count;
+    uint64_t start = now_ns();
+    if (path == bp_BATCH) {
+        sink += pbatch_decode(&batch, raws, iters, NULL);
+    }
+    for (uint32_t i = 0; i < iters && path != bp_BATCH; i += 1) {
+        PacketView_t view;
+        ConfigStore_t* others;
+        switch (path) {
+            case bp_UNPACK:
+                unpack_destroy(raws[i]);
+                break;
+            case bp_PACK:
+                sink += pack(c, frame, frame_length);
+                break;
+            case bp_STORE:
+                pview_init(&view, raws[i], true);
+                config_store_free(config_store_from_view(&view));
+                pview_release(&view);
+                break;
+            case bp_KNOWN:
+                pview_init(&view, raws[i], true);
+                config_known_apply(&known, &view, &others);
+                config_store_free(others);
+                pview_release(&view);
+                break;
+            case bp_BATCH:
+                break;
+        }
+    }
+    BenchResult_t result;
+    result.ns = (double) (now_ns() - start) / iters;
+    result.allocs = (double) (alloc_count - allocs) / iters;
+
+    (void) sink;
+    for (uint32_t i = 0; i < iters && path == bp_BATCH; i += 1) {
+        llnet_packet_free(raws[i]); // the batch only borrows them
+    }
+    pbatch_free(&batch);
+    config_known_clear(&known);
+    free(frame);
+    free(raws);
+    return result;
+}
+
+/**
+ * Runs several rounds and keeps the fastest
+ */
+static BenchResult_t best_of(const BenchCase_t* c, BenchPath_t path) {
+    BenchResult_t best = { 1e18, 0 };
+    for (uint32_t r = 0; r < BENCH_ROUNDS; r += 1) {
+        BenchResult_t result = run(c, path);
+        best = (result.ns < best.ns)? result : best;
+    }
+    return best;
+}
+
+/**
+ * Finishes a case from a packed frame: keeps its payload, and decodes it once
+ * for the packer
+ *
+ * @param c the case, with its name, type and arbitrary length set
+ * @param frame the frame
+ * @param frame_length the frame's length
+ */
+static void finish_case(BenchCase_t* c, const uint8_t* frame, uint32_t frame_length) {
+    c->length = frame_length - LLNET_HEADER_LENGTH;
+    c->payload = malloc(c->length + 1);
+    memcpy(c->payload, frame + LLNET_HEADER_LENGTH, c->length);
+    IntermediateTLV_t* raw = make_raw(c);
+    switch (c->type) {
+        case pt_INIT:            c->decoded = unpackInit(raw); break;
+        case pt_STATE_REQUEST:   c->decoded = unpackStateRequest(raw); break;
+        case pt_STATE_RESPONSE:  c->decoded = unpackStateResponse(raw); break;
+        case pt_STATE_UPDATE:    c->decoded = unpackStateUpdate(raw); break;
+        case pt_CONFIG_REQUEST:  c->decoded = unpackConfigRequest(raw); break;
+        case pt_CONFIG_RESPONSE: c->decoded = unpackConfigResponse(raw); break;
+        case pt_CONFIG_UPDATE:   c->decoded = unpackConfigUpdate(raw); break;
+        case pt_USER_DATA:       c->decoded = unpackUserData(raw); break;
+        case pt_UPDATE_STATUS:   c->decoded = unpackUpdateStatus(raw); break;
+        case pt_DEBUG:           c->decoded = unpackDebug(raw); break;
+    }
+}
+
+/**
+ * Builds a list of config pairs like a robot's config, cycling through the types
+ *
+ * @param count the number of pairs
+ * @returns the list (of KVPairTLV_t*)
+ */
+static ArrayList_t* build_pairs(uint32_t count) {
+    ArrayList_t* pairs = arraylist_init();
+    char key[48];
+    char string[24];
+    for (uint32_t i = 0; i < count; i += 1) {
+        KVPair_Value_u value;
+        KVPair_Type_t type = (KVPair_Type_t) (i % 5);
+        uint32_t length = 8;
+        snprintf(key, sizeof(key), "robot.subsystem_%u.param_%u", i / 8, i % 8);
+        switch (type) {
+            case kv_Integer: value.Integer = (int32_t) i; break;
+            case kv_Float:   value.Float = i * 0.25f; break;
+            case kv_Double:  value.Double = i * 0.125; length = 12; break;
+            case kv_Boolean: value.Boolean = (int8_t) (i & 1); length = 5; break;
+            case kv_CString:
+                snprintf(string, sizeof(string), "value_%u", i);
+                value.CString = string;
+                length = 4 + (uint32_t) strlen(string) + 1;
+                break;
+        }
+        arraylist_add(pairs, KVPairTLV_create(key, type, length, value));
+    }
+    return pairs;
+}
+
+/**
+ * Frees a list from build_pairs
+ */
+static void free_pairs(ArrayList_t* pairs) {
+    for (uint32_t i = 0; i < arraylist_size(pairs); i += 1) {
+        KVPairTLV_destroy(arraylist_get(pairs, i));
+    }
+    arraylist_free(pairs);
+}
+
+/**
+ * Builds every case
+ *
+ * @param cases where to put them
+ * @returns the number of cases
+ */
+static uint32_t build_cases(BenchCase_t* cases) {
+    static uint8_t frame[1 << 16];
+    static uint8_t arbitrary[1024];
+    uint32_t n = 0;
+    memset(arbitrary, 0x5a, sizeof(arbitrary));
+
+    PTLVData_INIT_t init = { 0xaa55aa55 };
+    cases[n] = (BenchCase_t) { "INIT", pt_INIT, NULL, 0, NULL, 0 };
+    finish_case(&cases[n], frame, packInit(&init, frame, sizeof(frame)));
+    n += 1;
+
+    cases[n] = (BenchCase_t) { "STATE_REQUEST", pt_STATE_REQUEST, NULL, 0, NULL, 0 };
+    finish_case(&cases[n], frame, packStateRequest(frame, sizeof(frame)));
+    n += 1;
+
+    const uint32_t ARBITRARY[] = { 0, 64, 1024 };
+    for (uint32_t i = 0; i < 3; i += 1) {
+        PTLVData_STATE_RESPONSE_t response = { rs_ENABLED, 0, arbitrary };
+        cases[n] = (BenchCase_t) { "", pt_STATE_RESPONSE, NULL, 0, NULL, ARBITRARY[i] };
+        snprintf(cases[n].name, sizeof(cases[n].name), "STATE_RESPONSE +%u", ARBITRARY[i]);
+        finish_case(&cases[n], frame, packStateResponse(&response, ARBITRARY[i], frame, sizeof(frame)));
+        n += 1;
+    }
+
+    PTLVData_STATE_UPDATE_t update = { rs_DISABLED, 0, arbitrary };
+    cases[n] = (BenchCase_t) { "STATE_UPDATE +64", pt_STATE_UPDATE, NULL, 0, NULL, 64 };
+    finish_case(&cases[n], frame, packStateUpdate(&update, 64, frame, sizeof(frame)));
+    n += 1;
+
+    PTLVData_USER_DATA_t user = { 0x55, 0xaa, 0xcc, 0x33, true, false, 0xff00 };
+    cases[n] = (BenchCase_t) { "USER_DATA", pt_USER_DATA, NULL, 0, NULL, 0 };
+    finish_case(&cases[n], frame, packUserData(&user, frame, sizeof(frame)));
+    n += 1;
+
+    PTLVData_UPDATE_STATUS_t status = { sc_SUCCESS, 0 };
+    cases[n] = (BenchCase_t) { "UPDATE_STATUS", pt_UPDATE_STATUS, NULL, 0, NULL, 0 };
+    finish_case(&cases[n], frame, packUpdateStatus(&status, frame, sizeof(frame)));
+    n += 1;
+
+    PTLVData_DEBUG_t debug = { cs_UP_TO_DATE, 0xbfd773d, 0xaa55aa55, rs_ENABLED, 0, 42, arbitrary };
+    cases[n] = (BenchCase_t) { "DEBUG +256", pt_DEBUG, NULL, 0, NULL, 256 };
+    finish_case(&cases[n], frame, packDebug(&debug, 256, frame, sizeof(frame)));
+    n += 1;
+
+    // CONFIG packets, from a few keys up to a full robot config
+    const uint32_t COUNTS[] = { 4, 64, 512 };
+    for (uint32_t i = 0; i < 3; i += 1) {
+        ArrayList_t* pairs = build_pairs(COUNTS[i]);
+        ArrayList_t* keys = arraylist_init();
+        for (uint32_t k = 0; k < COUNTS[i]; k += 1) {
+            arraylist_add(keys, ((KVPairTLV_t*) arraylist_get(pairs, k))->key);
+        }
+
+        PTLVData_CONFIG_REQUEST_t request = { (List_t*) keys };
+        cases[n] = (BenchCase_t) { "", pt_CONFIG_REQUEST, NULL, 0, NULL, 0 };
+        snprintf(cases[n].name, sizeof(cases[n].name), "CONFIG_REQUEST %u keys", COUNTS[i]);
+        finish_case(&cases[n], frame, packConfigRequest(&request, frame, sizeof(frame)));
+        n += 1;
+
+        PTLVData_CONFIG_RESPONSE_t response = { (List_t*) pairs };
+        cases[n] = (BenchCase_t) { "", pt_CONFIG_RESPONSE, NULL, 0, NULL, 0 };
+        snprintf(cases[n].name, sizeof(cases[n].name), "CONFIG_RESPONSE %u pairs", COUNTS[i]);
+        finish_case(&cases[n], frame, packConfigResponse(&response, frame, sizeof(frame)));
+        n += 1;
+
+        PTLVData_CONFIG_UPDATE_t config_update = { (List_t*) pairs };
+        cases[n] = (BenchCase_t) { "", pt_CONFIG_UPDATE, NULL, 0, NULL, 0 };
+        snprintf(cases[n].name, sizeof(cases[n].name), "CONFIG_UPDATE %u pairs", COUNTS[i]);
+        finish_case(&cases[n], frame, packConfigUpdate(&config_update, frame, sizeof(frame)));
+        n += 1;
+
+        arraylist_free(keys);
+        free_pairs(pairs);
+    }
+    return n;
+}
+
+/**
+ * Entry point to the program
+ */
+int main() {
+    BenchCase_t cases[32];
+    uint32_t count = build_cases(cases);
+    bool correct = true;
+
+    printf("packethandlers, best of %u rounds\n", BENCH_ROUNDS);
+    printf("  %-26s %6s   %-26s %-26s\n", "packet", "bytes", "unpack + destroy", "pack");
+    for (uint32_t i = 0; i < count; i += 1) {
+        BenchCase_t* c = &cases[i];
+        correct = correct && (c->decoded != NULL);
+        BenchResult_t unpacked = best_of(c, bp_UNPACK);
+        BenchResult_t packed = best_of(c, bp_PACK);
+        printf("  %-26s %6u   %9.1f ns %5.2f allocs   %9.1f ns %5.2f allocs\n", c->name, c->length,
+            unpacked.ns, unpacked.allocs, packed.ns, packed.allocs);
+        if (c->type == pt_CONFIG_RESPONSE) {
+            BenchResult_t store = best_of(c, bp_STORE);
+            BenchResult_t known = best_of(c, bp_KNOWN);
+            printf("    %-32s   %9.1f ns %5.2f allocs\n", "as a ConfigStore", store.ns, store.allocs);
+            printf("    %-32s   %9.1f ns %5.2f allocs\n", "known keys (+ store for others)", known.ns,
+                known.allocs);
+        }
+        if (c->type != pt_STATE_REQUEST && c->type != pt_CONFIG_REQUEST && c->type != pt_CONFIG_RESPONSE &&
+                c->type != pt_CONFIG_UPDATE) {
+            BenchResult_t batched = best_of(c, bp_BATCH);
+            printf("    %-32s   %9.1f ns %5.2f allocs\n", "batched", batched.ns, batched.allocs);
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i += 1) {
+        mh_destroy_packet(cases[i].decoded);
+        free(cases[i].payload);
+    }
+    return correct? EXIT_SUCCESS : EXIT_FAILURE;
+}
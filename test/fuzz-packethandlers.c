@@ -0,0 +1,388 @@
+/**
+ * core/test/fuzz-packethandlers.c
+ *
+ * A libFuzzer harness for every packet decoder. The first byte of an input is
+ * the packet type and the rest is its payload, which is run through the views,
+ * the ConfigStore and known-key paths, a PacketBatch, and the matching unpack
+ * and destroy pair. Each packet that decodes is packed again, and fixed-layout packets have
+ * to decode back to the same fields.
+ *
+ * Decode throughput (inputs and payload bytes per second) is tracked as well as
+ * crashes, and printed every few seconds and at exit, so a slowdown shows up
+ * in the fuzzer's log as well as in bench-packethandlers.
+ *
+ * Built with clang (see the fuzz-packethandlers recipe), libFuzzer supplies
+ * main. Built with FUZZ_STANDALONE, main mutates a set of seed packets instead,
+ * so the harness also runs with plain gcc and any sanitizer.
+ *
+ * @author agent <agent@local>
+ */
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "../network/lowlevel.h"
+#include "../network/packet.h"
+#include "../network/packethandlers.h"
+#include "../network/messagehandler.h"
+#include "../network/packetview.h"
+#include "../network/packetbatch.h"
+#include "../network/configstore.h"
+#include "../network/configknown.h"
+#include "../network/netutils.h"
+#include "../network/packetschema.h"
+#include "../collections/arraylist.h"
+
+#define FUZZ_REPORT_NS (5000000000ULL) // how often throughput is printed
+#define FUZZ_MAX_INPUT (1 << 16) // longest input tried (so it always packs into the frame)
+#define FUZZ_FRAME_LENGTH (1 << 18)
+
+// Defines the running totals
+typedef struct FuzzStats {
+    uint64_t start;
+    uint64_t last_report;
+    uint64_t inputs;
+    uint64_t decoded; // inputs that unpacked into a packet
+    uint64_t bytes;
+    uint64_t decode_ns; // time spent in the decoders
+} FuzzStats_t;
+
+static FuzzStats_t stats = { 0 };
+static uint8_t frame[FUZZ_FRAME_LENGTH];
+
+/**
+ * Gets the current monotonic time
+ *
+ * @returns the time in nanoseconds
+ */
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * Prints the throughput so far
+ */
+static void _fuzz_report() {
+    uint64_t now = now_ns();
+    double seconds = (now - stats.start) / 1e9;
+    double decoding = stats.decode_ns / 1e9;
+    fprintf(stderr, "fuzz-packethandlers: %lu inputs (%lu decoded) in %.1f s, %.0f inputs/s, "
+        "decoders at %.1f MB/s, %.0f ns/input\n", (unsigned long) stats.inputs, (unsigned long) stats.decoded,
+        seconds, (seconds > 0)? stats.inputs / seconds : 0, (decoding > 0)? stats.bytes / decoding / 1e6 : 0,
+        (stats.inputs > 0)? (double) stats.decode_ns / stats.inputs : 0);
+    stats.last_report = now;
+}
+
+/**
+ * Makes a raw packet from an input, sized exactly so any over-read is caught
+ *
+ * @param type the packet type
+ * @param payload the payload
+ * @param length the length of the payload
+ * @returns the packet
+ */
+static IntermediateTLV_t* _fuzz_raw(uint8_t type, const uint8_t* payload, uint32_t length) {
+    IntermediateTLV_t* raw = malloc(sizeof(IntermediateTLV_t));
+    raw->type = type;
+    raw->length = length;
+    raw->timestamp = 0;
+    raw->data = malloc(length);
+    if (length > 0) {
+        memcpy(raw->data, payload, length);
+    }
+    return raw;
+}
+
+/**
+ * Decodes an input through the paths that only borrow the packet (views and
+ * batches)
+ */
+static void _fuzz_views(uint8_t type, const uint8_t* payload, uint32_t length) {
+    PacketView_t view;
+    IntermediateTLV_t* raw = _fuzz_raw(type, payload, length);
+    static PacketBatch_t batch;
+    if (batch.capacity == 0) {
+        pbatch_init(&batch, 1);
+    }
+    pbatch_reset(&batch);
+    pbatch_decode(&batch, &raw, 1, NULL);
+
+    if (!pview_init(&view, raw, true)) {
+        llnet_packet_free(raw);
+        return;
+    }
+
+    PViewStringIter_t strings;
+    size_t string_length;
+    if (pview_strings_begin(&view, &strings)) {
+        while (pview_strings_next(&strings, &string_length) != NULL) { }
+    }
+
+    if (type == pt_CONFIG_RESPONSE || type == pt_CONFIG_UPDATE) {
+        ConfigStore_t* store = config_store_from_view(&view);
+        if (store != NULL) {
+            for (uint32_t entry = 0; entry < store->count; entry += 1) {
+                config_store_find(store, config_store_key(store, entry));
+            }
+            config_store_free(store);
+        }
+
+        ConfigKnown_t known;
+        ConfigStore_t* others;
+        config_known_init(&known);
+        config_known_apply(&known, &view, &others);
+        config_store_free(others);
+        config_known_clear(&known);
+    }
+    pview_release(&view);
+}
+
+/**
+ * Unpacks an input with the codec for its type
+ *
+ * @returns the packet, or NULL if it didn't decode
+ */
+static PacketTLV_t* _fuzz_unpack(uint8_t type, const uint8_t* payload, uint32_t length) {
+    IntermediateTLV_t* raw = _fuzz_raw(type, payload, length);
+    switch (type) {
+        case pt_INIT:            return unpackInit(raw);
+        case pt_STATE_REQUEST:   return unpackStateRequest(raw);
+        case pt_STATE_RESPONSE:  return unpackStateResponse(raw);
+        case pt_STATE_UPDATE:    return unpackStateUpdate(raw);
+        case pt_CONFIG_REQUEST:  return unpackConfigRequest(raw);
+        case pt_CONFIG_RESPONSE: return unpackConfigResponse(raw);
+        case pt_CONFIG_UPDATE:   return unpackConfigUpdate(raw);
+        case pt_USER_DATA:       return unpackUserData(raw);
+        case pt_UPDATE_STATUS:   return unpackUpdateStatus(raw);
+        case pt_DEBUG:           return unpackDebug(raw);
+    }
+    llnet_packet_free(raw);
+    return NULL;
+}
+
+/**
+ * Packs a decoded packet again
+ *
+ * @param packet the packet
+ * @param arbitrary the length of its arbitrary data (if it has any)
+ * @returns the frame length, or 0 if it couldn't be packed
+ */
+static uint32_t _fuzz_pack(const PacketTLV_t* packet, uint32_t arbitrary) {
+    const void* data = packet->data;
+    switch (packet->type) {
+        case pt_INIT:            return packInit(data, frame, FUZZ_FRAME_LENGTH);
+        case pt_STATE_REQUEST:   return packStateRequest(frame, FUZZ_FRAME_LENGTH);
+        case pt_STATE_RESPONSE:  return packStateResponse(data, arbitrary, frame, FUZZ_FRAME_LENGTH);
+        case pt_STATE_UPDATE:    return packStateUpdate(data, arbitrary, frame, FUZZ_FRAME_LENGTH);
+        case pt_CONFIG_REQUEST:  return packConfigRequest(data, frame, FUZZ_FRAME_LENGTH);
+        case pt_CONFIG_RESPONSE: return packConfigResponse(data, frame, FUZZ_FRAME_LENGTH);
+        case pt_CONFIG_UPDATE:   return packConfigUpdate(data, frame, FUZZ_FRAME_LENGTH);
+        case pt_USER_DATA:       return packUserData(data, frame, FUZZ_FRAME_LENGTH);
+        case pt_UPDATE_STATUS:   return packUpdateStatus(data, frame, FUZZ_FRAME_LENGTH);
+        case pt_DEBUG:           return packDebug(data, arbitrary, frame, FUZZ_FRAME_LENGTH);
+    }
+    return 0;
+}
+
+/**
+ * Checks a fixed-layout packet survives being packed and unpacked again
+ *
+ * @param packet the packet
+ * @param frame_length the length of the frame it was packed into
+ */
+static void _fuzz_round_trip(const PacketTLV_t* packet, uint32_t frame_length) {
+    if (packet->type != pt_INIT && packet->type != pt_USER_DATA && packet->type != pt_UPDATE_STATUS) {
+        return;
+    }
+    PacketTLV_t* again = _fuzz_unpack(packet->type, frame + LLNET_HEADER_LENGTH, frame_length - LLNET_HEADER_LENGTH);
+    bool same = (again != NULL);
+    if (same && packet->type == pt_INIT) {
+        same = ((PTLVData_INIT_t*) again->data)->robot_uuid == ((PTLVData_INIT_t*) packet->data)->robot_uuid;
+    } else if (same && packet->type == pt_USER_DATA) {
+        const PTLVData_USER_DATA_t* a = (const PTLVData_USER_DATA_t*) again->data;
+        const PTLVData_USER_DATA_t* b = (const PTLVData_USER_DATA_t*) packet->data;
+        same = a->left_stick_x == b->left_stick_x && a->left_stick_y == b->left_stick_y &&
+            a->right_stick_x == b->right_stick_x && a->right_stick_y == b->right_stick_y &&
+            a->button_a == b->button_a && a->button_b == b->button_b && a->controller_uuid == b->controller_uuid;
+    } else if (same) {
+        const PTLVData_UPDATE_STATUS_t* a = (const PTLVData_UPDATE_STATUS_t*) again->data;
+        const PTLVData_UPDATE_STATUS_t* b = (const PTLVData_UPDATE_STATUS_t*) packet->data;
+        same = a->code == b->code && a->reserved == b->reserved;
+    }
+    if (!same) {
+        fprintf(stderr, "fuzz-packethandlers: type 0x%02x didn't survive a round trip\n", packet->type);
+        abort();
+    }
+    mh_destroy_packet(again);
+}
+
+/**
+ * Runs one input (the libFuzzer entry point)
+ *
+ * @param data the input: a packet type, then its payload
+ * @param size the size of the input
+ * @returns 0
+ */
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (stats.start == 0) {
+        stats.start = now_ns();
+        stats.last_report = stats.start;
+        atexit(_fuzz_report);
+    }
+    if (size < 1 || size > FUZZ_MAX_INPUT) {
+        return 0;
+    }
+    uint8_t type = data[0];
+    const uint8_t* payload = data + 1;
+    uint32_t length = (uint32_t) (size - 1);
+
+    uint64_t start = now_ns();
+    _fuzz_views(type, payload, length);
+    PacketTLV_t* packet = _fuzz_unpack(type, payload, length);
+    uint64_t end = now_ns();
+    stats.decode_ns += end - start;
+    stats.inputs += 1;
+    stats.bytes += length;
+
+    if (packet != NULL) {
+        stats.decoded += 1;
+        uint32_t fixed_length;
+        PSchemaTrailing_t trailing;
+        pschema_layout(type, &fixed_length, &trailing);
+        uint32_t arbitrary = (trailing == pst_ARBITRARY)? length - fixed_length : 0;
+
+        // Anything that decoded has to pack again
+        uint32_t frame_length = _fuzz_pack(packet, arbitrary);
+        if (frame_length == 0) {
+            fprintf(stderr, "fuzz-packethandlers: type 0x%02x decoded but didn't pack\n", type);
+            abort();
+        }
+        _fuzz_round_trip(packet, frame_length);
+        mh_destroy_packet(packet);
+    }
+
+    if (end - stats.last_report > FUZZ_REPORT_NS) {
+        _fuzz_report();
+    }
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+
+#define FUZZ_RUNS (200000)
+#define FUZZ_SEED_LENGTH (4096)
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+/**
+ * Gets a pseudo-random number (xorshift64)
+ */
+static uint32_t _fuzz_rand() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t) (rng_state >> 32);
+}
+
+/**
+ * Adds a seed input, made by packing a packet
+ */
+static uint32_t _fuzz_seed(uint8_t* seed, uint32_t frame_length) {
+    seed[0] = frame[0];
+    memcpy(seed + 1, frame + LLNET_HEADER_LENGTH, frame_length - LLNET_HEADER_LENGTH);
+    return frame_length - LLNET_HEADER_LENGTH + 1;
+}
+
+/**
+ * Entry point to the program (only without libFuzzer)
+ *
+ * @param argc the number of arguments
+ * @param argv the arguments: optionally, the number of runs
+ */
+int main(int argc, char* argv[]) {
+    static uint8_t seeds[8][FUZZ_SEED_LENGTH];
+    uint32_t seed_lengths[8];
+    uint32_t seed_count = 0;
+    uint8_t arbitrary[64] = { 0 };
+    uint32_t runs = (argc > 1)? (uint32_t) strtoul(argv[1], NULL, 10) : FUZZ_RUNS;
+
+    PTLVData_USER_DATA_t user = { 1, 2, 3, 4, true, false, 0x1234 };
+    seed_lengths[seed_count] = _fuzz_seed(seeds[seed_count], packUserData(&user, frame, FUZZ_FRAME_LENGTH));
+    seed_count += 1;
+    PTLVData_DEBUG_t debug = { cs_AHEAD, 0xbfd773d, 0xaa55aa55, rs_ENABLED, 0, 2, arbitrary };
+    seed_lengths[seed_count] = _fuzz_seed(seeds[seed_count], packDebug(&debug, 16, frame, FUZZ_FRAME_LENGTH));
+    seed_count += 1;
+    PTLVData_STATE_RESPONSE_t response = { rs_DISABLED, 0, arbitrary };
+    seed_lengths[seed_count] = _fuzz_seed(seeds[seed_count], packStateResponse(&response, 8, frame,
+        FUZZ_FRAME_LENGTH));
+    seed_count += 1;
+
+    // CONFIG packets, with a known key, an unknown one and each type of value
+    ArrayList_t* pairs = arraylist_init();
+    ArrayList_t* keys = arraylist_init();
+    KVPair_Value_u value;
+    value.Boolean = 1;
+    arraylist_add(pairs, KVPairTLV_create("fms.disconnect_detect", kv_Boolean, 5, value));
+    value.Integer = 3;
+    arraylist_add(pairs, KVPairTLV_create("robot.team", kv_Integer, 8, value));
+    value.Double = 0.5;
+    arraylist_add(pairs, KVPairTLV_create("drive.max_speed", kv_Double, 12, value));
+    value.Float = 1.5f;
+    arraylist_add(pairs, KVPairTLV_create("drive.ramp", kv_Float, 8, value));
+    value.CString = "fuzzbot";
+    arraylist_add(pairs, KVPairTLV_create("robot.name", kv_CString, 12, value));
+    for (uint32_t i = 0; i < arraylist_size(pairs); i += 1) {
+        arraylist_add(keys, ((KVPairTLV_t*) arraylist_get(pairs, i))->key);
+    }
+    PTLVData_CONFIG_RESPONSE_t config_response = { (List_t*) pairs };
+    seed_lengths[seed_count] = _fuzz_seed(seeds[seed_count], packConfigResponse(&config_response, frame,
+        FUZZ_FRAME_LENGTH));
+    seed_count += 1;
+    PTLVData_CONFIG_UPDATE_t config_update = { (List_t*) pairs };
+    seed_lengths[seed_count] = _fuzz_seed(seeds[seed_count], packConfigUpdate(&config_update, frame,
+        FUZZ_FRAME_LENGTH));
+    seed_count += 1;
+    PTLVData_CONFIG_REQUEST_t config_request = { (List_t*) keys };
+    seed_lengths[seed_count] = _fuzz_seed(seeds[seed_count], packConfigRequest(&config_request, frame,
+        FUZZ_FRAME_LENGTH));
+    seed_count += 1;
+    for (uint32_t i = 0; i < arraylist_size(pairs); i += 1) {
+        KVPairTLV_destroy(arraylist_get(pairs, i));
+    }
+    arraylist_free(pairs);
+    arraylist_free(keys);
+
+    // Flip, overwrite, truncate and extend the seeds
+    uint8_t input[FUZZ_SEED_LENGTH];
+    for (uint32_t run = 0; run < runs; run += 1) {
+        uint32_t seed = _fuzz_rand() % seed_count;
+        uint32_t length = seed_lengths[seed];
+        memcpy(input, seeds[seed], length);
+        uint32_t mutations = 1 + (_fuzz_rand() % 4);
+        for (uint32_t m = 0; m < mutations; m += 1) {
+            uint32_t at = _fuzz_rand() % length;
+            switch (_fuzz_rand() % 5) {
+                case 0: input[at] ^= (uint8_t) (1 << (_fuzz_rand() % 8)); break;
+                case 1: input[at] = (uint8_t) _fuzz_rand(); break;
+                case 2: input[at] = (_fuzz_rand() & 1)? 0x00 : ';'; break;
+                case 3: length = 1 + (_fuzz_rand() % length); break;
+                case 4:
+                    if (length < FUZZ_SEED_LENGTH) {
+                        input[length] = (uint8_t) _fuzz_rand();
+                        length += 1;
+                    }
+                    break;
+            }
+        }
+        LLVMFuzzerTestOneInput(input, length);
+    }
+    return EXIT_SUCCESS;
+}
+
+#endif
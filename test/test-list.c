@@ -622,6 +622,40 @@ int t08_stack_test() {
  *
  * Should run all the given tests
  */
+/*
+ * Test an array list built in caller-owned memory: it fills up without growing, and freeing it leaves the memory
+ */
+int t09_arraylist_fixed() {
+    ArrayList_t storage;
+    void* elements[4];
+    List_t* list = (List_t*) arraylist_init_fixed(&storage, elements, 4);
+    for (uintptr_t i = 1; i <= 4; i += 1) {
+        if (list_add(list, (void*) i) != LIST_OKAY) {
+            print_dbgdata(list);
+            fprintf(stderr, "error: could not add %lu to a fixed list\n", i);
+            return TEST_FAILURE;
+        }
+    }
+
+    // the list is full, so this has to fail rather than reallocate
+    if (list_add(list, (void*) 5) != LIST_MEMORY || list_size(list) != 4 || storage.array != elements) {
+        print_dbgdata(list);
+        fprintf(stderr, "error: fixed list grew past its memory\n");
+        return TEST_FAILURE;
+    }
+
+    // removing shouldn't try to shrink the memory either
+    uintptr_t e = (uintptr_t) list_remove(list, 0);
+    if (e != 1 || list->err != LIST_OKAY || storage.array != elements || (uintptr_t) list_get(list, 0) != 2) {
+        print_dbgdata(list);
+        fprintf(stderr, "error: incorrect value removed from a fixed list %lu\n", e);
+        return TEST_FAILURE;
+    }
+
+    list_free(list);
+    return TEST_SUCCESS;
+}
+
 int main() {
     // Run tests on both types of list
     int error = 0;
@@ -642,6 +676,7 @@ int main() {
         // Run custom tests, continuing to accumulate the error value
         if (type == LIST_ARRAY) {
             error += t04_arraylist_add_pos_0(); // only run once, since it's an array list only test
+            error += t09_arraylist_fixed();
         } else if (type == LIST_LINKED) {
             for (int j = 1; j < 10; j += 1) {
                 error += t06_linkedlist_frontback_tests((uint32_t) j);
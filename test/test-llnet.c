@@ -10,10 +10,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <poll.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/wait.h>
 
 #include "test-utils.h"
 #include "../utils/bounds.h"
 #include "../network/lowlevel.h"
+#include "../network/compress.h"
+#include "../network/fec.h"
+#include "../network/reliable.h"
+#include "../network/sockfilter.h"
+#include "../network/packet.h"
+#include "../network/client.h"
+#include "../network/estop.h"
+#include "../network/statshm.h"
 #include "../collections/arraylist.h"
 
 // Debug stuff
@@ -22,12 +34,32 @@
 #define DEBUG true
 
 #define T02_PCKT_LENGTH (8)
+#define T03_PCKT_LENGTH (2048)
+#define T04_PCKT_COUNT (10)
+#define T04_BURST (2)
+#define T05_SHARDS (4)
+#define T05_CLIENTS (6)
+#define T07_PCKT_COUNT (8)
+#define T08_RECONNECTS (20)
+#define T09_FRAMES (4)
+#define T09_PCKT_COUNT (8)
+#define T10_PCKT_COUNT (6)
+#define T10_WINDOW_US (5000)
+#define T11_PCKT_COUNT (8)
+#define T12_PCKT_COUNT (4)
+#define T14_ROBOTS (3)
+#define T15_BUFFER_SIZE (65536)
+#define T15_FLOOD_COUNT (512)
+#define T16_TOGGLES (200)
 #define NUMBER_OF_POLLS (16)
 #define POLL_SLEEP_TIME (100)
 
 static ArrayList_t* t02_connections = NULL;
 static ArrayList_t* t02_svr_pckts = NULL;
 static ArrayList_t* t02_clnt_pckts = NULL;
+static uint32_t t08_disconnects = 0;
+static LLNetEstop_t* t14_estop = NULL;
+static uint32_t t14_estopped = 0;
 
 /**
  * Check if two packets are equal, including all fields
@@ -177,13 +209,38 @@ static void t02_clnt_on_packet(uint32_t id, IntermediateTLV_t* pckt) {
 }
 
 /**
- * Attempt to create a mock network and send some data around
+ * Sets up the lists the t02 handlers fill, shared by every test that makes a connection
  */
-int t02_send_data() {
-    // Initialize the basics
+static void _fixture_setup() {
     t02_connections = arraylist_init();
     t02_svr_pckts = arraylist_init();
     t02_clnt_pckts = arraylist_init();
+}
+
+/**
+ * Frees the lists the t02 handlers fill, along with any packets left in them
+ */
+static void _fixture_teardown() {
+    while (arraylist_size(t02_svr_pckts) > 0) {
+        llnet_packet_free(arraylist_remove(t02_svr_pckts, 0));
+    }
+    while (arraylist_size(t02_clnt_pckts) > 0) {
+        llnet_packet_free(arraylist_remove(t02_clnt_pckts, 0));
+    }
+    arraylist_free(t02_connections);
+    t02_connections = NULL;
+    arraylist_free(t02_svr_pckts);
+    t02_svr_pckts = NULL;
+    arraylist_free(t02_clnt_pckts);
+    t02_clnt_pckts = NULL;
+}
+
+/**
+ * Attempt to create a mock network and send some data around
+ */
+int t02_send_data() {
+    // Initialize the basics
+    _fixture_setup();
     AccepterConnection_t* accepter = llnet_connection_listen(llnet_connection_init(),
         t02_on_connect, t02_svr_on_packet);
 
@@ -205,9 +262,10 @@ int t02_send_data() {
     }
 
     // Test to see if the IDs have been assigned right
-    WorkerConnection_t* w1 = llnet_connection_get(1);
-    WorkerConnection_t* w2 = llnet_connection_get(2);
-    if (w1 == NULL || w2 == NULL || !(w1 != worker1 || w2 != worker1)) {
+    WorkerConnection_t* wa = arraylist_get(t02_connections, 0);
+    WorkerConnection_t* w1 = llnet_connection_get(worker1->connection_id);
+    WorkerConnection_t* w2 = llnet_connection_get(wa->connection_id);
+    if (w1 != worker1 || w2 != wa || worker1->connection_id == wa->connection_id) {
         dbg_error("connection IDs are incorrect (w1=%p, w2=%p)\n", w1, w2);
         llnet_connection_free((NetConnection_t*) worker1);
         llnet_connection_free((NetConnection_t*) accepter);
@@ -250,6 +308,30 @@ int t02_send_data() {
     llnet_packet_free(pckt_recvd);
     pckt_recvd = NULL;
 
+    // Send a frame that was encoded in place, header space first
+    uint8_t frame[LLNET_HEADER_LENGTH + T02_PCKT_LENGTH] = {0};
+    uint32_t word = htonl((0xac << 24) | T02_PCKT_LENGTH);
+    memcpy(frame, &word, sizeof(uint32_t));
+    memset(frame + LLNET_HEADER_LENGTH, 0x5a, T02_PCKT_LENGTH);
+    uint32_t rc = llnet_connection_send_packed(worker1, np_TCP, frame, sizeof(frame));
+    if (rc != 0 || !arraylist_poll(t02_svr_pckts)) {
+        dbg_error("packed frame not received (rc = %u)\n", rc);
+        llnet_connection_free((NetConnection_t*) worker1);
+        llnet_connection_free((NetConnection_t*) accepter);
+        return TEST_FAILURE;
+    }
+    pckt_recvd = arraylist_remove(t02_svr_pckts, 0);
+    bool packed_ok = pckt_recvd->type == 0xac && pckt_recvd->length == T02_PCKT_LENGTH &&
+        memcmp(pckt_recvd->data, frame + LLNET_HEADER_LENGTH, T02_PCKT_LENGTH) == 0;
+    llnet_packet_free(pckt_recvd);
+    pckt_recvd = NULL;
+    if (!packed_ok) {
+        dbg_error("packed frame received incorrectly\n");
+        llnet_connection_free((NetConnection_t*) worker1);
+        llnet_connection_free((NetConnection_t*) accepter);
+        return TEST_FAILURE;
+    }
+
     // Build and send a reply packet
     IntermediateTLV_t* pckt2 = malloc(sizeof(IntermediateTLV_t));
     pckt2->type = 0xab; // pick a random type, shouldn't matter
@@ -359,7 +441,7 @@ int t02_send_data() {
     // Give back resources
     llnet_packet_free(pckt4);
     pckt4 = NULL;
-    arraylist_remove(t02_clnt_pckts, 0);
+    arraylist_remove(t02_svr_pckts, 0);
     llnet_packet_free(pckt_recvd);
     pckt_recvd = NULL;
 
@@ -369,17 +451,1356 @@ int t02_send_data() {
     llnet_connection_free((NetConnection_t*) worker1);
     llnet_connection_free((NetConnection_t*) accepter);
 
-    // Clean up buffers/lists
-    arraylist_free(t02_connections);
-    t02_connections = NULL;
-    arraylist_free(t02_svr_pckts);
-    t02_svr_pckts = NULL;
-    arraylist_free(t02_clnt_pckts);
-    t02_clnt_pckts = NULL;
+    _fixture_teardown();
 
     return TEST_SUCCESS;
 }
 
+/**
+ * Test the compression codec and compressed packets over the network
+ */
+int t03_compression() {
+    // Build some compressible data (looks like a config key list)
+    uint8_t* data = malloc(T03_PCKT_LENGTH);
+    for (size_t i = 0; i < T03_PCKT_LENGTH; i += 1) {
+        data[i] = "robot_config_key_"[i % 17] + ((i / 64) % 4);
+    }
+
+    // Round trip through the codec
+    uint32_t bound = llnet_compress_bound(T03_PCKT_LENGTH);
+    uint8_t* cbuf = malloc(bound);
+    uint8_t* dbuf = malloc(T03_PCKT_LENGTH);
+    int32_t clen = llnet_compress(data, T03_PCKT_LENGTH, cbuf, bound);
+    int32_t dlen = llnet_decompress(cbuf, clen, dbuf, T03_PCKT_LENGTH);
+    bool codec_ok = (clen > 0) && (clen < T03_PCKT_LENGTH) && (dlen == T03_PCKT_LENGTH) &&
+        (memcmp(data, dbuf, T03_PCKT_LENGTH) == 0);
+
+    // Truncated blocks should be rejected, not overrun
+    codec_ok = codec_ok && (llnet_decompress(cbuf, clen, dbuf, T03_PCKT_LENGTH / 2) < 0);
+    free(cbuf);
+    free(dbuf);
+    if (!codec_ok) {
+        dbg_error("codec round trip failed (clen=%d, dlen=%d)\n", clen, dlen);
+        free(data);
+        return TEST_FAILURE;
+    }
+
+    // Now try it over the network, both sides need compression enabled
+    _fixture_setup();
+    NetConnection_t* c = llnet_connection_init();
+    llnet_connection_set_compression(c, true, LLNET_COMPRESS_DEFAULT_THRESHOLD);
+    AccepterConnection_t* accepter = llnet_connection_listen(c, t02_on_connect, t02_svr_on_packet);
+
+    msleep(5); // give some time for the accepter to start up
+
+    c = llnet_connection_init();
+    llnet_connection_set_compression(c, true, LLNET_COMPRESS_DEFAULT_THRESHOLD);
+    WorkerConnection_t* worker1 = llnet_connection_connect(c, "localhost", t02_clnt_on_packet);
+
+    // Wait for the capabilities to be exchanged
+    for (size_t i = 0; i < NUMBER_OF_POLLS && worker1->peer_caps == 0; i += 1) {
+        usleep(POLL_SLEEP_TIME);
+    }
+    if (!arraylist_poll(t02_connections) || !(worker1->peer_caps & llcap_COMPRESSION)) {
+        dbg_error("compression was not negotiated (peer_caps=0x%x)\n", worker1->peer_caps);
+        llnet_connection_free((NetConnection_t*) worker1);
+        llnet_connection_free((NetConnection_t*) accepter);
+        free(data);
+        return TEST_FAILURE;
+    }
+
+    // Send the packet
+    IntermediateTLV_t* pckt = malloc(sizeof(IntermediateTLV_t));
+    pckt->type = 0xef; // pick a random type, shouldn't matter
+    pckt->length = T03_PCKT_LENGTH;
+    pckt->data = data;
+    llnet_connection_send(worker1, np_TCP, pckt);
+
+    // Make sure it comes out the other side the same
+    bool received = arraylist_poll(t02_svr_pckts);
+    int rc = TEST_SUCCESS;
+    if (!received) {
+        dbg_error("no packet received (length = %u)\n", arraylist_size(t02_svr_pckts));
+        rc = TEST_FAILURE;
+    } else {
+        IntermediateTLV_t* pckt_recvd = arraylist_remove(t02_svr_pckts, 0);
+        if (!packet_equals(pckt, pckt_recvd)) {
+            rc = TEST_FAILURE;
+        }
+        llnet_packet_free(pckt_recvd);
+    }
+
+    // Payloads that would run into the flag bits of the length field are refused, not sent
+    uint8_t* big_frame = calloc(1, LLNET_HEADER_LENGTH + LLNET_LENGTH_MASK + 1);
+    IntermediateTLV_t big;
+    big.type = 0xef;
+    big.length = LLNET_LENGTH_MASK + 1;
+    big.data = big_frame + LLNET_HEADER_LENGTH;
+    uint32_t send_rc = llnet_connection_send(worker1, np_TCP, &big);
+    uint32_t packed_rc = llnet_connection_send_packed(worker1, np_TCP, big_frame,
+        LLNET_HEADER_LENGTH + LLNET_LENGTH_MASK + 1);
+    uint32_t async_rc = 0;
+    LLNetSendHandle_t* handle = llnet_connection_send_async(worker1, np_TCP, &big, NULL);
+    bool async_done = llnet_send_wait(handle, -1, &async_rc);
+    llnet_send_handle_free(handle);
+    free(big_frame);
+    msleep(5); // anything that did go out would have arrived by now
+    if (send_rc == 0 || packed_rc == 0 || !async_done || async_rc == 0 || arraylist_size(t02_svr_pckts) != 0) {
+        dbg_error("oversized payload was not refused (send=%u, packed=%u, async=%u, received=%u)\n",
+            send_rc, packed_rc, async_rc, arraylist_size(t02_svr_pckts));
+        rc = TEST_FAILURE;
+    }
+
+    // Clean up
+    llnet_packet_free(pckt);
+    llnet_connection_free((NetConnection_t*) worker1);
+    llnet_connection_free((NetConnection_t*) accepter);
+    _fixture_teardown();
+
+    return rc;
+}
+
+/**
+ * Test that the rate limiter drops packets over the limit and counts them
+ */
+int t04_ratelimit() {
+    _fixture_setup();
+
+    // Limit type 0x30 to a burst of a couple packets, and a slow refill
+    NetConnection_t* c = llnet_connection_init();
+    llnet_connection_set_ratelimit(c, 0x30, 1, T04_BURST);
+    AccepterConnection_t* accepter = llnet_connection_listen(c, t02_on_connect, t02_svr_on_packet);
+
+    msleep(5); // give some time for the accepter to start up
+
+    WorkerConnection_t* worker1 = llnet_connection_connect(llnet_connection_init(),
+        "localhost", t02_clnt_on_packet);
+    if (!arraylist_poll(t02_connections)) {
+        dbg_error("no client connected (length = %u)\n", arraylist_size(t02_connections));
+        llnet_connection_free((NetConnection_t*) worker1);
+        llnet_connection_free((NetConnection_t*) accepter);
+        return TEST_FAILURE;
+    }
+    WorkerConnection_t* worker_a = arraylist_get(t02_connections, 0);
+
+    // Flood the server with limited packets, then send one unlimited packet
+    uint64_t data = 0x0123456789abcdef;
+    IntermediateTLV_t pckt;
+    pckt.type = 0x30;
+    pckt.length = sizeof(uint64_t);
+    pckt.data = (uint8_t*) &data;
+    for (size_t i = 0; i < T04_PCKT_COUNT; i += 1) {
+        llnet_connection_send(worker1, np_TCP, &pckt);
+    }
+    pckt.type = 0x31;
+    llnet_connection_send(worker1, np_TCP, &pckt);
+
+    // Wait for everything to come in
+    LLNetStats_t stats;
+    for (size_t i = 0; i < NUMBER_OF_POLLS; i += 1) {
+        llnet_connection_get_stats(worker_a, &stats);
+        if (stats.rx_packets + stats.rx_dropped_ratelimit >= T04_PCKT_COUNT + 1) {
+            break;
+        }
+        usleep(POLL_SLEEP_TIME);
+    }
+
+    // Check the counters
+    int rc = TEST_SUCCESS;
+    uint64_t drops = llnet_connection_get_ratelimit_drops(worker_a, 0x30);
+    if (stats.rx_packets != T04_BURST + 1 || stats.rx_dropped_ratelimit != T04_PCKT_COUNT - T04_BURST ||
+            drops != T04_PCKT_COUNT - T04_BURST) {
+        dbg_error("rate limit mismatch (rx=%lu, dropped=%lu, type drops=%lu)\n", stats.rx_packets,
+            stats.rx_dropped_ratelimit, drops);
+        rc = TEST_FAILURE;
+    }
+
+    // Clean up
+    llnet_connection_free((NetConnection_t*) worker1);
+    llnet_connection_free((NetConnection_t*) accepter);
+    _fixture_teardown();
+
+    return rc;
+}
+
+/**
+ * Test that a sharded accepter takes connections on every shard and that the
+ * connection IDs can still be resolved
+ */
+int t05_sharded_listen() {
+    _fixture_setup();
+    AccepterConnection_t* accepter = llnet_connection_listen_sharded(llnet_connection_init(),
+        T05_SHARDS, t02_on_connect, t02_svr_on_packet);
+
+    msleep(5); // give some time for the accepters to start up
+
+    // Connect a handful of clients
+    WorkerConnection_t* clients[T05_CLIENTS];
+    for (size_t i = 0; i < T05_CLIENTS; i += 1) {
+        clients[i] = llnet_connection_connect(llnet_connection_init(), "localhost", t02_clnt_on_packet);
+    }
+
+    // Wait for all of them to be accepted
+    for (size_t i = 0; i < NUMBER_OF_POLLS * 10 && arraylist_size(t02_connections) < T05_CLIENTS; i += 1) {
+        usleep(POLL_SLEEP_TIME);
+    }
+
+    // Every accepted connection should be registered under its own ID
+    int rc = TEST_SUCCESS;
+    if (arraylist_size(t02_connections) != T05_CLIENTS) {
+        dbg_error("not all clients connected (length = %u)\n", arraylist_size(t02_connections));
+        rc = TEST_FAILURE;
+    }
+    for (size_t i = 0; i < arraylist_size(t02_connections); i += 1) {
+        WorkerConnection_t* w = arraylist_get(t02_connections, i);
+        if (llnet_connection_get(w->connection_id) != w) {
+            dbg_error("connection %u could not be resolved\n", w->connection_id);
+            rc = TEST_FAILURE;
+        }
+    }
+
+    // Clean up
+    for (size_t i = 0; i < T05_CLIENTS; i += 1) {
+        llnet_connection_free((NetConnection_t*) clients[i]);
+    }
+    llnet_connection_free((NetConnection_t*) accepter);
+    _fixture_teardown();
+
+    return rc;
+}
+
+/**
+ * Test that connections in separate contexts get separate IDs and registries
+ */
+int t06_contexts() {
+    _fixture_setup();
+
+    // Put the "FMS" and the "robot" in their own contexts
+    LLNetContext_t* svr_ctx = llnet_context_init();
+    LLNetContext_t* clnt_ctx = llnet_context_init();
+    AccepterConnection_t* accepter = llnet_connection_listen(llnet_connection_init_context(svr_ctx),
+        t02_on_connect, t02_svr_on_packet);
+
+    msleep(5); // give some time for the accepter to start up
+
+    WorkerConnection_t* worker1 = llnet_connection_connect(llnet_connection_init_context(clnt_ctx),
+        "localhost", t02_clnt_on_packet);
+
+    // Both contexts should hand out the same first ID, and not see each other
+    int rc = TEST_SUCCESS;
+    if (!arraylist_poll(t02_connections)) {
+        dbg_error("no client connected (length = %u)\n", arraylist_size(t02_connections));
+        rc = TEST_FAILURE;
+    } else {
+        WorkerConnection_t* worker_a = arraylist_get(t02_connections, 0);
+        uint32_t id = worker1->connection_id;
+        if (worker_a->connection_id != id || llnet_context_get(clnt_ctx, id) != worker1 ||
+                llnet_context_get(svr_ctx, id) != worker_a || llnet_context_get(svr_ctx, id + 1) != NULL) {
+            dbg_error("context registries are not independent (clnt=%u, svr=%u)\n",
+                worker1->connection_id, worker_a->connection_id);
+            rc = TEST_FAILURE;
+        }
+    }
+
+    // Clean up
+    llnet_connection_free((NetConnection_t*) worker1);
+    llnet_connection_free((NetConnection_t*) accepter);
+    llnet_context_free(clnt_ctx);
+    llnet_context_free(svr_ctx);
+    _fixture_teardown();
+
+    return rc;
+}
+
+/**
+ * Test asynchronous sends, both with a blocking wait and a completion queue
+ */
+int t07_send_async() {
+    _fixture_setup();
+    AccepterConnection_t* accepter = llnet_connection_listen(llnet_connection_init(),
+        t02_on_connect, t02_svr_on_packet);
+
+    msleep(5); // give some time for the accepter to start up
+
+    WorkerConnection_t* worker1 = llnet_connection_connect(llnet_connection_init(),
+        "localhost", t02_clnt_on_packet);
+    if (!arraylist_poll(t02_connections)) {
+        dbg_error("no client connected (length = %u)\n", arraylist_size(t02_connections));
+        llnet_connection_free((NetConnection_t*) worker1);
+        llnet_connection_free((NetConnection_t*) accepter);
+        return TEST_FAILURE;
+    }
+
+    int rc = TEST_SUCCESS;
+    uint64_t data = 0x1122334455667788;
+    IntermediateTLV_t pckts[T07_PCKT_COUNT];
+    for (size_t i = 0; i < T07_PCKT_COUNT; i += 1) {
+        pckts[i].type = 0xab;
+        pckts[i].length = sizeof(uint64_t);
+        pckts[i].data = (uint8_t*) &data;
+    }
+
+    // Blocking wait on a single send
+    uint32_t send_rc = 1;
+    LLNetSendHandle_t* handle = llnet_connection_send_async(worker1, np_TCP, &pckts[0], NULL);
+    if (!llnet_send_wait(handle, 1000, &send_rc) || send_rc != 0) {
+        dbg_error("async send did not finish (rc=%u)\n", send_rc);
+        rc = TEST_FAILURE;
+    }
+    llnet_send_handle_free(handle);
+
+    // Pipeline the rest through a completion queue
+    LLNetCompletionQueue_t* cq = llnet_cq_init();
+    for (size_t i = 1; i < T07_PCKT_COUNT; i += 1) {
+        llnet_connection_send_async(worker1, np_TCP, &pckts[i], cq);
+    }
+
+    // Wait on the eventfd and harvest in batches
+    uint32_t harvested = 0;
+    struct pollfd pfd = { .fd = cq->event_fd, .events = POLLIN };
+    while (harvested < T07_PCKT_COUNT - 1 && poll(&pfd, 1, 1000) > 0) {
+        LLNetSendHandle_t* done[4];
+        uint32_t n = llnet_cq_harvest(cq, done, num_elements(done));
+        for (uint32_t i = 0; i < n; i += 1) {
+            if (done[i]->rc != 0) {
+                rc = TEST_FAILURE;
+            }
+            llnet_send_handle_free(done[i]);
+        }
+        harvested += n;
+    }
+    llnet_cq_free(cq);
+    if (harvested != T07_PCKT_COUNT - 1) {
+        dbg_error("not all sends completed (harvested = %u)\n", harvested);
+        rc = TEST_FAILURE;
+    }
+
+    // Everything should make it to the server
+    for (size_t i = 0; i < NUMBER_OF_POLLS && arraylist_size(t02_svr_pckts) < T07_PCKT_COUNT; i += 1) {
+        usleep(POLL_SLEEP_TIME);
+    }
+    if (arraylist_size(t02_svr_pckts) != T07_PCKT_COUNT) {
+        dbg_error("not all packets received (length = %u)\n", arraylist_size(t02_svr_pckts));
+        rc = TEST_FAILURE;
+    }
+
+    // Clean up
+    llnet_connection_free((NetConnection_t*) worker1);
+    llnet_connection_free((NetConnection_t*) accepter);
+    _fixture_teardown();
+
+    return rc;
+}
+
+/**
+ * Counts the number of file descriptors this process has open
+ *
+ * @returns the number of open file descriptors
+ */
+static uint32_t count_fds() {
+    uint32_t count = 0;
+    DIR* dir = opendir("/proc/self/fd");
+    if (dir == NULL) {
+        return 0;
+    }
+    while (readdir(dir) != NULL) {
+        count += 1;
+    }
+    closedir(dir);
+    return count;
+}
+
+/**
+ * On-disconnect handler that counts lost connections
+ *
+ * @param c the lost connection
+ */
+static void t08_on_disconnect(WorkerConnection_t* c) {
+#if DEBUG
+    dbg_info("connection %u lost\n", c->connection_id);
+#endif
+    __atomic_fetch_add(&t08_disconnects, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Test that disconnected connections are reclaimed and their IDs go stale
+ */
+int t08_reconnect() {
+    _fixture_setup();
+    t08_disconnects = 0;
+
+    NetConnection_t* listener = llnet_connection_init();
+    llnet_connection_set_on_disconnect(listener, t08_on_disconnect);
+    AccepterConnection_t* accepter = llnet_connection_listen(listener, t02_on_connect, t02_svr_on_packet);
+
+    msleep(5); // give some time for the accepter to start up
+
+    int rc = TEST_SUCCESS;
+    uint32_t fds = count_fds();
+    uint32_t first_id = 0;
+    for (uint32_t i = 0; i < T08_RECONNECTS && rc == TEST_SUCCESS; i += 1) {
+        WorkerConnection_t* worker1 = llnet_connection_connect(llnet_connection_init(),
+            "localhost", t02_clnt_on_packet);
+        if (!arraylist_poll(t02_connections)) {
+            dbg_error("no client connected on attempt %u\n", i);
+            llnet_connection_free((NetConnection_t*) worker1);
+            rc = TEST_FAILURE;
+            break;
+        }
+        uint32_t id = ((WorkerConnection_t*) arraylist_remove(t02_connections, 0))->connection_id;
+        if (i == 0) {
+            first_id = id;
+        } else if (id == first_id) {
+            dbg_error("connection ID 0x%08x was handed out twice\n", id);
+            rc = TEST_FAILURE;
+        }
+
+        // Drop the robot and wait for the server side to notice
+        llnet_connection_free((NetConnection_t*) worker1);
+        for (size_t j = 0; j < NUMBER_OF_POLLS * 10 && __atomic_load_n(&t08_disconnects, __ATOMIC_RELAXED) <= i; j += 1) {
+            usleep(POLL_SLEEP_TIME);
+        }
+        if (t08_disconnects != i + 1) {
+            dbg_error("disconnect not seen (disconnects = %u)\n", t08_disconnects);
+            rc = TEST_FAILURE;
+        }
+        for (size_t j = 0; j < NUMBER_OF_POLLS && __atomic_load_n(&accepter->live_workers, __ATOMIC_ACQUIRE) != 0; j += 1) {
+            usleep(POLL_SLEEP_TIME);
+        }
+        if (llnet_connection_get(id) != NULL) {
+            dbg_error("stale connection ID 0x%08x still resolves\n", id);
+            rc = TEST_FAILURE;
+        }
+    }
+
+    // A held connection outlives its reclaim, but can't be sent on
+    WorkerConnection_t* worker1 = llnet_connection_connect(llnet_connection_init(), "localhost", t02_clnt_on_packet);
+    WorkerConnection_t* held = NULL;
+    if (rc == TEST_SUCCESS && arraylist_poll(t02_connections)) {
+        uint32_t id = ((WorkerConnection_t*) arraylist_remove(t02_connections, 0))->connection_id;
+        held = llnet_context_retain(llnet_context_default(), id);
+    }
+    llnet_connection_free((NetConnection_t*) worker1);
+    if (held == NULL) {
+        dbg_error("could not hold the connection\n");
+        rc = TEST_FAILURE;
+    } else {
+        for (size_t j = 0; j < NUMBER_OF_POLLS * 10 && __atomic_load_n(&accepter->live_workers, __ATOMIC_ACQUIRE) != 0; j += 1) {
+            usleep(POLL_SLEEP_TIME);
+        }
+        uint64_t data = 0x08;
+        IntermediateTLV_t pckt;
+        pckt.type = 0x30;
+        pckt.length = sizeof(uint64_t);
+        pckt.data = (uint8_t*) &data;
+        uint32_t async_rc = 0;
+        LLNetSendHandle_t* handle = llnet_connection_send_async(held, np_TCP, &pckt, NULL);
+        if (!llnet_send_wait(handle, -1, &async_rc) || async_rc == 0 || llnet_connection_send(held, np_TCP, &pckt) == 0) {
+            dbg_error("send on a reclaimed connection did not fail\n");
+            rc = TEST_FAILURE;
+        }
+        llnet_send_handle_free(handle);
+        llnet_connection_release(held);
+    }
+
+    // Everything is reclaimed, so nothing should grow with reconnects
+    uint32_t fds_after = count_fds();
+    if (rc == TEST_SUCCESS && fds_after != fds) {
+        dbg_error("file descriptors leaked (before = %u, after = %u)\n", fds, fds_after);
+        rc = TEST_FAILURE;
+    }
+
+    // Clean up
+    llnet_connection_free((NetConnection_t*) accepter);
+    _fixture_teardown();
+
+    return rc;
+}
+
+/**
+ * Test rebuilding a lost frame with FEC, locally and over the network
+ */
+int t09_fec() {
+    int rc = TEST_SUCCESS;
+
+    // Build a group of frames with different lengths
+    uint8_t frames[T09_FRAMES][64];
+    uint32_t lengths[T09_FRAMES];
+    uint8_t tags[T09_FRAMES][LLNET_FEC_TAG_LENGTH];
+    LLNetFec_t* tx = fec_init();
+    tx->tx.k = T09_FRAMES;
+    bool complete = false;
+    for (size_t i = 0; i < T09_FRAMES; i += 1) {
+        uint32_t length = 4 + (i * 7);
+        lengths[i] = LLNET_HEADER_LENGTH + length;
+        uint32_t word = htonl((0x30 << 24) | length);
+        memcpy(frames[i], &word, sizeof(uint32_t));
+        memset(frames[i] + 4, 0x10 + i, sizeof(uint32_t));
+        for (size_t j = 0; j < length; j += 1) {
+            frames[i][LLNET_HEADER_LENGTH + j] = (uint8_t) (i * 31 + j);
+        }
+        complete = fec_encode(&tx->tx, frames[i], lengths[i], tags[i]);
+    }
+    uint8_t parity[LLNET_FEC_TAG_LENGTH + LLNET_FEC_MAX_FRAME];
+    uint32_t parity_len = fec_parity(&tx->tx, parity);
+
+    // Lose the third frame, and get it back from the parity
+    LLNetFec_t* rx = fec_init();
+    uint8_t rebuilt[LLNET_FEC_MAX_FRAME];
+    for (size_t i = 0; i < T09_FRAMES; i += 1) {
+        if (i != 2) {
+            fec_decode_data(&rx->rx, tags[i], frames[i], lengths[i]);
+        }
+    }
+    int32_t rlen = fec_decode_parity(&rx->rx, parity, parity_len, rebuilt);
+    if (!complete || rlen != (int32_t) lengths[2] || memcmp(rebuilt, frames[2], lengths[2]) != 0) {
+        dbg_error("could not rebuild lost frame (length = %d)\n", rlen);
+        rc = TEST_FAILURE;
+    }
+
+    // Heavy loss should shrink the group (after the current one)
+    fec_encoder_adapt(&tx->tx, 200);
+    fec_encode(&tx->tx, frames[0], lengths[0], tags[0]);
+    fec_parity(&tx->tx, parity);
+    if (tx->tx.k != 2 || rx->rx.loss == 0) {
+        dbg_error("FEC did not adapt to loss (k = %u, loss = %u)\n", tx->tx.k, rx->rx.loss);
+        rc = TEST_FAILURE;
+    }
+    fec_free(tx);
+    fec_free(rx);
+
+    // A group finished early still rebuilds its lost frame, and skipped groups count as lost
+    tx = fec_init();
+    rx = fec_init();
+    tx->tx.k = T09_FRAMES;
+    fec_encode(&tx->tx, frames[0], lengths[0], tags[0]);
+    fec_encode(&tx->tx, frames[1], lengths[1], tags[1]);
+    parity_len = fec_parity(&tx->tx, parity);
+    fec_decode_data(&rx->rx, tags[1], frames[1], lengths[1]);
+    rlen = fec_decode_parity(&rx->rx, parity, parity_len, rebuilt);
+    if (rlen != (int32_t) lengths[0] || memcmp(rebuilt, frames[0], lengths[0]) != 0) {
+        dbg_error("could not rebuild frame of a short group (length = %d)\n", rlen);
+        rc = TEST_FAILURE;
+    }
+    uint32_t loss = rx->rx.loss;
+    tx->tx.group += 4;
+    fec_encode(&tx->tx, frames[0], lengths[0], tags[0]);
+    parity_len = fec_parity(&tx->tx, parity);
+    fec_decode_data(&rx->rx, tags[0], frames[0], lengths[0]);
+    fec_decode_parity(&rx->rx, parity, parity_len, rebuilt);
+    if (rx->rx.groups != 6 || rx->rx.loss <= loss) {
+        dbg_error("lost groups were not counted (groups = %u, loss = %u)\n", rx->rx.groups, rx->rx.loss);
+        rc = TEST_FAILURE;
+    }
+    fec_free(tx);
+    fec_free(rx);
+
+    // Protected frames should arrive as normal, without the parity frames
+    _fixture_setup();
+    NetConnection_t* listener = llnet_connection_init();
+    llnet_connection_set_fec(listener, true);
+    AccepterConnection_t* accepter = llnet_connection_listen(listener, t02_on_connect, t02_svr_on_packet);
+
+    msleep(5); // give some time for the accepter to start up
+
+    NetConnection_t* client = llnet_connection_init();
+    llnet_connection_set_fec(client, true);
+    WorkerConnection_t* worker1 = llnet_connection_connect(client, "localhost", t02_clnt_on_packet);
+    WorkerConnection_t* worker_a = NULL;
+    if (arraylist_poll(t02_connections)) {
+        worker_a = arraylist_get(t02_connections, 0);
+        for (size_t i = 0; i < NUMBER_OF_POLLS && !(worker_a->peer_caps & llcap_FEC); i += 1) {
+            usleep(POLL_SLEEP_TIME);
+        }
+    }
+    if (worker_a == NULL || !(worker_a->peer_caps & llcap_FEC)) {
+        dbg_error("FEC was not negotiated\n");
+        rc = TEST_FAILURE;
+    } else {
+        uint64_t data = 0x0123456789abcdef;
+        IntermediateTLV_t pckt;
+        pckt.type = 0x30;
+        pckt.length = sizeof(uint64_t);
+        pckt.data = (uint8_t*) &data;
+        for (size_t i = 0; i < T09_PCKT_COUNT; i += 1) {
+            llnet_connection_send(worker_a, np_UDP, &pckt);
+        }
+        for (size_t i = 0; i < NUMBER_OF_POLLS * 10 && arraylist_size(t02_svr_pckts) < T09_PCKT_COUNT; i += 1) {
+            usleep(POLL_SLEEP_TIME);
+        }
+        msleep(5); // make sure no parity frames sneak through
+        if (arraylist_size(t02_svr_pckts) != T09_PCKT_COUNT) {
+            dbg_error("wrong number of packets (length = %u)\n", arraylist_size(t02_svr_pckts));
+            rc = TEST_FAILURE;
+        }
+        for (size_t i = 0; i < arraylist_size(t02_svr_pckts); i += 1) {
+            IntermediateTLV_t* recvd = arraylist_get(t02_svr_pckts, i);
+            if (recvd->type != 0x30 || recvd->length != sizeof(uint64_t) || memcmp(recvd->data, &data, sizeof(uint64_t)) != 0) {
+                dbg_error("FEC packet %zu was corrupted\n", i);
+                rc = TEST_FAILURE;
+            }
+        }
+    }
+
+    // Clean up
+    llnet_connection_free((NetConnection_t*) worker1);
+    llnet_connection_free((NetConnection_t*) accepter);
+    _fixture_teardown();
+
+    return rc;
+}
+
+/**
+ * Test that small packets sent close together are bundled and split back up
+ */
+int t10_bundling() {
+    _fixture_setup();
+    NetConnection_t* listener = llnet_connection_init();
+    llnet_connection_set_bundling(listener, T10_WINDOW_US);
+    AccepterConnection_t* accepter = llnet_connection_listen(listener, t02_on_connect, t02_svr_on_packet);
+
+    msleep(5); // give some time for the accepter to start up
+
+    NetConnection_t* client = llnet_connection_init();
+    llnet_connection_set_bundling(client, T10_WINDOW_US);
+    WorkerConnection_t* worker1 = llnet_connection_connect(client, "localhost", t02_clnt_on_packet);
+    for (size_t i = 0; i < NUMBER_OF_POLLS && !(worker1->peer_caps & llcap_BUNDLE); i += 1) {
+        usleep(POLL_SLEEP_TIME);
+    }
+
+    int rc = TEST_SUCCESS;
+    if (!arraylist_poll(t02_connections) || !(worker1->peer_caps & llcap_BUNDLE)) {
+        dbg_error("bundling was not negotiated\n");
+        rc = TEST_FAILURE;
+    } else {
+        // Send a burst of small packets with different types, each one numbered
+        uint32_t data[T10_PCKT_COUNT];
+        for (size_t i = 0; i < T10_PCKT_COUNT; i += 1) {
+            data[i] = i;
+            IntermediateTLV_t pckt;
+            pckt.type = (i % 2 == 0)? 0x30 : 0x10;
+            pckt.length = sizeof(uint32_t);
+            pckt.data = (uint8_t*) &data[i];
+            llnet_connection_send(worker1, np_TCP, &pckt);
+        }
+
+        // They should all arrive, in order, as separate packets
+        for (size_t i = 0; i < NUMBER_OF_POLLS * 10 && arraylist_size(t02_svr_pckts) < T10_PCKT_COUNT; i += 1) {
+            usleep(POLL_SLEEP_TIME);
+        }
+        if (arraylist_size(t02_svr_pckts) != T10_PCKT_COUNT) {
+            dbg_error("wrong number of packets (length = %u)\n", arraylist_size(t02_svr_pckts));
+            rc = TEST_FAILURE;
+        }
+        for (size_t i = 0; i < arraylist_size(t02_svr_pckts); i += 1) {
+            IntermediateTLV_t* recvd = arraylist_get(t02_svr_pckts, i);
+            uint32_t value;
+            memcpy(&value, recvd->data, sizeof(uint32_t));
+            if (recvd->type != ((i % 2 == 0)? 0x30 : 0x10) || recvd->length != sizeof(uint32_t) || value != i) {
+                dbg_error("bundled packet %zu was wrong (type=0x%02x, value=%u)\n", i, recvd->type, value);
+                rc = TEST_FAILURE;
+            }
+        }
+
+        // Far fewer writes than packets
+        LLNetStats_t stats;
+        llnet_connection_get_stats(worker1, &stats);
+        if (stats.tx_bundles == 0 || stats.tx_bundles >= T10_PCKT_COUNT || stats.tx_packets < T10_PCKT_COUNT) {
+            dbg_error("packets were not bundled (bundles = %lu, packets = %lu)\n", stats.tx_bundles, stats.tx_packets);
+            rc = TEST_FAILURE;
+        }
+    }
+
+    // Clean up
+    llnet_connection_free((NetConnection_t*) worker1);
+    llnet_connection_free((NetConnection_t*) accepter);
+    _fixture_teardown();
+
+    return rc;
+}
+
+/**
+ * Test the reliable channel's bookkeeping, and that reliable packets arrive in
+ * order and get acknowledged
+ */
+int t11_reliable() {
+    int rc = TEST_SUCCESS;
+
+    // Send three messages, the other side only gets the first and last
+    LLNetReliable_t* tx = reliable_init();
+    for (uint64_t i = 0; i < 3; i += 1) {
+        uint8_t* buf = malloc(4);
+        memset(buf, (int) i, 4);
+        reliable_track(tx, buf, 4, i * 1000);
+    }
+    LLNetReliable_t* rx = reliable_init();
+    uint8_t msgs[3][4] = {{0, 0, 0, 0}, {1, 1, 1, 1}, {2, 2, 2, 2}};
+    reliable_receive(rx, 0, msgs[0], 4);
+    reliable_receive(rx, 2, msgs[2], 4);
+    uint32_t next_expected;
+    uint64_t sack;
+    reliable_ack_state(rx, &next_expected, &sack);
+    if (next_expected != 0 || sack != 0x2) {
+        dbg_error("wrong ACK state (next = %u, sack = 0x%lx)\n", next_expected, sack);
+        rc = TEST_FAILURE;
+    }
+
+    // Only the first can be handed up
+    uint32_t len;
+    uint8_t* popped = reliable_pop(rx, &len);
+    if (popped == NULL || popped[0] != 0 || reliable_pop(rx, &len) != NULL) {
+        dbg_error("out of order message was handed up\n");
+        rc = TEST_FAILURE;
+    }
+    free(popped);
+
+    // The selective ACK should leave only the middle message waiting
+    reliable_ack_state(rx, &next_expected, &sack);
+    if (reliable_ack(tx, next_expected, sack, 5000000) != 2 || tx->base != 1) {
+        dbg_error("selective ACK was not applied (base = %u)\n", tx->base);
+        rc = TEST_FAILURE;
+    }
+    uint32_t failed = 0;
+    LLNetReliableEntry_t* due = reliable_next_due(tx, 5000000, &failed);
+    if (due != NULL) {
+        dbg_error("message was resent before its timeout\n");
+        rc = TEST_FAILURE;
+    }
+    due = reliable_next_due(tx, 1000000000ULL, &failed);
+    if (due == NULL || due->seq != 1 || due->retries != 1 || failed != 0) {
+        dbg_error("lost message was not resent\n");
+        rc = TEST_FAILURE;
+    }
+
+    // Once it arrives, both remaining messages come out in order
+    reliable_receive(rx, 1, msgs[1], 4);
+    for (uint8_t i = 1; i < 3; i += 1) {
+        popped = reliable_pop(rx, &len);
+        if (popped == NULL || popped[0] != i) {
+            dbg_error("message %u was not handed up in order\n", i);
+            rc = TEST_FAILURE;
+        }
+        free(popped);
+    }
+    reliable_free(tx);
+    reliable_free(rx);
+
+    // Reliable packets should arrive as normal packets, in order
+    _fixture_setup();
+    NetConnection_t* listener = llnet_connection_init();
+    llnet_connection_set_reliable(listener, true);
+    AccepterConnection_t* accepter = llnet_connection_listen(listener, t02_on_connect, t02_svr_on_packet);
+
+    msleep(5); // give some time for the accepter to start up
+
+    NetConnection_t* client = llnet_connection_init();
+    llnet_connection_set_reliable(client, true);
+    WorkerConnection_t* worker1 = llnet_connection_connect(client, "localhost", t02_clnt_on_packet);
+    WorkerConnection_t* worker_a = NULL;
+    if (arraylist_poll(t02_connections)) {
+        worker_a = arraylist_get(t02_connections, 0);
+        for (size_t i = 0; i < NUMBER_OF_POLLS && !(worker_a->peer_caps & llcap_RELIABLE); i += 1) {
+            usleep(POLL_SLEEP_TIME);
+        }
+    }
+    if (worker_a == NULL || !(worker_a->peer_caps & llcap_RELIABLE)) {
+        dbg_error("reliable channel was not negotiated\n");
+        rc = TEST_FAILURE;
+    } else {
+        uint32_t data[T11_PCKT_COUNT];
+        for (size_t i = 0; i < T11_PCKT_COUNT; i += 1) {
+            data[i] = i;
+            IntermediateTLV_t pckt;
+            pckt.type = 0x30;
+            pckt.length = sizeof(uint32_t);
+            pckt.data = (uint8_t*) &data[i];
+            if (llnet_connection_send_reliable(worker_a, &pckt) != 0) {
+                dbg_error("could not send reliable packet %zu\n", i);
+                rc = TEST_FAILURE;
+            }
+        }
+        for (size_t i = 0; i < NUMBER_OF_POLLS * 10 && arraylist_size(t02_svr_pckts) < T11_PCKT_COUNT; i += 1) {
+            usleep(POLL_SLEEP_TIME);
+        }
+        msleep(5); // make sure no ACKs sneak through
+        if (arraylist_size(t02_svr_pckts) != T11_PCKT_COUNT) {
+            dbg_error("wrong number of packets (length = %u)\n", arraylist_size(t02_svr_pckts));
+            rc = TEST_FAILURE;
+        }
+        for (size_t i = 0; i < arraylist_size(t02_svr_pckts); i += 1) {
+            IntermediateTLV_t* recvd = arraylist_get(t02_svr_pckts, i);
+            uint32_t value;
+            memcpy(&value, recvd->data, sizeof(uint32_t));
+            if (recvd->type != 0x30 || recvd->length != sizeof(uint32_t) || value != i) {
+                dbg_error("reliable packet %zu was wrong (type=0x%02x, value=%u)\n", i, recvd->type, value);
+                rc = TEST_FAILURE;
+            }
+        }
+
+        // Everything should have been acknowledged
+        pthread_mutex_lock(&worker_a->reliable->mutex);
+        uint32_t waiting = worker_a->reliable->next_seq - worker_a->reliable->base;
+        pthread_mutex_unlock(&worker_a->reliable->mutex);
+        if (waiting != 0) {
+            dbg_error("reliable packets were not acknowledged (waiting = %u)\n", waiting);
+            rc = TEST_FAILURE;
+        }
+    }
+
+    // Clean up
+    llnet_connection_free((NetConnection_t*) worker1);
+    llnet_connection_free((NetConnection_t*) accepter);
+    _fixture_teardown();
+
+    return rc;
+}
+
+/**
+ * Sends a datagram with the given header word and number of payload bytes
+ *
+ * @param fd the socket to send from
+ * @param addr where to send the datagram
+ * @param word the first word of the header (type and length field)
+ * @param payload the number of payload bytes to send
+ */
+static void t12_send(int fd, struct sockaddr_in* addr, uint32_t word, uint32_t payload) {
+    uint8_t buf[LLNET_HEADER_LENGTH + 16] = {0};
+    word = htonl(word);
+    memcpy(buf, &word, sizeof(uint32_t));
+    sendto(fd, buf, LLNET_HEADER_LENGTH + payload, 0, (struct sockaddr*) addr, sizeof(struct sockaddr_in));
+}
+
+/**
+ * Test that the UDP socket filter drops malformed datagrams and unknown types
+ */
+int t12_udp_filter() {
+    int rc = TEST_SUCCESS;
+
+    // Filter a socket of our own down to a single type
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(struct sockaddr_in);
+    bind(rx, (struct sockaddr*) &addr, addr_len);
+    getsockname(rx, (struct sockaddr*) &addr, &addr_len);
+    uint32_t types[LLNET_SOCKFILTER_WORDS] = {0};
+    types[0x30 / 32] |= (1U << (0x30 % 32));
+    if (sockfilter_attach(rx, types) < 0) {
+        dbg_error("could not attach filter: %s\n", strerror(errno));
+        rc = TEST_FAILURE;
+    }
+
+    // Only the well-formed datagrams of the right type should make it
+    t12_send(tx, &addr, (0x30 << 24) | 4, 4); // good
+    t12_send(tx, &addr, (0x30 << 24) | 4, 4 - LLNET_HEADER_LENGTH); // shorter than a header
+    t12_send(tx, &addr, (0xcd << 24) | 4, 4); // unknown type
+    t12_send(tx, &addr, (0x31 << 24) | 4, 4); // unknown type, same bitmap word
+    t12_send(tx, &addr, (0x30 << 24) | 8, 4); // length field is too long
+    t12_send(tx, &addr, (0x30 << 24) | 2, 4); // length field is too short
+    t12_send(tx, &addr, (0x30 << 24) | LLNET_FLAG_FEC | 12, 12); // good, flags aren't part of the length
+    msleep(5);
+    uint32_t received = 0;
+    uint8_t buf[LLNET_HEADER_LENGTH + 16];
+    while (recv(rx, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+        received += 1;
+    }
+    if (received != 2) {
+        dbg_error("filter let the wrong datagrams through (received = %u)\n", received);
+        rc = TEST_FAILURE;
+    }
+    close(rx);
+    close(tx);
+
+    // Known types should still get through a filtered connection, others shouldn't
+    _fixture_setup();
+    uint8_t known[] = PACKET_TYPES;
+    NetConnection_t* listener = llnet_connection_init();
+    llnet_connection_set_udp_filter(listener, known, sizeof(known));
+    AccepterConnection_t* accepter = llnet_connection_listen(listener, t02_on_connect, t02_svr_on_packet);
+
+    msleep(5); // give some time for the accepter to start up
+
+    NetConnection_t* client = llnet_connection_init();
+    if (llnet_connection_set_udp_filter(client, known, sizeof(known)) != 0) {
+        dbg_error("could not filter the client\n");
+        rc = TEST_FAILURE;
+    }
+    WorkerConnection_t* worker1 = llnet_connection_connect(client, "localhost", t02_clnt_on_packet);
+    if (!arraylist_poll(t02_connections)) {
+        dbg_error("no connection was made\n");
+        rc = TEST_FAILURE;
+    } else {
+        WorkerConnection_t* worker_a = arraylist_get(t02_connections, 0);
+        uint32_t data = 0xdeadbeef;
+        IntermediateTLV_t pckt;
+        pckt.length = sizeof(uint32_t);
+        pckt.data = (uint8_t*) &data;
+        for (size_t i = 0; i < T12_PCKT_COUNT; i += 1) {
+            pckt.type = (i % 2 == 0)? pt_USER_DATA : 0xcd;
+            llnet_connection_send(worker_a, np_UDP, &pckt);
+        }
+        for (size_t i = 0; i < NUMBER_OF_POLLS * 10 && arraylist_size(t02_svr_pckts) < T12_PCKT_COUNT / 2; i += 1) {
+            usleep(POLL_SLEEP_TIME);
+        }
+        msleep(5); // make sure nothing else sneaks through
+        if (arraylist_size(t02_svr_pckts) != T12_PCKT_COUNT / 2) {
+            dbg_error("wrong number of packets (length = %u)\n", arraylist_size(t02_svr_pckts));
+            rc = TEST_FAILURE;
+        }
+        for (size_t i = 0; i < arraylist_size(t02_svr_pckts); i += 1) {
+            IntermediateTLV_t* recvd = arraylist_get(t02_svr_pckts, i);
+            if (recvd->type != pt_USER_DATA) {
+                dbg_error("filtered packet type 0x%02x got through\n", recvd->type);
+                rc = TEST_FAILURE;
+            }
+        }
+    }
+
+    // Clean up
+    llnet_connection_free((NetConnection_t*) worker1);
+    llnet_connection_free((NetConnection_t*) accepter);
+    _fixture_teardown();
+
+    return rc;
+}
+
+/**
+ * Test that a client connects once the server comes up, and reconnects (sending
+ * INIT again) when the connection drops
+ */
+int t13_client() {
+    int rc = TEST_SUCCESS;
+    _fixture_setup();
+
+    // Start the client before there's anything to connect to
+    char name[] = "robot";
+    IntermediateTLV_t init;
+    init.type = pt_INIT;
+    init.length = sizeof(name);
+    init.data = (uint8_t*) name;
+    LLNetClient_t* client = llnet_client_init(llnet_connection_init(), "localhost", t02_clnt_on_packet);
+    llnet_client_set_init(client, &init);
+    llnet_client_set_backoff(client, 100, 2, 10);
+    llnet_client_start(client);
+    msleep(20);
+    if (llnet_client_wait(client, 0) || client->failures == 0) {
+        dbg_error("client connected without a server (failures = %lu)\n", client->failures);
+        rc = TEST_FAILURE;
+    }
+
+    // Once the server is up, the client should connect and say who it is
+    AccepterConnection_t* accepter = llnet_connection_listen(llnet_connection_init(), t02_on_connect, t02_svr_on_packet);
+    if (!llnet_client_wait(client, 1000) || !arraylist_poll(t02_svr_pckts)) {
+        dbg_error("client did not connect\n");
+        rc = TEST_FAILURE;
+    } else {
+        // Drop the connection from the server side
+        llnet_connection_free((NetConnection_t*) arraylist_get(t02_connections, 0));
+        for (size_t i = 0; i < NUMBER_OF_POLLS * 100 && arraylist_size(t02_svr_pckts) < 2; i += 1) {
+            usleep(POLL_SLEEP_TIME);
+        }
+        if (arraylist_size(t02_connections) != 2 || arraylist_size(t02_svr_pckts) != 2 || !llnet_client_wait(client, 1000)) {
+            dbg_error("client did not reconnect (connections = %u)\n", arraylist_size(t02_connections));
+            rc = TEST_FAILURE;
+        }
+
+        // Every connection should start with the INIT packet
+        for (size_t i = 0; i < arraylist_size(t02_svr_pckts); i += 1) {
+            IntermediateTLV_t* recvd = arraylist_get(t02_svr_pckts, i);
+            if (recvd->type != pt_INIT || recvd->length != sizeof(name) || memcmp(recvd->data, name, sizeof(name)) != 0) {
+                dbg_error("connection %zu did not start with INIT\n", i);
+                rc = TEST_FAILURE;
+            }
+        }
+
+        // The new connection should work like any other
+        uint32_t data = 0x12345678;
+        IntermediateTLV_t pckt;
+        pckt.type = pt_USER_DATA;
+        pckt.length = sizeof(uint32_t);
+        pckt.data = (uint8_t*) &data;
+        if (llnet_client_send(client, np_TCP, &pckt) != 0) {
+            dbg_error("could not send on the new connection\n");
+            rc = TEST_FAILURE;
+        }
+        for (size_t i = 0; i < NUMBER_OF_POLLS * 10 && arraylist_size(t02_svr_pckts) < 3; i += 1) {
+            usleep(POLL_SLEEP_TIME);
+        }
+        if (arraylist_size(t02_svr_pckts) != 3 || !packet_equals(arraylist_get(t02_svr_pckts, 2), &pckt)) {
+            dbg_error("packet on the new connection was lost\n");
+            rc = TEST_FAILURE;
+        }
+    }
+
+    // Clean up
+    llnet_client_free(client);
+    llnet_connection_free((NetConnection_t*) accepter);
+    _fixture_teardown();
+
+    return rc;
+}
+
+/**
+ * Robot side of the e-stop test: answers an e-stop with an UPDATE_STATUS
+ *
+ * @param id the connection the packet came in on
+ * @param pckt the packet
+ */
+static void t14_robot_on_packet(uint32_t id, IntermediateTLV_t* pckt) {
+    if (pckt->type == pt_STATE_UPDATE && pckt->length >= 1 && pckt->data[0] == rs_E_STOPPED) {
+        __atomic_fetch_add(&t14_estopped, 1, __ATOMIC_RELAXED);
+        uint32_t status = 0;
+        IntermediateTLV_t response;
+        response.type = pt_UPDATE_STATUS;
+        response.length = sizeof(uint32_t);
+        response.data = (uint8_t*) &status;
+        WorkerConnection_t* worker = llnet_connection_get(id);
+        if (worker != NULL) {
+            llnet_connection_send(worker, np_TCP, &response);
+        }
+    }
+    llnet_packet_free(pckt);
+}
+
+/**
+ * FMS side of the e-stop test: records responses
+ *
+ * @param id the connection the packet came in on
+ * @param pckt the packet
+ */
+static void t14_fms_on_packet(uint32_t id, IntermediateTLV_t* pckt) {
+    llnet_estop_observe(t14_estop, id, pckt);
+    llnet_packet_free(pckt);
+}
+
+/**
+ * Test that an e-stop reaches every robot, and every response is timed
+ */
+int t14_estop_fast_path() {
+    int rc = TEST_SUCCESS;
+    _fixture_setup();
+    t14_estopped = 0;
+
+    // The FMS gets its own context, so an e-stop only goes from the FMS to the robots
+    LLNetContext_t* fms = llnet_context_init();
+    t14_estop = llnet_estop_init(fms, T14_ROBOTS);
+    AccepterConnection_t* accepter = llnet_connection_listen(llnet_connection_init_context(fms), t02_on_connect,
+        t14_fms_on_packet);
+
+    msleep(5); // give some time for the accepter to start up
+
+    WorkerConnection_t* robots[T14_ROBOTS];
+    for (size_t i = 0; i < T14_ROBOTS; i += 1) {
+        robots[i] = llnet_connection_connect(llnet_connection_init(), "localhost", t14_robot_on_packet);
+    }
+    for (size_t i = 0; i < NUMBER_OF_POLLS * 10 && arraylist_size(t02_connections) < T14_ROBOTS; i += 1) {
+        usleep(POLL_SLEEP_TIME);
+    }
+
+    // Every robot should be sent the e-stop, and every response should be timed
+    uint32_t count = llnet_estop_trigger(t14_estop);
+    if (count != T14_ROBOTS) {
+        dbg_error("e-stop did not reach every robot (count = %u)\n", count);
+        rc = TEST_FAILURE;
+    }
+    for (size_t i = 0; i < NUMBER_OF_POLLS * 10 && llnet_estop_pending(t14_estop) > 0; i += 1) {
+        usleep(POLL_SLEEP_TIME);
+    }
+    if (llnet_estop_pending(t14_estop) != 0 || llnet_estop_worst_latency(t14_estop) == 0) {
+        dbg_error("e-stop responses were not recorded (pending = %u)\n", llnet_estop_pending(t14_estop));
+        rc = TEST_FAILURE;
+    }
+    for (size_t i = 0; i < t14_estop->num_records; i += 1) {
+        if (!t14_estop->records[i].tcp_sent) {
+            dbg_error("e-stop was not written to a TCP socket\n");
+            rc = TEST_FAILURE;
+        }
+    }
+    if (__atomic_load_n(&t14_estopped, __ATOMIC_RELAXED) < T14_ROBOTS) {
+        dbg_error("robots did not see the e-stop (estopped = %u)\n", t14_estopped);
+        rc = TEST_FAILURE;
+    }
+
+    // E-stopping a single robot starts a new record
+    if (arraylist_size(t02_connections) > 0) {
+        if (llnet_estop_trigger_one(t14_estop, arraylist_get(t02_connections, 0)) != 0 ||
+                t14_estop->num_records != 1) {
+            dbg_error("single e-stop was not sent\n");
+            rc = TEST_FAILURE;
+        }
+
+        // Failed responses, and responses stamped before the trigger, don't count
+        uint32_t status = sc_INVALID_STATE;
+        IntermediateTLV_t response;
+        response.type = pt_UPDATE_STATUS;
+        response.length = sizeof(uint32_t);
+        response.data = (uint8_t*) &status;
+        response.timestamp = t14_estop->timestamp;
+        bool failed_counted = llnet_estop_observe(t14_estop, t14_estop->records[0].id, &response);
+        status = sc_SUCCESS;
+        response.timestamp = t14_estop->timestamp - 1;
+        bool stale_counted = llnet_estop_observe(t14_estop, t14_estop->records[0].id, &response);
+        if (failed_counted || stale_counted) {
+            dbg_error("e-stop response was wrongly counted (failed = %d, stale = %d)\n", failed_counted,
+                stale_counted);
+            rc = TEST_FAILURE;
+        }
+    }
+
+    // Clean up
+    for (size_t i = 0; i < T14_ROBOTS; i += 1) {
+        llnet_connection_free((NetConnection_t*) robots[i]);
+    }
+    llnet_connection_free((NetConnection_t*) accepter);
+    llnet_estop_free(t14_estop);
+    t14_estop = NULL;
+    llnet_context_free(fms);
+    _fixture_teardown();
+
+    return rc;
+}
+
+/**
+ * Test that socket buffers can be sized, and the kernel's socket state is sampled
+ */
+int t15_socket_stats() {
+    int rc = TEST_SUCCESS;
+    _fixture_setup();
+
+    // The accepter gets its own context, so it can be sampled on its own
+    LLNetContext_t* svr = llnet_context_init();
+    LLNetBufferSizes_t sizes;
+    memset(&sizes, 0, sizeof(LLNetBufferSizes_t));
+    sizes.tcp_rcvbuf = T15_BUFFER_SIZE;
+    sizes.udp_rcvbuf = T15_BUFFER_SIZE;
+    NetConnection_t* listener = llnet_connection_init_context(svr);
+    llnet_connection_set_buffers(listener, &sizes);
+    AccepterConnection_t* accepter = llnet_connection_listen(listener, t02_on_connect, t02_svr_on_packet);
+    llnet_context_set_sample_period(svr, 1);
+
+    msleep(5); // give some time for the accepter to start up
+
+    // The client's UDP buffer is as small as it can be, so it overflows
+    NetConnection_t* client = llnet_connection_init();
+    memset(&sizes, 0, sizeof(LLNetBufferSizes_t));
+    sizes.udp_rcvbuf = 1;
+    llnet_connection_set_buffers(client, &sizes);
+    WorkerConnection_t* worker1 = llnet_connection_connect(client, "localhost", t02_clnt_on_packet);
+    if (!arraylist_poll(t02_connections)) {
+        dbg_error("connection was not accepted\n");
+        rc = TEST_FAILURE;
+    } else {
+        WorkerConnection_t* worker_a = arraylist_get(t02_connections, 0);
+
+        // A packet each way gives TCP a round trip to measure
+        uint32_t value = 0x15;
+        IntermediateTLV_t pckt;
+        pckt.type = 0x30;
+        pckt.length = sizeof(uint32_t);
+        pckt.data = (uint8_t*) &value;
+        llnet_connection_send(worker1, np_TCP, &pckt);
+        llnet_connection_send(worker_a, np_TCP, &pckt);
+        arraylist_poll(t02_svr_pckts);
+        arraylist_poll(t02_clnt_pckts);
+
+        // The sampler should pick the accepted connection up on its own
+        LLNetSocketStats_t stats;
+        memset(&stats, 0, sizeof(LLNetSocketStats_t));
+        for (size_t i = 0; i < NUMBER_OF_POLLS && (stats.sampled_ns == 0 || stats.tcp_rtt_us == 0); i += 1) {
+            usleep(POLL_SLEEP_TIME);
+            llnet_connection_get_socket_stats(worker_a, &stats);
+        }
+        if (stats.sampled_ns == 0 || stats.tcp_rtt_us == 0 || stats.tcp_snd_cwnd == 0) {
+            dbg_error("socket state was not sampled (rtt = %lu, cwnd = %lu)\n", stats.tcp_rtt_us, stats.tcp_snd_cwnd);
+            rc = TEST_FAILURE;
+        }
+        if (stats.udp_rcvbuf < T15_BUFFER_SIZE || stats.tcp_rcvbuf < T15_BUFFER_SIZE) {
+            dbg_error("buffer sizes were not applied (udp = %lu, tcp = %lu)\n", stats.udp_rcvbuf, stats.tcp_rcvbuf);
+            rc = TEST_FAILURE;
+        }
+
+        // Flooding the client's tiny buffer should have the kernel count drops (on loopback,
+        // the client's datagrams come back in on its own socket, see t02)
+        uint8_t payload[1024];
+        memset(payload, 0xaa, sizeof(payload));
+        pckt.length = sizeof(payload);
+        pckt.data = payload;
+        for (size_t i = 0; i < T15_FLOOD_COUNT; i += 1) {
+            llnet_connection_send(worker1, np_UDP, &pckt);
+        }
+        LLNetStats_t counters;
+        memset(&counters, 0, sizeof(LLNetStats_t));
+        for (size_t i = 0; i < NUMBER_OF_POLLS && counters.rx_dropped_kernel == 0; i += 1) {
+            msleep(1);
+            llnet_connection_send(worker1, np_UDP, &pckt); // drops are reported with the next datagram
+            llnet_connection_get_stats(worker1, &counters);
+        }
+        if (counters.rx_dropped_kernel == 0) {
+            dbg_error("kernel drops were not counted (rx = %lu)\n", counters.rx_packets);
+            rc = TEST_FAILURE;
+        }
+        llnet_connection_sample_sockets(worker1, &stats);
+        if (stats.udp_rcvbuf >= T15_BUFFER_SIZE) {
+            dbg_error("client buffer was not shrunk (udp = %lu)\n", stats.udp_rcvbuf);
+            rc = TEST_FAILURE;
+        }
+    }
+
+    // Clean up
+    llnet_context_set_sample_period(svr, 0);
+    llnet_connection_free((NetConnection_t*) worker1);
+    llnet_connection_free((NetConnection_t*) accepter);
+    llnet_context_free(svr);
+    _fixture_teardown();
+
+    return rc;
+}
+
+/**
+ * Turns sampling on and off over and over, racing another thread doing the same
+ *
+ * @param _context the context to sample
+ * @returns NULL
+ */
+static void* t16_toggle_sampling(void* _context) {
+    for (size_t i = 0; i < T16_TOGGLES; i += 1) {
+        llnet_context_set_sample_period((LLNetContext_t*) _context, 1);
+        llnet_context_set_sample_period((LLNetContext_t*) _context, 0);
+    }
+    return NULL;
+}
+
+/**
+ * Test that counters are published to shared memory, and can be read back
+ */
+int t16_stats_shm() {
+    int rc = TEST_SUCCESS;
+    char name[32];
+    snprintf(name, sizeof(name), "/llnet-test-%d", (int) getpid());
+
+    // A slot that is being written can't be read
+    LLNetStatsShm_t* writer = statshm_create(name, 2);
+    LLNetStatsShm_t* reader = statshm_open(name);
+    if (writer == NULL || reader == NULL) {
+        dbg_error("could not create the stats segment\n");
+        return TEST_FAILURE;
+    }
+    LLNetStats_t stats;
+    LLNetSocketStats_t sockets;
+    memset(&stats, 0, sizeof(LLNetStats_t));
+    memset(&sockets, 0, sizeof(LLNetSocketStats_t));
+    stats.rx_packets = 16;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    statshm_begin(writer);
+    statshm_write(writer, 0x1234, 0, &addr, &stats, &sockets);
+    statshm_end(writer, 1);
+    LLNetStatsSlot_t slot;
+    if (!statshm_read(reader, 0, &slot) || slot.connection_id != 0x1234 || slot.stats.rx_packets != 16 ||
+            statshm_read(reader, 1, &slot)) {
+        dbg_error("published slot was not read back\n");
+        rc = TEST_FAILURE;
+    }
+    writer->slots[0].seq += 1;
+    if (statshm_read(reader, 0, &slot)) {
+        dbg_error("slot was read while it was being written\n");
+        rc = TEST_FAILURE;
+    }
+
+    // A live publisher's segment isn't taken over, one whose publisher is gone is
+    if (statshm_create(name, 2) != NULL) {
+        dbg_error("stats segment of a live publisher was taken over\n");
+        rc = TEST_FAILURE;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        _exit(0);
+    }
+    waitpid(child, NULL, 0);
+    writer->header->pid = child;
+    LLNetStatsShm_t* replacement = statshm_create(name, 2);
+    if (replacement == NULL) {
+        dbg_error("stale stats segment was not replaced\n");
+        rc = TEST_FAILURE;
+    } else {
+        statshm_close(replacement);
+    }
+    statshm_close(reader);
+    statshm_close(writer);
+    if (statshm_open(name) != NULL) {
+        dbg_error("stats segment was not removed\n");
+        rc = TEST_FAILURE;
+    }
+
+    // A context publishes every connection on its own
+    _fixture_setup();
+    LLNetContext_t* svr = llnet_context_init();
+    if (llnet_context_publish_stats(svr, name) != 0) {
+        dbg_error("context could not publish its stats\n");
+        rc = TEST_FAILURE;
+    }
+    llnet_context_set_sample_period(svr, 1); // faster than the default, to keep the test short
+    AccepterConnection_t* accepter = llnet_connection_listen(llnet_connection_init_context(svr), t02_on_connect,
+        t02_svr_on_packet);
+
+    msleep(5); // give some time for the accepter to start up
+
+    WorkerConnection_t* worker1 = llnet_connection_connect(llnet_connection_init(), "localhost", t02_clnt_on_packet);
+    uint32_t value = 0x16;
+    IntermediateTLV_t pckt;
+    pckt.type = 0x30;
+    pckt.length = sizeof(uint32_t);
+    pckt.data = (uint8_t*) &value;
+    llnet_connection_send(worker1, np_TCP, &pckt);
+    arraylist_poll(t02_svr_pckts);
+
+    reader = statshm_open(name);
+    bool found = false;
+    for (size_t i = 0; reader != NULL && i < NUMBER_OF_POLLS && !found; i += 1) {
+        usleep(POLL_SLEEP_TIME * 10);
+        if (statshm_read(reader, 0, &slot) && slot.stats.rx_packets >= 1 && slot.sockets.sampled_ns != 0) {
+            found = true;
+        }
+    }
+    if (!found || reader->header->pid != (uint64_t) getpid()) {
+        dbg_error("connection was not published\n");
+        rc = TEST_FAILURE;
+    } else if (arraylist_size(t02_connections) != 1 ||
+            slot.connection_id != ((WorkerConnection_t*) arraylist_get(t02_connections, 0))->connection_id) {
+        dbg_error("wrong connection was published (id = 0x%08x)\n", slot.connection_id);
+        rc = TEST_FAILURE;
+    }
+    if (reader != NULL) {
+        statshm_close(reader);
+    }
+
+    // Sampling can be turned on and off from several threads at once
+    pthread_t toggler;
+    pthread_create(&toggler, NULL, &t16_toggle_sampling, (void*) svr);
+    t16_toggle_sampling((void*) svr);
+    pthread_join(toggler, NULL);
+    llnet_context_set_sample_period(svr, 0);
+    if (svr->sampler_started) {
+        dbg_error("sampler was left running\n");
+        rc = TEST_FAILURE;
+    }
+
+    // Clean up
+    llnet_connection_free((NetConnection_t*) worker1);
+    llnet_connection_free((NetConnection_t*) accepter);
+    llnet_context_free(svr);
+    if (statshm_open(name) != NULL) {
+        dbg_error("context did not remove its stats segment\n");
+        rc = TEST_FAILURE;
+    }
+    _fixture_teardown();
+
+    return rc;
+}
+
 /**
  * Entry point to the program
  */
@@ -388,6 +1809,20 @@ int main() {
     int error = 0;
     error += t01_creation();
     error += t02_send_data();
+    error += t03_compression();
+    error += t04_ratelimit();
+    error += t05_sharded_listen();
+    error += t06_contexts();
+    error += t07_send_async();
+    error += t08_reconnect();
+    error += t09_fec();
+    error += t10_bundling();
+    error += t11_reliable();
+    error += t12_udp_filter();
+    error += t13_client();
+    error += t14_estop_fast_path();
+    error += t15_socket_stats();
+    error += t16_stats_shm();
 
     // Tests finished, handle the error code
     if (error == TEST_SUCCESS) {
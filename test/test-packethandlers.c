@@ -6,7 +6,17 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <arpa/inet.h>
+#include <pthread.h>
 #include "../network/packethandlers.h"
+#include "../network/messagehandler.h"
+#include "../network/packetview.h"
+#include "../network/packetbatch.h"
+#include "../network/configstore.h"
+#include "../network/nulscan.h"
+#include "../network/keyintern.h"
+#include "../network/configknown.h"
+#include "../network/packetschema.h"
 #include "../network/packet.h"
 #include "../network/lowlevel.h"
 #include "../utils/dbgprint.h"
@@ -968,6 +978,901 @@ int t09_testDebugUnpacking()
     return errCount;
 }
 
+/**
+ * Makes a raw packet like the low-level network interface would hand up.
+ */
+static IntermediateTLV_t* makeRawPacket(uint8_t type, const uint8_t* data, uint32_t length)
+{
+    IntermediateTLV_t* packet = malloc(sizeof(IntermediateTLV_t));
+    packet->type = type;
+    packet->length = length;
+    packet->timestamp = 0xAAAAAAAA;
+    packet->data = malloc(length);
+    memcpy(packet->data, data, length);
+    return packet;
+}
+
+int t10_testUpdateStatusUnpacking()
+{
+    int errCount = 0;
+    const uint8_t updateStatusData[] = {sc_PERMISSION_DENIED, 0x01, 0x02, 0x03};
+    PacketTLV_t* unpackedPacket = unpackUpdateStatus(makeRawPacket(pt_UPDATE_STATUS, updateStatusData,
+            sizeof(updateStatusData)));
+    //Something failed in the function.  They system is probably out of memory
+    if (unpackedPacket == NULL) {
+        dbg_error("unpackUpdateStatus returned NULL!\n");
+        return 1;
+    }
+
+    //Check the header
+    if (unpackedPacket->type != pt_UPDATE_STATUS || unpackedPacket->timestamp != 0xAAAAAAAA ||
+            unpackedPacket->length != sizeof(updateStatusData)) {
+        dbg_error("unpackUpdateStatus returned an incorrect header!\n");
+        errCount++;
+    }
+
+    //Check the code and reserved fields
+    PTLVData_UPDATE_STATUS_t* unpackedData = (PTLVData_UPDATE_STATUS_t*)unpackedPacket->data;
+    if (unpackedData->code != sc_PERMISSION_DENIED || unpackedData->reserved != 0x010203) {
+        dbg_error("unpackUpdateStatus returned incorrect data!\n");
+        errCount++;
+    }
+    destroyUpdateStatus(unpackedPacket);
+    return errCount;
+}
+
+static uint32_t dispatchHandled = 0;
+static uint32_t dispatchLastId = 0;
+
+/**
+ * Handler for the dispatch test, checks the packet was unpacked before it got here.
+ */
+static void t11_initHandler(uint32_t connectionId, PacketTLV_t* packet)
+{
+    if (packet->type == pt_INIT && ((PTLVData_INIT_t*)packet->data)->robot_uuid == knownGoodInit.robot_uuid) {
+        dispatchHandled++;
+    }
+    dispatchLastId = connectionId;
+    mh_destroy_packet(packet);
+}
+
+int t11_testMessageDispatch()
+{
+    int errCount = 0;
+    if (mh_init() != MH_SUCCESS || mh_init() != MH_ERR_ALREADY_INITIALIZED) {
+        dbg_error("mh_init returned the wrong code!\n");
+        errCount++;
+    }
+
+    //Without a handler, packets wait in the bucket for their type
+    mh_sort_packet(1, makeRawPacket(pt_USER_DATA, USER_DATA_DATA, sizeof(USER_DATA_DATA)));
+    PacketTLV_t* packet = mh_get_packet(pt_USER_DATA);
+    if (packet == NULL || packet->type != pt_USER_DATA || mh_get_packet(pt_USER_DATA) != NULL ||
+            ((PTLVData_USER_DATA_t*)packet->data)->controller_uuid != knownGoodUserData.controller_uuid) {
+        dbg_error("USER_DATA packet was not put in its bucket!\n");
+        errCount++;
+    }
+    if (packet != NULL) {
+        mh_destroy_packet(packet);
+    }
+
+    //With a handler, packets skip the bucket
+    if (mh_set_handler(pt_INIT, t11_initHandler) != MH_SUCCESS) {
+        dbg_error("could not set the INIT handler!\n");
+        errCount++;
+    }
+    mh_sort_packet(7, makeRawPacket(pt_INIT, INIT_DATA, sizeof(INIT_DATA)));
+    if (dispatchHandled != 1 || dispatchLastId != 7 || mh_get_packet(pt_INIT) != NULL) {
+        dbg_error("INIT packet was not given to its handler!\n");
+        errCount++;
+    }
+
+    //Unknown types are counted and dropped
+    if (mh_set_handler((PacketType_t)0x55, t11_initHandler) != MH_ERR_UNKNOWN_TYPE) {
+        dbg_error("handler was set for an unknown type!\n");
+        errCount++;
+    }
+    mh_sort_packet(1, makeRawPacket(0x55, INIT_DATA, sizeof(INIT_DATA)));
+    mh_sort_packet(1, makeRawPacket(0xfe, INIT_DATA, sizeof(INIT_DATA)));
+    if (mh_get_unknown_count() != 2) {
+        dbg_error("unknown packets were not counted (count = %lu)!\n", mh_get_unknown_count());
+        errCount++;
+    }
+
+    //Anything left in a bucket is cleaned up
+    mh_sort_packet(1, makeRawPacket(pt_UPDATE_STATUS, INIT_DATA, sizeof(INIT_DATA)));
+    mh_free();
+    if (mh_get_packet(pt_UPDATE_STATUS) != NULL || mh_get_unknown_count() != 0) {
+        dbg_error("mh_free did not clean up!\n");
+        errCount++;
+    }
+    return errCount;
+}
+
+int t12_testPacketViews()
+{
+    int errCount = 0;
+    PacketView_t view;
+
+    //Fixed fields and arbitrary data are read in place
+    setup(pt_STATE_RESPONSE);
+    PTLVData_STATE_RESPONSE_t stateResponse;
+    uint32_t arbitraryLen = 0;
+    if (!pview_init(&view, stateResponsePacket, true) ||
+            !pview_get_state_response(&view, &stateResponse, &arbitraryLen)) {
+        dbg_error("could not view STATE_RESPONSE packet!\n");
+        errCount++;
+    } else if (stateResponse.state != knownGoodStateResponse.state ||
+            stateResponse.reserved != knownGoodStateResponse.reserved ||
+            arbitraryLen != sizeof(STATE_RESPONSE_DATA) - 4 || stateResponse.arbitrary != view.data + 4 ||
+            memcmp(stateResponse.arbitrary, knownGoodStateResponse.arbitrary, arbitraryLen) != 0) {
+        dbg_error("STATE_RESPONSE view returned incorrect data!\n");
+        errCount++;
+    }
+    if (pview_get_init(&view, NULL)) {
+        dbg_error("STATE_RESPONSE was viewed as an INIT packet!\n");
+        errCount++;
+    }
+    pview_release(&view);
+    teardown(pt_STATE_RESPONSE);
+
+    setup(pt_DEBUG);
+    PTLVData_DEBUG_t debug;
+    if (!pview_init(&view, debugPacket, true) || !pview_get_debug(&view, &debug, &arbitraryLen) ||
+            debug.code_status != knownGoodDebug.code_status || debug.commit_hash != knownGoodDebug.commit_hash ||
+            debug.robot_uuid != knownGoodDebug.robot_uuid || debug.config_entries != knownGoodDebug.config_entries ||
+            arbitraryLen != sizeof(DEBUG_DATA) - 12 ||
+            memcmp(debug.arbitrary, knownGoodDebug.arbitrary, arbitraryLen) != 0) {
+        dbg_error("DEBUG view returned incorrect data!\n");
+        errCount++;
+    }
+    pview_release(&view);
+    teardown(pt_DEBUG);
+
+    //Keys are iterated in place
+    setup(pt_CONFIG_REQUEST);
+    PViewStringIter_t strings;
+    unsigned int keyCount = 0;
+    if (!pview_init(&view, configRequestPacket, false) || !pview_strings_begin(&view, &strings)) {
+        dbg_error("could not view CONFIG_REQUEST packet!\n");
+        errCount++;
+    } else {
+        const char* key;
+        size_t keyLen;
+        while ((key = pview_strings_next(&strings, &keyLen)) != NULL) {
+            if (keyCount >= numConfigKeys || strcmp(key, CONFIG_KEYS[keyCount]) != 0 ||
+                    keyLen != strlen(CONFIG_KEYS[keyCount])) {
+                dbg_error("CONFIG_REQUEST view returned incorrect key %u!\n", keyCount);
+                errCount++;
+            }
+            keyCount++;
+        }
+    }
+    if (keyCount != numConfigKeys || pview_detach(&view) != NULL) {
+        dbg_error("CONFIG_REQUEST view returned %u keys!\n", keyCount);
+        errCount++;
+    }
+    //The view borrowed the packet, so it's still ours
+    llnet_packet_free(configRequestPacket);
+    teardown(pt_CONFIG_REQUEST);
+
+    //Pairs are decoded as they are iterated
+    setup(pt_CONFIG_RESPONSE);
+    PViewKVIter_t pairs;
+    PViewKV_t kv;
+    unsigned int pairCount = 0;
+    if (!pview_init(&view, configResponsePacket, true) || !pview_kv_begin(&view, &pairs)) {
+        dbg_error("could not view CONFIG_RESPONSE packet!\n");
+        errCount++;
+    } else {
+        while (pview_kv_next(&pairs, &kv)) {
+            KVPairTLV_t* knownGood = list_get(knownGoodConfigResponse.pairs, min(pairCount, 2u));
+            KVPair_Value_u value;
+            bool same = pview_kv_value(&kv, &value) && pairCount < 3 && strcmp(kv.key, knownGood->key) == 0 &&
+                    kv.type == knownGood->type && kv.value_length + 4 == knownGood->length;
+            if (same && kv.type == kv_Integer) {
+                same = value.Integer == knownGood->value.Integer;
+            } else if (same && kv.type == kv_Boolean) {
+                same = value.Boolean == knownGood->value.Boolean;
+            } else if (same && kv.type == kv_CString) {
+                same = strcmp(value.CString, knownGood->value.CString) == 0;
+            }
+            if (!same) {
+                dbg_error("CONFIG_RESPONSE view returned incorrect pair %u!\n", pairCount);
+                errCount++;
+            }
+            pairCount++;
+        }
+    }
+    if (pairCount != 3 || pairs.malformed) {
+        dbg_error("CONFIG_RESPONSE view returned %u pairs!\n", pairCount);
+        errCount++;
+    }
+    pview_release(&view);
+    teardown(pt_CONFIG_RESPONSE);
+
+    //Packets that are too short, or lists that run off the end, are caught
+    IntermediateTLV_t* shortPacket = makeRawPacket(pt_USER_DATA, USER_DATA_DATA, 4);
+    if (pview_init(&view, shortPacket, true)) {
+        dbg_error("short USER_DATA packet was viewed!\n");
+        errCount++;
+    }
+    llnet_packet_free(shortPacket);
+    IntermediateTLV_t* truncated = makeRawPacket(pt_CONFIG_UPDATE, CONFIG_UPDATE_DATA, 40);
+    pview_init(&view, truncated, true);
+    pview_kv_begin(&view, &pairs);
+    pairCount = 0;
+    while (pview_kv_next(&pairs, &kv)) {
+        pairCount++;
+    }
+    if (pairCount != 2 || !pairs.malformed) {
+        dbg_error("truncated CONFIG_UPDATE was not caught (pairs = %u)!\n", pairCount);
+        errCount++;
+    }
+    pview_release(&view);
+
+    //Pairs read straight from memory get the same checks, and stop at the limit
+    const char* kvStart = (const char*)CONFIG_UPDATE_DATA;
+    char* kvEnd = NULL;
+    KVPairTLV_t* fromMemory = KVPairTLV_createFromMemory(kvStart, kvStart + sizeof(CONFIG_UPDATE_DATA), &kvEnd);
+    if (fromMemory == NULL || strcmp(fromMemory->key, "test_key") || fromMemory->type != kv_Integer ||
+            kvEnd != kvStart + 17) {
+        dbg_error("pair was not read from memory!\n");
+        errCount++;
+    }
+    if (fromMemory != NULL) {
+        KVPairTLV_destroy(fromMemory);
+    }
+    if (KVPairTLV_createFromMemory(kvStart, kvStart + 15, &kvEnd) != NULL || kvEnd != NULL) {
+        dbg_error("pair running past the limit was read from memory!\n");
+        errCount++;
+    }
+    const char shortPair[] = {'k', 0x00, kv_Integer, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00};
+    if (KVPairTLV_createFromMemory(shortPair, shortPair + sizeof(shortPair), &kvEnd) != NULL || kvEnd != NULL) {
+        dbg_error("pair shorter than its header was read from memory!\n");
+        errCount++;
+    }
+    return errCount;
+}
+
+/**
+ * Checks a packed frame against the bytes the unpacking tests use.
+ * @return 0 if the frame matches, 1 if not
+ */
+static int checkPackedFrame(const char* name, PacketType_t type, const uint8_t* frame, uint32_t frameLength,
+        const uint8_t* expected, uint32_t expectedLength)
+{
+    uint32_t word;
+    memcpy(&word, frame, sizeof(uint32_t));
+    word = ntohl(word);
+    if(frameLength != LLNET_HEADER_LENGTH + expectedLength || (word >> 24) != type ||
+            (word & LLNET_LENGTH_MASK) != expectedLength ||
+            memcmp(frame + LLNET_HEADER_LENGTH, expected, expectedLength) != 0)
+    {
+        dbg_error("%s packed incorrectly (frame length = %u)!\n", name, frameLength);
+        return 1;
+    }
+    return 0;
+}
+
+int t13_testPacking()
+{
+    int errCount = 0;
+    uint8_t frame[128];
+
+    //Packing the known-good structures should give back the bytes they were unpacked from
+    errCount += checkPackedFrame("USER_DATA", pt_USER_DATA, frame, packUserData(&knownGoodUserData, frame,
+            sizeof(frame)), USER_DATA_DATA, sizeof(USER_DATA_DATA));
+
+    setup(pt_STATE_RESPONSE);
+    uint32_t arbitraryLen = sizeof(STATE_RESPONSE_DATA) - 4;
+    uint32_t frameLen = packStateResponse(&knownGoodStateResponse, arbitraryLen, frame, sizeof(frame));
+    errCount += checkPackedFrame("STATE_RESPONSE", pt_STATE_RESPONSE, frame, frameLen, STATE_RESPONSE_DATA,
+            sizeof(STATE_RESPONSE_DATA));
+    if(packedLength(pt_STATE_RESPONSE, (PTLVData_Base_t*)&knownGoodStateResponse, arbitraryLen) != frameLen)
+    {
+        dbg_error("packedLength disagrees with packStateResponse!\n");
+        errCount++;
+    }
+    //A buffer one byte short is refused
+    if(packStateResponse(&knownGoodStateResponse, arbitraryLen, frame, frameLen - 1) != 0)
+    {
+        dbg_error("packStateResponse wrote past the end of the buffer!\n");
+        errCount++;
+    }
+    llnet_packet_free(stateResponsePacket);
+    teardown(pt_STATE_RESPONSE);
+
+    setup(pt_DEBUG);
+    frameLen = packDebug(&knownGoodDebug, sizeof(DEBUG_DATA) - 12, frame, sizeof(frame));
+    errCount += checkPackedFrame("DEBUG", pt_DEBUG, frame, frameLen, DEBUG_DATA, sizeof(DEBUG_DATA));
+    llnet_packet_free(debugPacket);
+    teardown(pt_DEBUG);
+
+    //Lists are padded out the same way as the test data
+    setup(pt_CONFIG_REQUEST);
+    frameLen = packConfigRequest(&knownGoodConfigRequest, frame, sizeof(frame));
+    errCount += checkPackedFrame("CONFIG_REQUEST", pt_CONFIG_REQUEST, frame, frameLen, CONFIG_REQUEST_DATA,
+            sizeof(CONFIG_REQUEST_DATA));
+    llnet_packet_free(configRequestPacket);
+    teardown(pt_CONFIG_REQUEST);
+
+    setup(pt_CONFIG_RESPONSE);
+    frameLen = packConfigResponse(&knownGoodConfigResponse, frame, sizeof(frame));
+    errCount += checkPackedFrame("CONFIG_RESPONSE", pt_CONFIG_RESPONSE, frame, frameLen, CONFIG_RESPONSE_DATA,
+            sizeof(CONFIG_RESPONSE_DATA));
+    if(packedLength(pt_CONFIG_RESPONSE, (PTLVData_Base_t*)&knownGoodConfigResponse, 0) != frameLen)
+    {
+        dbg_error("packedLength disagrees with packConfigResponse!\n");
+        errCount++;
+    }
+    llnet_packet_free(configResponsePacket);
+    teardown(pt_CONFIG_RESPONSE);
+
+    //Packed frames round trip through the unpackers
+    PTLVData_UPDATE_STATUS_t status = {sc_PERMISSION_DENIED, 0x010203};
+    frameLen = packUpdateStatus(&status, frame, sizeof(frame));
+    PacketTLV_t* unpacked = unpackUpdateStatus(makeRawPacket(pt_UPDATE_STATUS, frame + LLNET_HEADER_LENGTH,
+            frameLen - LLNET_HEADER_LENGTH));
+    PTLVData_UPDATE_STATUS_t* unpackedStatus = (PTLVData_UPDATE_STATUS_t*)unpacked->data;
+    if(unpackedStatus->code != status.code || unpackedStatus->reserved != status.reserved)
+    {
+        dbg_error("UPDATE_STATUS did not round trip!\n");
+        errCount++;
+    }
+    destroyUpdateStatus(unpacked);
+
+    PTLVData_INIT_t init = {0x12345678};
+    frameLen = packInit(&init, frame, sizeof(frame));
+    unpacked = unpackInit(makeRawPacket(pt_INIT, frame + LLNET_HEADER_LENGTH, frameLen - LLNET_HEADER_LENGTH));
+    if(((PTLVData_INIT_t*)unpacked->data)->robot_uuid != init.robot_uuid)
+    {
+        dbg_error("INIT did not round trip!\n");
+        errCount++;
+    }
+    destroyInit(unpacked);
+
+    if(packStateRequest(frame, sizeof(frame)) != LLNET_HEADER_LENGTH || frame[0] != pt_STATE_REQUEST)
+    {
+        dbg_error("STATE_REQUEST packed incorrectly!\n");
+        errCount++;
+    }
+
+    //Pools hand out every buffer once, then nothing until one comes back
+    PackPool_t* pool = packPoolInit(2, 64);
+    uint8_t* first = packPoolTake(pool);
+    uint8_t* second = packPoolTake(pool);
+    if(first == NULL || second == NULL || first == second || packPoolTake(pool) != NULL)
+    {
+        dbg_error("pack pool handed out the wrong buffers!\n");
+        errCount++;
+    }
+    packPoolGive(pool, first);
+    if(packPoolTake(pool) != first)
+    {
+        dbg_error("pack pool did not reuse a buffer!\n");
+        errCount++;
+    }
+    packPoolGive(pool, first);
+    packPoolGive(pool, second);
+    packPoolFree(pool);
+    return errCount;
+}
+
+int t14_testConfigStore()
+{
+    int errCount = 0;
+    PacketView_t view;
+
+    //The test response decodes into typed lookups
+    setup(pt_CONFIG_RESPONSE);
+    pview_init(&view, configResponsePacket, true);
+    ConfigStore_t* store = config_store_from_view(&view);
+    pview_release(&view);
+    teardown(pt_CONFIG_RESPONSE);
+    if(store == NULL || store->count != 3)
+    {
+        dbg_error("could not build a config store from CONFIG_RESPONSE!\n");
+        return errCount + 1;
+    }
+    int32_t intValue = 0;
+    bool boolValue = true;
+    const char* stringValue = config_store_get_string(store, "test_key3");
+    if(!config_store_get_int(store, "test_key", &intValue) || intValue != 0x55000055 ||
+            !config_store_get_bool(store, "test_key2", &boolValue) || boolValue ||
+            stringValue == NULL || strcmp(stringValue, "Hello, world") != 0)
+    {
+        dbg_error("config store returned incorrect values!\n");
+        errCount++;
+    }
+    //Missing keys and the wrong type are both misses
+    if(config_store_find(store, "test_key4") != CONFIG_STORE_NOT_FOUND ||
+            config_store_get_int(store, "test_key2", &intValue) || config_store_get_string(store, "test_key") != NULL)
+    {
+        dbg_error("config store found a value that isn't there!\n");
+        errCount++;
+    }
+    config_store_free(store);
+
+    //Enough keys to probe past collisions, with the first key repeated at the end
+    ArrayList_t* pairs = arraylist_init();
+    char key[32];
+    for(int i = 0; i < 100; i++)
+    {
+        KVPair_Value_u value;
+        value.Double = i * 0.5;
+        snprintf(key, sizeof(key), "key_%d", i);
+        arraylist_add(pairs, KVPairTLV_create(key, kv_Double, 12, value));
+    }
+    KVPair_Value_u repeated;
+    repeated.Double = -1.0;
+    arraylist_add(pairs, KVPairTLV_create("key_0", kv_Double, 12, repeated));
+    PTLVData_CONFIG_UPDATE_t update = {(List_t*)pairs};
+    uint32_t frameLen = packedLength(pt_CONFIG_UPDATE, (PTLVData_Base_t*)&update, 0);
+    uint8_t* frame = malloc(frameLen);
+    packConfigUpdate(&update, frame, frameLen);
+    IntermediateTLV_t* raw = makeRawPacket(pt_CONFIG_UPDATE, frame + LLNET_HEADER_LENGTH, frameLen - LLNET_HEADER_LENGTH);
+    free(frame);
+    for(unsigned int i = 0; i < arraylist_size(pairs); i++)
+    {
+        KVPairTLV_destroy(arraylist_get(pairs, i));
+    }
+    arraylist_free(pairs);
+
+    pview_init(&view, raw, true);
+    store = config_store_from_view(&view);
+    pview_release(&view);
+    if(store == NULL)
+    {
+        dbg_error("could not build a config store from CONFIG_UPDATE!\n");
+        return errCount + 1;
+    }
+    double doubleValue = 0;
+    if(!config_store_get_double(store, "key_0", &doubleValue) || doubleValue != -1.0)
+    {
+        dbg_error("config store did not keep the last value of a repeated key!\n");
+        errCount++;
+    }
+    for(int i = 1; i < 100; i++)
+    {
+        snprintf(key, sizeof(key), "key_%d", i);
+        if(!config_store_get_double(store, key, &doubleValue) || doubleValue != i * 0.5)
+        {
+            dbg_error("config store returned an incorrect value for %s!\n", key);
+            errCount++;
+            break;
+        }
+    }
+    config_store_free(store);
+    return errCount;
+}
+
+int t15_testNulScan()
+{
+    int errCount = 0;
+    //Odd length so every implementation ends in its byte-at-a-time tail, allocated exactly so overreads show up
+    const uint32_t length = 1001;
+    uint8_t* data = malloc(length);
+    uint32_t expected[1001];
+    uint32_t expectedCount = 0;
+    srand(45);
+    for(uint32_t i = 0; i < length; i++)
+    {
+        data[i] = (rand() % 7 == 0) ? 0 : (uint8_t)(1 + rand() % 255);
+        if(data[i] == 0)
+        {
+            expected[expectedCount++] = i;
+        }
+    }
+
+    const NulScanImpl_t impls[] = {nsi_SCALAR, nsi_SSE2, nsi_AVX2};
+    for(unsigned int k = 0; k < sizeof(impls) / sizeof(impls[0]); k++)
+    {
+        NulScanImpl_t impl = nulscan_set_impl(impls[k]);
+        //Scan in small chunks, so resuming part way through a block is covered
+        uint32_t offsets[5];
+        uint32_t found;
+        uint32_t total = 0;
+        uint32_t start = 0;
+        do
+        {
+            found = nulscan(data, start, length, offsets, 5);
+            for(uint32_t i = 0; i < found; i++)
+            {
+                if(total >= expectedCount || offsets[i] != expected[total])
+                {
+                    dbg_error("nulscan (impl %d) found a nul at %u that isn't there!\n", impl, offsets[i]);
+                    errCount++;
+                    break;
+                }
+                total++;
+            }
+            if(found > 0)
+            {
+                start = offsets[found - 1] + 1;
+            }
+        } while(found == 5);
+        if(total != expectedCount)
+        {
+            dbg_error("nulscan (impl %d) found %u of %u nuls!\n", impl, total, expectedCount);
+            errCount++;
+        }
+
+        //The first nul, and a range with none in it
+        if(nulscan_find(data, data + length) != data + expected[0] ||
+                nulscan_find(data, data + expected[0]) != NULL)
+        {
+            dbg_error("nulscan_find (impl %d) returned the wrong nul!\n", impl);
+            errCount++;
+        }
+    }
+    nulscan_set_impl(nsi_AUTO);
+    free(data);
+
+    //A CONFIG_REQUEST with an unterminated last key keeps only the terminated ones
+    setup(pt_CONFIG_REQUEST);
+    PacketTLV_t* unpacked = unpackConfigRequest(makeRawPacket(pt_CONFIG_REQUEST, CONFIG_REQUEST_DATA, 28));
+    PTLVData_CONFIG_REQUEST_t* request = (PTLVData_CONFIG_REQUEST_t*)unpacked->data;
+    if(list_size(request->keys) != 2 || strcmp(list_get(request->keys, 1), CONFIG_KEYS[1]) != 0)
+    {
+        dbg_error("unterminated CONFIG_REQUEST key was not dropped (keys = %u)!\n", list_size(request->keys));
+        errCount++;
+    }
+    destroyConfigRequest(unpacked);
+    llnet_packet_free(configRequestPacket);
+    teardown(pt_CONFIG_REQUEST);
+    return errCount;
+}
+
+#define INTERN_THREADS 4
+#define INTERN_KEYS 3000
+
+//Each thread interns the same keys, starting at a different place, and records the ids it got
+static uint32_t internIds[INTERN_THREADS][INTERN_KEYS];
+
+static void* internWorker(void* arg)
+{
+    int thread = (int)(intptr_t)arg;
+    char key[32];
+    for(int n = 0; n < INTERN_KEYS; n++)
+    {
+        int i = (n + thread * (INTERN_KEYS / INTERN_THREADS)) % INTERN_KEYS;
+        int len = snprintf(key, sizeof(key), "intern_test.key_%d", i);
+        internIds[thread][i] = intern_key(key, len);
+    }
+    return NULL;
+}
+
+int t16_testKeyInterning()
+{
+    int errCount = 0;
+
+    //Racing threads must agree on every id, across the index growing several times
+    pthread_t threads[INTERN_THREADS];
+    for(int t = 0; t < INTERN_THREADS; t++)
+    {
+        pthread_create(&threads[t], NULL, internWorker, (void*)(intptr_t)t);
+    }
+    for(int t = 0; t < INTERN_THREADS; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+    char key[32];
+    for(int i = 0; i < INTERN_KEYS; i++)
+    {
+        int len = snprintf(key, sizeof(key), "intern_test.key_%d", i);
+        uint32_t id = internIds[0][i];
+        const char* name = intern_name(id);
+        if(id == INTERN_NONE || name == NULL || strcmp(name, key) != 0 || intern_find(key, len) != id)
+        {
+            dbg_error("interned key %s has the wrong id or name!\n", key);
+            errCount++;
+            break;
+        }
+        for(int t = 1; t < INTERN_THREADS; t++)
+        {
+            if(internIds[t][i] != id)
+            {
+                dbg_error("threads got different ids for %s!\n", key);
+                errCount++;
+                break;
+            }
+        }
+    }
+    //A key is only a match at its full length
+    if(intern_find("intern_test.key_1", 16) != INTERN_NONE || intern_find("intern_test.not_a_key", 21) != INTERN_NONE ||
+            intern_name(INTERN_NONE) != NULL || intern_name(intern_count() + 1) != NULL)
+    {
+        dbg_error("interning found a key that was never added!\n");
+        errCount++;
+    }
+
+    //Decoded pairs share the canonical key with pairs made by hand
+    setup(pt_CONFIG_RESPONSE);
+    PacketTLV_t* unpacked = unpackConfigResponse(configResponsePacket);
+    PTLVData_CONFIG_RESPONSE_t* response = (PTLVData_CONFIG_RESPONSE_t*)unpacked->data;
+    for(unsigned int i = 0; i < list_size(response->pairs); i++)
+    {
+        KVPairTLV_t* pair = list_get(response->pairs, i);
+        KVPairTLV_t* known = list_get(knownGoodConfigResponse.pairs, i);
+        KVPairTLV_t* made = KVPairTLV_create(CONFIG_KEYS[i], known->type, known->length, known->value);
+        if(!intern_owns(pair->key) || pair->key != made->key || !KVPairTLV_equals(pair, made))
+        {
+            dbg_error("decoded key %s was not interned!\n", pair->key);
+            errCount++;
+        }
+        KVPairTLV_destroy(made);
+    }
+    destroyConfigResponse(unpacked);
+    teardown(pt_CONFIG_RESPONSE);
+
+    //Keys from a list that turns out to be malformed aren't kept
+    uint8_t malformed[] = {
+        'i', 'n', 't', 'e', 'r', 'n', '_', 't', 'e', 's', 't', '.', 'b', 'a', 'd', '\0',
+        kv_Integer, 0x00, 0x00, 0x08, 0x01, 0x00, 0x00, 0x00, ';',
+        'x', '\0', kv_Integer, 0x00, 0x00, 0x08, 0x01
+    };
+    PacketTLV_t* bad = unpackConfigResponse(makeRawPacket(pt_CONFIG_RESPONSE, malformed, sizeof(malformed)));
+    if(intern_find("intern_test.bad", 15) != INTERN_NONE)
+    {
+        dbg_error("a malformed list's keys were interned!\n");
+        errCount++;
+    }
+    if(bad != NULL)
+    {
+        destroyConfigResponse(bad);
+    }
+
+    //Long keys are copied instead, and the copy is still the pair's to free
+    char longKey[INTERN_MAX_KEY_LENGTH + 2];
+    memset(longKey, 'k', sizeof(longKey) - 1);
+    longKey[sizeof(longKey) - 1] = '\0';
+    KVPair_Value_u value;
+    value.Integer = 1;
+    KVPairTLV_t* longPair = KVPairTLV_create(longKey, kv_Integer, 8, value);
+    if(intern_find(longKey, strlen(longKey)) != INTERN_NONE || intern_owns(longPair->key) ||
+            strcmp(longPair->key, longKey) != 0)
+    {
+        dbg_error("a long key was interned!\n");
+        errCount++;
+    }
+    KVPairTLV_destroy(longPair);
+    return errCount;
+}
+
+int t17_testKnownConfigKeys()
+{
+    int errCount = 0;
+
+    //Every declared key hashes to itself, and near misses hash to nothing
+    for(int i = 0; i < CONFIG_KNOWN_COUNT; i++)
+    {
+        const char* key = config_known_key((ConfigKnownKey_t)i);
+        if(config_known_find(key, strlen(key)) != i || config_known_find(key, strlen(key) - 1) != CONFIG_KNOWN_NONE)
+        {
+            dbg_error("known key %s was not found in its slot!\n", key);
+            errCount++;
+        }
+    }
+    if(config_known_find("robot.namex", 11) != CONFIG_KNOWN_NONE || config_known_find("test_key", 8) != CONFIG_KNOWN_NONE)
+    {
+        dbg_error("an unknown key was found!\n");
+        errCount++;
+    }
+
+    //An update with one of each type, an unknown key, and a known key with the wrong type
+    ArrayList_t* pairs = arraylist_init();
+    KVPair_Value_u value;
+    value.Boolean = 1;
+    arraylist_add(pairs, KVPairTLV_create("fms.disconnect_detect", kv_Boolean, 5, value));
+    value.Float = 5.0f;
+    arraylist_add(pairs, KVPairTLV_create("fms.state_request_period", kv_Float, 8, value));
+    value.CString = "Optimus";
+    arraylist_add(pairs, KVPairTLV_create("robot.name", kv_CString, 12, value));
+    value.Integer = 2020;
+    arraylist_add(pairs, KVPairTLV_create("robot.team", kv_Integer, 8, value));
+    value.Double = 150.0;
+    arraylist_add(pairs, KVPairTLV_create("game.match_length", kv_Double, 12, value));
+    value.Integer = 7;
+    arraylist_add(pairs, KVPairTLV_create("arm.speed", kv_Integer, 8, value));
+    value.Float = 1.0f;
+    arraylist_add(pairs, KVPairTLV_create("game.alliance", kv_Float, 8, value));
+    PTLVData_CONFIG_UPDATE_t update = {(List_t*)pairs};
+    uint32_t frameLen = packedLength(pt_CONFIG_UPDATE, (PTLVData_Base_t*)&update, 0);
+    uint8_t* frame = malloc(frameLen);
+    packConfigUpdate(&update, frame, frameLen);
+    for(unsigned int i = 0; i < arraylist_size(pairs); i++)
+    {
+        KVPairTLV_destroy(arraylist_get(pairs, i));
+    }
+    arraylist_free(pairs);
+
+    ConfigKnown_t known;
+    ConfigStore_t* others = NULL;
+    PacketView_t view;
+    config_known_init(&known);
+    IntermediateTLV_t* raw = makeRawPacket(pt_CONFIG_UPDATE, frame + LLNET_HEADER_LENGTH, frameLen - LLNET_HEADER_LENGTH);
+    pview_init(&view, raw, true);
+    if(!config_known_apply(&known, &view, &others))
+    {
+        dbg_error("config_known_apply rejected a good CONFIG_UPDATE!\n");
+        errCount++;
+    }
+    pview_release(&view);
+    if(!known.present[ck_disconnect_detect] || !known.disconnect_detect || known.state_request_period != 5.0f ||
+            known.robot_name == NULL || strcmp(known.robot_name, "Optimus") != 0 || known.team_number != 2020 ||
+            known.match_length != 150.0)
+    {
+        dbg_error("known config values were decoded incorrectly!\n");
+        errCount++;
+    }
+    //The unknown key and the mistyped one go to the store instead
+    int32_t speed = 0;
+    float alliance = 0;
+    if(known.present[ck_alliance] || others == NULL || !config_store_get_int(others, "arm.speed", &speed) || speed != 7 ||
+            !config_store_get_float(others, "game.alliance", &alliance))
+    {
+        dbg_error("unknown config keys did not fall back to a config store!\n");
+        errCount++;
+    }
+    config_store_free(others);
+
+    //A truncated list changes nothing
+    raw = makeRawPacket(pt_CONFIG_UPDATE, frame + LLNET_HEADER_LENGTH, 20);
+    pview_init(&view, raw, true);
+    if(config_known_apply(&known, &view, &others) || others != NULL || strcmp(known.robot_name, "Optimus") != 0)
+    {
+        dbg_error("config_known_apply accepted a truncated CONFIG_UPDATE!\n");
+        errCount++;
+    }
+    pview_release(&view);
+    free(frame);
+    config_known_clear(&known);
+    return errCount;
+}
+
+int t18_testPacketSchema()
+{
+    int errCount = 0;
+    uint8_t payload[12];
+
+    //Every field at its widest, so a mask or shift that's off by one shows up
+    PTLVData_DEBUG_t debug = {0};
+    debug.code_status = 0x0F;
+    debug.commit_hash = 0x0FFFFFFF;
+    debug.robot_uuid = 0x12345678;
+    debug.state = rs_E_STOPPED;
+    debug.reserved = 0xA5;
+    debug.config_entries = 0xBEEF;
+    PTLVData_DEBUG_t debugOut = {0};
+    pschema_encode_DEBUG(&debug, payload);
+    if(payload[0] != 0xFF || payload[3] != 0xFF || payload[10] != 0xBE || payload[11] != 0xEF ||
+            !pschema_decode_DEBUG(payload, 12, &debugOut) || debugOut.code_status != debug.code_status ||
+            debugOut.commit_hash != debug.commit_hash || debugOut.robot_uuid != debug.robot_uuid ||
+            debugOut.state != debug.state || debugOut.reserved != debug.reserved ||
+            debugOut.config_entries != debug.config_entries)
+    {
+        dbg_error("DEBUG fields did not survive the schema codecs!\n");
+        errCount++;
+    }
+
+    //Fields that share a byte don't clobber each other
+    PTLVData_USER_DATA_t user = {0xFF, 0x01, 0x80, 0x7F, false, true, 0x8001};
+    PTLVData_USER_DATA_t userOut;
+    memset(payload, 0xFF, sizeof(payload));
+    pschema_encode_USER_DATA(&user, payload);
+    if(payload[4] != 0x40 || payload[5] != 0x00 || !pschema_decode_USER_DATA(payload, 8, &userOut) ||
+            userOut.left_stick_x != 0xFF || userOut.right_stick_y != 0x7F || userOut.button_a || !userOut.button_b ||
+            userOut.controller_uuid != 0x8001)
+    {
+        dbg_error("USER_DATA fields did not survive the schema codecs!\n");
+        errCount++;
+    }
+
+    //Payloads too short for their fixed fields are rejected, not read past
+    PTLVData_UPDATE_STATUS_t status;
+    if(pschema_decode_USER_DATA(payload, 7, &userOut) || pschema_decode_DEBUG(payload, 11, &debugOut) ||
+            pschema_decode_UPDATE_STATUS(payload, 3, &status))
+    {
+        dbg_error("schema decoders accepted a short payload!\n");
+        errCount++;
+    }
+    if(unpackUserData(makeRawPacket(pt_USER_DATA, USER_DATA_DATA, 6)) != NULL ||
+            unpackDebug(makeRawPacket(pt_DEBUG, payload, 8)) != NULL)
+    {
+        dbg_error("unpacking a short packet did not fail!\n");
+        errCount++;
+    }
+
+    //The packers and views agree with the schema's lengths
+    uint32_t fixedLength;
+    PSchemaTrailing_t trailing;
+    if(!pschema_layout(pt_DEBUG, &fixedLength, &trailing) || fixedLength != 12 || trailing != pst_ARBITRARY ||
+            packedLength(pt_DEBUG, (PTLVData_Base_t*)&debug, 5) != LLNET_HEADER_LENGTH + 17 ||
+            pschema_layout(0x99, &fixedLength, &trailing))
+    {
+        dbg_error("schema layout does not match the packers!\n");
+        errCount++;
+    }
+    return errCount;
+}
+
+int t19_testPacketBatch()
+{
+    int errCount = 0;
+    uint8_t otherUserData[8];
+    memcpy(otherUserData, USER_DATA_DATA, sizeof(otherUserData));
+    otherUserData[0] = 0x12;
+
+    //Columns of two, so the third USER_DATA doesn't fit
+    IntermediateTLV_t* packets[] = {
+        makeRawPacket(pt_USER_DATA, USER_DATA_DATA, sizeof(USER_DATA_DATA)),
+        makeRawPacket(pt_STATE_RESPONSE, STATE_RESPONSE_DATA, sizeof(STATE_RESPONSE_DATA)),
+        makeRawPacket(pt_USER_DATA, USER_DATA_DATA, 6),
+        makeRawPacket(pt_CONFIG_REQUEST, CONFIG_REQUEST_DATA, sizeof(CONFIG_REQUEST_DATA)),
+        makeRawPacket(pt_USER_DATA, otherUserData, sizeof(otherUserData)),
+        NULL,
+        makeRawPacket(pt_USER_DATA, USER_DATA_DATA, sizeof(USER_DATA_DATA)),
+        makeRawPacket(pt_INIT, INIT_DATA, sizeof(INIT_DATA))
+    };
+    const uint32_t count = sizeof(packets) / sizeof(packets[0]);
+    const PBatchStatus_t expected[] = {pbs_DECODED, pbs_DECODED, pbs_SHORT, pbs_UNSUPPORTED, pbs_DECODED,
+        pbs_UNSUPPORTED, pbs_FULL, pbs_DECODED};
+    PBatchStatus_t status[sizeof(packets) / sizeof(packets[0])];
+    PacketBatch_t batch;
+    if(!pbatch_init(&batch, 2))
+    {
+        dbg_error("could not set up a batch!\n");
+        return 1;
+    }
+
+    if(pbatch_decode(&batch, packets, count, status) != 4 || memcmp(status, expected, sizeof(expected)) != 0)
+    {
+        dbg_error("batch statuses are wrong!\n");
+        errCount++;
+    }
+    //Every packet of a type sits in one column, in order, with where it came from
+    if(batch.user_data_count != 2 || batch.user_data_packets[0] != 0 || batch.user_data_packets[1] != 4 ||
+            batch.user_data[0].left_stick_x != knownGoodUserData.left_stick_x ||
+            batch.user_data[0].right_stick_y != knownGoodUserData.right_stick_y ||
+            batch.user_data[0].button_a != knownGoodUserData.button_a ||
+            batch.user_data[0].controller_uuid != knownGoodUserData.controller_uuid ||
+            batch.user_data[1].left_stick_x != 0x12 ||
+            batch.init_count != 1 || batch.init[0].robot_uuid != knownGoodInit.robot_uuid ||
+            batch.debug_count != 0)
+    {
+        dbg_error("batch columns are wrong!\n");
+        errCount++;
+    }
+    //Arbitrary data points into the packet rather than being copied
+    if(batch.state_response_count != 1 || batch.state_response[0].state != knownGoodStateResponse.state ||
+            batch.state_response[0].reserved != knownGoodStateResponse.reserved ||
+            batch.state_response[0].arbitrary != packets[1]->data + 4)
+    {
+        dbg_error("batched STATE_RESPONSE is wrong!\n");
+        errCount++;
+    }
+
+    //A reset empties the columns for the next tick, and positions start over
+    pbatch_reset(&batch);
+    if(pbatch_decode(&batch, &packets[6], 1, NULL) != 1 || batch.user_data_count != 1 ||
+            batch.user_data_packets[0] != 0 || batch.init_count != 0)
+    {
+        dbg_error("batch did not reset!\n");
+        errCount++;
+    }
+
+    pbatch_free(&batch);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        if(packets[i] != NULL)
+        {
+            llnet_packet_free(packets[i]);
+        }
+    }
+    return errCount;
+}
+
 int main()
 {
     // Run tests on both types of list
@@ -1063,6 +1968,98 @@ int main()
     }
     allErrors += error;
 
+    printf("Starting Test10!\n");
+    error = t10_testUpdateStatusUnpacking();
+    if(error == 0 ) {
+        printf("success!\n");
+    }
+    else {
+        printf("^^^ test errors\n");
+    }
+    allErrors += error;
+
+    printf("Starting Test11!\n");
+    error = t11_testMessageDispatch();
+    if(error == 0 ) {
+        printf("success!\n");
+    }
+    else {
+        printf("^^^ test errors\n");
+    }
+    allErrors += error;
+    printf("Starting Test12!\n");
+    error = t12_testPacketViews();
+    if(error == 0 ) {
+        printf("success!\n");
+    }
+    else {
+        printf("^^^ test errors\n");
+    }
+    allErrors += error;
+    printf("Starting Test13!\n");
+    error = t13_testPacking();
+    if(error == 0 ) {
+        printf("success!\n");
+    }
+    else {
+        printf("^^^ test errors\n");
+    }
+    allErrors += error;
+    printf("Starting Test14!\n");
+    error = t14_testConfigStore();
+    if(error == 0 ) {
+        printf("success!\n");
+    }
+    else {
+        printf("^^^ test errors\n");
+    }
+    allErrors += error;
+    printf("Starting Test15!\n");
+    error = t15_testNulScan();
+    if(error == 0 ) {
+        printf("success!\n");
+    }
+    else {
+        printf("^^^ test errors\n");
+    }
+    allErrors += error;
+    printf("Starting Test16!\n");
+    error = t16_testKeyInterning();
+    if(error == 0 ) {
+        printf("success!\n");
+    }
+    else {
+        printf("^^^ test errors\n");
+    }
+    allErrors += error;
+    printf("Starting Test17!\n");
+    error = t17_testKnownConfigKeys();
+    if(error == 0 ) {
+        printf("success!\n");
+    }
+    else {
+        printf("^^^ test errors\n");
+    }
+    allErrors += error;
+    printf("Starting Test18!\n");
+    error = t18_testPacketSchema();
+    if(error == 0 ) {
+        printf("success!\n");
+    }
+    else {
+        printf("^^^ test errors\n");
+    }
+    allErrors += error;
+    printf("Starting Test19!\n");
+    error = t19_testPacketBatch();
+    if(error == 0 ) {
+        printf("success!\n");
+    }
+    else {
+        printf("^^^ test errors\n");
+    }
+    allErrors += error;
+
     // Tests finished, handle the error code
     if (allErrors == 0) {
         return EXIT_SUCCESS;